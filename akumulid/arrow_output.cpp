@@ -0,0 +1,547 @@
+#include "arrow_output.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Akumuli {
+
+namespace {
+
+//                               //
+//   Minimal flatbuffer builder  //
+//                               //
+
+/** Table field description.
+  * Scalar fields are written as is, offset fields are written as
+  * placeholders and patched when the referenced object is written.
+  */
+struct FbField {
+    u16  id;      //< field id (from the schema)
+    u8   size;    //< field size (1, 2, 4 or 8)
+    u64  value;   //< field value
+    bool offset;  //< field is an offset to another object
+};
+
+/** Flatbuffer builder that writes objects front to back.
+  * Child objects are always written after the parent, so all offsets
+  * point forward (as required by the format). First four bytes of the
+  * buffer contain the offset of the root table.
+  */
+class FbBuilder {
+    std::vector<char> buf_;
+
+public:
+    FbBuilder() {
+        put(0, 4);
+    }
+
+    size_t size() const {
+        return buf_.size();
+    }
+
+    void pad(size_t align) {
+        while (buf_.size() % align) {
+            buf_.push_back(0);
+        }
+    }
+
+    void put(u64 value, int nbytes) {
+        for (int i = 0; i < nbytes; i++) {
+            buf_.push_back(static_cast<char>((value >> (8*i)) & 0xFF));
+        }
+    }
+
+    //! Set offset in `slot` to point to `target`
+    void patch(size_t slot, size_t target) {
+        u32 rel = static_cast<u32>(target - slot);
+        for (int i = 0; i < 4; i++) {
+            buf_[slot + static_cast<size_t>(i)] = static_cast<char>((rel >> (8*i)) & 0xFF);
+        }
+    }
+
+    //! Set root table
+    void finish(size_t root) {
+        patch(0, root);
+    }
+
+    /** Write table (vtable goes first).
+      * @param slots receives positions of the fields (in the same order)
+      * @return position of the table
+      */
+    size_t table(std::vector<FbField> const& fields, std::vector<size_t>* slots) {
+        // Layout: larger fields first to minimize padding
+        std::vector<size_t> order(fields.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [&fields](size_t lhs, size_t rhs) {
+            return fields[lhs].size > fields[rhs].size;
+        });
+        std::vector<u16> rel(fields.size());
+        size_t off = 4;  // soffset to vtable
+        size_t align = 4;
+        u16 nslots = 0;
+        for (auto ix: order) {
+            size_t sz = fields[ix].size;
+            off = (off + sz - 1) / sz * sz;
+            rel[ix] = static_cast<u16>(off);
+            off += sz;
+            align = std::max(align, sz);
+            nslots = std::max(nslots, static_cast<u16>(fields[ix].id + 1));
+        }
+        // vtable
+        pad(2);
+        size_t vtable = size();
+        put(4u + 2u*nslots, 2);
+        put(off, 2);
+        for (u16 slot = 0; slot < nslots; slot++) {
+            u16 value = 0;
+            for (size_t i = 0; i < fields.size(); i++) {
+                if (fields[i].id == slot) {
+                    value = rel[i];
+                }
+            }
+            put(value, 2);
+        }
+        // table
+        pad(align);
+        size_t table = size();
+        put(static_cast<u32>(table - vtable), 4);
+        for (auto ix: order) {
+            while (size() < table + rel[ix]) {
+                buf_.push_back(0);
+            }
+            put(fields[ix].offset ? 0 : fields[ix].value, fields[ix].size);
+        }
+        slots->resize(fields.size());
+        for (size_t i = 0; i < fields.size(); i++) {
+            slots->at(i) = table + rel[i];
+        }
+        return table;
+    }
+
+    size_t string(std::string const& str) {
+        pad(4);
+        size_t pos = size();
+        put(str.size(), 4);
+        buf_.insert(buf_.end(), str.begin(), str.end());
+        buf_.push_back(0);
+        return pos;
+    }
+
+    /** Write vector of offsets.
+      * @param slots receives positions of the elements
+      */
+    size_t offsets(size_t n, std::vector<size_t>* slots) {
+        pad(4);
+        size_t pos = size();
+        put(n, 4);
+        slots->clear();
+        for (size_t i = 0; i < n; i++) {
+            slots->push_back(size());
+            put(0, 4);
+        }
+        return pos;
+    }
+
+    //! Write vector of structs that consist of two longs (FieldNode, Buffer)
+    size_t long_pairs(std::vector<std::pair<u64, u64>> const& items) {
+        pad(4);
+        if ((size() + 4) % 8 != 0) {
+            put(0, 4);
+        }
+        size_t pos = size();
+        put(items.size(), 4);
+        for (auto const& kv: items) {
+            put(kv.first, 8);
+            put(kv.second, 8);
+        }
+        return pos;
+    }
+
+    std::vector<char>& data() {
+        return buf_;
+    }
+};
+
+// Arrow format constants (see Schema.fbs and Message.fbs)
+
+enum {
+    METADATA_V5 = 4,
+};
+
+enum MessageHeader {
+    HEADER_SCHEMA           = 1,
+    HEADER_DICTIONARY_BATCH = 2,
+    HEADER_RECORD_BATCH     = 3,
+};
+
+enum TypeId {
+    TYPE_INT           = 2,
+    TYPE_FLOATING      = 3,
+    TYPE_UTF8          = 5,
+    TYPE_TIMESTAMP     = 10,
+};
+
+enum {
+    PRECISION_DOUBLE   = 2,
+    TIME_UNIT_NANO     = 3,
+};
+
+enum Column {
+    COL_SERIES    = 0,
+    COL_TIMESTAMP = 1,
+    COL_VALUE     = 2,
+};
+
+static const i64 DICTIONARY_ID = 0;
+
+/** Write Message table with empty header and return slot of the header.
+  * @param custom_metadata is a list of key-value pairs (optional)
+  */
+size_t write_message_table(FbBuilder& fb, MessageHeader type, u64 body_length,
+                           std::vector<std::pair<std::string, std::string>> const& custom_metadata = {})
+{
+    std::vector<size_t> slots;
+    std::vector<FbField> spec = {
+        { 0, 2, METADATA_V5, false },
+        { 1, 1, static_cast<u64>(type), false },
+        { 2, 4, 0, true },
+        { 3, 8, body_length, false },
+    };
+    if (!custom_metadata.empty()) {
+        spec.push_back({ 4, 4, 0, true });
+    }
+    size_t msg = fb.table(spec, &slots);
+    fb.finish(msg);
+    if (!custom_metadata.empty()) {
+        std::vector<size_t> items;
+        fb.patch(slots[4], fb.offsets(custom_metadata.size(), &items));
+        for (size_t i = 0; i < custom_metadata.size(); i++) {
+            // KeyValue { key, value }
+            std::vector<size_t> kvslots;
+            size_t kv = fb.table({
+                                     { 0, 4, 0, true },
+                                     { 1, 4, 0, true },
+                                 }, &kvslots);
+            fb.patch(items[i], kv);
+            fb.patch(kvslots[0], fb.string(custom_metadata[i].first));
+            fb.patch(kvslots[1], fb.string(custom_metadata[i].second));
+        }
+    }
+    return slots[2];
+}
+
+/** Write RecordBatch table.
+  * @param length is a number of rows
+  * @param nodes is a list of (length, null_count) pairs
+  * @param buffers is a list of (offset, length) pairs
+  */
+size_t write_record_batch(FbBuilder& fb, u64 length,
+                          std::vector<std::pair<u64, u64>> const& nodes,
+                          std::vector<std::pair<u64, u64>> const& buffers)
+{
+    std::vector<size_t> slots;
+    size_t batch = fb.table({
+                                { 0, 8, length, false },
+                                { 1, 4, 0, true },
+                                { 2, 4, 0, true },
+                            }, &slots);
+    fb.patch(slots[1], fb.long_pairs(nodes));
+    fb.patch(slots[2], fb.long_pairs(buffers));
+    return batch;
+}
+
+//! Write Int type table
+size_t write_int_type(FbBuilder& fb, int width, bool is_signed) {
+    std::vector<size_t> slots;
+    return fb.table({
+                        { 0, 4, static_cast<u64>(width), false },
+                        { 1, 1, is_signed ? 1u : 0u, false },
+                    }, &slots);
+}
+
+/** Pack validity flags into the bitmap.
+  * Empty bitmap is returned if there is no nulls.
+  */
+std::vector<char> pack_bitmap(std::vector<u8> const& valid, u64 nulls) {
+    std::vector<char> bitmap;
+    if (nulls == 0) {
+        return bitmap;
+    }
+    bitmap.resize((valid.size() + 7) / 8, 0);
+    for (size_t i = 0; i < valid.size(); i++) {
+        if (valid[i]) {
+            bitmap[i / 8] = static_cast<char>(bitmap[i / 8] | (1 << (i % 8)));
+        }
+    }
+    return bitmap;
+}
+
+template<class T>
+std::vector<char> to_bytes(std::vector<T> const& items) {
+    std::vector<char> res(items.size()*sizeof(T));
+    if (!items.empty()) {
+        memcpy(res.data(), items.data(), res.size());
+    }
+    return res;
+}
+
+}  // namespace
+
+
+ArrowStreamWriter::ArrowStreamWriter(bool raw_timestamps)
+    : raw_timestamps_(raw_timestamps)
+    , dict_sent_(false)
+    , nulls_{0, 0, 0}
+    , out_pos_(0)
+{
+    write_schema();
+}
+
+void ArrowStreamWriter::write_message(const std::vector<char>& metadata,
+                                      const std::vector<std::vector<char>>& buffers)
+{
+    // Continuation marker, metadata length (metadata is padded to 8 bytes)
+    u32 marker = 0xFFFFFFFF;
+    u32 len = static_cast<u32>((metadata.size() + 7) / 8 * 8);
+    out_.insert(out_.end(), reinterpret_cast<const char*>(&marker), reinterpret_cast<const char*>(&marker) + 4);
+    out_.insert(out_.end(), reinterpret_cast<const char*>(&len), reinterpret_cast<const char*>(&len) + 4);
+    out_.insert(out_.end(), metadata.begin(), metadata.end());
+    out_.resize(out_.size() + (len - metadata.size()), 0);
+    // Message body, every buffer is padded to 8 bytes
+    for (auto const& buf: buffers) {
+        out_.insert(out_.end(), buf.begin(), buf.end());
+        out_.resize(out_.size() + (8 - buf.size() % 8) % 8, 0);
+    }
+}
+
+//! Compute (offset, length) pairs of the body buffers and the body length
+static u64 layout_body(const std::vector<std::vector<char>>& buffers, std::vector<std::pair<u64, u64>>* out) {
+    u64 offset = 0;
+    for (auto const& buf: buffers) {
+        out->push_back(std::make_pair(offset, static_cast<u64>(buf.size())));
+        offset += (buf.size() + 7) / 8 * 8;
+    }
+    return offset;
+}
+
+void ArrowStreamWriter::write_schema() {
+    FbBuilder fb;
+    std::vector<size_t> slots;
+    size_t header = write_message_table(fb, HEADER_SCHEMA, 0);
+    // Schema { fields }
+    size_t schema = fb.table({
+                                 { 1, 4, 0, true },
+                             }, &slots);
+    fb.patch(header, schema);
+    std::vector<size_t> fields;
+    fb.patch(slots[0], fb.offsets(3, &fields));
+    const char* names[] = { "series", "timestamp", "value" };
+    for (int col = 0; col < 3; col++) {
+        // Field { name, nullable, type_type, type, dictionary, children }
+        u64 type_id = TYPE_FLOATING;
+        if (col == COL_SERIES) {
+            type_id = TYPE_UTF8;
+        } else if (col == COL_TIMESTAMP) {
+            type_id = raw_timestamps_ ? TYPE_INT : TYPE_TIMESTAMP;
+        }
+        std::vector<FbField> spec = {
+            { 0, 4, 0, true },
+            { 1, 1, 1, false },
+            { 2, 1, type_id, false },
+            { 3, 4, 0, true },
+            { 5, 4, 0, true },
+        };
+        if (col == COL_SERIES) {
+            spec.push_back({ 4, 4, 0, true });
+        }
+        std::vector<size_t> fslots;
+        size_t field = fb.table(spec, &fslots);
+        fb.patch(fields[static_cast<size_t>(col)], field);
+        fb.patch(fslots[0], fb.string(names[col]));
+        // Type
+        std::vector<size_t> tslots;
+        size_t type = 0;
+        switch (col) {
+        case COL_SERIES:
+            type = fb.table({}, &tslots);
+            break;
+        case COL_TIMESTAMP:
+            if (raw_timestamps_) {
+                type = write_int_type(fb, 64, false);
+            } else {
+                type = fb.table({
+                                    { 0, 2, TIME_UNIT_NANO, false },
+                                    { 1, 4, 0, true },
+                                }, &tslots);
+                fb.patch(tslots[1], fb.string("UTC"));
+            }
+            break;
+        case COL_VALUE:
+            type = fb.table({
+                                { 0, 2, PRECISION_DOUBLE, false },
+                            }, &tslots);
+            break;
+        };
+        fb.patch(fslots[3], type);
+        // Children (empty list)
+        std::vector<size_t> cslots;
+        fb.patch(fslots[4], fb.offsets(0, &cslots));
+        if (col == COL_SERIES) {
+            // DictionaryEncoding { id, indexType }
+            std::vector<size_t> dslots;
+            size_t dict = fb.table({
+                                       { 0, 8, static_cast<u64>(DICTIONARY_ID), false },
+                                       { 1, 4, 0, true },
+                                   }, &dslots);
+            fb.patch(fslots[5], dict);
+            fb.patch(dslots[1], write_int_type(fb, 32, true));
+        }
+    }
+    write_message(fb.data(), {});
+}
+
+void ArrowStreamWriter::write_dictionary() {
+    // Utf8 column: validity (empty), offsets, data
+    std::vector<i32> offsets;
+    std::vector<char> data;
+    offsets.push_back(0);
+    for (auto const& name: new_names_) {
+        data.insert(data.end(), name.begin(), name.end());
+        offsets.push_back(static_cast<i32>(data.size()));
+    }
+    std::vector<std::vector<char>> buffers = {
+        std::vector<char>(),
+        to_bytes(offsets),
+        data,
+    };
+    std::vector<std::pair<u64, u64>> layout;
+    u64 body_length = layout_body(buffers, &layout);
+    u64 length = new_names_.size();
+
+    FbBuilder fb;
+    std::vector<size_t> slots;
+    size_t header = write_message_table(fb, HEADER_DICTIONARY_BATCH, body_length);
+    // DictionaryBatch { id, data, isDelta }
+    size_t dict = fb.table({
+                               { 0, 8, static_cast<u64>(DICTIONARY_ID), false },
+                               { 1, 4, 0, true },
+                               { 2, 1, dict_sent_ ? 1u : 0u, false },
+                           }, &slots);
+    fb.patch(header, dict);
+    fb.patch(slots[1], write_record_batch(fb, length, { std::make_pair(length, 0ull) }, layout));
+    write_message(fb.data(), buffers);
+
+    new_names_.clear();
+    dict_sent_ = true;
+}
+
+i32 ArrowStreamWriter::find_series(aku_ParamId id) const {
+    auto it = series_.find(id);
+    if (it == series_.end()) {
+        return -1;
+    }
+    return it->second;
+}
+
+i32 ArrowStreamWriter::add_series(aku_ParamId id, std::string name) {
+    i32 ix = static_cast<i32>(series_.size());
+    series_[id] = ix;
+    new_names_.push_back(std::move(name));
+    return ix;
+}
+
+void ArrowStreamWriter::append(i32 series, const aku_Timestamp* ts, const double* value) {
+    index_.push_back(series < 0 ? 0 : series);
+    valid_[COL_SERIES].push_back(series < 0 ? 0 : 1);
+    nulls_[COL_SERIES] += series < 0 ? 1 : 0;
+    tss_.push_back(ts ? *ts : 0);
+    valid_[COL_TIMESTAMP].push_back(ts ? 1 : 0);
+    nulls_[COL_TIMESTAMP] += ts ? 0 : 1;
+    xss_.push_back(value ? *value : 0.0);
+    valid_[COL_VALUE].push_back(value ? 1 : 0);
+    nulls_[COL_VALUE] += value ? 0 : 1;
+}
+
+size_t ArrowStreamWriter::batch_size() const {
+    return index_.size();
+}
+
+void ArrowStreamWriter::flush_batch() {
+    if (index_.empty()) {
+        return;
+    }
+    write_batch({});
+}
+
+void ArrowStreamWriter::write_batch(const std::vector<std::pair<std::string, std::string>>& custom_metadata) {
+    // Dictionary should be sent before the first record batch even if it's empty
+    if (!new_names_.empty() || !dict_sent_) {
+        write_dictionary();
+    }
+    std::vector<std::vector<char>> buffers = {
+        pack_bitmap(valid_[COL_SERIES], nulls_[COL_SERIES]),
+        to_bytes(index_),
+        pack_bitmap(valid_[COL_TIMESTAMP], nulls_[COL_TIMESTAMP]),
+        to_bytes(tss_),
+        pack_bitmap(valid_[COL_VALUE], nulls_[COL_VALUE]),
+        to_bytes(xss_),
+    };
+    std::vector<std::pair<u64, u64>> layout;
+    u64 body_length = layout_body(buffers, &layout);
+    u64 length = index_.size();
+    std::vector<std::pair<u64, u64>> nodes = {
+        std::make_pair(length, nulls_[COL_SERIES]),
+        std::make_pair(length, nulls_[COL_TIMESTAMP]),
+        std::make_pair(length, nulls_[COL_VALUE]),
+    };
+
+    FbBuilder fb;
+    size_t header = write_message_table(fb, HEADER_RECORD_BATCH, body_length, custom_metadata);
+    fb.patch(header, write_record_batch(fb, length, nodes, layout));
+    write_message(fb.data(), buffers);
+
+    index_.clear();
+    tss_.clear();
+    xss_.clear();
+    for (int i = 0; i < 3; i++) {
+        valid_[i].clear();
+        nulls_[i] = 0;
+    }
+}
+
+static void write_eos(std::vector<char>* out) {
+    u32 eos[] = { 0xFFFFFFFF, 0 };
+    out->insert(out->end(), reinterpret_cast<const char*>(eos), reinterpret_cast<const char*>(eos) + sizeof(eos));
+}
+
+void ArrowStreamWriter::finish() {
+    flush_batch();
+    write_eos(&out_);
+}
+
+void ArrowStreamWriter::finish(std::string const& error) {
+    flush_batch();
+    write_batch({ std::make_pair(std::string("error"), error) });
+    write_eos(&out_);
+}
+
+size_t ArrowStreamWriter::read(char* dest, size_t size) {
+    size_t n = std::min(size, out_.size() - out_pos_);
+    if (n != 0) {
+        memcpy(dest, out_.data() + out_pos_, n);
+        out_pos_ += n;
+    }
+    if (out_pos_ == out_.size()) {
+        out_.clear();
+        out_pos_ = 0;
+    }
+    return n;
+}
+
+size_t ArrowStreamWriter::available() const {
+    return out_.size() - out_pos_;
+}
+
+}  // namespace
@@ -0,0 +1,106 @@
+/**
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "akumuli.h"
+
+namespace Akumuli {
+
+/** Encoder for the Apache Arrow IPC streaming format.
+  * Stream starts with the schema message followed by dictionary and record batches:
+  * - series (dictionary<int32, utf8>), every series name is sent only once, new names
+  *   are added using delta dictionary batches;
+  * - timestamp (timestamp[ns, UTC] or uint64 if raw timestamps are requested);
+  * - value (float64).
+  * All columns are nullable. Encoded messages are accumulated in the output buffer
+  * until consumed by the `read` method. Query error is reported using the custom
+  * metadata of the last record batch.
+  */
+class ArrowStreamWriter {
+    const bool                              raw_timestamps_;
+    std::unordered_map<aku_ParamId, i32>    series_;     //< Maps series id to dictionary index
+    std::vector<std::string>                new_names_;  //< Dictionary entries that wasn't sent yet
+    bool                                    dict_sent_;  //< Initial dictionary batch was sent
+
+    // Current batch
+    std::vector<i32>    index_;
+    std::vector<u64>    tss_;
+    std::vector<double> xss_;
+    std::vector<u8>     valid_[3];
+    u64                 nulls_[3];
+
+    // Output
+    std::vector<char>   out_;
+    size_t              out_pos_;
+
+    void write_schema();
+    void write_dictionary();
+    //! Encode current batch (can be empty) with optional custom metadata and clear it
+    void write_batch(const std::vector<std::pair<std::string, std::string>>& custom_metadata);
+    void write_message(const std::vector<char>& metadata, const std::vector<std::vector<char>>& buffers);
+public:
+    /**
+     * @brief C-tor, schema message is written to the output immediately
+     * @param raw_timestamps use uint64 type for timestamps instead of timestamp[ns]
+     */
+    ArrowStreamWriter(bool raw_timestamps);
+
+    /** Return dictionary index of the series or -1 if the series wasn't added yet.
+      */
+    i32 find_series(aku_ParamId id) const;
+
+    /** Add series to the dictionary.
+      * @return dictionary index of the series
+      */
+    i32 add_series(aku_ParamId id, std::string name);
+
+    /** Add row to the current batch.
+      * @param series is a dictionary index or -1 (null)
+      * @param ts is a pointer to timestamp or null
+      * @param value is a pointer to value or null
+      */
+    void append(i32 series, const aku_Timestamp* ts, const double* value);
+
+    //! Number of rows in the current batch
+    size_t batch_size() const;
+
+    //! Encode current batch (and new dictionary entries), does nothing if batch is empty
+    void flush_batch();
+
+    //! Encode current batch and end-of-stream marker
+    void finish();
+
+    /** Encode current batch, then empty record batch with the error message
+      * in custom metadata (under the "error" key) and end-of-stream marker.
+      */
+    void finish(std::string const& error);
+
+    /** Copy encoded data to the buffer.
+      * @return number of bytes copied
+      */
+    size_t read(char* dest, size_t size);
+
+    //! Number of encoded bytes that wasn't read yet
+    size_t available() const;
+};
+
+}  // namespace
@@ -0,0 +1,371 @@
+#include "http_compression.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <zlib.h>
+#ifdef AKU_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include <boost/algorithm/string.hpp>
+#include <boost/exception/all.hpp>
+
+namespace Akumuli {
+namespace Http {
+
+static Logger logger("http-compression");
+
+ContentEncoding negotiate_encoding(const char* accept_encoding, CompressionSettings const& settings) {
+    if (accept_encoding == nullptr) {
+        return ContentEncoding::IDENTITY;
+    }
+    double gzip_q = 0.0, zstd_q = 0.0, any_q = -1.0;
+    bool gzip_set = false, zstd_set = false;
+    std::vector<std::string> items;
+    boost::split(items, accept_encoding, boost::is_any_of(","));
+    for (auto& item: items) {
+        // Format: coding[;q=weight]
+        std::vector<std::string> parts;
+        boost::split(parts, item, boost::is_any_of(";"));
+        std::string coding = boost::algorithm::to_lower_copy(boost::algorithm::trim_copy(parts.front()));
+        double q = 1.0;
+        for (size_t i = 1; i < parts.size(); i++) {
+            std::string param = boost::algorithm::trim_copy(parts.at(i));
+            if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=') {
+                q = std::strtod(param.c_str() + 2, nullptr);
+            }
+        }
+        if (coding == "gzip" || coding == "x-gzip") {
+            gzip_q = q;
+            gzip_set = true;
+        } else if (coding == "zstd") {
+            zstd_q = q;
+            zstd_set = true;
+        } else if (coding == "*") {
+            any_q = q;
+        }
+    }
+    if (!gzip_set && any_q >= 0) {
+        gzip_q = any_q;
+    }
+    if (!zstd_set && any_q >= 0) {
+        zstd_q = any_q;
+    }
+#ifndef AKU_WITH_ZSTD
+    zstd_q = 0.0;
+#endif
+    if (settings.gzip_level == 0) {
+        gzip_q = 0.0;
+    }
+    if (settings.zstd_level == 0) {
+        zstd_q = 0.0;
+    }
+    if (zstd_q > 0.0 && zstd_q >= gzip_q) {
+        return ContentEncoding::ZSTD;
+    }
+    if (gzip_q > 0.0) {
+        return ContentEncoding::GZIP;
+    }
+    return ContentEncoding::IDENTITY;
+}
+
+const char* encoding_name(ContentEncoding enc) {
+    switch (enc) {
+    case ContentEncoding::GZIP:
+        return "gzip";
+    case ContentEncoding::ZSTD:
+        return "zstd";
+    case ContentEncoding::IDENTITY:
+        break;
+    };
+    return nullptr;
+}
+
+//! Gzip compressor (zlib deflate with gzip wrapper)
+struct GzipCompressor : StreamCompressor {
+    enum {
+        OUTPUT_STEP = 0x4000,
+    };
+    z_stream strm_;
+
+    GzipCompressor(int level) {
+        memset(&strm_, 0, sizeof(strm_));
+        // 15 + 16 - max window size with gzip header and trailer
+        if (deflateInit2(&strm_, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            std::runtime_error err("can't initialize gzip compressor");
+            BOOST_THROW_EXCEPTION(err);
+        }
+    }
+
+    ~GzipCompressor() {
+        deflateEnd(&strm_);
+    }
+
+    void deflate_all(int flush, std::vector<char>* out) {
+        while (true) {
+            size_t pos = out->size();
+            out->resize(pos + OUTPUT_STEP);
+            strm_.next_out = reinterpret_cast<Bytef*>(out->data() + pos);
+            strm_.avail_out = OUTPUT_STEP;
+            int ret = deflate(&strm_, flush);
+            out->resize(out->size() - strm_.avail_out);
+            if (ret == Z_STREAM_END) {
+                break;
+            }
+            if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                std::runtime_error err("gzip compression error");
+                BOOST_THROW_EXCEPTION(err);
+            }
+            if (flush != Z_FINISH && strm_.avail_out != 0) {
+                // All input consumed and flushed
+                break;
+            }
+        }
+    }
+
+    virtual void compress(const char* data, size_t size, std::vector<char>* out) {
+        strm_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        strm_.avail_in = static_cast<uInt>(size);
+        deflate_all(Z_SYNC_FLUSH, out);
+    }
+
+    virtual void finish(std::vector<char>* out) {
+        strm_.next_in = nullptr;
+        strm_.avail_in = 0;
+        deflate_all(Z_FINISH, out);
+    }
+};
+
+#ifdef AKU_WITH_ZSTD
+//! Zstandard compressor
+struct ZstdCompressor : StreamCompressor {
+    ZSTD_CStream* zcs_;
+
+    ZstdCompressor(int level)
+        : zcs_(ZSTD_createCStream())
+    {
+        if (zcs_ == nullptr) {
+            std::runtime_error err("can't initialize zstd compressor");
+            BOOST_THROW_EXCEPTION(err);
+        }
+        check(ZSTD_initCStream(zcs_, std::max(1, std::min(level, ZSTD_maxCLevel()))));
+    }
+
+    ~ZstdCompressor() {
+        ZSTD_freeCStream(zcs_);
+    }
+
+    static size_t check(size_t ret) {
+        if (ZSTD_isError(ret)) {
+            std::runtime_error err(std::string("zstd compression error: ") + ZSTD_getErrorName(ret));
+            BOOST_THROW_EXCEPTION(err);
+        }
+        return ret;
+    }
+
+    //! Call `fn` until it reports that nothing is left in the internal buffers
+    template<class Fn>
+    void drain(Fn const& fn, std::vector<char>* out) {
+        const size_t step = ZSTD_CStreamOutSize();
+        size_t remaining = 0;
+        do {
+            size_t pos = out->size();
+            out->resize(pos + step);
+            ZSTD_outBuffer output = { out->data() + pos, step, 0 };
+            remaining = check(fn(&output));
+            out->resize(pos + output.pos);
+        } while (remaining != 0);
+    }
+
+    virtual void compress(const char* data, size_t size, std::vector<char>* out) {
+        ZSTD_inBuffer input = { data, size, 0 };
+        while (input.pos < input.size) {
+            drain([&](ZSTD_outBuffer* output) {
+                check(ZSTD_compressStream(zcs_, output, &input));
+                return static_cast<size_t>(0);
+            }, out);
+        }
+        drain([this](ZSTD_outBuffer* output) { return ZSTD_flushStream(zcs_, output); }, out);
+    }
+
+    virtual void finish(std::vector<char>* out) {
+        drain([this](ZSTD_outBuffer* output) { return ZSTD_endStream(zcs_, output); }, out);
+    }
+};
+#endif
+
+std::unique_ptr<StreamCompressor> StreamCompressor::create(ContentEncoding enc, CompressionSettings const& settings) {
+    std::unique_ptr<StreamCompressor> res;
+    switch (enc) {
+    case ContentEncoding::GZIP:
+        res.reset(new GzipCompressor(std::max(1, std::min(settings.gzip_level, 9))));
+        break;
+#ifdef AKU_WITH_ZSTD
+    case ContentEncoding::ZSTD:
+        res.reset(new ZstdCompressor(settings.zstd_level));
+        break;
+#endif
+    default: {
+            std::runtime_error err("unsupported content encoding");
+            BOOST_THROW_EXCEPTION(err);
+        }
+    };
+    return res;
+}
+
+//-------------------------
+// CompressedReadOperation
+//-------------------------
+
+CompressedReadOperation::CompressedReadOperation(std::unique_ptr<ReadOperation> cursor,
+                                                 std::unique_ptr<StreamCompressor> compressor)
+    : cursor_(std::move(cursor))
+    , compressor_(std::move(compressor))
+    , input_done_(false)
+    , output_pos_(0)
+    , output_done_(false)
+    , stop_(false)
+{
+    chunk_.reserve(CHUNK_SIZE);
+    worker_ = std::thread(&CompressedReadOperation::compress_loop, this);
+}
+
+CompressedReadOperation::~CompressedReadOperation() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cond_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
+
+void CompressedReadOperation::compress_loop() {
+    while (true) {
+        std::vector<char> chunk;
+        bool last = false;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this] { return stop_ || !input_.empty() || input_done_; });
+            if (stop_) {
+                return;
+            }
+            if (input_.empty()) {
+                last = true;
+            } else {
+                chunk = std::move(input_.front());
+                input_.pop_front();
+            }
+        }
+        std::vector<char> out;
+        try {
+            if (last) {
+                compressor_->finish(&out);
+            } else {
+                compressor_->compress(chunk.data(), chunk.size(), &out);
+            }
+        } catch (const std::exception& e) {
+            // Client will receive truncated stream
+            logger.error() << "Compression error: " << e.what();
+            last = true;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (output_pos_ == output_.size()) {
+                output_.clear();
+                output_pos_ = 0;
+            }
+            output_.insert(output_.end(), out.begin(), out.end());
+            output_done_ = last;
+        }
+        cond_.notify_all();
+        if (last) {
+            return;
+        }
+    }
+}
+
+void CompressedReadOperation::push_chunk(bool done) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!chunk_.empty()) {
+            input_.push_back(std::move(chunk_));
+        }
+        input_done_ = done;
+    }
+    cond_.notify_all();
+    chunk_ = std::vector<char>();
+    chunk_.reserve(CHUNK_SIZE);
+}
+
+void CompressedReadOperation::start() {
+    cursor_->start();
+}
+
+void CompressedReadOperation::append(const char* data, size_t data_size) {
+    cursor_->append(data, data_size);
+}
+
+aku_Status CompressedReadOperation::get_error() {
+    return cursor_->get_error();
+}
+
+const char* CompressedReadOperation::get_error_message() {
+    return cursor_->get_error_message();
+}
+
+std::tuple<size_t, bool> CompressedReadOperation::read_some(char* buf, size_t buf_size) {
+    bool read_input;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // Don't read from the cursor if the client is slow and compressed data accumulates
+        read_input = !input_done_ && input_.size() < MAX_QUEUE
+                  && (output_.size() - output_pos_) < static_cast<size_t>(CHUNK_SIZE);
+    }
+    if (read_input) {
+        // Fill the chunk, partial chunk is sent to the compressor if the cursor has no data yet
+        bool done = false;
+        size_t len = 0;
+        do {
+            size_t pos = chunk_.size();
+            chunk_.resize(CHUNK_SIZE);
+            std::tie(len, done) = cursor_->read_some(chunk_.data() + pos, CHUNK_SIZE - pos);
+            chunk_.resize(pos + len);
+        } while (!done && len != 0 && chunk_.size() < CHUNK_SIZE);
+        if (done || !chunk_.empty()) {
+            push_chunk(done);
+        }
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait_for(lock, std::chrono::milliseconds(WAIT_MS), [this] {
+        return output_pos_ < output_.size() || output_done_;
+    });
+    size_t len = std::min(buf_size, output_.size() - output_pos_);
+    if (len != 0) {
+        memcpy(buf, output_.data() + output_pos_, len);
+        output_pos_ += len;
+        return std::make_tuple(len, false);
+    }
+    return std::make_tuple(0u, output_done_);
+}
+
+void CompressedReadOperation::close() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cond_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+    cursor_->close();
+}
+
+}  // namespace Http
+}  // namespace Akumuli
@@ -0,0 +1,117 @@
+/**
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "server.h"
+
+namespace Akumuli {
+namespace Http {
+
+enum class ContentEncoding {
+    IDENTITY,
+    GZIP,
+    ZSTD,
+};
+
+//! Compression settings of the HTTP server, level 0 disables the encoding
+struct CompressionSettings {
+    enum {
+        DEFAULT_GZIP_LEVEL = 6,
+        DEFAULT_ZSTD_LEVEL = 3,
+    };
+    int gzip_level;
+    int zstd_level;
+};
+
+/** Choose response encoding using the value of the Accept-Encoding header.
+  * Encoding with the highest q-value wins, zstd is preferred over gzip if both
+  * have the same weight. Disabled encodings are never chosen.
+  */
+ContentEncoding negotiate_encoding(const char* accept_encoding, CompressionSettings const& settings);
+
+//! Return value of the Content-Encoding header or nullptr for identity encoding
+const char* encoding_name(ContentEncoding enc);
+
+//! Streaming compressor interface
+struct StreamCompressor {
+    virtual ~StreamCompressor() = default;
+
+    /** Compress data and flush the output, so the client can decode everything
+      * received so far.
+      */
+    virtual void compress(const char* data, size_t size, std::vector<char>* out) = 0;
+
+    //! Complete the compressed stream
+    virtual void finish(std::vector<char>* out) = 0;
+
+    /** Create compressor.
+      * @throw std::runtime_error if encoding is not supported
+      */
+    static std::unique_ptr<StreamCompressor> create(ContentEncoding enc, CompressionSettings const& settings);
+};
+
+/** Read operation that compresses the output of another read operation.
+  * Compression runs in a separate thread, the thread that serves the connection
+  * reads next chunk from the underlying cursor while the previous one is being compressed.
+  */
+class CompressedReadOperation : public ReadOperation {
+    enum {
+        CHUNK_SIZE = 0x10000,  //< Size of the uncompressed chunk
+        MAX_QUEUE  = 4,        //< Max number of uncompressed chunks waiting for compression
+        WAIT_MS    = 10,       //< Max wait time for compressed data
+    };
+    std::unique_ptr<ReadOperation>      cursor_;
+    std::unique_ptr<StreamCompressor>   compressor_;
+    std::vector<char>                   chunk_;        //< Chunk being read from the cursor
+
+    std::mutex                          mutex_;
+    std::condition_variable             cond_;
+    std::deque<std::vector<char>>       input_;        //< Uncompressed chunks
+    bool                                input_done_;   //< Cursor is exhausted
+    std::vector<char>                   output_;       //< Compressed data
+    size_t                              output_pos_;
+    bool                                output_done_;  //< Compressed stream is completed
+    bool                                stop_;
+    std::thread                         worker_;
+
+    void compress_loop();
+    void push_chunk(bool done);
+public:
+    /**
+     * @brief C-tor
+     * @param cursor is a started read operation
+     * @param compressor is a compressor that should be used
+     */
+    CompressedReadOperation(std::unique_ptr<ReadOperation> cursor, std::unique_ptr<StreamCompressor> compressor);
+    ~CompressedReadOperation();
+
+    virtual void start();
+    virtual void append(const char* data, size_t data_size);
+    virtual aku_Status get_error();
+    virtual const char* get_error_message();
+    virtual std::tuple<size_t, bool> read_some(char* buf, size_t buf_size);
+    virtual void close();
+};
+
+}  // namespace Http
+}  // namespace Akumuli
@@ -72,7 +72,8 @@ static int accept_connection(void           *cls,
     if (strcmp(method, "POST") == 0) {
         ApiEndpoint endpoint = get_endpoint(path);
         if (endpoint != ApiEndpoint::UNKNOWN) {
-            ReadOperationBuilder *queryproc = static_cast<ReadOperationBuilder*>(cls);
+            HttpServer *server = static_cast<HttpServer*>(cls);
+            ReadOperationBuilder *queryproc = server->proc_.get();
             ReadOperation* cursor = static_cast<ReadOperation*>(*con_cls);
             if (cursor == nullptr) {
                 cursor = queryproc->create(endpoint);
@@ -103,7 +104,26 @@ static int accept_connection(void           *cls,
                 return error_response(error_msg, MHD_HTTP_BAD_REQUEST);
             }
 
+            // Compress the response if the client supports it
+            const char* accept_encoding = MHD_lookup_connection_value(connection, MHD_HEADER_KIND,
+                                                                      MHD_HTTP_HEADER_ACCEPT_ENCODING);
+            auto encoding = negotiate_encoding(accept_encoding, server->compression_);
+            if (encoding != ContentEncoding::IDENTITY) {
+                try {
+                    auto compressor = StreamCompressor::create(encoding, server->compression_);
+                    cursor = new CompressedReadOperation(std::unique_ptr<ReadOperation>(cursor), std::move(compressor));
+                    *con_cls = cursor;
+                } catch (const std::exception& err) {
+                    logger.error() << "Cursor " << reinterpret_cast<u64>(con_cls) << " compression error: " << err.what();
+                    encoding = ContentEncoding::IDENTITY;
+                }
+            }
+
             auto response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, 64*1024, &read_callback, cursor, &free_callback);
+            if (encoding != ContentEncoding::IDENTITY) {
+                MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_ENCODING, encoding_name(encoding));
+            }
+            MHD_add_response_header(response, "Vary", "Accept-Encoding");
             int ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
             MHD_destroy_response(response);
             return ret;
@@ -114,7 +134,7 @@ static int accept_connection(void           *cls,
         }
     } else if (strcmp(method, "GET") == 0) {
         static const char* SIGIL = "";
-        auto queryproc = static_cast<ReadOperationBuilder*>(cls);
+        auto queryproc = static_cast<HttpServer*>(cls)->proc_.get();
         auto cursor = static_cast<const char*>(*con_cls);
         if (cursor == nullptr) {
             *con_cls = const_cast<char*>(SIGIL);
@@ -162,11 +182,18 @@ static int accept_connection(void           *cls,
 }
 }
 
-HttpServer::HttpServer(boost::asio::ip::tcp::endpoint const& endpoint, std::shared_ptr<ReadOperationBuilder> qproc, AccessControlList const& acl)
+HttpServer::HttpServer(boost::asio::ip::tcp::endpoint const& endpoint, std::shared_ptr<ReadOperationBuilder> qproc,
+                       AccessControlList const& acl, CompressionSettings const& compression)
     : acl_(acl)
     , proc_(qproc)
     , endpoint_(endpoint)
     , daemon_(nullptr)  // `start` should be called to initialize daemon_ correctly
+    , compression_(compression)
+{
+}
+
+HttpServer::HttpServer(boost::asio::ip::tcp::endpoint const& endpoint, std::shared_ptr<ReadOperationBuilder> qproc, AccessControlList const& acl)
+    : HttpServer(endpoint, qproc, acl, CompressionSettings{ CompressionSettings::DEFAULT_GZIP_LEVEL, CompressionSettings::DEFAULT_ZSTD_LEVEL })
 {
 }
 
@@ -182,7 +209,7 @@ void HttpServer::start(SignalHandler* sig, int id) {
                                NULL,
                                NULL,
                                &MHD::accept_connection,
-                               proc_.get(),
+                               this,
                                MHD_OPTION_SOCK_ADDR,
                                endpoint_.data(),
                                MHD_OPTION_END);
@@ -214,7 +241,8 @@ struct HttpServerBuilder {
             s_logger_.error() << "Can't initialize HTTP server, more than one protocol specified";
             BOOST_THROW_EXCEPTION(std::runtime_error("invalid http-server settings"));
         }
-        return std::make_shared<HttpServer>(settings.protocols.front().endpoint, qproc);
+        CompressionSettings compression = { settings.gzip_level, settings.zstd_level };
+        return std::make_shared<HttpServer>(settings.protocols.front().endpoint, qproc, AccessControlList(), compression);
     }
 };
 
@@ -23,6 +23,7 @@
 #include <boost/asio.hpp>
 
 #include "akumuli.h"
+#include "http_compression.h"
 #include "logger.h"
 #include "server.h"
 
@@ -36,10 +37,13 @@ struct HttpServer : std::enable_shared_from_this<HttpServer>, Server {
     std::shared_ptr<ReadOperationBuilder> proc_;
     boost::asio::ip::tcp::endpoint        endpoint_;
     MHD_Daemon*                           daemon_;
+    CompressionSettings                   compression_;
 
     HttpServer(const boost::asio::ip::tcp::endpoint &endpoint, std::shared_ptr<ReadOperationBuilder> qproc);
     HttpServer(const boost::asio::ip::tcp::endpoint &endpoint, std::shared_ptr<ReadOperationBuilder> qproc,
                AccessControlList const& acl);
+    HttpServer(const boost::asio::ip::tcp::endpoint &endpoint, std::shared_ptr<ReadOperationBuilder> qproc,
+               AccessControlList const& acl, CompressionSettings const& compression);
 
     virtual void start(SignalHandler* handler, int id);
     void stop();
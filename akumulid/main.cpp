@@ -51,12 +51,50 @@ nvolumes=%1%
 # Default value is 4GB (if value is not set).
 volume_size=4GB
 
+# Out-of-order write window in milliseconds. Data-points that are
+# older than the last data-point of the series but fall within
+# this window are buffered in memory and merged in timestamp order.
+# Zero (default value) disables the window.
+reorder_window=0
+
+# Max number of data-points buffered per series by the out-of-order
+# write window.
+reorder_buffer_size=1024
+
+# Representation of the posting lists in the series index. Possible
+# values are `compressed` (default) and `roaring`. Roaring bitmaps use
+# more memory on small databases but make queries with many tag filters
+# much faster on databases with millions of series.
+index_postings=compressed
+
+# Keep series names in the persistent memory mapped index. The index
+# lives next to the database file and lets the server start ingesting
+# data without reading all series names from the metadata storage.
+# Query index is populated in the background.
+persistent_index=false
+
+# Max number of series that can be matched by one query. Number of
+# series is estimated before the query is executed and queries that
+# exceed the limit are rejected. Zero (default value) disables the limit.
+max_query_cardinality=0
+
+# Number of series ids reserved for every metric at once. Series of
+# the same metric get adjacent ids so queries and merges over one metric
+# touch a contiguous id range. Zero (default value) means that ids are
+# allocated sequentially. Can't be used with the persistent index.
+series_id_range=0
+
 
 # HTTP API endpoint configuration
 
 [HTTP]
 # port number
 port=8181
+# Compression of query responses, the encoding is negotiated using
+# the Accept-Encoding header. Gzip level is in 1-9 range, zstd level
+# is in 1-22 range, 0 disables the encoding.
+gzip_level=6
+zstd_level=3
 
 
 # TCP ingestion server config (delete to disable)
@@ -66,6 +104,17 @@ port=8181
 port=8282
 # worker pool size (0 means that the size of the pool will be chosen automatically)
 pool_size=0
+# Use listening socket per worker thread (SO_REUSEPORT), connections are
+# spread between threads by the kernel and never leave the thread that accepted them
+reuse_port=false
+# Pin worker threads to CPU cores
+cpu_affinity=false
+# Flow control: max number of bytes read from the sockets and not yet written
+# to the storage (0 - unlimited). Sessions stop reading when the limit is reached.
+max_inflight_bytes=0
+# Flow control: pause reading from the sockets when the number of pending storage
+# metadata updates is larger than this value (0 - unlimited)
+max_write_backlog=0
 
 
 # UDP ingestion server config (delete to disable)
@@ -73,8 +122,12 @@ pool_size=0
 [UDP]
 # port number
 port=8383
-# worker pool size
+# worker pool size, every worker receives datagrams from its own socket
 pool_size=1
+# max number of datagrams received by one system call
+batch_size=16
+# accept coalesced datagrams (UDP generic receive offload, Linux only)
+gro=false
 
 # OpenTSDB telnet-style data connection enabled (remove this section to disable).
 
@@ -82,6 +135,19 @@ pool_size=1
 # port number
 port=4242
 
+# Binary columnar protocol (length-prefixed frames with pre-resolved series ids).
+# Uncomment this section to enable.
+
+#[Binary]
+# port number
+#port=8484
+
+# InfluxDB line protocol over TCP. Uncomment this section to enable.
+
+#[Influx]
+# port number
+#port=8089
+
 
 # Logging configuration
 # This is just a log4cxx configuration without any modifications
@@ -242,6 +308,39 @@ struct ConfigFile {
         return get_memory_size(strsize);
     }
 
+    //! Return out-of-order write window in nanoseconds
+    static u64 get_reorder_window(PTree conf) {
+        return conf.get<u64>("reorder_window", 0) * 1000000ull;
+    }
+
+    static u32 get_reorder_buffer_size(PTree conf) {
+        return conf.get<u32>("reorder_buffer_size", 1024);
+    }
+
+    //! Return true if series index should use roaring bitmaps
+    static bool get_roaring_index(PTree conf) {
+        auto postings = conf.get<std::string>("index_postings", "compressed");
+        if (postings == "roaring") {
+            return true;
+        } else if (postings != "compressed") {
+            std::runtime_error err("invalid index_postings value: " + postings);
+            BOOST_THROW_EXCEPTION(err);
+        }
+        return false;
+    }
+
+    static bool get_persistent_index(PTree conf) {
+        return conf.get<bool>("persistent_index", false);
+    }
+
+    static u64 get_max_query_cardinality(PTree conf) {
+        return conf.get<u64>("max_query_cardinality", 0);
+    }
+
+    static u64 get_series_id_range(PTree conf) {
+        return conf.get<u64>("series_id_range", 0);
+    }
+
     static WALSettings get_wal_settings(PTree conf) {
         WALSettings settings = {};
         if (conf.find("WAL") != conf.not_found()) {
@@ -277,6 +376,8 @@ struct ConfigFile {
             settings.protocols.push_back({ "HTTP", endpoint });
             settings.nworkers = -1;
         }
+        settings.gzip_level = conf.get<int>("HTTP.gzip_level", 6);
+        settings.zstd_level = conf.get<int>("HTTP.zstd_level", 3);
         return settings;
     }
 
@@ -296,6 +397,8 @@ struct ConfigFile {
             settings.protocols.push_back({ "UDP", endpoint });
             settings.nworkers = conf.get<int>("UDP.pool_size");
         }
+        settings.batch_size = conf.get<int>("UDP.batch_size", 16);
+        settings.gro        = conf.get<bool>("UDP.gro", false);
         return settings;
     }
 
@@ -327,7 +430,39 @@ struct ConfigFile {
                 settings.protocols.push_back({ "OpenTSDB", endpoint });
             }
         }
+
+        if (conf.count("Binary")) {
+            auto bip = conf.get_optional<std::string>("Binary.bind_addr");
+            if (bip) {
+                auto addr = boost::asio::ip::address_v4::from_string(*bip);
+                boost::asio::ip::tcp::endpoint endpoint(addr, conf.get<unsigned short>("Binary.port"));
+                settings.protocols.push_back({ "Binary", endpoint });
+            }
+            else {
+                boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v4(),
+                                                        conf.get<unsigned short>("Binary.port"));
+                settings.protocols.push_back({ "Binary", endpoint });
+            }
+        }
+
+        if (conf.count("Influx")) {
+            auto iip = conf.get_optional<std::string>("Influx.bind_addr");
+            if (iip) {
+                auto addr = boost::asio::ip::address_v4::from_string(*iip);
+                boost::asio::ip::tcp::endpoint endpoint(addr, conf.get<unsigned short>("Influx.port"));
+                settings.protocols.push_back({ "Influx", endpoint });
+            }
+            else {
+                boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v4(),
+                                                        conf.get<unsigned short>("Influx.port"));
+                settings.protocols.push_back({ "Influx", endpoint });
+            }
+        }
         settings.nworkers = conf.get<int>("TCP.pool_size");
+        settings.reuse_port = conf.get<bool>("TCP.reuse_port", false);
+        settings.cpu_affinity = conf.get<bool>("TCP.cpu_affinity", false);
+        settings.max_inflight = conf.get<u64>("TCP.max_inflight_bytes", 0);
+        settings.max_backlog = conf.get<u64>("TCP.max_write_backlog", 0);
         return settings;
     }
 
@@ -546,6 +681,12 @@ void cmd_run_server(boost::optional<std::string> cmd_config_path) {
                 params.input_log_volume_size = static_cast<u64>(wal_config.volume_size_bytes);
             }
         }
+        params.reorder_window      = ConfigFile::get_reorder_window(config);
+        params.reorder_buffer_size = ConfigFile::get_reorder_buffer_size(config);
+        params.roaring_index       = ConfigFile::get_roaring_index(config) ? 1 : 0;
+        params.persistent_index    = ConfigFile::get_persistent_index(config) ? 1 : 0;
+        params.max_query_cardinality = ConfigFile::get_max_query_cardinality(config);
+        params.series_id_range     = ConfigFile::get_series_id_range(config);
 
         auto connection  = std::make_shared<AkumuliConnection>(full_path.c_str(), params);
         auto qproc       = std::make_shared<QueryProcessor>(connection, 2048);
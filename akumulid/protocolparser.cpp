@@ -1,6 +1,7 @@
 #include "protocolparser.h"
 #include <sstream>
 #include <cassert>
+#include <chrono>
 #include <boost/algorithm/string.hpp>
 
 #include "resp.h"
@@ -70,18 +71,32 @@ int ReadBuffer::read_line(Byte* buffer, size_t quota) {
     assert(quota < 0x100000000ul);
     u32 available = wpos_ - rpos_;
     auto to_read = std::min(static_cast<u32>(quota), available);
-    for (u32 i = 0; i < to_read; i++) {
-        Byte c = buffer_[rpos_ + i];
-        buffer[i] = c;
-        if (c == '\n') {
-            // Stop iteration
-            u32 bytes_copied = i + 1;
-            rpos_ += bytes_copied;
-            return static_cast<int>(bytes_copied);
-        }
+    const Byte* begin = buffer_.data() + rpos_;
+    const Byte* eol = find_newline(begin, begin + to_read);
+    if (eol == begin + to_read) {
+        // No end of line found
+        memcpy(buffer, begin, to_read);
+        return -1*static_cast<int>(to_read);
+    }
+    u32 bytes_copied = static_cast<u32>(eol - begin) + 1;
+    memcpy(buffer, begin, bytes_copied);
+    rpos_ += bytes_copied;
+    return static_cast<int>(bytes_copied);
+}
+
+std::tuple<Byte*, int> ReadBuffer::read_line_inplace(size_t quota) {
+    assert(quota < 0x100000000ul);
+    u32 available = wpos_ - rpos_;
+    auto to_read = std::min(static_cast<u32>(quota), available);
+    Byte* begin = buffer_.data() + rpos_;
+    auto eol = begin + (find_newline(begin, begin + to_read) - begin);
+    if (eol == begin + to_read) {
+        // No end of line found
+        return std::make_tuple(begin, -1*static_cast<int>(to_read));
     }
-    // No end of line found
-    return -1*static_cast<int>(to_read);
+    u32 bytes_read = static_cast<u32>(eol - begin) + 1;
+    rpos_ += bytes_read;
+    return std::make_tuple(begin, static_cast<int>(bytes_read));
 }
 
 void ReadBuffer::close() {
@@ -156,6 +171,8 @@ RESPProtocolParser::RESPProtocolParser(std::shared_ptr<DbSession> consumer)
     , rdbuf_(RDBUF_SIZE)
     , consumer_(consumer)
     , logger_("resp-protocol-parser")
+    , state_(ParserState::IDS)
+    , rowwidth_(0)
 {
 }
 
@@ -402,8 +419,7 @@ bool RESPProtocolParser::parse_values(RESPStream&        stream,
             BOOST_THROW_EXCEPTION(ProtocolParserError(msg, pos));
         }
         buf[bytes_read] = '\0';
-        char* endptr = nullptr;
-        values[at] = strtod(buf, &endptr);
+        const Byte* endptr = parse_double(buf, buf + bytes_read, &values[at]);
         if (endptr - buf != bytes_read) {
             std::stringstream fmt;
             fmt << "can't parse double value: " << buf;
@@ -544,74 +560,81 @@ bool RESPProtocolParser::parse_values(RESPStream&        stream,
 }
 
 void RESPProtocolParser::worker() {
-    // Buffer to read strings from
-    int rowwidth = 0;
-    // Data to read
-    aku_Sample sample;
-    aku_Status status = AKU_SUCCESS;
-    //
     RESPStream stream(&rdbuf_);
-    // try to read dict
-    while (true) {
-        bool ok = parse_dict(stream);
-        // Dict may be incomplete yet. In this case the method will return false and we
-        // will need to call it once again. When done it will return true. On error it will
-        // throw ProtocolParserError exception (the same way as all other parse_stuff methods).
-        if (ok) break;
-        else   return;
-    }
     while(true) {
-        bool success;
-        // read id
-        rowwidth = parse_ids(stream, paramids_, AKU_LIMITS_MAX_ROW_WIDTH);
-        if (rowwidth < 0) {
-            rdbuf_.discard();
-            return;
+        // Every element of the message is consumed as soon as it's parsed. If the message
+        // is incomplete, the parser stops and resumes from the same state when the next
+        // buffer arrives. Already parsed elements are not parsed (and resolved) again.
+        if (state_ == ParserState::IDS) {
+            // Dict may be incomplete yet. In this case the method will return false and we
+            // will need to call it once again. When done it will return true. On error it will
+            // throw ProtocolParserError exception (the same way as all other parse_stuff methods).
+            // Dictionary can only be placed between messages.
+            if (!parse_dict(stream)) {
+                return;
+            }
+            rowwidth_ = parse_ids(stream, paramids_, AKU_LIMITS_MAX_ROW_WIDTH);
+            if (rowwidth_ < 0) {
+                rdbuf_.discard();
+                return;
+            }
+            rdbuf_.consume();
+            state_ = ParserState::TIMESTAMP;
         }
-        // read ts
-        success = parse_timestamp(stream, sample);
-        if (!success) {
-            rdbuf_.discard();
-            return;
+        if (state_ == ParserState::TIMESTAMP) {
+            if (!parse_timestamp(stream, sample_)) {
+                rdbuf_.discard();
+                return;
+            }
+            rdbuf_.consume();
+            state_ = ParserState::VALUES;
         }
-        success = parse_values(stream, paramids_, values_, events_, rowwidth);
-        if (!success) {
+        if (events_.size() < static_cast<size_t>(rowwidth_)) {
+            events_.resize(static_cast<size_t>(rowwidth_));
+        }
+        if (!parse_values(stream, paramids_, values_, events_.data(), rowwidth_)) {
             rdbuf_.discard();
             return;
         }
-
         rdbuf_.consume();
+        state_ = ParserState::IDS;
 
-        sample.payload.type = AKU_PAYLOAD_FLOAT;
-        sample.payload.size = sizeof(aku_Sample);
-        // Timestamp is initialized once and for all
-        for (int i = 0; i < rowwidth; i++) {
-            if (static_cast<i64>(paramids_[i]) > 0) {
-                // Fast path
-                sample.paramid = paramids_[i];
-                sample.payload.float64 = values_[i];
-                status = consumer_->write(sample);
-                // Message processed and frame can be removed (if possible)
-                if (status != AKU_SUCCESS) {
-                    BOOST_THROW_EXCEPTION(DatabaseError(status));
-                }
+        write_row();
+    }
+}
+
+void RESPProtocolParser::write_row() {
+    aku_Status status = AKU_SUCCESS;
+    aku_Sample sample = sample_;
+    sample.payload.type = AKU_PAYLOAD_FLOAT;
+    sample.payload.size = sizeof(aku_Sample);
+    // Timestamp is initialized once and for all
+    for (int i = 0; i < rowwidth_; i++) {
+        if (static_cast<i64>(paramids_[i]) > 0) {
+            // Fast path
+            sample.paramid = paramids_[i];
+            sample.payload.float64 = values_[i];
+            status = consumer_->write(sample);
+            // Message processed and frame can be removed (if possible)
+            if (status != AKU_SUCCESS) {
+                BOOST_THROW_EXCEPTION(DatabaseError(status));
             }
-            else {
-                size_t len = events_[i].size() + sizeof(aku_Sample);
-                aku_Sample evt;
-                evt.payload.type = AKU_PAYLOAD_EVENT;
-                evt.payload.size = static_cast<u16>(len);  // len guaranteed to fit
-                evt.timestamp = sample.timestamp;
-                evt.paramid = paramids_[i];
-                event_out_buf_.resize(len);
-                auto pevt = reinterpret_cast<aku_Sample*>(event_out_buf_.data());
-                memcpy(pevt, &evt, sizeof(evt));
-                memcpy(pevt->payload.data, events_[i].data(), events_[i].size());
-                status = consumer_->write(*pevt);
-                // Message processed and frame can be removed (if possible)
-                if (status != AKU_SUCCESS) {
-                    BOOST_THROW_EXCEPTION(DatabaseError(status));
-                }
+        }
+        else {
+            size_t len = events_[i].size() + sizeof(aku_Sample);
+            aku_Sample evt;
+            evt.payload.type = AKU_PAYLOAD_EVENT;
+            evt.payload.size = static_cast<u16>(len);  // len guaranteed to fit
+            evt.timestamp = sample.timestamp;
+            evt.paramid = paramids_[i];
+            event_out_buf_.resize(len);
+            auto pevt = reinterpret_cast<aku_Sample*>(event_out_buf_.data());
+            memcpy(pevt, &evt, sizeof(evt));
+            memcpy(pevt->payload.data, events_[i].data(), events_[i].size());
+            status = consumer_->write(*pevt);
+            // Message processed and frame can be removed (if possible)
+            if (status != AKU_SUCCESS) {
+                BOOST_THROW_EXCEPTION(DatabaseError(status));
             }
         }
     }
@@ -748,17 +771,8 @@ static OpenTSDBMessageType message_dispatch(Byte* p, int len) {
  * @invariant quota >= ntrailing, ntrailing >= 1
  */
 static std::tuple<Byte*, int, int> skip_element(Byte* buffer, int len) {
-    int quota = len;
-    Byte* p = buffer;
-    // Skip element
-    while(quota) {
-        Byte c = *p;
-        if (c == ' ' || c == '\n') {
-            break;
-        }
-        p++;
-        quota--;
-    }
+    Byte* p = buffer + (find_first_of(buffer, buffer + len, ' ', '\n') - buffer);
+    int quota = len - static_cast<int>(p - buffer);
     // Skip space
     int ntrailing = 0;
     while(quota) {
@@ -915,11 +929,8 @@ OpenTSDBResponse OpenTSDBProtocolParser::worker() {
             }
             pbuf += timestamp_size;
 
-            const int tix = value_size - value_trailing;
-            pbuf[tix] = '\0';  // Replace space with 0-terminator
-            char* endptr = nullptr;
-            pbuf[tix] = ' ';
-            double value = strtod(pbuf, &endptr);
+            double value = 0;
+            const Byte* endptr = parse_double(pbuf, pbuf + (value_size - value_trailing), &value);
             if (endptr - pbuf != (value_size - value_trailing)) {
                 std::string msg;
                 size_t pos;
@@ -974,4 +985,487 @@ std::string OpenTSDBProtocolParser::error_repr(int kind, std::string const& err)
     return err + "\n";
 }
 
+
+
+//     Binary protocol      //
+
+BinaryProtocolParser::BinaryProtocolParser(std::shared_ptr<DbSession> consumer)
+    : done_(false)
+    , rdbuf_(RDBUF_SIZE)
+    , consumer_(consumer)
+    , logger_("binary-protocol-parser")
+{
+}
+
+void BinaryProtocolParser::start() {
+    logger_.info() << "Starting protocol parser";
+}
+
+bool BinaryProtocolParser::read_exact(void* dest, u32 size) {
+    if (size == 0) {
+        return true;
+    }
+    int nbytes = rdbuf_.read(reinterpret_cast<Byte*>(dest), size);
+    return nbytes == static_cast<int>(size);
+}
+
+void BinaryProtocolParser::process_dict(const Byte* payload, u32 size) {
+    const Byte* it  = payload;
+    const Byte* end = payload + size;
+    u32 count;
+    if (size < sizeof(count)) {
+        BOOST_THROW_EXCEPTION(ProtocolParserError("dictionary frame is too small", 0));
+    }
+    memcpy(&count, it, sizeof(count));
+    it += sizeof(count);
+    for (u32 i = 0; i < count; i++) {
+        u16 len;
+        if (end - it < static_cast<std::ptrdiff_t>(sizeof(len))) {
+            BOOST_THROW_EXCEPTION(ProtocolParserError("dictionary frame is truncated", 0));
+        }
+        memcpy(&len, it, sizeof(len));
+        it += sizeof(len);
+        if (end - it < static_cast<std::ptrdiff_t>(len)) {
+            BOOST_THROW_EXCEPTION(ProtocolParserError("dictionary frame is truncated", 0));
+        }
+        aku_ParamId id;
+        int rowwidth = consumer_->name_to_param_id_list(it, it + len, &id, 1);
+        if (rowwidth != 1) {
+            std::string name(it, it + len);
+            BOOST_THROW_EXCEPTION(ProtocolParserError("invalid series name format: " + name, 0));
+        }
+        if (static_cast<i64>(id) < 0) {
+            std::string name(it, it + len);
+            BOOST_THROW_EXCEPTION(ProtocolParserError("events are not supported: " + name, 0));
+        }
+        dict_.push_back(id);
+        it += len;
+    }
+    if (it != end) {
+        BOOST_THROW_EXCEPTION(ProtocolParserError("dictionary frame size mismatch", 0));
+    }
+}
+
+bool BinaryProtocolParser::process_batch(Byte type, u32 size) {
+    // The payload is read column by column directly into the output arrays,
+    // incomplete frame is detected by the first short read.
+    u32 count;
+    if (size < sizeof(count)) {
+        BOOST_THROW_EXCEPTION(ProtocolParserError("batch frame is too small", 0));
+    }
+    if (!read_exact(&count, sizeof(count))) {
+        return false;
+    }
+    const u64 idsize = type == ID_BATCH ? sizeof(aku_ParamId) : sizeof(u32);
+    const u64 expected = sizeof(count) + static_cast<u64>(count)*(idsize + sizeof(aku_Timestamp) + sizeof(double));
+    if (expected != size) {
+        BOOST_THROW_EXCEPTION(ProtocolParserError("batch frame size mismatch", 0));
+    }
+    ids_.resize(count);
+    tss_.resize(count);
+    xss_.resize(count);
+    if (type == ID_BATCH) {
+        if (!read_exact(ids_.data(), count*sizeof(aku_ParamId))) {
+            return false;
+        }
+    } else {
+        refs_.resize(count);
+        if (!read_exact(refs_.data(), count*sizeof(u32))) {
+            return false;
+        }
+    }
+    if (!read_exact(tss_.data(), count*sizeof(aku_Timestamp)) ||
+        !read_exact(xss_.data(), count*sizeof(double)))
+    {
+        return false;
+    }
+    rdbuf_.consume();
+    if (type == REF_BATCH) {
+        const u32 dictsize = static_cast<u32>(dict_.size());
+        for (u32 i = 0; i < count; i++) {
+            u32 ref = refs_[i];
+            if (ref >= dictsize) {
+                BOOST_THROW_EXCEPTION(ProtocolParserError("unknown series reference " + std::to_string(ref), 0));
+            }
+            ids_[i] = dict_[ref];
+        }
+    }
+    auto status = consumer_->write_batch(ids_.data(), tss_.data(), xss_.data(), count);
+    if (status != AKU_SUCCESS) {
+        BOOST_THROW_EXCEPTION(DatabaseError(status));
+    }
+    return true;
+}
+
+void BinaryProtocolParser::worker() {
+    while (true) {
+        Byte header[HEADER_SIZE];
+        if (!read_exact(header, HEADER_SIZE)) {
+            rdbuf_.discard();
+            return;
+        }
+        u32 size;
+        memcpy(&size, header, sizeof(size));
+        Byte type = header[sizeof(size)];
+        if (size > MAX_FRAME_SIZE) {
+            BOOST_THROW_EXCEPTION(ProtocolParserError("frame is too large", 0));
+        }
+        switch (type) {
+        case DICT:
+            frame_.resize(size);
+            if (!read_exact(frame_.data(), size)) {
+                rdbuf_.discard();
+                return;
+            }
+            rdbuf_.consume();
+            process_dict(frame_.data(), size);
+            break;
+        case ID_BATCH:
+        case REF_BATCH:
+            if (!process_batch(type, size)) {
+                rdbuf_.discard();
+                return;
+            }
+            break;
+        default: {
+            std::string msg = "unknown frame type " + std::to_string(static_cast<int>(type));
+            BOOST_THROW_EXCEPTION(ProtocolParserError(msg, 0));
+        }
+        };
+    }
+}
+
+NullResponse BinaryProtocolParser::parse_next(Byte* buffer, u32 sz) {
+    static NullResponse response;
+    rdbuf_.push(buffer, sz);
+    worker();
+    return response;
+}
+
+Byte* BinaryProtocolParser::get_next_buffer() {
+    return rdbuf_.pull();
+}
+
+void BinaryProtocolParser::close() {
+    done_ = true;
+}
+
+std::string BinaryProtocolParser::error_repr(int kind, std::string const& err) const {
+    switch (kind) {
+    case ERR:
+        return "-ERR " + err + "\r\n";
+    case DB:
+        return "-DB " + err + "\r\n";
+    case PARSE:
+        return "-PARSER " + err + "\r\n";
+    };
+    return "-UNKNOWN " + err + "\r\n";
+}
+
+
+
+//     Influx line protocol      //
+
+InfluxProtocolParser::InfluxProtocolParser(std::shared_ptr<DbSession> consumer)
+    : done_(false)
+    , rdbuf_(RDBUF_SIZE)
+    , consumer_(consumer)
+    , logger_("influx-protocol-parser")
+{
+}
+
+void InfluxProtocolParser::start() {
+    logger_.info() << "Starting protocol parser";
+}
+
+void InfluxProtocolParser::parse_error(const char* what) const {
+    std::string msg;
+    size_t pos;
+    std::tie(msg, pos) = rdbuf_.get_error_context(what);
+    BOOST_THROW_EXCEPTION(ProtocolParserError(msg, pos));
+}
+
+/** Find first unescaped occurence of `a` or `b`, return `end` if not found.
+  */
+static Byte* influx_scan(Byte* it, Byte* end, char a, char b) {
+    while (it < end) {
+        Byte c = *it;
+        if (c == '\\') {
+            it += 2;
+            continue;
+        }
+        if (c == a || c == b) {
+            return it;
+        }
+        it++;
+    }
+    return end;
+}
+
+/** Append unescaped content of the [begin, end) range to the string.
+  */
+static void influx_unescape(const Byte* begin, const Byte* end, std::string* out) {
+    for (auto it = begin; it < end; it++) {
+        if (*it == '\\' && it + 1 < end) {
+            it++;
+        }
+        out->push_back(*it);
+    }
+}
+
+/** Parse field value (float, integer or boolean).
+  */
+static bool influx_parse_value(const Byte* begin, const Byte* end, double* out) {
+    const int buflen = 64;
+    char buf[buflen];
+    auto len = static_cast<int>(end - begin);
+    if (len <= 0 || len >= buflen) {
+        return false;
+    }
+    std::copy(begin, end, buf);
+    buf[len] = '\0';
+    char* endptr = nullptr;
+    switch (buf[len - 1]) {
+    case 'i':
+        buf[--len] = '\0';
+        *out = static_cast<double>(strtoll(buf, &endptr, 10));
+        return len != 0 && endptr == buf + len;
+    case 'u':
+        buf[--len] = '\0';
+        *out = static_cast<double>(strtoull(buf, &endptr, 10));
+        return len != 0 && endptr == buf + len;
+    case 't':
+    case 'T':
+    case 'e':
+    case 'E':
+        if (!strcmp(buf, "t") || !strcmp(buf, "T") || !strcmp(buf, "true") ||
+            !strcmp(buf, "True") || !strcmp(buf, "TRUE"))
+        {
+            *out = 1.0;
+            return true;
+        }
+        if (!strcmp(buf, "false") || !strcmp(buf, "False") || !strcmp(buf, "FALSE")) {
+            *out = 0.0;
+            return true;
+        }
+        break;
+    case 'f':
+    case 'F':
+        if (len == 1) {
+            *out = 0.0;
+            return true;
+        }
+        break;
+    };
+    return parse_double(buf, buf + len, out) == buf + len;
+}
+
+void InfluxProtocolParser::parse_line(Byte* begin, Byte* end) {
+    double values[AKU_LIMITS_MAX_ROW_WIDTH];
+    int nfields = 0;
+    name_.clear();
+    tags_.clear();
+
+    // Measurement
+    Byte* it = begin;
+    Byte* mbegin = it;
+    Byte* mend = influx_scan(it, end, ',', ' ');
+    if (mend == mbegin) {
+        parse_error("measurement name expected");
+    }
+    it = mend;
+
+    // Tags
+    while (it < end && *it == ',') {
+        it++;
+        Byte* eq = influx_scan(it, end, '=', '=');
+        if (eq == end || eq == it) {
+            parse_error("invalid tag format");
+        }
+        Byte* vend = influx_scan(eq + 1, end, ',', ' ');
+        if (vend == eq + 1) {
+            parse_error("empty tag value");
+        }
+        tags_.push_back(' ');
+        influx_unescape(it, eq, &tags_);
+        tags_.push_back('=');
+        auto vpos = tags_.size();
+        influx_unescape(eq + 1, vend, &tags_);
+        if (tags_.find(' ', vpos) != std::string::npos) {
+            parse_error("tag values with spaces are not supported");
+        }
+        it = vend;
+    }
+    if (it == end) {
+        parse_error("field set expected");
+    }
+    it++;  // skip space
+
+    // Fields
+    while (true) {
+        Byte* eq = influx_scan(it, end, '=', '=');
+        if (eq == end || eq == it) {
+            parse_error("invalid field format");
+        }
+        Byte* vbegin = eq + 1;
+        Byte* vend = vbegin;
+        if (vbegin < end && *vbegin == '"') {
+            // String fields can't be stored, skip
+            vend++;
+            while (vend < end && *vend != '"') {
+                if (*vend == '\\') {
+                    vend++;
+                }
+                vend++;
+            }
+            if (vend >= end) {
+                parse_error("unterminated string field");
+            }
+            vend++;
+        } else {
+            vend = influx_scan(vbegin, end, ',', ' ');
+            if (nfields == AKU_LIMITS_MAX_ROW_WIDTH) {
+                parse_error("too many fields");
+            }
+            if (!influx_parse_value(vbegin, vend, &values[nfields])) {
+                parse_error("invalid field value");
+            }
+            if (nfields != 0) {
+                name_.push_back('|');
+            }
+            influx_unescape(mbegin, mend, &name_);
+            name_.push_back('.');
+            influx_unescape(it, eq, &name_);
+            nfields++;
+        }
+        it = vend;
+        if (it < end && *it == ',') {
+            it++;
+            continue;
+        }
+        break;
+    }
+
+    // Timestamp
+    while (it < end && *it == ' ') {
+        it++;
+    }
+    aku_Timestamp ts = 0;
+    if (it == end) {
+        auto now = std::chrono::system_clock::now().time_since_epoch();
+        ts = static_cast<aku_Timestamp>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+    } else {
+        for (; it < end && *it != ' ' && *it != '\t'; it++) {
+            Byte c = *it;
+            if (c < '0' || c > '9') {
+                parse_error("invalid timestamp");
+            }
+            ts = ts*10 + static_cast<aku_Timestamp>(c - '0');
+        }
+        // Trailing whitespace
+        for (; it < end; it++) {
+            if (*it != ' ' && *it != '\t') {
+                parse_error("invalid timestamp");
+            }
+        }
+    }
+
+    if (nfields == 0) {
+        return;
+    }
+    if (name_.find(' ') != std::string::npos) {
+        parse_error("measurement and field names with spaces are not supported");
+    }
+    name_.append(tags_);
+    auto base = ids_.size();
+    ids_.resize(base + static_cast<size_t>(nfields));
+    int rowwidth = consumer_->name_to_param_id_list(name_.data(), name_.data() + name_.size(),
+                                                    ids_.data() + base, static_cast<u32>(nfields));
+    if (rowwidth != nfields) {
+        ids_.resize(base);
+        parse_error("invalid series name format");
+    }
+    for (int i = 0; i < nfields; i++) {
+        tss_.push_back(ts);
+        xss_.push_back(values[i]);
+    }
+}
+
+void InfluxProtocolParser::write_batch() {
+    if (ids_.empty()) {
+        return;
+    }
+    auto status = consumer_->write_batch(ids_.data(), tss_.data(), xss_.data(), static_cast<u32>(ids_.size()));
+    ids_.clear();
+    tss_.clear();
+    xss_.clear();
+    if (status != AKU_SUCCESS) {
+        BOOST_THROW_EXCEPTION(DatabaseError(status));
+    }
+}
+
+void InfluxProtocolParser::worker() {
+    ids_.clear();
+    tss_.clear();
+    xss_.clear();
+    try {
+        while (true) {
+            Byte* line;
+            int len;
+            std::tie(line, len) = rdbuf_.read_line_inplace(MAX_LINE_SIZE);
+            if (len <= 0) {
+                if (-len == MAX_LINE_SIZE) {
+                    parse_error("line is too long");
+                }
+                break;
+            }
+            Byte* end = line + len - 1;  // skip '\n'
+            if (end > line && *(end - 1) == '\r') {
+                end--;
+            }
+            while (line < end && *line == ' ') {
+                line++;
+            }
+            if (line < end && *line != '#') {
+                parse_line(line, end);
+            }
+            rdbuf_.consume();
+        }
+    } catch (ProtocolParserError const&) {
+        // Lines before the bad one are already consumed, they shouldn't be lost
+        try {
+            write_batch();
+        } catch (DatabaseError const& err) {
+            logger_.error() << "Can't write batch: " << err.what();
+        }
+        throw;
+    }
+    write_batch();
+}
+
+NullResponse InfluxProtocolParser::parse_next(Byte* buffer, u32 sz) {
+    static NullResponse response;
+    rdbuf_.push(buffer, sz);
+    worker();
+    return response;
+}
+
+Byte* InfluxProtocolParser::get_next_buffer() {
+    return rdbuf_.pull();
+}
+
+void InfluxProtocolParser::close() {
+    done_ = true;
+}
+
+std::string InfluxProtocolParser::error_repr(int kind, std::string const& err) const {
+    switch (kind) {
+    case ERR:
+        return "error: " + err + "\n";
+    case DB:
+        return "database: " + err + "\n";
+    };
+    return err + "\n";
+}
+
 }
@@ -16,7 +16,6 @@
 
 #pragma once
 
-// Using old-style boost.coroutines
 #include <cstdint>
 #include <memory>
 #include <queue>
@@ -109,6 +108,13 @@ public:
     virtual void consume();
     virtual void discard();
 
+    /** Zero-copy version of `read_line`. Returns pointer to the next line inside the buffer
+      * and its length (including '\n' character). Pointer is valid until next `pull` call.
+      * If the buffer doesn't contain full line the method returns negative number of available
+      * bytes (same as `read_line`) and doesn't move read position.
+      */
+    std::tuple<Byte*, int> read_line_inplace(size_t quota);
+
     // BufferAllocator interface
 public:
     /** Get pointer to buffer. Size of the buffer is guaranteed to be at least
@@ -214,20 +220,34 @@ struct NullResponse : ProtocolParserResponse {
  */
 class RESPProtocolParser {
     typedef std::unordered_multimap<aku_ParamId, aku_ParamId> SeriesIdMap;
+
+    //! Position inside the message (the parser is resumable)
+    enum class ParserState {
+        IDS,
+        TIMESTAMP,
+        VALUES,
+    };
+
     bool                               done_;
     ReadBuffer                         rdbuf_;
     std::shared_ptr<DbSession>         consumer_;
     Logger                             logger_;
     SeriesIdMap                        idmap_;
+    ParserState                        state_;
+    int                                rowwidth_;
+    aku_Sample                         sample_;
     u64                                paramids_[AKU_LIMITS_MAX_ROW_WIDTH];
     double                             values_  [AKU_LIMITS_MAX_ROW_WIDTH];
-    std::string                        events_  [AKU_LIMITS_MAX_ROW_WIDTH];
+    std::vector<std::string>           events_;
     std::vector<char>                  event_inp_buf_;
     std::vector<char>                  event_out_buf_;
 
-    //! Process frames from queue
+    //! Process messages from read buffer
     void worker();
 
+    //! Write fully parsed message to the database
+    void write_row();
+
     //! Generate error message
     std::tuple<std::string, size_t> get_error_from_pdu(PDU const& pdu) const;
 
@@ -335,4 +355,154 @@ public:
     std::string error_repr(int kind, std::string const& err) const;
 };
 
+
+/**
+ * @brief Binary columnar protocol parser
+ *
+ * Every PDU is a length-prefixed frame. The frame header contains the payload size (u32)
+ * followed by the frame type (one byte). All integers and floating point values are encoded
+ * in little-endian byte order.
+ *
+ *     frame  := u32 payload_size, u8 frame_type, payload
+ *
+ * DICTIONARY frame ('D') binds series names to connection-local references. Every name
+ * gets next reference number in order of appearance (the first name sent over the
+ * connection gets reference 0, the next one gets reference 1, etc). Names are resolved
+ * only once and the client can use references afterwards.
+ *
+ *     payload := u32 count, { u16 length, name[length] } * count
+ *
+ * ID BATCH frame ('I') contains three columns: series ids, timestamps and values. Series
+ * ids should be resolved beforehand (e.g. using the query API).
+ *
+ *     payload := u32 count, u64 ids[count], u64 timestamps[count], f64 values[count]
+ *
+ * REF BATCH frame ('R') is the same as ID BATCH but series are identified by references
+ * created by dictionary frames.
+ *
+ *     payload := u32 count, u32 refs[count], u64 timestamps[count], f64 values[count]
+ *
+ * Batches are written to the database using the bulk write path (DbSession::write_batch).
+ * Only floating point values are supported.
+ */
+class BinaryProtocolParser {
+    bool                               done_;
+    ReadBuffer                         rdbuf_;
+    std::shared_ptr<DbSession>         consumer_;
+    Logger                             logger_;
+    std::vector<aku_ParamId>           dict_;
+    std::vector<Byte>                  frame_;
+    std::vector<u32>                   refs_;
+    std::vector<aku_ParamId>           ids_;
+    std::vector<aku_Timestamp>         tss_;
+    std::vector<double>                xss_;
+
+    //! Read exactly `size` bytes from the read buffer, return false if not enough data
+    bool read_exact(void* dest, u32 size);
+
+    //! Process frames from read buffer
+    void worker();
+
+    void process_dict(const Byte* payload, u32 size);
+
+    //! Read and write batch frame, return false if frame is incomplete
+    bool process_batch(Byte type, u32 size);
+public:
+    enum {
+        RDBUF_SIZE = 0x10000,  // 64KB
+        HEADER_SIZE = 5,
+        MAX_FRAME_SIZE = 0x1000000,  // 16MB
+    };
+
+    enum FrameType {
+        DICT = 'D',
+        ID_BATCH = 'I',
+        REF_BATCH = 'R',
+    };
+
+    BinaryProtocolParser(std::shared_ptr<DbSession> consumer);
+    void start();
+    NullResponse parse_next(Byte *buffer, u32 sz);
+    void close();
+    Byte* get_next_buffer();
+
+    // Error representation
+    enum {
+        DB,
+        ERR,
+        PARSE,
+    };
+
+    /**
+     * @brief Return error representation (same format as in RESP protocol)
+     */
+    std::string error_repr(int kind, std::string const& err) const;
+};
+
+
+/**
+ * @brief InfluxDB line protocol parser
+ *
+ * Each line contains measurement name, optional set of tags, set of fields and optional
+ * timestamp (nanoseconds since epoch, server time is used if timestamp is missing).
+ * Lines are parsed in place inside the read buffer. Every field is mapped to the series
+ * that has the name `<measurement>.<field>` and the same set of tags. All fields from one
+ * line are resolved at once using compound series name.
+ *
+ * Example:
+ *     cpu,host=machine1,region=NW user=3.12,sys=12.6 1418197423000000000
+ *
+ * is converted to compound series name `cpu.user|cpu.sys host=machine1 region=NW` with
+ * two values that share the same timestamp. Integer (`10i`, `10u`) and boolean values are
+ * converted to floating point values, string fields are ignored.
+ *
+ * Samples parsed from one network buffer are written using single batch write.
+ */
+class InfluxProtocolParser {
+    bool                               done_;
+    ReadBuffer                         rdbuf_;
+    std::shared_ptr<DbSession>         consumer_;
+    Logger                             logger_;
+    std::string                        name_;
+    std::string                        tags_;
+    std::vector<aku_ParamId>           ids_;
+    std::vector<aku_Timestamp>         tss_;
+    std::vector<double>                xss_;
+
+    //! Parse single line and append its samples to the batch
+    void parse_line(Byte* begin, Byte* end);
+
+    //! Throw ProtocolParserError with context
+    void parse_error(const char* what) const;
+
+    //! Write accumulated batch to the database and clear it
+    void write_batch();
+
+    //! Process lines from read buffer
+    void worker();
+public:
+    enum {
+        RDBUF_SIZE = 0x1000,  // 4KB
+        MAX_LINE_SIZE = 0x10000,
+    };
+
+    InfluxProtocolParser(std::shared_ptr<DbSession> consumer);
+    void start();
+    NullResponse parse_next(Byte *buffer, u32 sz);
+    void close();
+    Byte* get_next_buffer();
+
+    // Error representation
+    enum {
+        DB,
+        ERR,
+        PARSE,
+    };
+
+    /**
+     * @brief Return error representation (same format as in OpenTSDB protocol)
+     */
+    std::string error_repr(int kind, std::string const& err) const;
+};
+
 }  // namespace
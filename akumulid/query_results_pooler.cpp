@@ -1,6 +1,11 @@
 #include "query_results_pooler.h"
+#include "arrow_output.h"
 #include "logger.h"
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
+#include <limits>
+#include <sstream>
 #include <thread>
 #include <inttypes.h>
 #include <stdint.h>
@@ -28,15 +33,141 @@ static boost::property_tree::ptree from_json(std::string json) {
     return ptree;
 }
 
+//-----------------
+// SeriesNameCache
+//-----------------
+
+SeriesNameCache::SeriesNameCache(std::shared_ptr<DbSession> session, size_t capacity)
+    : session_(session)
+    , capacity_(std::max(capacity, (size_t)1))
+{
+}
+
+int SeriesNameCache::get(aku_ParamId id, char* buffer, size_t buffer_size) {
+    auto it = index_.find(id);
+    if (it != index_.end()) {
+        // Move to front
+        items_.splice(items_.begin(), items_, it->second);
+        std::string const& name = it->second->second;
+        if (name.size() > buffer_size) {
+            return -1*static_cast<int>(name.size());
+        }
+        memcpy(buffer, name.data(), name.size());
+        return static_cast<int>(name.size());
+    }
+    int len = session_->param_id_to_series(id, buffer, buffer_size);
+    if (len <= 0) {
+        // Unknown id or not enough space, nothing to cache
+        return len;
+    }
+    if (items_.size() == capacity_) {
+        index_.erase(items_.back().first);
+        items_.pop_back();
+    }
+    items_.emplace_front(id, std::string(buffer, buffer + len));
+    index_[id] = items_.begin();
+    return len;
+}
+
+size_t SeriesNameCache::size() const {
+    return items_.size();
+}
+
+//-----------------------
+// IsoTimestampFormatter
+//-----------------------
+
+static const u64 NS_PER_SEC = 1000000000ull;
+static const u64 SEC_PER_DAY = 86400ull;
+
+//! Write `n` digits of the `value` to `p`
+static inline void put_digits(char* p, u64 value, int n) {
+    for (int i = n; i --> 0;) {
+        p[i] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    }
+}
+
+IsoTimestampFormatter::IsoTimestampFormatter()
+    : day_(0)
+    , sec_(0)
+    , empty_(true)
+{
+}
+
+int IsoTimestampFormatter::format(aku_Timestamp ts, char* buffer, size_t buffer_size) {
+    const int len = PREFIX_SIZE + 10;  // prefix + '.' + nanoseconds
+    if (buffer_size < static_cast<size_t>(len + 1)) {
+        return -(len + 1);
+    }
+    if (ts > static_cast<aku_Timestamp>(std::numeric_limits<i64>::max())) {
+        // Out of range of the boost::posix_time, keep output consistent with the library
+        return aku_timestamp_to_string(ts, buffer, buffer_size);
+    }
+    u64 sec = ts / NS_PER_SEC;
+    if (empty_ || sec != sec_) {
+        u64 day = sec / SEC_PER_DAY;
+        if (empty_ || day != day_) {
+            // Convert days since epoch to civil date (proleptic Gregorian calendar)
+            u64 z = day + 719468;
+            u64 era = z / 146097;
+            u64 doe = z - era * 146097;
+            u64 yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+            u64 doy = doe - (365*yoe + yoe/4 - yoe/100);
+            u64 mp = (5*doy + 2)/153;
+            u64 d = doy - (153*mp + 2)/5 + 1;
+            u64 m = mp < 10 ? mp + 3 : mp - 9;
+            u64 y = yoe + era * 400 + (m <= 2 ? 1 : 0);
+            put_digits(prefix_, y, 4);
+            put_digits(prefix_ + 4, m, 2);
+            put_digits(prefix_ + 6, d, 2);
+            prefix_[8] = 'T';
+            day_ = day;
+        }
+        u64 tod = sec % SEC_PER_DAY;
+        put_digits(prefix_ + 9, tod / 3600, 2);
+        put_digits(prefix_ + 11, tod / 60 % 60, 2);
+        put_digits(prefix_ + 13, tod % 60, 2);
+        sec_ = sec;
+        empty_ = false;
+    }
+    memcpy(buffer, prefix_, PREFIX_SIZE);
+    buffer[PREFIX_SIZE] = '.';
+    put_digits(buffer + PREFIX_SIZE + 1, ts % NS_PER_SEC, 9);
+    buffer[len] = '\0';
+    return len + 1;
+}
+
+//--------------------
+// Output formatters
+//--------------------
+
+char* OutputFormatter::format_error(char* begin, char* end, const char* message) {
+    int size = static_cast<int>(end - begin);
+    if (size < 4) {
+        return nullptr;
+    }
+    // Leave space for "\r\n"
+    int len = snprintf(begin, static_cast<size_t>(size - 2), "-%s", message);
+    if (len < 0) {
+        return nullptr;
+    }
+    len = std::min(len, size - 3);
+    begin[len] = '\r';
+    begin[len + 1] = '\n';
+    return begin + len + 2;
+}
+
 struct CSVOutputFormatter : OutputFormatter {
 
-    std::shared_ptr<DbSession> session_;
+    SeriesNameCache names_;
+    IsoTimestampFormatter timestamps_;
     const bool iso_timestamps_;
 
     // TODO: parametrize column separator
 
     CSVOutputFormatter(std::shared_ptr<DbSession> con, bool iso_timestamps)
-        : session_(con)
+        : names_(con)
         , iso_timestamps_(iso_timestamps)
     {
     }
@@ -53,7 +184,7 @@ struct CSVOutputFormatter : OutputFormatter {
 
         if (sample.payload.type & aku_PData::PARAMID_BIT) {
             // Series name
-            len = session_->param_id_to_series(sample.paramid, begin, size);
+            len = names_.get(sample.paramid, begin, size);
             // '\0' character is counted in len
             if (len == 0) { // Error, no such Id
                 len = snprintf(begin, size, "id=%" PRId64, sample.paramid);
@@ -87,7 +218,7 @@ struct CSVOutputFormatter : OutputFormatter {
                 return nullptr;
             }
             if ((sample.payload.type&aku_PData::CUSTOM_TIMESTAMP) == 0 && iso_timestamps_) {
-                len = aku_timestamp_to_string(sample.timestamp, begin, size) - 1;  // -1 is for '\0' character
+                len = timestamps_.format(sample.timestamp, begin, size) - 1;  // -1 is for '\0' character
             } else {
                 len = -1;
             }
@@ -229,11 +360,12 @@ struct CSVOutputFormatter : OutputFormatter {
 //! RESP output implementation
 struct RESPOutputFormatter : OutputFormatter {
 
-    std::shared_ptr<DbSession> session_;
+    SeriesNameCache names_;
+    IsoTimestampFormatter timestamps_;
     const bool iso_timestamps_;
 
     RESPOutputFormatter(std::shared_ptr<DbSession> con, bool iso_timestamps)
-        : session_(con)
+        : names_(con)
         , iso_timestamps_(iso_timestamps)
     {
     }
@@ -256,7 +388,7 @@ struct RESPOutputFormatter : OutputFormatter {
 
         if (sample.payload.type & aku_PData::PARAMID_BIT) {
             // Series name
-            len = session_->param_id_to_series(sample.paramid, begin, size);
+            len = names_.get(sample.paramid, begin, size);
             // '\0' character is counted in len
             if (len == 0) { // Error, no such Id
                 len = snprintf(begin, size, "id=%" PRId64, sample.paramid);
@@ -290,7 +422,7 @@ struct RESPOutputFormatter : OutputFormatter {
                 return nullptr;
             }
             if ((sample.payload.type&aku_PData::CUSTOM_TIMESTAMP) == 0 && iso_timestamps_) {
-                len = aku_timestamp_to_string(sample.timestamp, begin, size) - 1;  // -1 is for '\0' character
+                len = timestamps_.format(sample.timestamp, begin, size) - 1;  // -1 is for '\0' character
             } else {
                 len = -1;
             }
@@ -402,6 +534,85 @@ struct RESPOutputFormatter : OutputFormatter {
     }
 };
 
+/** Apache Arrow output (IPC stream format).
+  * Samples are encoded in columnar batches, every series name is sent
+  * once as a dictionary entry. Only scalar values are supported, value
+  * column contains nulls for other payload types (tuples, events).
+  */
+struct ArrowOutputFormatter : OutputFormatter {
+
+    enum {
+        MAX_BATCH_SIZE = 0x10000,  //< Max number of rows in record batch
+        NAME_SIZE      = 0x1000,   //< Max series name length
+    };
+
+    std::shared_ptr<DbSession> session_;
+    ArrowStreamWriter          writer_;
+    bool                       done_;
+    std::vector<char>          name_;
+
+    ArrowOutputFormatter(std::shared_ptr<DbSession> con, bool iso_timestamps)
+        : session_(con)
+        , writer_(!iso_timestamps)
+        , done_(false)
+        , name_(NAME_SIZE)
+    {
+    }
+
+    virtual char* format(char* begin, char*, const aku_Sample& sample) {
+        i32 series = -1;
+        if (sample.payload.type & aku_PData::PARAMID_BIT) {
+            series = writer_.find_series(sample.paramid);
+            if (series < 0) {
+                int len = session_->param_id_to_series(sample.paramid, name_.data(), name_.size());
+                if (len < 0) {
+                    // Buffer is too small, -len is the length of the name
+                    name_.resize(static_cast<size_t>(-len));
+                    len = session_->param_id_to_series(sample.paramid, name_.data(), name_.size());
+                }
+                std::string name = len > 0 ? std::string(name_.data(), name_.data() + len)
+                                           : "id=" + std::to_string(sample.paramid);
+                series = writer_.add_series(sample.paramid, std::move(name));
+            }
+        }
+        const aku_Timestamp* ts = (sample.payload.type & aku_PData::TIMESTAMP_BIT) ? &sample.timestamp : nullptr;
+        const double* value = (sample.payload.type & aku_PData::FLOAT_BIT) ? &sample.payload.float64 : nullptr;
+        writer_.append(series, ts, value);
+        if (writer_.batch_size() == MAX_BATCH_SIZE) {
+            writer_.flush_batch();
+        }
+        // Output is written by `flush`
+        return begin;
+    }
+
+    virtual char* flush(char* begin, char* end) {
+        return begin + writer_.read(begin, static_cast<size_t>(end - begin));
+    }
+
+    virtual void end_batch() {
+        writer_.flush_batch();
+    }
+
+    virtual bool end_stream() {
+        if (done_) {
+            return false;
+        }
+        done_ = true;
+        writer_.finish();
+        return true;
+    }
+
+    virtual char* format_error(char* begin, char* end, const char* message) {
+        // Error is sent as a part of the stream so the client could read it using Arrow library,
+        // rows formatted before the error are sent first.
+        if (!done_) {
+            done_ = true;
+            writer_.finish(message);
+        }
+        return flush(begin, end);
+    }
+};
+
 QueryResultsPooler::QueryResultsPooler(std::shared_ptr<DbSession> session, int readbufsize, ApiEndpoint endpoint)
     : session_(session)
     , rdbuf_pos_(0)
@@ -431,7 +642,7 @@ void QueryResultsPooler::throw_if_not_started() const {
 
 void QueryResultsPooler::start() {
     throw_if_started();
-    enum Format { RESP, CSV };
+    enum Format { RESP, CSV, ARROW };
     bool use_iso_timestamps = true;
     Format output_format = RESP;
     boost::property_tree::ptree tree;
@@ -440,6 +651,7 @@ void QueryResultsPooler::start() {
     } catch (boost::property_tree::json_parser_error const& e) {
         logger.error() << "Bad JSON document received (line: " << e.line() << "), error: " << e.message();
         // We need to pass invalid document further to generate proper error response
+        formatter_.reset(new RESPOutputFormatter(session_, use_iso_timestamps));
         _init_cursor();
         return;
     }
@@ -462,6 +674,8 @@ void QueryResultsPooler::start() {
                     output_format = RESP;
                 } else if (fmt == "csv" || fmt == "CSV") {
                     output_format = CSV;
+                } else if (fmt == "arrow" || fmt == "ARROW") {
+                    output_format = ARROW;
                 } else {
                     std::runtime_error err("invalid output statement (format)");
                     BOOST_THROW_EXCEPTION(err);
@@ -476,6 +690,9 @@ void QueryResultsPooler::start() {
     case CSV:
         formatter_.reset(new CSVOutputFormatter(session_, use_iso_timestamps));
         break;
+    case ARROW:
+        formatter_.reset(new ArrowOutputFormatter(session_, use_iso_timestamps));
+        break;
     };
 
     _init_cursor();
@@ -520,20 +737,26 @@ const char* QueryResultsPooler::get_error_message() {
 std::tuple<size_t, bool> QueryResultsPooler::read_some(char *buf, size_t buf_size) {
     aku_Status status = AKU_SUCCESS;
     throw_if_not_started();
+    char* begin = buf;
+    char* end = begin + buf_size;
+    if (formatter_) {
+        // Output buffered by the formatter during previous calls goes first
+        begin = formatter_->flush(begin, end);
+        if (begin != buf) {
+            return std::make_tuple(begin - buf, false);
+        }
+    }
     if (rdbuf_pos_ == rdbuf_top_) {
         const char* error_msg = nullptr;
         if (cursor_->is_done()) {
             // This can be the case if error occured
             if (error_produced_ == false && cursor_->is_error(&error_msg, &status)) {
                 // Some error occured, put error message to the outgoing buffer and return
-                if (std::strlen(error_msg) == 0) {
-                    error_msg = aku_error_message(status);
-                }
-                int len = snprintf(buf, buf_size, "-%s\r\n", error_msg);
-                if (len > 0) {
-                    error_produced_ = true;
-                    return std::make_tuple((size_t)len, false);
-                }
+                return produce_error(buf, buf_size, error_msg, status);
+            }
+            if (formatter_ && formatter_->end_stream()) {
+                begin = formatter_->flush(begin, end);
+                return std::make_tuple(begin - buf, false);
             }
             return std::make_tuple(0u, true);
         }
@@ -542,21 +765,11 @@ std::tuple<size_t, bool> QueryResultsPooler::read_some(char *buf, size_t buf_siz
         rdbuf_pos_ = 0u;
         if (cursor_->is_error(&error_msg, &status)) {
             // Some error occured, put error message to the outgoing buffer and return
-            if (std::strlen(error_msg) == 0) {
-                error_msg = aku_error_message(status);
-            }
-            int len = snprintf(buf, buf_size, "-%s\r\n", error_msg);
-            if (len > 0) {
-                error_produced_ = true;
-                return std::make_tuple((size_t)len, false);
-            }
-            return std::make_tuple(0u, false);
+            return produce_error(buf, buf_size, error_msg, status);
         }
     }
 
     // format output
-    char* begin = buf;
-    char* end = begin + buf_size;
     while(rdbuf_pos_ < rdbuf_top_) {
         const aku_Sample* sample = reinterpret_cast<const aku_Sample*>(rdbuf_.data() + rdbuf_pos_);
         char* next = formatter_->format(begin, end, *sample);
@@ -568,9 +781,27 @@ std::tuple<size_t, bool> QueryResultsPooler::read_some(char *buf, size_t buf_siz
         assert(sample->payload.size);
         rdbuf_pos_ += sample->payload.size;
     }
+    if (rdbuf_pos_ == rdbuf_top_) {
+        formatter_->end_batch();
+    }
+    begin = formatter_->flush(begin, end);
     return std::make_tuple(begin - buf, false);
 }
 
+std::tuple<size_t, bool> QueryResultsPooler::produce_error(char* buf, size_t buf_size,
+                                                           const char* error_msg, aku_Status status)
+{
+    if (std::strlen(error_msg) == 0) {
+        error_msg = aku_error_message(status);
+    }
+    char* end = formatter_->format_error(buf, buf + buf_size, error_msg);
+    if (end == nullptr) {
+        return std::make_tuple(0u, false);
+    }
+    error_produced_ = true;
+    return std::make_tuple(static_cast<size_t>(end - buf), false);
+}
+
 void QueryResultsPooler::close() {
     throw_if_not_started();
     cursor_->close();
@@ -599,7 +830,25 @@ ReadOperation *QueryProcessor::create(ApiEndpoint endpoint) {
 std::string QueryProcessor::get_all_stats() {
     auto con = con_.lock();
     if (con) {
-        return con->get_all_stats();
+        auto stats = con->get_all_stats();
+        auto servers = ServerStats::instance().collect();
+        if (servers.empty()) {
+            return stats;
+        }
+        // Merge server-side counters into the storage engine stats
+        boost::property_tree::ptree tree;
+        try {
+            std::stringstream input(stats);
+            boost::property_tree::json_parser::read_json(input, tree);
+        } catch (boost::property_tree::json_parser_error const&) {
+            return stats;
+        }
+        for (auto const& kv: servers) {
+            tree.add_child(kv.first, kv.second);
+        }
+        std::stringstream out;
+        boost::property_tree::json_parser::write_json(out, tree, true);
+        return out.str();
     }
     std::runtime_error err("Database connection was closed");
     BOOST_THROW_EXCEPTION(err);
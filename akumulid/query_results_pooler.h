@@ -2,14 +2,83 @@
 #include "httpserver.h"
 #include "storage_api.h"
 #include "server.h"
+#include <list>
 #include <memory>
+#include <unordered_map>
 
 namespace Akumuli {
 
+/** Per-query LRU cache of series names.
+  * Query results usually contain a small number of series repeated many times,
+  * cache saves a call to DbSession::param_id_to_series for every sample.
+  */
+class SeriesNameCache {
+    typedef std::pair<aku_ParamId, std::string> ItemT;
+    std::shared_ptr<DbSession>                                       session_;
+    const size_t                                                     capacity_;
+    std::list<ItemT>                                                 items_;  //< Most recently used first
+    std::unordered_map<aku_ParamId, std::list<ItemT>::iterator>      index_;
+public:
+    enum {
+        DEFAULT_CAPACITY = 1024,
+    };
+
+    SeriesNameCache(std::shared_ptr<DbSession> session, size_t capacity = DEFAULT_CAPACITY);
+
+    /** Copy series name to the buffer (without terminating '\0').
+      * @return same as DbSession::param_id_to_series: name length on success, 0 if there is
+      *         no such id, -LEN if buffer is too small
+      */
+    int get(aku_ParamId id, char* buffer, size_t buffer_size);
+
+    //! Number of cached names
+    size_t size() const;
+};
+
+/** Formatter for ISO 8601 timestamps (YYYYMMDDTHHMMSS.nnnnnnnnn).
+  * Query results are ordered by time in most cases, so date and time of day
+  * of the previous timestamp are reused when only seconds or nanoseconds change.
+  */
+class IsoTimestampFormatter {
+    enum {
+        PREFIX_SIZE = 15,  //< YYYYMMDDTHHMMSS
+    };
+    u64  day_;        //< Day number of the cached date
+    u64  sec_;        //< Seconds since epoch of the cached prefix
+    char prefix_[PREFIX_SIZE];
+    bool empty_;
+public:
+    IsoTimestampFormatter();
+
+    /** Format timestamp, output is the same as produced by aku_timestamp_to_string.
+      * @return string length + 1 (for '\0' character) or negative value if buffer is too small
+      */
+    int format(aku_Timestamp ts, char* buffer, size_t buffer_size);
+};
+
 //! Output formatter interface
 struct OutputFormatter {
     virtual ~OutputFormatter() = default;
     virtual char* format(char* begin, char* end, const aku_Sample& sample) = 0;
+
+    /** Write output buffered by the formatter (formatters that encode samples in batches).
+      * @return pointer past the last written byte
+      */
+    virtual char* flush(char* begin, char*) { return begin; }
+
+    //! All samples from the read buffer were formatted
+    virtual void end_batch() {}
+
+    /** Query results are exhausted.
+      * @return true if the formatter has some trailing output to flush
+      */
+    virtual bool end_stream() { return false; }
+
+    /** Write error message, query results are not available after that.
+      * Default implementation uses RESP error format (message is truncated to fit the buffer).
+      * @return pointer past the last written byte or nullptr if buffer is too small
+      */
+    virtual char* format_error(char* begin, char* end, const char* message);
 };
 
 
@@ -46,6 +115,9 @@ struct QueryResultsPooler : ReadOperation {
 
     virtual std::tuple<size_t, bool> read_some(char* buf, size_t buf_size);
 
+    //! Put error message to the output buffer
+    std::tuple<size_t, bool> produce_error(char* buf, size_t buf_size, const char* error_msg, aku_Status status);
+
     virtual void close();
 };
 
@@ -4,8 +4,11 @@
 #include "signal_handler.h"
 
 #include <boost/asio.hpp>
+#include <boost/property_tree/ptree.hpp>
 
+#include <functional>
 #include <map>
+#include <mutex>
 #include <string>
 #include <tuple>
 #include <tuple>
@@ -21,6 +24,14 @@ struct ServerSettings {
     std::string                   name;
     std::vector<ProtocolSettings> protocols;
     int                           nworkers;
+    bool                          reuse_port   = false;  //< Listening socket per worker (SO_REUSEPORT)
+    bool                          cpu_affinity = false;  //< Pin worker threads to CPU cores
+    int                           batch_size   = 16;     //< Max number of datagrams per recvmmsg call (UDP)
+    bool                          gro          = false;  //< Accept coalesced datagrams (UDP_GRO)
+    u64                           max_inflight = 0;      //< Max bytes read by TCP sessions and not yet written (0 - unlimited)
+    u64                           max_backlog  = 0;      //< Pause TCP reads if storage write backlog is larger (0 - unlimited)
+    int                           gzip_level   = 6;      //< Gzip compression level of HTTP responses (0 - disabled)
+    int                           zstd_level   = 3;      //< Zstd compression level of HTTP responses (0 - disabled)
 };
 
 struct WALSettings {
@@ -120,4 +131,43 @@ struct ServerFactory {
     }
 };
 
+/** Registry of the server-side counters (not maintained by the storage engine).
+  * Every provider fills its own subtree, the result is merged into the output
+  * of the HTTP stats endpoint.
+  */
+struct ServerStats {
+
+    typedef std::function<void(boost::property_tree::ptree&)> Provider;
+
+    std::mutex                      mutex_;
+    std::map<std::string, Provider> providers_;
+
+    void register_provider(std::string name, Provider provider) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        providers_[name] = provider;
+    }
+
+    void remove_provider(std::string name) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        providers_.erase(name);
+    }
+
+    //! Collect stats from all registered providers
+    boost::property_tree::ptree collect() {
+        std::lock_guard<std::mutex> guard(mutex_);
+        boost::property_tree::ptree result;
+        for (auto const& kv: providers_) {
+            boost::property_tree::ptree subtree;
+            kv.second(subtree);
+            result.add_child(kv.first, subtree);
+        }
+        return result;
+    }
+
+    static ServerStats& instance() {
+        static ServerStats stats;
+        return stats;
+    }
+};
+
 }  // namespace
@@ -43,6 +43,26 @@ struct AkumuliCursor : DbCursor {
 
 // Session //
 
+aku_Status DbSession::write_batch(const aku_ParamId* ids, const aku_Timestamp* tss, const double* xss, u32 size) {
+    aku_Sample sample;
+    sample.payload.type = AKU_PAYLOAD_FLOAT;
+    sample.payload.size = sizeof(aku_Sample);
+    for (u32 i = 0; i < size; i++) {
+        sample.paramid = ids[i];
+        sample.timestamp = tss[i];
+        sample.payload.float64 = xss[i];
+        auto status = write(sample);
+        if (status != AKU_SUCCESS) {
+            return status;
+        }
+    }
+    return AKU_SUCCESS;
+}
+
+u64 DbSession::get_write_backlog() {
+    return 0;
+}
+
 AkumuliSession::AkumuliSession(aku_Session* session)
     : session_(session)
 {
@@ -56,6 +76,14 @@ aku_Status AkumuliSession::write(const aku_Sample &sample) {
     return aku_write(session_, &sample);
 }
 
+aku_Status AkumuliSession::write_batch(const aku_ParamId* ids, const aku_Timestamp* tss, const double* xss, u32 size) {
+    return aku_write_batch(session_, ids, tss, xss, size, nullptr);
+}
+
+u64 AkumuliSession::get_write_backlog() {
+    return aku_get_write_backlog(session_);
+}
+
 std::shared_ptr<DbCursor> AkumuliSession::query(std::string query) {
     aku_Cursor* cursor = aku_query(session_, query.c_str());
     return std::make_shared<AkumuliCursor>(cursor);
@@ -57,6 +57,16 @@ struct DbSession {
     //! Write value to DB
     virtual aku_Status write(const aku_Sample& sample) = 0;
 
+    /** Write batch of float values to DB (column-oriented).
+      * Default implementation writes samples one by one and stops on first error.
+      */
+    virtual aku_Status write_batch(const aku_ParamId* ids, const aku_Timestamp* tss, const double* xss, u32 size);
+
+    /** Return number of storage updates that wasn't synced yet.
+      * Default implementation returns 0 (no backlog).
+      */
+    virtual u64 get_write_backlog();
+
     //! Execute database query
     virtual std::shared_ptr<DbCursor> query(std::string query) = 0;
 
@@ -92,6 +102,8 @@ public:
     AkumuliSession(aku_Session* session);
     virtual ~AkumuliSession() override;
     virtual aku_Status write(const aku_Sample &sample) override;
+    virtual aku_Status write_batch(const aku_ParamId* ids, const aku_Timestamp* tss, const double* xss, u32 size) override;
+    virtual u64 get_write_backlog() override;
     virtual std::shared_ptr<DbCursor> query(std::string query) override;
     virtual std::shared_ptr<DbCursor> suggest(std::string query) override;
     virtual std::shared_ptr<DbCursor> search(std::string query) override;
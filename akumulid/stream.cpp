@@ -5,6 +5,12 @@
 #include <sstream>
 #include <boost/exception/all.hpp>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 namespace Akumuli {
 
 StreamError::StreamError(std::string line, size_t pos)
@@ -28,6 +34,145 @@ std::string StreamError::get_bottom_line() const {
 
 ByteStreamReader::~ByteStreamReader() {}
 
+// Scanning routines
+
+const Byte* find_newline(const Byte* begin, const Byte* end) {
+    // memchr is vectorized by libc
+    auto res = static_cast<const Byte*>(memchr(begin, '\n', static_cast<size_t>(end - begin)));
+    return res == nullptr ? end : res;
+}
+
+const Byte* find_first_of(const Byte* begin, const Byte* end, Byte a, Byte b) {
+    const Byte* it = begin;
+#if defined(__AVX2__)
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    while (end - it >= 32) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(it));
+        __m256i eq = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, va), _mm256_cmpeq_epi8(chunk, vb));
+        auto mask = static_cast<u32>(_mm256_movemask_epi8(eq));
+        if (mask) {
+            return it + __builtin_ctz(mask);
+        }
+        it += 32;
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i xa = _mm_set1_epi8(a);
+    const __m128i xb = _mm_set1_epi8(b);
+    while (end - it >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(it));
+        __m128i eq = _mm_or_si128(_mm_cmpeq_epi8(chunk, xa), _mm_cmpeq_epi8(chunk, xb));
+        auto mask = static_cast<u32>(_mm_movemask_epi8(eq));
+        if (mask) {
+            return it + __builtin_ctz(mask);
+        }
+        it += 16;
+    }
+#endif
+    while (it < end) {
+        if (*it == a || *it == b) {
+            return it;
+        }
+        it++;
+    }
+    return end;
+}
+
+static const Byte* parse_double_slow(const Byte* begin, const Byte* end, double* out) {
+    const size_t buflen = 128;
+    auto len = static_cast<size_t>(end - begin);
+    char* endptr = nullptr;
+    if (len < buflen) {
+        char buf[buflen];
+        memcpy(buf, begin, len);
+        buf[len] = '\0';
+        *out = strtod(buf, &endptr);
+        return begin + (endptr - buf);
+    }
+    std::string str(begin, end);
+    *out = strtod(str.c_str(), &endptr);
+    return begin + (endptr - str.c_str());
+}
+
+const Byte* parse_double(const Byte* begin, const Byte* end, double* out) {
+    // Powers of ten that can be represented exactly
+    static const double POW10[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+    static const u64 MAX_EXACT_MANTISSA = 1ull << 53;
+    const int MAX_DIGITS = 19;
+    const Byte* it = begin;
+    bool negative = false;
+    if (it < end && (*it == '-' || *it == '+')) {
+        negative = *it == '-';
+        it++;
+    }
+    u64 mantissa = 0;
+    int  ndigits = 0;  // number of significant digits
+    int  nparsed = 0;  // total number of digits
+    int  exp10   = 0;
+    while (it < end && *it >= '0' && *it <= '9') {
+        if (mantissa != 0 || *it != '0') {
+            ndigits++;
+        }
+        mantissa = mantissa*10 + static_cast<u64>(*it - '0');
+        nparsed++;
+        it++;
+    }
+    if (mantissa == 0 && nparsed == 1 && it < end && (*it == 'x' || *it == 'X')) {
+        // Hex float ("0x10", "-0X1p3")
+        return parse_double_slow(begin, end, out);
+    }
+    if (it < end && *it == '.') {
+        it++;
+        while (it < end && *it >= '0' && *it <= '9') {
+            if (mantissa != 0 || *it != '0') {
+                ndigits++;
+            }
+            mantissa = mantissa*10 + static_cast<u64>(*it - '0');
+            nparsed++;
+            exp10--;
+            it++;
+        }
+    }
+    if (nparsed == 0 || ndigits > MAX_DIGITS) {
+        // nan, inf, hex floats or mantissa doesn't fit into u64
+        return parse_double_slow(begin, end, out);
+    }
+    if (it < end && (*it == 'e' || *it == 'E')) {
+        const Byte* exp_begin = it;
+        it++;
+        bool exp_negative = false;
+        if (it < end && (*it == '-' || *it == '+')) {
+            exp_negative = *it == '-';
+            it++;
+        }
+        if (it == end || *it < '0' || *it > '9') {
+            // Not an exponent, stop before 'e'
+            it = exp_begin;
+        } else {
+            int e = 0;
+            while (it < end && *it >= '0' && *it <= '9') {
+                if (e < 10000) {
+                    e = e*10 + (*it - '0');
+                }
+                it++;
+            }
+            exp10 += exp_negative ? -e : e;
+        }
+    }
+    if (mantissa > MAX_EXACT_MANTISSA || exp10 < -22 || exp10 > 22) {
+        return parse_double_slow(begin, end, out);
+    }
+    // Both mantissa and power of ten are exact, the result is correctly rounded
+    double value = static_cast<double>(mantissa);
+    value = exp10 < 0 ? value / POW10[-exp10] : value * POW10[exp10];
+    *out = negative ? -value : value;
+    return it;
+}
+
 // MemStreamReader implementation
 
 MemStreamReader::MemStreamReader(const Byte *buffer, size_t buffer_len)
@@ -67,18 +212,17 @@ int MemStreamReader::read(Byte *buffer, size_t buffer_len) {
 int MemStreamReader::read_line(Byte* buffer, size_t quota) {
     auto available = size_ - pos_;
     auto to_read = std::min(quota, available);
-    for (u32 i = 0; i < to_read; i++) {
-        Byte c = buf_[pos_ + i];
-        buffer[i] = c;
-        if (c == '\n') {
-            // Stop iteration
-            u32 bytes_copied = i + 1;
-            pos_ += bytes_copied;
-            return static_cast<int>(bytes_copied);
-        }
+    const Byte* begin = buf_ + pos_;
+    const Byte* eol = find_newline(begin, begin + to_read);
+    if (eol == begin + to_read) {
+        // No end of line found
+        memcpy(buffer, begin, to_read);
+        return -1*static_cast<int>(to_read);
     }
-    // No end of line found
-    return -1*static_cast<int>(to_read);
+    auto bytes_copied = static_cast<size_t>(eol - begin) + 1;
+    memcpy(buffer, begin, bytes_copied);
+    pos_ += bytes_copied;
+    return static_cast<int>(bytes_copied);
 }
 
 void MemStreamReader::close() {
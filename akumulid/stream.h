@@ -101,6 +101,26 @@ struct ByteStreamReader {
 };
 
 
+/** Find first occurence of the '\n' character in [begin, end) range.
+  * @return pointer to the character or `end` if not found
+  */
+const Byte* find_newline(const Byte* begin, const Byte* end);
+
+/** Find first occurence of `a` or `b` in [begin, end) range.
+  * Uses SSE2/AVX2 if available (scalar loop otherwise).
+  * @return pointer to the character or `end` if not found
+  */
+const Byte* find_first_of(const Byte* begin, const Byte* end, Byte a, Byte b);
+
+/** Parse floating point number from [begin, end) range.
+  * Numbers with up to 19 significant digits and small exponent are converted
+  * using exact fast path (without strtod call). Everything else (long mantissas,
+  * large exponents, nan, inf) is handled by strtod.
+  * @return pointer to the first character that wasn't consumed (`begin` on error)
+  */
+const Byte* parse_double(const Byte* begin, const Byte* end, double* out);
+
+
 class MemStreamReader : public ByteStreamReader {
     const Byte*  buf_;   //< Source bytes
     const size_t size_;  //< Source size
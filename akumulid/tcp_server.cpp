@@ -8,6 +8,64 @@
 namespace Akumuli {
 
 
+//                       //
+//     Flow control      //
+//                       //
+
+FlowControl::FlowControl(u64 capacity, u64 max_backlog)
+    : capacity_(capacity)
+    , max_backlog_(max_backlog)
+    , inflight_{0}
+    , backlog_{0}
+    , npaused_{0}
+    , npauses_{0}
+{
+}
+
+bool FlowControl::acquire(u64 nbytes) {
+    if (max_backlog_ != 0 && backlog_.load(std::memory_order_relaxed) > max_backlog_) {
+        return false;
+    }
+    if (capacity_ == 0) {
+        inflight_ += nbytes;
+        return true;
+    }
+    u64 current = inflight_.load();
+    do {
+        if (current != 0 && current + nbytes > capacity_) {
+            return false;
+        }
+    } while (!inflight_.compare_exchange_weak(current, current + nbytes));
+    return true;
+}
+
+void FlowControl::release(u64 nbytes) {
+    inflight_ -= nbytes;
+}
+
+void FlowControl::update_backlog(u64 backlog) {
+    backlog_.store(backlog, std::memory_order_relaxed);
+}
+
+void FlowControl::pause() {
+    npaused_++;
+    npauses_++;
+}
+
+void FlowControl::resume() {
+    npaused_--;
+}
+
+void FlowControl::get_stats(boost::property_tree::ptree& tree) const {
+    tree.put("inflight_bytes", inflight_.load());
+    tree.put("max_inflight_bytes", capacity_);
+    tree.put("write_backlog", backlog_.load());
+    tree.put("max_write_backlog", max_backlog_);
+    tree.put("paused_sessions", npaused_.load());
+    tree.put("pauses", npauses_.load());
+}
+
+
 //                       //
 //     Telnet Session    //
 //                       //
@@ -27,7 +85,10 @@ class TelnetSession : public ProtocolSession, public std::enable_shared_from_thi
     // TODO: Unique session ID
     enum {
         BUFFER_SIZE = ProtocolT::RDBUF_SIZE,  //< Buffer size
+        PAUSE_MS    = 10,                     //< Delay between flow control retries
     };
+    typedef Byte* BufferT;
+
     const bool                      parallel_;
     IOServiceT*                     io_;
     SocketT                         socket_;
@@ -35,10 +96,13 @@ class TelnetSession : public ProtocolSession, public std::enable_shared_from_thi
     std::shared_ptr<DbSession>      spout_;
     ProtocolT                       parser_;
     Logger                          logger_;
+    std::shared_ptr<FlowControl>    flow_;
+    boost::asio::deadline_timer     pause_timer_;
+    u64                             credits_;  //< Credits taken from `flow_`
+    BufferT                         pending_;  //< Buffer that was read but not parsed yet
+    size_t                          pending_size_;
 
 public:
-    typedef Byte* BufferT;
-
     TelnetSession(IOServiceT *io, std::shared_ptr<DbSession> spout, bool parallel)
         : parallel_(parallel)
         , io_(io)
@@ -46,13 +110,18 @@ public:
         , strand_(*io)
         , spout_(spout)
         , parser_(spout)
-    , logger_(make_unique_session_name())
+        , logger_(make_unique_session_name())
+        , pause_timer_(*io)
+        , credits_(0)
+        , pending_(nullptr)
+        , pending_size_(0)
     {
         logger_.info() << "Session created";
         parser_.start();
     }
 
     ~TelnetSession() {
+        release_credits();
         logger_.info() << "Session destroyed";
     }
 
@@ -60,6 +129,14 @@ public:
         return socket_;
     }
 
+    virtual void set_flow_control(std::shared_ptr<FlowControl> flow) {
+        flow_ = flow;
+    }
+
+    /** Start reading from the socket.
+      * Credits are not needed to wait for the data, the session takes them
+      * from `flow_` only when the data is received (see `process`).
+      */
     virtual void start() {
         BufferT buf;
         size_t buf_size;
@@ -108,6 +185,47 @@ public:
     }
 
 private:
+    /** Stop processing the data for a while.
+      * The session retries to take the credits after the timeout.
+      */
+    void pause() {
+        flow_->pause();
+        pause_timer_.expires_from_now(boost::posix_time::milliseconds(static_cast<long>(PAUSE_MS)));
+        if (parallel_) {
+            pause_timer_.async_wait(
+                    strand_.wrap(
+                        boost::bind(&TelnetSession<ProtocolT>::handle_pause,
+                                    this->shared_from_this(),
+                                    boost::asio::placeholders::error)));
+        } else {
+            pause_timer_.async_wait(
+                    boost::bind(&TelnetSession<ProtocolT>::handle_pause,
+                                this->shared_from_this(),
+                                boost::asio::placeholders::error));
+        }
+    }
+
+    void handle_pause(boost::system::error_code error) {
+        flow_->resume();
+        if (error) {
+            logger_.error() << error.message();
+            parser_.close();
+            return;
+        }
+        // Backlog can only be observed by the sessions, refresh it before retry
+        flow_->update_backlog(spout_->get_write_backlog());
+        process();
+    }
+
+    //! Return credits when the data is written to the storage
+    void release_credits() {
+        if (credits_) {
+            flow_->release(credits_);
+            flow_->update_backlog(spout_->get_write_backlog());
+            credits_ = 0;
+        }
+    }
+
     /** Allocate new buffer.
       */
     std::tuple<BufferT, size_t> get_next_buffer() {
@@ -123,53 +241,78 @@ private:
             logger_.error() << error.message();
             parser_.close();
         } else {
-            try {
-                auto response = parser_.parse_next(buffer, static_cast<u32>(nbytes));
-                if(response.is_available()) {
-                    boost::asio::streambuf stream;
-                    std::ostream os(&stream);
-                    os << ProtocolT::PARSE, response.get_body();
-                    boost::asio::async_write(socket_, stream,
-                                             boost::bind(&TelnetSession::handle_write,
-                                                         this->shared_from_this(),
-                                                         boost::asio::placeholders::error)
-                                             );
-                }
-                start();
-            } catch (StreamError const& stream_error) {
-                // This error is related to client so we need to send it back
-                logger_.error() << stream_error.what();
-                boost::asio::streambuf stream;
-                std::ostream os(&stream);
-                os << parser_.error_repr(ProtocolT::PARSE, stream_error.what());
-                boost::asio::async_write(socket_, stream,
-                                         boost::bind(&TelnetSession::handle_write_error,
-                                                     this->shared_from_this(),
-                                                     boost::asio::placeholders::error)
-                                         );
-            } catch (DatabaseError const& dberr) {
-                // Database error
-                logger_.error() << boost::current_exception_diagnostic_information();
-                boost::asio::streambuf stream;
-                std::ostream os(&stream);
-                os << parser_.error_repr(ProtocolT::DB, dberr.what());
-                boost::asio::async_write(socket_, stream,
-                                         boost::bind(&TelnetSession::handle_write_error,
-                                                     this->shared_from_this(),
-                                                     boost::asio::placeholders::error)
-                                         );
-            } catch (...) {
-                // Unexpected error
-                logger_.error() << boost::current_exception_diagnostic_information();
+            pending_ = buffer;
+            pending_size_ = nbytes;
+            process();
+        }
+    }
+
+    /** Parse the pending buffer.
+      * Takes `pending_size_` credits from `flow_` first, if they're not
+      * available the session is paused and the buffer is kept until retry.
+      */
+    void process() {
+        if (flow_) {
+            if (!flow_->acquire(pending_size_)) {
+                pause();
+                return;
+            }
+            credits_ = pending_size_;
+        }
+        BufferT buffer = pending_;
+        size_t nbytes = pending_size_;
+        pending_ = nullptr;
+        pending_size_ = 0;
+        try {
+            auto response = parser_.parse_next(buffer, static_cast<u32>(nbytes));
+            release_credits();
+            if(response.is_available()) {
                 boost::asio::streambuf stream;
                 std::ostream os(&stream);
-                os << parser_.error_repr(ProtocolT::ERR, boost::current_exception_diagnostic_information());
+                os << ProtocolT::PARSE, response.get_body();
                 boost::asio::async_write(socket_, stream,
-                                         boost::bind(&TelnetSession::handle_write_error,
+                                         boost::bind(&TelnetSession::handle_write,
                                                      this->shared_from_this(),
                                                      boost::asio::placeholders::error)
                                          );
             }
+            start();
+        } catch (StreamError const& stream_error) {
+            // This error is related to client so we need to send it back
+            release_credits();
+            logger_.error() << stream_error.what();
+            boost::asio::streambuf stream;
+            std::ostream os(&stream);
+            os << parser_.error_repr(ProtocolT::PARSE, stream_error.what());
+            boost::asio::async_write(socket_, stream,
+                                     boost::bind(&TelnetSession::handle_write_error,
+                                                 this->shared_from_this(),
+                                                 boost::asio::placeholders::error)
+                                     );
+        } catch (DatabaseError const& dberr) {
+            // Database error
+            release_credits();
+            logger_.error() << boost::current_exception_diagnostic_information();
+            boost::asio::streambuf stream;
+            std::ostream os(&stream);
+            os << parser_.error_repr(ProtocolT::DB, dberr.what());
+            boost::asio::async_write(socket_, stream,
+                                     boost::bind(&TelnetSession::handle_write_error,
+                                                 this->shared_from_this(),
+                                                 boost::asio::placeholders::error)
+                                     );
+        } catch (...) {
+            // Unexpected error
+            release_credits();
+            logger_.error() << boost::current_exception_diagnostic_information();
+            boost::asio::streambuf stream;
+            std::ostream os(&stream);
+            os << parser_.error_repr(ProtocolT::ERR, boost::current_exception_diagnostic_information());
+            boost::asio::async_write(socket_, stream,
+                                     boost::bind(&TelnetSession::handle_write_error,
+                                                 this->shared_from_this(),
+                                                 boost::asio::placeholders::error)
+                                     );
         }
     }
 
@@ -200,6 +343,8 @@ private:
 
 typedef TelnetSession<RESPProtocolParser> RESPSession;
 typedef TelnetSession<OpenTSDBProtocolParser> OpenTSDBSession;
+typedef TelnetSession<BinaryProtocolParser> BinarySession;
+typedef TelnetSession<InfluxProtocolParser> InfluxSession;
 
 //                           //
 //     Protocol builders     //
@@ -222,6 +367,16 @@ struct RESPSessionBuilder : ProtocolSessionBuilder {
     virtual std::string name() const {
         return "RESP";
     }
+
+    virtual bool is_parallel() const {
+        return parallel_;
+    }
+
+    virtual std::unique_ptr<ProtocolSessionBuilder> clone(bool parallel) const {
+        std::unique_ptr<ProtocolSessionBuilder> res;
+        res.reset(new RESPSessionBuilder(parallel));
+        return res;
+    }
 };
 
 
@@ -242,6 +397,74 @@ struct OpenTSDBSessionBuilder : ProtocolSessionBuilder {
     virtual std::string name() const {
         return "OpenTSDB";
     }
+
+    virtual bool is_parallel() const {
+        return parallel_;
+    }
+
+    virtual std::unique_ptr<ProtocolSessionBuilder> clone(bool parallel) const {
+        std::unique_ptr<ProtocolSessionBuilder> res;
+        res.reset(new OpenTSDBSessionBuilder(parallel));
+        return res;
+    }
+};
+
+struct BinarySessionBuilder : ProtocolSessionBuilder {
+    bool parallel_;
+
+    BinarySessionBuilder(bool parallel=true)
+        : parallel_(parallel)
+    {
+    }
+
+    virtual std::shared_ptr<ProtocolSession> create(IOServiceT *io, std::shared_ptr<DbSession> session) {
+        std::shared_ptr<ProtocolSession> result;
+        result.reset(new BinarySession(io, session, parallel_));
+        return result;
+    }
+
+    virtual std::string name() const {
+        return "Binary";
+    }
+
+    virtual bool is_parallel() const {
+        return parallel_;
+    }
+
+    virtual std::unique_ptr<ProtocolSessionBuilder> clone(bool parallel) const {
+        std::unique_ptr<ProtocolSessionBuilder> res;
+        res.reset(new BinarySessionBuilder(parallel));
+        return res;
+    }
+};
+
+struct InfluxSessionBuilder : ProtocolSessionBuilder {
+    bool parallel_;
+
+    InfluxSessionBuilder(bool parallel=true)
+        : parallel_(parallel)
+    {
+    }
+
+    virtual std::shared_ptr<ProtocolSession> create(IOServiceT *io, std::shared_ptr<DbSession> session) {
+        std::shared_ptr<ProtocolSession> result;
+        result.reset(new InfluxSession(io, session, parallel_));
+        return result;
+    }
+
+    virtual std::string name() const {
+        return "Influx";
+    }
+
+    virtual bool is_parallel() const {
+        return parallel_;
+    }
+
+    virtual std::unique_ptr<ProtocolSessionBuilder> clone(bool parallel) const {
+        std::unique_ptr<ProtocolSessionBuilder> res;
+        res.reset(new InfluxSessionBuilder(parallel));
+        return res;
+    }
 };
 
 std::unique_ptr<ProtocolSessionBuilder> ProtocolSessionBuilder::create_resp_builder(bool parallel) {
@@ -256,6 +479,18 @@ std::unique_ptr<ProtocolSessionBuilder> ProtocolSessionBuilder::create_opentsdb_
     return res;
 }
 
+std::unique_ptr<ProtocolSessionBuilder> ProtocolSessionBuilder::create_binary_builder(bool parallel) {
+    std::unique_ptr<ProtocolSessionBuilder> res;
+    res.reset(new BinarySessionBuilder(parallel));
+    return res;
+}
+
+std::unique_ptr<ProtocolSessionBuilder> ProtocolSessionBuilder::create_influx_builder(bool parallel) {
+    std::unique_ptr<ProtocolSessionBuilder> res;
+    res.reset(new InfluxSessionBuilder(parallel));
+    return res;
+}
+
 //                      //
 //     Tcp Acceptor     //
 //                      //
@@ -266,7 +501,8 @@ TcpAcceptor::TcpAcceptor(// Server parameters
                         std::shared_ptr<DbConnection> connection ,
                         bool parallel)
     //: parallel_(parallel)
-    : acceptor_(own_io_, endpoint)
+    : reuse_port_(false)
+    , acceptor_(own_io_, endpoint)
     , protocol_(ProtocolSessionBuilder::create_resp_builder(true))
     , sessions_io_(io)
     , connection_(connection)
@@ -290,9 +526,11 @@ TcpAcceptor::TcpAcceptor(
         EndpointT endpoint,
         std::unique_ptr<ProtocolSessionBuilder> protocol,
         std::shared_ptr<DbConnection> connection,
-        bool parallel)
+        bool parallel,
+        bool reuse_port)
     //: parallel_(parallel)
-    : acceptor_(own_io_, endpoint)
+    : reuse_port_(reuse_port)
+    , acceptor_(reuse_port ? *io.at(0) : own_io_)
     , protocol_(std::move(protocol))
     , sessions_io_(io)
     , connection_(connection)
@@ -304,6 +542,7 @@ TcpAcceptor::TcpAcceptor(
 {
     logger_.info() << "Server created!";
     logger_.info() << "Endpoint: " << endpoint;
+    open_acceptor(endpoint);
 
     // Blocking I/O services
     for (auto io: sessions_io_) {
@@ -315,7 +554,32 @@ TcpAcceptor::~TcpAcceptor() {
     logger_.info() << "TCP acceptor destroyed";
 }
 
+void TcpAcceptor::open_acceptor(EndpointT endpoint) {
+    acceptor_.open(endpoint.protocol());
+    acceptor_.set_option(AcceptorT::reuse_address(true));
+    if (reuse_port_) {
+#ifdef SO_REUSEPORT
+        int enable = 1;
+        if (setsockopt(acceptor_.native_handle(), SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) != 0) {
+            boost::system::error_code err(errno, boost::system::system_category());
+            logger_.error() << "Can't set SO_REUSEPORT option: " << err.message();
+            BOOST_THROW_EXCEPTION(boost::system::system_error(err));
+        }
+#else
+        logger_.error() << "SO_REUSEPORT is not supported on this platform";
+#endif
+    }
+    acceptor_.bind(endpoint);
+    acceptor_.listen();
+}
+
 void TcpAcceptor::start() {
+    if (reuse_port_) {
+        // Acceptor shares the event loop with its sessions, accept thread is not needed
+        logger_.info() << "Start listening (SO_REUSEPORT)";
+        _start();
+        return;
+    }
     WorkT work(own_io_);
 
     // Run detached thread for accepts
@@ -362,6 +626,9 @@ void TcpAcceptor::_start() {
         std::shared_ptr<DbSession> spout = con->create_session();
         IOServiceT* io = sessions_io_.at(static_cast<size_t>(io_index_++) % sessions_io_.size());
         session = protocol_->create(io, spout);
+        if (flow_control_) {
+            session->set_flow_control(flow_control_);
+        }
     } else {
         logger_.error() << "Database was already closed";
     }
@@ -379,6 +646,11 @@ void TcpAcceptor::_start() {
 void TcpAcceptor::stop() {
     logger_.info() << "Stopping acceptor";
     acceptor_.close();
+    if (reuse_port_) {
+        sessions_work_.clear();
+        logger_.info() << "Acceptor successfully stopped";
+        return;
+    }
     own_io_.stop();
     sessions_work_.clear();
     logger_.info() << "Trying to stop acceptor";
@@ -399,6 +671,10 @@ void TcpAcceptor::_stop() {
     sessions_work_.clear();
 }
 
+void TcpAcceptor::set_flow_control(std::shared_ptr<FlowControl> flow) {
+    flow_control_ = flow;
+}
+
 std::string TcpAcceptor::name() const {
     return protocol_->name();
 }
@@ -420,6 +696,7 @@ TcpServer::TcpServer(std::shared_ptr<DbConnection> connection, int concurrency,
     : connection_(connection)
     , barrier(static_cast<u32>(concurrency) + 1)
     , stopped{0}
+    , cpu_affinity_(false)
     , logger_("tcp-server")
 {
     logger_.info() << "TCP server created, concurrency: " << concurrency;
@@ -450,14 +727,18 @@ TcpServer::TcpServer(std::shared_ptr<DbConnection> connection, int concurrency,
 TcpServer::TcpServer(std::shared_ptr<DbConnection> connection,
                      int concurrency,
                      std::map<EndpointT, std::unique_ptr<ProtocolSessionBuilder> > protocol_map,
-                     TcpServer::Mode mode)
+                     TcpServer::Mode mode,
+                     bool cpu_affinity,
+                     std::shared_ptr<FlowControl> flow_control)
     : connection_(connection)
     , barrier(static_cast<u32>(concurrency) + 1)
     , stopped{0}
+    , cpu_affinity_(cpu_affinity)
+    , flow_control_(flow_control)
     , logger_("tcp-server")
 {
     logger_.info() << "TCP server created, concurrency: " << concurrency;
-    if (mode == Mode::EVENT_LOOP_PER_THREAD) {
+    if (mode == Mode::EVENT_LOOP_PER_THREAD || mode == Mode::ACCEPTOR_PER_THREAD) {
         for(int i = 0; i < concurrency; i++) {
             IOPtr ptr = IOPtr(new IOServiceT(1));
             iovec.push_back(ptr.get());
@@ -474,8 +755,18 @@ TcpServer::TcpServer(std::shared_ptr<DbConnection> connection,
         EndpointT endpoint = kv.first;
         auto protocol = std::move(kv.second);
         logger_.info() << "Create acceptor for " << protocol->name() << ", endpoint: " << endpoint;
-        if (con) {
+        if (con && mode == Mode::ACCEPTOR_PER_THREAD) {
+            // Every event loop gets its own listening socket
+            for (auto io: iovec) {
+                std::vector<IOServiceT*> single = { io };
+                auto serv = std::make_shared<TcpAcceptor>(single, endpoint, protocol->clone(false), con, false, true);
+                serv->set_flow_control(flow_control_);
+                serv->start();
+                acceptors_.push_back(serv);
+            }
+        } else if (con) {
             auto serv = std::make_shared<TcpAcceptor>(iovec, endpoint, std::move(protocol), con, parallel);
+            serv->set_flow_control(flow_control_);
             serv->start();
             acceptors_.push_back(serv);
         } else {
@@ -495,14 +786,33 @@ void TcpServer::start(SignalHandler* sig, int id) {
     auto self = shared_from_this();
     sig->add_handler(boost::bind(&TcpServer::stop, self), id);
 
+    if (flow_control_) {
+        std::weak_ptr<FlowControl> weak = flow_control_;
+        ServerStats::instance().register_provider("tcp", [weak](boost::property_tree::ptree& tree) {
+            auto flow = weak.lock();
+            if (flow) {
+                flow->get_stats(tree);
+            }
+        });
+    }
+
     auto iorun = [self](IOServiceT& io, int cnt) {
         auto fn = [self, &io, cnt]() {
+            Logger logger("tcp-server-worker");
 #ifdef __gnu_linux__
             // Name the thread
             auto thread = pthread_self();
             pthread_setname_np(thread, "TCP-worker");
+            if (self->cpu_affinity_) {
+                auto ncpus = std::thread::hardware_concurrency();
+                cpu_set_t cpuset;
+                CPU_ZERO(&cpuset);
+                CPU_SET(static_cast<unsigned>(cnt) % std::max(ncpus, 1u), &cpuset);
+                if (pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset) != 0) {
+                    logger.error() << "Can't set CPU affinity for event loop " << cnt;
+                }
+            }
 #endif
-            Logger logger("tcp-server-worker");
             try {
                 logger.info() << "Event loop " << cnt << " started";
                 io.run();
@@ -541,6 +851,10 @@ void TcpServer::stop() {
 
         barrier.wait();
         logger_.info() << "I/O threads stopped";
+
+        if (flow_control_) {
+            ServerStats::instance().remove_provider("tcp");
+        }
     }
 }
 
@@ -567,19 +881,32 @@ struct TcpServerBuilder {
         if (nworkers >= AKU_MAX_THREADS) {
             nworkers = AKU_MAX_THREADS - 4;
         }
+        // Every session is served by the single event loop if the acceptor runs per thread
+        bool parallel = !settings.reuse_port;
         std::map<EndpointT, std::unique_ptr<ProtocolSessionBuilder>> protocol_map;
         for (const auto& protocol: settings.protocols) {
             std::unique_ptr<ProtocolSessionBuilder> inst;
             if (protocol.name == "RESP") {
-                inst = ProtocolSessionBuilder::create_resp_builder(true);
+                inst = ProtocolSessionBuilder::create_resp_builder(parallel);
             } else if (protocol.name == "OpenTSDB") {
-                inst = ProtocolSessionBuilder::create_opentsdb_builder(true);
+                inst = ProtocolSessionBuilder::create_opentsdb_builder(parallel);
+            } else if (protocol.name == "Binary") {
+                inst = ProtocolSessionBuilder::create_binary_builder(parallel);
+            } else if (protocol.name == "Influx") {
+                inst = ProtocolSessionBuilder::create_influx_builder(parallel);
             } else {
                 s_logger_.error() << "Unknown protocol " << protocol.name;
             }
             protocol_map[protocol.endpoint] = std::move(inst);
         }
-        return std::make_shared<TcpServer>(con, nworkers, std::move(protocol_map));
+        auto mode = settings.reuse_port ? TcpServer::Mode::ACCEPTOR_PER_THREAD
+                                        : TcpServer::Mode::EVENT_LOOP_PER_THREAD;
+        std::shared_ptr<FlowControl> flow;
+        if (settings.max_inflight != 0 || settings.max_backlog != 0) {
+            flow = std::make_shared<FlowControl>(settings.max_inflight, settings.max_backlog);
+        }
+        return std::make_shared<TcpServer>(con, nworkers, std::move(protocol_map), mode,
+                                           settings.cpu_affinity, flow);
     }
 };
 
@@ -16,9 +16,11 @@
 
 #pragma once
 
+#include <atomic>
 #include <memory>
 
 #include <boost/asio.hpp>
+#include <boost/property_tree/ptree.hpp>
 #include <boost/bind.hpp>
 #include <boost/thread/barrier.hpp>
 
@@ -41,6 +43,55 @@ typedef boost::asio::io_service::work        WorkT;
 typedef std::function<void(aku_Status, u64)> ErrorCallback;
 
 
+/**
+ * Credit-based flow control shared by all TCP sessions of the server.
+ * Session takes credits (bytes) before reading from the socket and returns them
+ * after the data was parsed and written to the storage. If there is not enough
+ * credits or the storage write backlog is above the limit, the session stops
+ * reading from the socket until the next retry, TCP flow control propagates
+ * this to the client.
+ */
+class FlowControl {
+    const u64        capacity_;     //< Max number of bytes in flight (0 - unlimited)
+    const u64        max_backlog_;  //< Max storage write backlog (0 - unlimited)
+    std::atomic<u64> inflight_;     //< Number of bytes being processed
+    std::atomic<u64> backlog_;      //< Last observed storage write backlog
+    std::atomic<u64> npaused_;      //< Number of sessions waiting for credits
+    std::atomic<u64> npauses_;      //< Total number of pauses
+
+public:
+    /**
+     * @brief C-tor
+     * @param capacity is a max number of bytes in flight (0 - unlimited)
+     * @param max_backlog is a max storage write backlog (0 - unlimited)
+     */
+    FlowControl(u64 capacity, u64 max_backlog);
+
+    /**
+     * @brief Try to take credits
+     * @param nbytes is a number of bytes session is about to read
+     * @return true on success, false if session should pause
+     * @note request is granted if nothing is in flight even if it's larger than the capacity
+     */
+    bool acquire(u64 nbytes);
+
+    //! Return credits taken by `acquire`
+    void release(u64 nbytes);
+
+    //! Set write backlog reported by the storage
+    void update_backlog(u64 backlog);
+
+    //! Account paused session
+    void pause();
+
+    //! Account resumed session
+    void resume();
+
+    //! Write counters to the property tree
+    void get_stats(boost::property_tree::ptree& tree) const;
+};
+
+
 /**
  * Common interface for all protocol session (RESP, line, etc)
  */
@@ -63,6 +114,11 @@ struct ProtocolSession {
      * to report errors.
      */
     virtual ErrorCallback get_error_cb() = 0;
+
+    /**
+     * Attach flow control object, should be called before `start`
+     */
+    virtual void set_flow_control(std::shared_ptr<FlowControl> flow) = 0;
 };
 
 
@@ -86,6 +142,17 @@ struct ProtocolSessionBuilder {
      */
     virtual std::string name() const = 0;
 
+    /**
+     * Return true if the builder creates thread safe sessions
+     */
+    virtual bool is_parallel() const = 0;
+
+    /**
+     * Create a copy of the builder (used to create several acceptors for the same protocol)
+     * @param parallel use thread safe implementation if true
+     */
+    virtual std::unique_ptr<ProtocolSessionBuilder> clone(bool parallel) const = 0;
+
     /**
      * @brief Create RESP parser builder
      * @param parallel use thread safe implementation if true
@@ -99,6 +166,20 @@ struct ProtocolSessionBuilder {
      * @return newly created object
      */
     static std::unique_ptr<ProtocolSessionBuilder> create_opentsdb_builder(bool parallel=true);
+
+    /**
+     * @brief Create binary columnar protocol parser builder
+     * @param parallel use thread safe implementation if true
+     * @return newly created object
+     */
+    static std::unique_ptr<ProtocolSessionBuilder> create_binary_builder(bool parallel=true);
+
+    /**
+     * @brief Create InfluxDB line protocol parser builder
+     * @param parallel use thread safe implementation if true
+     * @return newly created object
+     */
+    static std::unique_ptr<ProtocolSessionBuilder> create_influx_builder(bool parallel=true);
 };
 
 
@@ -109,6 +190,7 @@ class TcpAcceptor : public std::enable_shared_from_this<TcpAcceptor> {
     typedef std::unique_ptr<ProtocolSessionBuilder> ProtocolSessionBuilderT;
 
     //const bool                         parallel_;  //< Flag for TcpSession instances
+    const bool                         reuse_port_;  //< Acceptor runs on the session's event loop
     IOServiceT                           own_io_;  //< Acceptor's own io-service
     AcceptorT                          acceptor_;  //< Acceptor
     ProtocolSessionBuilderT            protocol_;  //< Protocol builder
@@ -116,6 +198,7 @@ class TcpAcceptor : public std::enable_shared_from_this<TcpAcceptor> {
     std::vector<WorkT>            sessions_work_;  //< Work to block io-services from completing too early
     std::weak_ptr<DbConnection>      connection_;  //< DB connection
     std::atomic<int>                   io_index_;  //< I/O service index
+    std::shared_ptr<FlowControl>   flow_control_;  //< Flow control for sessions (can be null)
 
     boost::barrier start_barrier_;  //< Barrier to start worker thread
     boost::barrier stop_barrier_;   //< Barrier to stop worker thread
@@ -140,15 +223,22 @@ public:
       * @param port port to listen for new connections
       * @param protocol is a protocol builder
       * @param connection to the database
+      * @param reuse_port if set, the listening socket is opened with SO_REUSEPORT and
+      *        the acceptor runs on the first io-service from `io` (no dedicated thread),
+      *        several acceptors can listen on the same endpoint in this mode
      */
     TcpAcceptor(std::vector<IOServiceT*> io,
                 EndpointT endpoint,
                 std::unique_ptr<ProtocolSessionBuilder> protocol,
                 std::shared_ptr<DbConnection> connection,
-                bool parallel=true);
+                bool parallel=true,
+                bool reuse_port=false);
 
     ~TcpAcceptor();
 
+    //! Set flow control object for new sessions (should be called before `start`)
+    void set_flow_control(std::shared_ptr<FlowControl> flow);
+
     //! Start listening on socket
     void start();
 
@@ -167,6 +257,9 @@ public:
     std::string name() const;
 
 private:
+    //! Open, bind and listen
+    void open_acceptor(EndpointT endpoint);
+
     //! Accept event handler
     void handle_accept(std::shared_ptr<ProtocolSession> session, boost::system::error_code err);
 };
@@ -176,6 +269,9 @@ struct TcpServer : std::enable_shared_from_this<TcpServer>, Server {
     enum class Mode {
         EVENT_LOOP_PER_THREAD,
         SHARED_EVENT_LOOP,
+        //! Event loop and SO_REUSEPORT listening socket per thread, connections
+        //! are spread by the kernel and never leave the thread that accepted them
+        ACCEPTOR_PER_THREAD,
     };
     typedef std::unique_ptr<IOServiceT>  IOPtr;
     std::weak_ptr<DbConnection>          connection_;
@@ -184,6 +280,8 @@ struct TcpServer : std::enable_shared_from_this<TcpServer>, Server {
     std::vector<IOServiceT*>             iovec;
     boost::barrier                       barrier;
     std::atomic<int>                     stopped;
+    bool                                 cpu_affinity_;
+    std::shared_ptr<FlowControl>         flow_control_;
     Logger                               logger_;
 
     /**
@@ -196,10 +294,21 @@ struct TcpServer : std::enable_shared_from_this<TcpServer>, Server {
      */
     TcpServer(std::shared_ptr<DbConnection> connection, int concurrency, EndpointT ep, Mode mode=Mode::EVENT_LOOP_PER_THREAD);
 
+    /**
+     * @brief Creates multiprotocol TCP server
+     * @param connection is a pointer to opened database connection
+     * @param concurrency is a number of worker threads
+     * @param protocol_map maps endpoints to protocols
+     * @param mode is a server mode
+     * @param cpu_affinity pin worker threads to CPU cores if set
+     * @param flow_control is a flow control object shared by all sessions (can be null)
+     */
     TcpServer(std::shared_ptr<DbConnection> connection,
               int concurrency,
               std::map<EndpointT, std::unique_ptr<ProtocolSessionBuilder> > protocol_map,
-              Mode mode=Mode::EVENT_LOOP_PER_THREAD);
+              Mode mode=Mode::EVENT_LOOP_PER_THREAD,
+              bool cpu_affinity=false,
+              std::shared_ptr<FlowControl> flow_control=std::shared_ptr<FlowControl>());
 
     ~TcpServer();
 
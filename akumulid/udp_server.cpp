@@ -1,5 +1,7 @@
 #include "udp_server.h"
 
+#include <algorithm>
+#include <sstream>
 #include <thread>
 
 #include <sys/socket.h>
@@ -9,66 +11,184 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <limits.h>
 #include <time.h>
+#include <unistd.h>
 
 #include <boost/bind.hpp>
 #include <boost/exception/diagnostic_information.hpp>
 
 namespace Akumuli {
 
-UdpServer::UdpServer(std::shared_ptr<DbConnection> db, int nworkers, boost::asio::ip::tcp::endpoint const& endpoint)
+UdpServer::WorkerStats::WorkerStats()
+    : pps{0}
+    , bps{0}
+    , drops{0}
+{
+}
+
+UdpServer::IOBuf::IOBuf(int npackets)
+    : msgs(static_cast<size_t>(npackets))
+    , iovecs(static_cast<size_t>(npackets))
+    , bufs(static_cast<size_t>(npackets)*MSS)
+    , cmsgs(static_cast<size_t>(npackets)*CMSG_SIZE)
+{
+    for (int i = 0; i < npackets; i++) {
+        iovecs[i].iov_base = bufs.data() + i*MSS;
+        iovecs[i].iov_len  = MSS;
+    }
+    reset();
+}
+
+void UdpServer::IOBuf::reset() {
+    for (size_t i = 0; i < msgs.size(); i++) {
+        memset(&msgs[i], 0, sizeof(mmsghdr));
+        msgs[i].msg_hdr.msg_iov        = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen     = 1;
+        msgs[i].msg_hdr.msg_control    = cmsgs.data() + i*CMSG_SIZE;
+        msgs[i].msg_hdr.msg_controllen = CMSG_SIZE;
+    }
+}
+
+static int clamp_batch_size(int batch_size) {
+#ifdef __APPLE__
+    // recvmmsg is not available, datagrams are received one by one
+    (void)batch_size;
+    return 1;
+#else
+    return std::max(1, std::min(batch_size, UIO_MAXIOV));
+#endif
+}
+
+UdpServer::UdpServer(std::shared_ptr<DbConnection> db,
+                     int nworkers,
+                     boost::asio::ip::tcp::endpoint const& endpoint,
+                     int batch_size,
+                     bool gro)
     : db_(db)
     , start_barrier_(static_cast<u32>(nworkers + 1))
     , stop_barrier_(static_cast<u32>(nworkers + 1))
     , stop_{0}
     , endpoint_(endpoint)
     , nworkers_(nworkers)
-    , sockfd_(-1)
+    , batch_size_(clamp_batch_size(batch_size))
+    , gro_(gro)
     , logger_("UdpServer")
 {
+    for (int i = 0; i < nworkers; i++) {
+        stats_.emplace_back(new WorkerStats());
+    }
+}
+
+static void throw_socket_error(const char* what) {
+    const char* msg = strerror(errno);
+    std::stringstream fmt;
+    fmt << what << ": " << msg;
+    std::runtime_error err(fmt.str());
+    BOOST_THROW_EXCEPTION(err);
+}
+
+int UdpServer::open_socket() {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == -1) {
+        throw_socket_error("can't create socket");
+    }
+    try {
+        // All workers are bound to the same port
+        int optval = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) == -1) {
+            throw_socket_error("can't set socket options");
+        }
+        // Read timeout is used to check the stop flag periodically
+        timeval tv = {};
+        tv.tv_usec = RECV_TIMEOUT_MS*1000;
+        if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1) {
+            throw_socket_error("can't set socket timeout");
+        }
+#ifdef SO_RXQ_OVFL
+        // Kernel attaches the number of dropped datagrams to every received datagram
+        if (setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &optval, sizeof(optval)) == -1) {
+            logger_.error() << "can't enable SO_RXQ_OVFL: " << strerror(errno);
+        }
+#endif
+        if (gro_) {
+#ifdef UDP_GRO
+            if (setsockopt(fd, IPPROTO_UDP, UDP_GRO, &optval, sizeof(optval)) == -1) {
+                logger_.error() << "can't enable UDP_GRO: " << strerror(errno);
+            }
+#else
+            logger_.error() << "UDP_GRO is not supported on this platform";
+#endif
+        }
+        if (bind(fd, endpoint_.data(), static_cast<socklen_t>(endpoint_.size())) == -1) {
+            throw_socket_error("can't bind socket");
+        }
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    return fd;
 }
 
 void UdpServer::start(SignalHandler *sig, int id) {
     auto self = shared_from_this();
     sig->add_handler(boost::bind(&UdpServer::stop, std::move(self)), id);
 
+    // Sockets are created upfront to report configuration errors immediately
+    for (int i = 0; i < nworkers_; i++) {
+        sockets_.push_back(open_socket());
+    }
+
+    std::weak_ptr<UdpServer> weak = shared_from_this();
+    ServerStats::instance().register_provider("udp", [weak](boost::property_tree::ptree& tree) {
+        auto self = weak.lock();
+        if (self) {
+            self->get_stats(tree);
+        }
+    });
+
     // Create workers
     for (int i = 0; i < nworkers_; i++) {
         auto session = db_->create_session();
-        std::thread thread(std::bind(&UdpServer::worker, shared_from_this(), std::move(session)));
+        std::thread thread(std::bind(&UdpServer::worker, shared_from_this(), i, std::move(session)));
         thread.detach();
     }
     start_barrier_.wait();
+    logger_.info() << "UDP server started, " << nworkers_ << " workers, batch size " << batch_size_
+                   << (gro_ ? ", GRO enabled" : "");
 }
 
-static void sendByteToLocalhost(boost::asio::ip::tcp::endpoint const& endpoint) {
-    Logger logger("UdpServer");
-    int fd;
-
-    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
-        // We can't send the message to the socket thus, we wouldn't be able
-        // to stop the program normally anyway.
-        logger.error() << "Can't create the socket";
-        std::terminate();
-    }
-
-    char payload = 0;
-
-    if (sendto(fd, &payload, 1, 0, endpoint.data(), endpoint.size()) < 0) {
-        // Same reasoning as previously
-        logger.error() << "Can't send the data through the socket";
-        std::terminate();
+void UdpServer::get_stats(boost::property_tree::ptree& tree) const {
+    u64 pps = 0, bps = 0, drops = 0;
+    for (size_t i = 0; i < stats_.size(); i++) {
+        boost::property_tree::ptree worker;
+        worker.put("received", stats_[i]->pps.load());
+        worker.put("bytes", stats_[i]->bps.load());
+        worker.put("dropped", stats_[i]->drops.load());
+        tree.add_child("worker_" + std::to_string(i), worker);
+        pps   += stats_[i]->pps.load();
+        bps   += stats_[i]->bps.load();
+        drops += stats_[i]->drops.load();
     }
+    tree.put("received", pps);
+    tree.put("bytes", bps);
+    tree.put("dropped", drops);
 }
 
 void UdpServer::stop() {
-    // Set the flag and then send the 1-byte payload to wake up the
-    // worker thread. The socket descriptor can be closed afterwards.
+    // Set the flag and wait until all workers will notice it (socket
+    // read timeout guarantees that). Sockets can be closed afterwards.
     stop_.store(1, std::memory_order_relaxed);
-    sendByteToLocalhost(endpoint_);
     stop_barrier_.wait();
+    ServerStats::instance().remove_provider("udp");
     logger_.info() << "UDP server stopped";
-    close(sockfd_);
+    for (auto fd: sockets_) {
+        close(fd);
+    }
+    sockets_.clear();
 }
 
 #ifdef __APPLE__
@@ -83,7 +203,20 @@ int UdpServer::recvmsg_(int fd, UdpServer::mmsghdr* hdr, unsigned, int) {
 }
 #endif
 
-void UdpServer::worker(std::shared_ptr<DbSession> spout) {
+/** Pass datagram to the parser in chunks that fit into its read buffer.
+  */
+static void parse_datagram(RESPProtocolParser& parser, const char* data, u32 size) {
+    while (size) {
+        u32 chunk = std::min(size, static_cast<u32>(RESPProtocolParser::RDBUF_SIZE));
+        auto buf = parser.get_next_buffer();
+        memcpy(buf, data, chunk);
+        parser.parse_next(buf, chunk);
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+void UdpServer::worker(int id, std::shared_ptr<DbSession> spout) {
 #ifdef __gnu_linux__
         // Name the thread
         auto thread = pthread_self();
@@ -92,62 +225,25 @@ void UdpServer::worker(std::shared_ptr<DbSession> spout) {
     start_barrier_.wait();
 
     int retval;
-    sockaddr_in sa{};
+    int sockfd = sockets_.at(static_cast<size_t>(id));
+    WorkerStats& stats = *stats_.at(static_cast<size_t>(id));
 
     try {
-        // Create socket
-        sockfd_ = socket(AF_INET, SOCK_DGRAM, 0);
-        if (sockfd_ == -1) {
-            const char* msg = strerror(errno);
-            std::stringstream fmt;
-            fmt << "can't create socket: " << msg;
-            std::runtime_error err(fmt.str());
-            BOOST_THROW_EXCEPTION(err);
-        }
-
-        // Set socket options
-        int optval = 1;
-        if (setsockopt(sockfd_, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) == -1) {
-            const char* msg = strerror(errno);
-            std::stringstream fmt;
-            fmt << "can't set socket options: " << msg;
-            std::runtime_error err(fmt.str());
-            BOOST_THROW_EXCEPTION(err);
-        }
-
-        // Bind socket to port
-        if (bind(sockfd_, endpoint_.data(), sizeof(sa)) == -1) {
-            const char* msg = strerror(errno);
-            std::stringstream fmt;
-            fmt << "can't bind socket: " << msg;
-            std::runtime_error err(fmt.str());
-            BOOST_THROW_EXCEPTION(err);
-        }
-
-        auto iobuf = std::make_shared<IOBuf>();
+        IOBuf iobuf(batch_size_);
 
-        while(true) {
+        while(!stop_.load(std::memory_order_relaxed)) {
 
 #ifdef __APPLE__
-            retval = recvmsg_(sockfd_, iobuf->msgs, NPACKETS, MSG_WAITALL);
+            retval = recvmsg_(sockfd, iobuf.msgs.data(), 1, MSG_WAITALL);
 #else
-            retval = recvmmsg(sockfd_, iobuf->msgs, NPACKETS, MSG_WAITFORONE, nullptr);
+            retval = recvmmsg(sockfd, iobuf.msgs.data(), static_cast<unsigned>(batch_size_), MSG_WAITFORONE, nullptr);
 #endif
             if (retval == -1) {
-                if (errno == EAGAIN || errno == EINTR) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
                     continue;
                 }
-                const char* msg = strerror(errno);
-                std::stringstream fmt;
-                fmt << "socket read error: " << msg;
-                std::runtime_error err(fmt.str());
-                BOOST_THROW_EXCEPTION(err);
+                throw_socket_error("socket read error");
             }
-            if (stop_.load(std::memory_order_seq_cst)) {
-                break;
-            }
-
-            iobuf->pps++;
 
             RESPProtocolParser parser(spout);
             // Protocol parser should be created for each Udp packet
@@ -158,15 +254,36 @@ void UdpServer::worker(std::shared_ptr<DbSession> spout) {
             // it only writes to the log. This call here will polute the
             // log file.
             for (int i = 0; i < retval; i++) {
-                // reset buffer to receive new message
-                iobuf->bps += iobuf->msgs[i].msg_len;
-                auto mlen = iobuf->msgs[i].msg_len;
-                iobuf->msgs[i].msg_len = 0;
-
-                auto buf = parser.get_next_buffer();
-                memcpy(buf, iobuf->bufs[i], mlen);
+                auto& hdr = iobuf.msgs[i].msg_hdr;
+                u32 mlen = iobuf.msgs[i].msg_len;
+                // Coalesced (GRO) message consists of datagrams of the same size,
+                // only the last one can be shorter.
+                u32 segsize = mlen;
+                for (cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+#ifdef SO_RXQ_OVFL
+                    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+                        u32 ndropped;
+                        memcpy(&ndropped, CMSG_DATA(cmsg), sizeof(ndropped));
+                        stats.drops.store(ndropped, std::memory_order_relaxed);
+                    }
+#endif
+#ifdef UDP_GRO
+                    if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO) {
+                        int gso_size;
+                        memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+                        if (gso_size > 0) {
+                            segsize = static_cast<u32>(gso_size);
+                        }
+                    }
+#endif
+                }
+                const char* data = iobuf.bufs.data() + static_cast<size_t>(i)*MSS;
+                stats.bps += mlen;
+                stats.pps += segsize ? (mlen + segsize - 1) / segsize : 1;
                 try {
-                    parser.parse_next(buf, mlen);
+                    for (u32 offset = 0; offset < mlen; offset += segsize) {
+                        parse_datagram(parser, data + offset, std::min(segsize, mlen - offset));
+                    }
                 } catch (StreamError const& err) {
                     // Catch protocol parsing errors here and continue processing data
                     logger_.error() << err.what();
@@ -177,10 +294,8 @@ void UdpServer::worker(std::shared_ptr<DbSession> spout) {
                     break;
                 }
             }
-            if (retval != 0) {
-                iobuf = std::make_shared<IOBuf>();
-            }
             parser.close();
+            iobuf.reset();
         }
     } catch(...) {
         logger_.error() << boost::current_exception_diagnostic_information();
@@ -204,7 +319,11 @@ struct UdpServerBuilder {
             s_logger_.error() << "Can't initialize UDP server, more than one protocol specified";
             BOOST_THROW_EXCEPTION(std::runtime_error("invalid upd-server settings"));
         }
-        return std::make_shared<UdpServer>(con, settings.nworkers, settings.protocols.front().endpoint);
+        return std::make_shared<UdpServer>(con,
+                                           settings.nworkers,
+                                           settings.protocols.front().endpoint,
+                                           settings.batch_size,
+                                           settings.gro);
     }
 };
 
@@ -18,6 +18,7 @@
 
 #include <atomic>
 #include <memory>
+#include <vector>
 
 #include <boost/thread/barrier.hpp>
 
@@ -31,6 +32,8 @@ namespace Akumuli {
 
 
 /** UDP server for data ingestion.
+  * Every worker thread owns its own socket bound to the same port (SO_REUSEPORT),
+  * the kernel distributes datagrams between them.
   */
 class UdpServer : public std::enable_shared_from_this<UdpServer>, public Server {
     std::shared_ptr<DbConnection>      db_;
@@ -39,12 +42,18 @@ class UdpServer : public std::enable_shared_from_this<UdpServer>, public Server
     std::atomic<int>                   stop_;
     boost::asio::ip::tcp::endpoint     endpoint_;
     const int                          nworkers_;
-    int                                sockfd_;         //< UDP socket file descriptor
+    const int                          batch_size_;     //< Max number of datagrams per recvmmsg call
+    const bool                         gro_;            //< UDP_GRO enabled
+    std::vector<int>                   sockets_;        //< UDP socket per worker
 
     Logger logger_;
 
     static const int MSS      = 0x10000;
-    
+    //! Socket read timeout, workers check the stop flag at least this often
+    static const int RECV_TIMEOUT_MS = 100;
+    //! Space for SO_RXQ_OVFL and UDP_GRO control messages
+    static const int CMSG_SIZE = 64;
+
 #ifndef __APPLE__
     static const int NPACKETS = 16;
 #else
@@ -56,43 +65,55 @@ class UdpServer : public std::enable_shared_from_this<UdpServer>, public Server
 
     static int recvmsg_(int fd, mmsghdr* hdr, unsigned, int);
 #endif
-    struct IOBuf {
-        // Counters
-        std::atomic<u64> pps;
-        std::atomic<u64> bps;
-        // Packet recv structs
-        mmsghdr msgs[NPACKETS];
-        iovec   iovecs[NPACKETS];
-        char    bufs[NPACKETS][MSS];  // 1MB
-        IOBuf() {
-            memset(this, 0, sizeof(IOBuf));
-            for (int i = 0; i < NPACKETS; i++) {
-                iovecs[i].iov_base         = bufs[i];
-                iovecs[i].iov_len          = MSS;
-                msgs[i].msg_hdr.msg_iov    = &iovecs[i];
-                msgs[i].msg_hdr.msg_iovlen = 1;
-            }
-        }
 
+    //! Per-worker counters
+    struct WorkerStats {
+        std::atomic<u64> pps;    //< Number of datagrams received
+        std::atomic<u64> bps;    //< Number of bytes received
+        std::atomic<u64> drops;  //< Number of datagrams dropped by the kernel (SO_RXQ_OVFL)
+        WorkerStats();
     };
+    std::vector<std::unique_ptr<WorkerStats>> stats_;
 
+    //! Packet recv structs
+    struct IOBuf {
+        std::vector<mmsghdr> msgs;
+        std::vector<iovec>   iovecs;
+        std::vector<char>    bufs;
+        std::vector<char>    cmsgs;
+        IOBuf(int npackets);
+        //! Reset fields overwritten by the kernel
+        void reset();
+    };
 
 public:
     /** C-tor.
-      * @param nworker number of workers
-      * @param port port number
       * @param pipeline pointer to ingestion pipeline
+      * @param nworkers number of workers
+      * @param endpoint address to bind to
+      * @param batch_size max number of datagrams received by one recvmmsg call
+      * @param gro enable UDP generic receive offload
       */
-    UdpServer(std::shared_ptr<DbConnection> pipeline, int nworkers, const boost::asio::ip::tcp::endpoint &endpoint);
+    UdpServer(std::shared_ptr<DbConnection> pipeline,
+              int nworkers,
+              const boost::asio::ip::tcp::endpoint &endpoint,
+              int batch_size = NPACKETS,
+              bool gro = false);
 
     //! Start processing packets
     virtual void start(SignalHandler* sig, int id);
 
+    //! Write per-worker counters to the property tree
+    void get_stats(boost::property_tree::ptree& tree) const;
+
 private:
     //! Stop processing packets, close the socket
     void stop();
 
-    void worker(std::shared_ptr<DbSession> spout);
+    //! Create socket and bind it to the endpoint
+    int open_socket();
+
+    void worker(int id, std::shared_ptr<DbSession> spout);
 };
 
 }  // namespace
@@ -0,0 +1,30 @@
+# Find the zstd library
+#
+# Usage:
+#   find_package(zstd [REQUIRED] [QUIET] )
+#
+# It sets the following variables:
+#   zstd_FOUND               ... true if zstd is found on the system
+#   zstd_LIBRARIES           ... full path to zstd library
+#   zstd_INCLUDES            ... zstd include directory
+#
+
+find_package(PkgConfig)
+
+pkg_check_modules(PC_ZSTD QUIET libzstd)
+
+find_path(zstd_INCLUDES zstd.h
+          HINTS ${PC_ZSTD_INCLUDEDIR} ${PC_ZSTD_INCLUDE_DIRS})
+
+find_library(zstd_LIBRARIES NAMES zstd libzstd
+             HINTS ${PC_ZSTD_LIBDIR} ${PC_ZSTD_LIBRARY_DIRS} )
+
+set(zstd_FOUND FALSE)
+if(zstd_INCLUDES AND zstd_LIBRARIES)
+    set(zstd_FOUND TRUE)
+    MESSAGE(STATUS "Found zstd: ${zstd_LIBRARIES}")
+else()
+    MESSAGE(STATUS "Not found zstd, zstd HTTP compression is disabled")
+endif()
+
+mark_as_advanced(zstd_INCLUDES zstd_LIBRARIES )
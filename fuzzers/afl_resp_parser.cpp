@@ -1,5 +1,6 @@
 #include <fstream>
 #include <iostream>
+#include <cstdlib>
 #include "akumuli.h"
 #include "resp.h"
 
@@ -23,9 +24,23 @@ int main(int argc, char** argv) {
             case RESPStream::INTEGER:
                 stream.read_int();
                 break;
-            case RESPStream::STRING:
-                stream.read_string(strbuffer, RESPStream::STRING_LENGTH_MAX);
+            case RESPStream::STRING: {
+                bool success;
+                int len;
+                std::tie(success, len) = stream.read_string(strbuffer, RESPStream::STRING_LENGTH_MAX - 1);
+                if (success && len > 0) {
+                    // Fast float parser should agree with strtod
+                    double fast, slow;
+                    auto fast_end = parse_double(strbuffer, strbuffer + len, &fast);
+                    strbuffer[len] = '\0';
+                    char* slow_end = nullptr;
+                    slow = strtod(strbuffer, &slow_end);
+                    if (fast_end != slow_end || (fast != slow && fast == fast)) {
+                        std::abort();
+                    }
+                }
                 break;
+            }
             case RESPStream::BULK_STR:
                 stream.read_bulkstr(bulkbuffer, RESPStream::BULK_LENGTH_MAX);
                 break;
@@ -231,6 +231,29 @@ AKU_EXPORT aku_Status aku_write_double_raw(aku_Session* session, aku_ParamId par
   */
 AKU_EXPORT aku_Status aku_write(aku_Session* ist, const aku_Sample* sample);
 
+/** Write measurements to DB in bulk (column-oriented)
+  * @param session is an opened ingestion stream
+  * @param ids is an array of series ids
+  * @param timestamps is an array of timestamps
+  * @param values is an array of values
+  * @param size is a size of every array
+  * @param out_status_or_null is an array of `size` elements that receives status of every
+  *        sample, it's filled only if the function returns an error (can be null)
+  * @returns AKU_SUCCESS if all samples were written, status of the first failed write otherwise
+  */
+AKU_EXPORT aku_Status aku_write_batch(aku_Session* session, const aku_ParamId* ids,
+                                      const aku_Timestamp* timestamps, const double* values,
+                                      u32 size, aku_Status* out_status_or_null);
+
+/** @brief Get write backlog of the storage engine
+  * Backlog is a number of metadata updates (produced by tree flushes) that wasn't
+  * synced yet. Writes stall on input log rotation until the backlog is processed,
+  * so the value can be used to slow down the clients before this happens.
+  * @param session should point to opened session instance
+  * @return number of pending updates
+  */
+AKU_EXPORT u64 aku_get_write_backlog(aku_Session* session);
+
 
 //---------
 // Queries
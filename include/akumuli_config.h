@@ -66,4 +66,22 @@ typedef struct {
     //! Path to input log root directory
     const char* input_log_path;
 
+    //! Out-of-order write window in timestamp units (0 - disabled)
+    u64 reorder_window;
+
+    //! Max number of data-points buffered per series by the reorder window
+    u32 reorder_buffer_size;
+
+    //! Store series index postings as roaring bitmaps (0 - use compressed lists)
+    u32 roaring_index;
+
+    //! Keep series names in the persistent memory mapped index (0 - disabled)
+    u32 persistent_index;
+
+    //! Max estimated number of series that can be matched by one query (0 - unlimited)
+    u64 max_query_cardinality;
+
+    //! Number of series ids reserved for every metric at once (0 - ids are allocated sequentially)
+    u64 series_id_range;
+
 } aku_FineTuneParams;
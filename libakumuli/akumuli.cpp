@@ -222,6 +222,16 @@ public:
         return session_->write(sample);
     }
 
+    aku_Status add_samples(const aku_ParamId* ids, const aku_Timestamp* tss, const double* xss,
+                           u32 size, aku_Status* out_status_or_null)
+    {
+        return session_->write_batch(ids, tss, xss, size, out_status_or_null);
+    }
+
+    u64 get_write_backlog() const {
+        return session_->get_write_backlog();
+    }
+
     CursorImpl* query(const char* q) {
         auto res = new CursorImpl(session_, q);
         return res;
@@ -342,6 +352,18 @@ aku_Status aku_write(aku_Session* session, const aku_Sample* sample) {
     return ises->add_sample(*sample);
 }
 
+aku_Status aku_write_batch(aku_Session* session, const aku_ParamId* ids, const aku_Timestamp* timestamps,
+                           const double* values, u32 size, aku_Status* out_status_or_null)
+{
+    auto ises = reinterpret_cast<Session*>(session);
+    return ises->add_samples(ids, timestamps, values, size, out_status_or_null);
+}
+
+u64 aku_get_write_backlog(aku_Session* session) {
+    auto ises = reinterpret_cast<Session*>(session);
+    return ises->get_write_backlog();
+}
+
 aku_Status aku_parse_duration(const char* str, int* value) {
     try {
         *value = DateTimeUtil::parse_duration(str, strlen(str));
@@ -20,6 +20,8 @@
 #include <memory>
 #include <algorithm>
 #include <sstream>
+#include <cmath>
+#include <limits>
 
 #include "util.h"
 #include "stringpool.h"
@@ -355,6 +357,124 @@ CMSketch::TVal CMSketch::extract(u64 value) const {
     return *inputs[0] & *inputs[1] & *inputs[2];
 }
 
+//               //
+//  HyperLogLog  //
+//               //
+
+//! 64-bit hash finalizer (splitmix64), values can be sequential ids
+static u64 mix_hash(u64 x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+void HyperLogLog::set_register(u32 ix, u8 rank) {
+    if (!dense_.empty()) {
+        dense_[ix] = std::max(dense_[ix], rank);
+        return;
+    }
+    u16 entry = static_cast<u16>((ix << 6) | rank);
+    auto it = std::lower_bound(sparse_.begin(), sparse_.end(), entry, [](u16 lhs, u16 rhs) {
+        return (lhs >> 6) < (rhs >> 6);
+    });
+    if (it != sparse_.end() && (*it >> 6) == ix) {
+        *it = std::max(*it, entry);
+        return;
+    }
+    sparse_.insert(it, entry);
+    if (sparse_.size() > MAX_SPARSE) {
+        dense_.resize(NREGISTERS, 0);
+        for (auto e: sparse_) {
+            dense_[e >> 6] = static_cast<u8>(e & 0x3F);
+        }
+        sparse_ = std::vector<u16>();
+    }
+}
+
+void HyperLogLog::add(u64 value) {
+    u64 hash = mix_hash(value);
+    u32 ix = static_cast<u32>(hash >> (64 - PRECISION));
+    // Guard bit limits the rank so it always fits into 6 bits
+    u64 rest = (hash << PRECISION) | (1ull << (PRECISION - 1));
+    set_register(ix, static_cast<u8>(__builtin_clzll(rest) + 1));
+}
+
+void HyperLogLog::merge(HyperLogLog const& other) {
+    if (!other.dense_.empty()) {
+        if (dense_.empty()) {
+            dense_ = other.dense_;
+            for (auto e: sparse_) {
+                dense_[e >> 6] = std::max(dense_[e >> 6], static_cast<u8>(e & 0x3F));
+            }
+            sparse_ = std::vector<u16>();
+        } else {
+            for (u32 i = 0; i < NREGISTERS; i++) {
+                dense_[i] = std::max(dense_[i], other.dense_[i]);
+            }
+        }
+        return;
+    }
+    for (auto e: other.sparse_) {
+        set_register(e >> 6, static_cast<u8>(e & 0x3F));
+    }
+}
+
+u64 HyperLogLog::estimate() const {
+    const double m = NREGISTERS;
+    double sum = 0;
+    u32 zeros = 0;
+    if (dense_.empty()) {
+        zeros = NREGISTERS - static_cast<u32>(sparse_.size());
+        sum = zeros;
+        for (auto e: sparse_) {
+            sum += std::ldexp(1.0, -(e & 0x3F));
+        }
+    } else {
+        for (auto r: dense_) {
+            zeros += r == 0 ? 1 : 0;
+            sum += std::ldexp(1.0, -r);
+        }
+    }
+    const double alpha = 0.7213/(1.0 + 1.079/m);
+    double est = alpha*m*m/sum;
+    if (est <= 2.5*m && zeros != 0) {
+        // Small range correction (linear counting)
+        est = m*std::log(m/zeros);
+    }
+    return static_cast<u64>(std::llround(est));
+}
+
+size_t HyperLogLog::get_size_in_bytes() const {
+    return sparse_.capacity()*sizeof(u16) + dense_.capacity();
+}
+
+//                    //
+//  CardinalityIndex  //
+//                    //
+
+void CardinalityIndex::add(u64 key, u64 value) {
+    table_[key].add(value);
+}
+
+size_t CardinalityIndex::get_size_in_bytes() const {
+    size_t sum = 0;
+    for (auto const& kv: table_) {
+        sum += kv.second.get_size_in_bytes() + sizeof(kv);
+    }
+    return sum;
+}
+
+HyperLogLog CardinalityIndex::extract(u64 key) const {
+    auto it = table_.find(key);
+    if (it == table_.end()) {
+        return HyperLogLog();
+    }
+    return it->second;
+}
+
 //               //
 // InvertedIndex //
 //               //
@@ -384,6 +504,27 @@ InvertedIndex::TVal InvertedIndex::extract(u64 value) const {
     return it->second;
 }
 
+void BitmapInvertedIndex::add(u64 key, u64 value) {
+    table_[key].add(static_cast<u32>(value));
+}
+
+size_t BitmapInvertedIndex::get_size_in_bytes() const {
+    size_t sum = 0;
+    for (auto const& row: table_) {
+        sum += row.second.getSizeInBytes();
+    }
+    return sum;
+}
+
+BitmapInvertedIndex::TVal BitmapInvertedIndex::extract(u64 value) const {
+    auto it = table_.find(value);
+    if (it == table_.end()) {
+        // Return empty value
+        return TVal();
+    }
+    return it->second;
+}
+
 
 //              //
 //  MetricName  //
@@ -475,33 +616,185 @@ bool TagValuePair::check(const char* begin, const char* end) const {
 }
 
 
+//               //
+//  TagValueSet  //
+//               //
+
+TagValueSet::TagValueSet()
+    : tags_(16, &StringTools::hash, &StringTools::equal)
+{
+}
+
+void TagValueSet::add(std::string const& tag, std::vector<std::string> const& values) {
+    storage_.push_back(tag);
+    StringTools::StringT key = std::make_pair(storage_.back().data(), static_cast<int>(storage_.back().size()));
+    auto it = tags_.find(key);
+    if (it == tags_.end()) {
+        it = tags_.insert(std::make_pair(key, StringTools::create_set(values.size()))).first;
+    }
+    for (auto const& value: values) {
+        storage_.push_back(value);
+        it->second.insert(std::make_pair(storage_.back().data(), static_cast<int>(storage_.back().size())));
+    }
+}
+
+bool TagValueSet::empty() const {
+    return tags_.empty();
+}
+
+bool TagValueSet::check(const char* begin, const char* end) const {
+    const char* p = begin;
+    // skip metric name
+    p = skip_space(p, end);
+    if (p == end) {
+        return false;
+    }
+    while(p < end && *p != ' ') {
+        p++;
+    }
+    p = skip_space(p, end);
+    size_t nmatches = 0;
+    bool error = false;
+    while (!error && p < end) {
+        const char* tag_start = p;
+        const char* tag_end = skip_tag(tag_start, end, &error);
+        StringT tag;
+        StringT val;
+        if (!split_pair(std::make_pair(tag_start, tag_end - tag_start), &tag, &val)) {
+            return false;
+        }
+        auto it = tags_.find(tag);
+        if (it != tags_.end()) {
+            if (it->second.count(val) == 0) {
+                return false;
+            }
+            nmatches++;
+        }
+        p = skip_space(tag_end, end);
+    }
+    return nmatches == tags_.size();
+}
+
+
 //                             //
 //  IndexQueryResultsIterator  //
 //                             //
 
-IndexQueryResultsIterator::IndexQueryResultsIterator(CompressedPListConstIterator postinglist, StringPool const* spool)
+static const Roaring EMPTY_BITMAP;
+
+IndexQueryResultsIterator::IndexQueryResultsIterator(CompressedPListConstIterator postinglist, InternedStringPool const* spool)
     : it_(postinglist)
     , spool_(spool)
+    , bit_(EMPTY_BITMAP, true)
+    , names_(nullptr)
+{
+}
+
+IndexQueryResultsIterator::IndexQueryResultsIterator(CompressedPListConstIterator postinglist,
+                                                     RoaringSetBitForwardIterator bitmap,
+                                                     std::vector<StringT> const* names)
+    : it_(postinglist)
+    , spool_(nullptr)
+    , bit_(bitmap)
+    , names_(names)
 {
 }
 
 StringT IndexQueryResultsIterator::operator * () const {
+    if (names_ != nullptr) {
+        return (*names_)[*bit_];
+    }
     auto id = *it_;
-    auto str = spool_->str(id);
+    auto str = spool_->tuple(id);
     return str;
 }
 
 IndexQueryResultsIterator& IndexQueryResultsIterator::operator ++ () {
-    ++it_;
+    if (names_ != nullptr) {
+        ++bit_;
+    } else {
+        ++it_;
+    }
     return *this;
 }
 
 bool IndexQueryResultsIterator::operator == (IndexQueryResultsIterator const& other) const {
+    if (names_ != nullptr) {
+        if (bit_.i.has_value != other.bit_.i.has_value) {
+            return false;
+        }
+        return !bit_.i.has_value || bit_.i.current_value == other.bit_.i.current_value;
+    }
     return it_ == other.it_;
 }
 
 bool IndexQueryResultsIterator::operator != (IndexQueryResultsIterator const& other) const {
-    return it_ != other.it_;
+    return !(*this == other);
+}
+
+
+//                  //
+//  TagValueFilter  //
+//                  //
+
+/** Extract literal prefix of the regular expression, all strings that match
+  * the expression start with this prefix.
+  */
+static std::string get_literal_prefix(std::string const& rexp) {
+    if (rexp.find('|') != std::string::npos) {
+        // Alternatives can have different prefixes
+        return std::string();
+    }
+    static const std::string special = ".[]{}()\\*+?^$";
+    std::string prefix;
+    size_t ix = 0;
+    if (!rexp.empty() && rexp.front() == '^') {
+        ix++;
+    }
+    for (; ix < rexp.size(); ix++) {
+        char c = rexp[ix];
+        if (special.find(c) != std::string::npos) {
+            if ((c == '*' || c == '?' || c == '{') && !prefix.empty()) {
+                // Previous character is optional
+                prefix.pop_back();
+            }
+            break;
+        }
+        prefix.push_back(c);
+    }
+    return prefix;
+}
+
+TagValueFilter::TagValueFilter(Kind kind, std::string const& pattern)
+    : kind_(kind)
+    , pattern_(pattern)
+{
+    if (kind_ == Kind::REGEX) {
+        regex_ = std::make_shared<boost::regex>(pattern_, boost::regex_constants::optimize);
+        prefix_ = get_literal_prefix(pattern_);
+    } else {
+        prefix_ = pattern_;
+    }
+}
+
+TagValueFilter::Kind TagValueFilter::get_kind() const {
+    return kind_;
+}
+
+std::string const& TagValueFilter::get_pattern() const {
+    return pattern_;
+}
+
+std::string const& TagValueFilter::get_prefix() const {
+    return prefix_;
+}
+
+bool TagValueFilter::match(StringT value) const {
+    if (kind_ == Kind::REGEX) {
+        return boost::regex_match(value.first, value.first + value.second, *regex_);
+    }
+    return static_cast<size_t>(value.second) >= prefix_.size()
+        && std::equal(prefix_.begin(), prefix_.end(), value.first);
 }
 
 
@@ -511,17 +804,29 @@ bool IndexQueryResultsIterator::operator != (IndexQueryResultsIterator const& ot
 
 IndexQueryResults::IndexQueryResults()
     : spool_(nullptr)
+    , names_(nullptr)
 {}
 
-IndexQueryResults::IndexQueryResults(CompressedPList&& plist, StringPool const* spool)
+IndexQueryResults::IndexQueryResults(CompressedPList&& plist, InternedStringPool const* spool)
     : postinglist_(plist)
     , spool_(spool)
+    , names_(nullptr)
+{
+}
+
+IndexQueryResults::IndexQueryResults(Roaring&& bitmap, std::vector<StringT> const* names,
+                                     InternedStringPool const* spool)
+    : spool_(spool)
+    , bitmap_(std::move(bitmap))
+    , names_(names)
 {
 }
 
 IndexQueryResults::IndexQueryResults(IndexQueryResults const& other)
     : postinglist_(other.postinglist_)
     , spool_(other.spool_)
+    , bitmap_(other.bitmap_)
+    , names_(other.names_)
 {
 }
 
@@ -531,57 +836,144 @@ IndexQueryResults& IndexQueryResults::operator = (IndexQueryResults && other) {
     }
     postinglist_ = std::move(other.postinglist_);
     spool_ = other.spool_;
+    bitmap_ = std::move(other.bitmap_);
+    names_ = other.names_;
     return *this;
 }
 
 IndexQueryResults::IndexQueryResults(IndexQueryResults&& plist)
     : postinglist_(std::move(plist.postinglist_))
     , spool_(plist.spool_)
+    , bitmap_(std::move(plist.bitmap_))
+    , names_(plist.names_)
 {
 }
 
 
 IndexQueryResults IndexQueryResults::unique() const {
+    if (names_ != nullptr) {
+        // Bitmap can't contain duplicates
+        return *this;
+    }
     IndexQueryResults result(postinglist_.unique(), spool_);
     return result;
 }
 
+// Default constructed (empty) results can be combined with results of
+// any type. Results that use bitmaps can't be combined with posting lists.
+
 IndexQueryResults IndexQueryResults::intersection(IndexQueryResults const& other) const {
-    const StringPool *spool = spool_;
+    const InternedStringPool *spool = spool_;
     if (spool == nullptr) {
         spool = other.spool_;
     }
+    if (names_ != nullptr || other.names_ != nullptr) {
+        assert(postinglist_.cardinality() == 0 && other.postinglist_.cardinality() == 0);
+        return IndexQueryResults(bitmap_ & other.bitmap_, names_ ? names_ : other.names_, spool);
+    }
     IndexQueryResults result(postinglist_ & other.postinglist_, spool);
     return result;
 }
 
 IndexQueryResults IndexQueryResults::difference(IndexQueryResults const& other) const {
-    const StringPool *spool = spool_;
+    const InternedStringPool *spool = spool_;
     if (spool == nullptr) {
         spool = other.spool_;
     }
+    if (names_ != nullptr || other.names_ != nullptr) {
+        assert(postinglist_.cardinality() == 0 && other.postinglist_.cardinality() == 0);
+        return IndexQueryResults(bitmap_ - other.bitmap_, names_ ? names_ : other.names_, spool);
+    }
     IndexQueryResults result(postinglist_ ^ other.postinglist_, spool);
     return result;
 }
 
 IndexQueryResults IndexQueryResults::join(IndexQueryResults const& other) const {
-    const StringPool *spool = spool_;
+    const InternedStringPool *spool = spool_;
     if (spool == nullptr) {
         spool = other.spool_;
     }
+    if (names_ != nullptr || other.names_ != nullptr) {
+        assert(postinglist_.cardinality() == 0 && other.postinglist_.cardinality() == 0);
+        return IndexQueryResults(bitmap_ | other.bitmap_, names_ ? names_ : other.names_, spool);
+    }
     IndexQueryResults result(postinglist_ | other.postinglist_, spool);
     return result;
 }
 
+IndexQueryResults IndexQueryResults::unite(std::vector<IndexQueryResults> const& parts) {
+    if (parts.empty()) {
+        return IndexQueryResults();
+    }
+    for (auto const& part: parts) {
+        if (part.names_ != nullptr) {
+            // All bitmaps are united at once
+            std::vector<const Roaring*> bitmaps;
+            for (auto const& p: parts) {
+                assert(p.postinglist_.cardinality() == 0);
+                bitmaps.push_back(&p.bitmap_);
+            }
+            return IndexQueryResults(Roaring::fastunion(bitmaps.size(), bitmaps.data()), part.names_, part.spool_);
+        }
+    }
+    // K-way merge of the posting lists
+    typedef std::pair<u64, size_t> HeapItem;  // value, index of the list
+    std::vector<CompressedPListConstIterator> its;
+    std::vector<CompressedPListConstIterator> ends;
+    std::vector<HeapItem> heap;
+    const InternedStringPool* spool = nullptr;
+    for (auto const& part: parts) {
+        if (part.spool_ != nullptr) {
+            spool = part.spool_;
+        }
+        its.push_back(part.postinglist_.begin());
+        ends.push_back(part.postinglist_.end());
+        if (its.back() != ends.back()) {
+            heap.push_back(std::make_pair(*its.back(), its.size() - 1));
+        }
+    }
+    std::greater<HeapItem> cmp;
+    std::make_heap(heap.begin(), heap.end(), cmp);
+    CompressedPList result;
+    bool first = true;
+    u64 prev = 0;
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), cmp);
+        HeapItem top = heap.back();
+        heap.pop_back();
+        if (first || top.first != prev) {
+            result.add(top.first);
+            prev = top.first;
+            first = false;
+        }
+        auto& it = its[top.second];
+        ++it;
+        if (it != ends[top.second]) {
+            heap.push_back(std::make_pair(*it, top.second));
+            std::push_heap(heap.begin(), heap.end(), cmp);
+        }
+    }
+    return IndexQueryResults(std::move(result), spool);
+}
+
 size_t IndexQueryResults::cardinality() const {
+    if (names_ != nullptr) {
+        return static_cast<size_t>(bitmap_.cardinality());
+    }
     return postinglist_.cardinality();
 }
 
 IndexQueryResultsIterator IndexQueryResults::begin() const {
+    if (names_ != nullptr) {
+        return IndexQueryResultsIterator(postinglist_.end(), bitmap_.begin(), names_);
+    }
     return IndexQueryResultsIterator(postinglist_.begin(), spool_);
 }
 
 IndexQueryResultsIterator IndexQueryResults::end() const {
+    if (names_ != nullptr) {
+        return IndexQueryResultsIterator(postinglist_.end(), RoaringSetBitForwardIterator(bitmap_, true), names_);
+    }
     return IndexQueryResultsIterator(postinglist_.end(), spool_);
 }
 
@@ -590,6 +982,10 @@ IndexQueryResultsIterator IndexQueryResults::end() const {
 //  IncludeTags  //
 //               //
 
+u64 IndexQueryNodeBase::estimate(IndexBase const& index) const {
+    return query(index).cardinality();
+}
+
 IndexQueryResults IncludeIfAllTagsMatch::query(IndexBase const& index) const {
     IndexQueryResults results = index.metric_query(metric_);
     for(auto const& tv: pairs_) {
@@ -599,6 +995,14 @@ IndexQueryResults IncludeIfAllTagsMatch::query(IndexBase const& index) const {
     return results.filter(metric_).filter(pairs_);
 }
 
+u64 IncludeIfAllTagsMatch::estimate(IndexBase const& index) const {
+    u64 result = index.metric_sketch(metric_).estimate();
+    for(auto const& tv: pairs_) {
+        result = std::min(result, index.tagvalue_sketch(tv).estimate());
+    }
+    return result;
+}
+
 //                    //
 //  IncludeMany2Many  //
 //                    //
@@ -610,40 +1014,85 @@ IncludeMany2Many::IncludeMany2Many(std::string mname, std::map<std::string, std:
 {
 }
 
+IncludeMany2Many::IncludeMany2Many(std::string mname,
+                                   std::map<std::string, std::vector<std::string>> const& map,
+                                   std::map<std::string, TagValueFilter> const& filters)
+    : IndexQueryNodeBase(node_name_)
+    , metric_(mname.data(), mname.data() + mname.size())
+    , tags_(map)
+    , filters_(filters)
+{
+}
+
+bool IncludeMany2Many::get_tags(IndexBase const& index, std::map<std::string, std::vector<std::string>>* tags) const {
+    *tags = tags_;
+    for (auto const& kv: filters_) {
+        // Only values that match the filter are visited
+        auto values = index.match_tag_values(metric_.get_value(), tostrt(kv.first), kv.second);
+        if (values.empty()) {
+            return false;
+        }
+        auto& out = (*tags)[kv.first];
+        for (auto val: values) {
+            out.push_back(fromstrt(val));
+        }
+    }
+    return true;
+}
+
 IndexQueryResults IncludeMany2Many::query(IndexBase const& index) const {
-    std::vector<TagValuePair> tgv;
+    TagValueSet allowed;
     IndexQueryResults final_res;
     bool first = true;
-    for (auto kv: tags_) {
-        if (kv.second.size() > 0) {
-            std::stringstream pair;
-            pair << kv.first << "=" << kv.second[0];
-            TagValuePair tagval(pair.str());
-            auto results = index.tagvalue_query(tagval);
-            tgv.push_back(tagval);
-            for (size_t ix = 1; ix < kv.second.size(); ix++) {
-                std::stringstream ixpair;
-                ixpair << kv.first << "=" << kv.second[ix];
-                TagValuePair ixtagval(ixpair.str());
-                tgv.push_back(ixtagval);
-                auto res = index.tagvalue_query(ixtagval);
-                results = results.join(res).unique();
-            }
-            if (first) {
-                final_res = std::move(results);
-                first = false;
-            } else {
-                final_res = final_res.intersection(results);
-            }
+    std::map<std::string, std::vector<std::string>> tags;
+    if (!get_tags(index, &tags)) {
+        return IndexQueryResults();
+    }
+    // Postings of all values of the tag are united
+    std::vector<IndexQueryResults> parts;
+    for (auto const& kv: tags) {
+        if (kv.second.empty()) {
+            continue;
+        }
+        parts.clear();
+        for (auto const& value: kv.second) {
+            parts.push_back(index.tagvalue_query(TagValuePair(kv.first + "=" + value)));
+        }
+        auto results = IndexQueryResults::unite(parts);
+        allowed.add(kv.first, kv.second);
+        if (first) {
+            final_res = std::move(results);
+            first = false;
+        } else {
+            final_res = final_res.intersection(results);
         }
     }
     auto allmetric = index.metric_query(metric_);
-    if (tgv.empty()) {
+    if (allowed.empty()) {
         // Select by metric only
         return allmetric.filter(metric_);
     }
     final_res = final_res.intersection(allmetric);
-    return final_res.filter(metric_).filter(tgv);
+    return final_res.filter(metric_).filter(allowed);
+}
+
+u64 IncludeMany2Many::estimate(IndexBase const& index) const {
+    std::map<std::string, std::vector<std::string>> tags;
+    if (!get_tags(index, &tags)) {
+        return 0;
+    }
+    u64 result = index.metric_sketch(metric_).estimate();
+    for (auto const& kv: tags) {
+        if (kv.second.empty()) {
+            continue;
+        }
+        HyperLogLog sketch;
+        for (auto const& value: kv.second) {
+            sketch.merge(index.tagvalue_sketch(TagValuePair(kv.first + "=" + value)));
+        }
+        result = std::min(result, sketch.estimate());
+    }
+    return result;
 }
 
 //                   //
@@ -665,6 +1114,20 @@ IndexQueryResults IncludeIfHasTag::query(IndexBase const& index) const {
     return subquery.query(index);
 }
 
+u64 IncludeIfHasTag::estimate(IndexBase const& index) const {
+    std::map<std::string, std::vector<std::string>> pairs;
+    for (auto tag: tagnames_) {
+        std::vector<std::string> values;
+        auto res = index.list_tag_values(tostrt(metric_), tostrt(tag));
+        for (auto val: res) {
+            values.push_back(fromstrt(val));
+        }
+        pairs[tag] = values;
+    }
+    IncludeMany2Many subquery(metric_, pairs);
+    return subquery.estimate(index);
+}
+
 
 //               //
 //  ExcludeTags  //
@@ -680,6 +1143,10 @@ IndexQueryResults ExcludeTags::query(IndexBase const& index) const {
     return results.filter(metric_);
 }
 
+u64 ExcludeTags::estimate(IndexBase const& index) const {
+    return index.metric_sketch(metric_).estimate();
+}
+
 
 //              //
 //  JoinByTags  //
@@ -698,78 +1165,95 @@ IndexQueryResults JoinByTags::query(IndexBase const& index) const {
     return results.filter(metrics_).filter(pairs_);
 }
 
+u64 JoinByTags::estimate(IndexBase const& index) const {
+    HyperLogLog sketch;
+    for(auto const& m: metrics_) {
+        sketch.merge(index.metric_sketch(m));
+    }
+    return sketch.estimate();
+}
+
 
 //                      //
 //  SeriesNameTopology  //
 //                      //
 
 
+namespace {
+
+/** Call `fn` for every element of the sorted set that starts with the prefix
+  * until `fn` returns false.
+  */
+template<class Fn>
+void visit_prefix_range(StringTools::SortedSetT const& set, StringT prefix, Fn const& fn) {
+    StringTools::StringT pstr = std::make_pair(prefix.first, static_cast<int>(prefix.second));
+    for (auto it = set.lower_bound(pstr); it != set.end(); ++it) {
+        if (static_cast<u32>(it->second) < prefix.second || !std::equal(prefix.first, prefix.first + prefix.second, it->first)) {
+            break;
+        }
+        if (!fn(*it)) {
+            break;
+        }
+    }
+}
+
+std::vector<StringT> prefix_range(StringTools::SortedSetT const& set, StringT prefix, size_t limit) {
+    std::vector<StringT> res;
+    visit_prefix_range(set, prefix, [&](StringTools::StringT value) {
+        res.push_back(value);
+        return limit == 0 || res.size() < limit;
+    });
+    return res;
+}
+
+}
+
 SeriesNameTopology::SeriesNameTopology()
     : index_(StringTools::create_l3_table(1000))
+    , metrics_(StringTools::create_sorted_set())
+    , tags_(StringTools::create_l2_table(1000))
 {
 }
 
-void SeriesNameTopology::add_name(StringT name) {
-    StringT metric = skip_metric_name(name.first, name.first + name.second);
-    StringT tags = std::make_pair(name.first + metric.second, name.second - metric.second);
+void SeriesNameTopology::add_name(std::vector<StringT> const& tokens) {
+    if (tokens.empty()) {
+        return;
+    }
+    StringT metric = tokens.front();
     auto it = index_.find(metric);
     if (it == index_.end()) {
         StringTools::L2TableT tagtable = StringTools::create_l2_table(1024);
         index_[metric] = std::move(tagtable);
         it = index_.find(metric);
+        metrics_.insert(it->first);
+        tags_.insert(std::make_pair(it->first, StringTools::create_sorted_set()));
     }
     // Iterate through tags
-    const char* p = tags.first;
-    const char* end = p + tags.second;
-    p = skip_space(p, end);
-    if (p == end) {
-        return;
-    }
-    // Check tags
-    bool error = false;
-    while (!error && p < end) {
-        const char* tag_start = p;
-        const char* tag_end = skip_tag(tag_start, end, &error);
-        auto tagstr = std::make_pair(tag_start, tag_end - tag_start);
-        StringT tag;
-        StringT val;
-        if (!split_pair(tagstr, &tag, &val)) {
-            error = true;
-        }
+    for (size_t i = 1; i + 1 < tokens.size(); i += 2) {
+        StringT tag = tokens[i];
+        StringT val = tokens[i + 1];
         StringTools::L2TableT& tagtable = it->second;
         auto tagit = tagtable.find(tag);
         if (tagit == tagtable.end()) {
-            auto valtab = StringTools::create_set(1024);
-            //tagtable.insert({tag, valtab});
-            tagtable[tag] = valtab; std::move(valtab);
-            tagit = tagtable.find(tag);
+            tagit = tagtable.insert(std::make_pair(tag, StringTools::create_sorted_set())).first;
+            tags_.find(it->first)->second.insert(tag);
         }
-        StringTools::SetT& valueset = tagit->second;
+        StringTools::SortedSetT& valueset = tagit->second;
         valueset.insert(val);
-        // next
-        p = skip_space(tag_end, end);
     }
 }
 
 std::vector<StringT> SeriesNameTopology::list_metric_names() const {
-    std::vector<StringT> res;
-    std::transform(index_.begin(), index_.end(), std::back_inserter(res),
-                   [](std::pair<StringT, StringTools::L2TableT> const& v) {
-                        return v.first;
-                   });
-    return res;
+    return std::vector<StringT>(metrics_.begin(), metrics_.end());
 }
 
 std::vector<StringT> SeriesNameTopology::list_tags(StringT metric) const {
     std::vector<StringT> res;
-    auto it = index_.find(metric);
-    if (it == index_.end()) {
+    auto it = tags_.find(metric);
+    if (it == tags_.end()) {
         return res;
     }
-    std::transform(it->second.begin(), it->second.end(), std::back_inserter(res),
-                   [](std::pair<StringT, StringTools::SetT> const& v) {
-                        return v.first;
-                   });
+    std::copy(it->second.begin(), it->second.end(), std::back_inserter(res));
     return res;
 }
 
@@ -788,38 +1272,92 @@ std::vector<StringT> SeriesNameTopology::list_tag_values(StringT metric, StringT
     return res;
 }
 
+std::vector<StringT> SeriesNameTopology::match_tag_values(StringT metric, StringT tag, TagValueFilter const& filter) const {
+    std::vector<StringT> res;
+    auto it = index_.find(metric);
+    if (it == index_.end()) {
+        return res;
+    }
+    auto vit = it->second.find(tag);
+    if (vit == it->second.end()) {
+        return res;
+    }
+    // Visit only the range of values that starts with the literal prefix
+    visit_prefix_range(vit->second, tostrt(filter.get_prefix()), [&](StringTools::StringT value) {
+        if (filter.match(value)) {
+            res.push_back(value);
+        }
+        return true;
+    });
+    return res;
+}
+
+std::vector<StringT> SeriesNameTopology::suggest_metric_names(StringT prefix, size_t limit) const {
+    return prefix_range(metrics_, prefix, limit);
+}
+
+std::vector<StringT> SeriesNameTopology::suggest_tags(StringT metric, StringT prefix, size_t limit) const {
+    auto it = tags_.find(metric);
+    if (it == tags_.end()) {
+        return std::vector<StringT>();
+    }
+    return prefix_range(it->second, prefix, limit);
+}
+
+std::vector<StringT> SeriesNameTopology::suggest_tag_values(StringT metric, StringT tag, StringT prefix, size_t limit) const {
+    auto it = index_.find(metric);
+    if (it == index_.end()) {
+        return std::vector<StringT>();
+    }
+    auto vit = it->second.find(tag);
+    if (vit == it->second.end()) {
+        return std::vector<StringT>();
+    }
+    return prefix_range(vit->second, prefix, limit);
+}
+
 //         //
 //  Index  //
 //         //
 
-Index::Index()
+Index::Index(IndexPostings postings)
     : table_(StringTools::create_table(100000))
     , metrics_names_(1024)
     , tagvalue_pairs_(1024)
+    , postings_(postings)
 {
 }
 
+IndexPostings Index::get_postings_type() const {
+    return postings_;
+}
+
 SeriesNameTopology const& Index::get_topology() const {
     return topology_;
 }
 
+InternedStringPool const& Index::get_pool() const {
+    return pool_;
+}
+
 size_t Index::cardinality() const {
     return table_.size();
 }
 
 size_t Index::memory_use() const {
-    // TODO: use counting allocator for table_ to provide memory stats
-    size_t sm = metrics_names_.get_size_in_bytes();
-    size_t st = tagvalue_pairs_.get_size_in_bytes();
-    size_t sp = pool_.mem_used();
-    return sm + st + sp;
+    return index_memory_use() + pool_memory_use();
 }
 
 size_t Index::index_memory_use() const {
     // TODO: use counting allocator for table_ to provide memory stats
     size_t sm = metrics_names_.get_size_in_bytes();
     size_t st = tagvalue_pairs_.get_size_in_bytes();
-    return sm + st;
+    size_t bm = metrics_bitmaps_.get_size_in_bytes();
+    size_t bt = tagvalue_bitmaps_.get_size_in_bytes();
+    size_t sn = names_.capacity()*sizeof(StringT);
+    size_t hm = metrics_hll_.get_size_in_bytes();
+    size_t ht = tagvalue_hll_.get_size_in_bytes();
+    return sm + st + bm + bt + sn + hm + ht;
 }
 
 size_t Index::pool_memory_use() const {
@@ -836,39 +1374,63 @@ std::tuple<aku_Status, StringT> Index::append(const char* begin, const char* end
     if (status != AKU_SUCCESS) {
         return std::make_tuple(status, EMPTY_STRING);
     }
-    // Check if name is already been added
-    auto name = std::make_pair(static_cast<const char*>(buffer), tags_end - buffer);
-    if (table_.count(name) == 0) {
+    // Check if name is already been added, names are stored as tuples of dictionary ids
+    char tuple[InternedStringPool::MAX_TUPLE_SIZE];
+    auto tuple_size = pool_.encode(buffer, tags_end, tuple, sizeof(tuple));
+    auto key = std::make_pair(static_cast<const char*>(tuple), static_cast<int>(tuple_size));
+    if (tuple_size == 0 || table_.count(key) == 0) {
+        const bool use_bitmaps = postings_ == IndexPostings::ROARING;
+        if (use_bitmaps && names_.size() == std::numeric_limits<u32>::max()) {
+            // Ordinals are 32-bit
+            return std::make_tuple(AKU_EOVERFLOW, EMPTY_STRING);
+        }
         // insert value
         auto id = pool_.add(buffer, tags_end);
         if (id == 0) {
             return std::make_tuple(AKU_EBAD_DATA, EMPTY_STRING);
         }
-        write_tags(tags_begin, tags_end, &tagvalue_pairs_, id);
-        name = pool_.str(id);  // name now have the same lifetime as pool
-        table_[name] = id;
+        auto name = pool_.tuple(id);  // encoded name now have the same lifetime as pool
         auto mname = skip_metric_name(buffer, tags_begin);
         if (mname.second == 0) {
             return std::make_tuple(AKU_EBAD_DATA, EMPTY_STRING);
         }
+        table_[std::make_pair(name.first, static_cast<int>(name.second))] = id;
         auto mhash = StringTools::hash(mname);
-        metrics_names_.add(mhash, id);
+        if (use_bitmaps) {
+            u64 ordinal = names_.size();
+            names_.push_back(name);
+            write_tags(tags_begin, tags_end, &tagvalue_bitmaps_, ordinal);
+            metrics_bitmaps_.add(mhash, ordinal);
+        } else {
+            write_tags(tags_begin, tags_end, &tagvalue_pairs_, id);
+            metrics_names_.add(mhash, id);
+        }
+        write_tags(tags_begin, tags_end, &tagvalue_hll_, id);
+        metrics_hll_.add(mhash, id);
         // update topology
-        topology_.add_name(name);
+        std::vector<StringT> tokens;
+        pool_.tokens(name, &tokens);
+        topology_.add_name(tokens);
         return std::make_tuple(AKU_SUCCESS, name);
     }
-    auto it = table_.find(name);
-    return std::make_tuple(AKU_SUCCESS, it->first);
+    auto it = table_.find(key);
+    return std::make_tuple(AKU_SUCCESS, std::make_pair(it->first.first, static_cast<u32>(it->first.second)));
 }
 
 IndexQueryResults Index::tagvalue_query(const TagValuePair &value) const {
     auto hash = StringTools::hash(value.get_value());
+    if (postings_ == IndexPostings::ROARING) {
+        return IndexQueryResults(tagvalue_bitmaps_.extract(hash), &names_, &pool_);
+    }
     auto post = tagvalue_pairs_.extract(hash);
     return IndexQueryResults(std::move(post), &pool_);
 }
 
 IndexQueryResults Index::metric_query(const MetricName &value) const {
     auto hash = StringTools::hash(value.get_value());
+    if (postings_ == IndexPostings::ROARING) {
+        return IndexQueryResults(metrics_bitmaps_.extract(hash), &names_, &pool_);
+    }
     auto post = metrics_names_.extract(hash);
     return IndexQueryResults(std::move(post), &pool_);
 }
@@ -885,4 +1447,16 @@ std::vector<StringT> Index::list_tag_values(StringT metric, StringT tag) const {
     return topology_.list_tag_values(metric, tag);
 }
 
+std::vector<StringT> Index::match_tag_values(StringT metric, StringT tag, TagValueFilter const& filter) const {
+    return topology_.match_tag_values(metric, tag, filter);
+}
+
+HyperLogLog Index::tagvalue_sketch(TagValuePair const& value) const {
+    return tagvalue_hll_.extract(StringTools::hash(value.get_value()));
+}
+
+HyperLogLog Index::metric_sketch(MetricName const& value) const {
+    return metrics_hll_.extract(StringTools::hash(value.get_value()));
+}
+
 }  // namespace
@@ -19,6 +19,7 @@
 #include "hashfnfamily.h"
 #include "stringpool.h"
 #include "util.h"
+#include "../roaring/roaring.hh"
 
 #include <memory>
 #include <unordered_map>
@@ -26,9 +27,12 @@
 #include <cassert>
 #include <iterator>
 #include <algorithm>
+#include <deque>
 #include <map>
 #include <sstream>
 
+#include <boost/regex.hpp>
+
 namespace Akumuli {
 
 struct TwoUnivHashFnFamily {
@@ -439,6 +443,58 @@ public:
 };
 
 
+//               //
+//  HyperLogLog  //
+//               //
+
+/** HyperLogLog cardinality estimator (standard error is about 3%).
+  * Small sketches are stored in sparse form (sorted list of non-zero
+  * registers) and converted to the dense array of registers when the
+  * list grows, so low cardinality keys stay cheap.
+  */
+class HyperLogLog {
+public:
+    enum {
+        PRECISION  = 10,
+        NREGISTERS = 1 << PRECISION,
+        MAX_SPARSE = 128,  //< Max number of registers in sparse form
+    };
+private:
+    std::vector<u16> sparse_;  //< Register index (high bits) and rank (low 6 bits)
+    std::vector<u8>  dense_;
+
+    void set_register(u32 ix, u8 rank);
+public:
+    //! Add value (value is hashed)
+    void add(u64 value);
+
+    //! Merge with another sketch (result estimates cardinality of the union)
+    void merge(HyperLogLog const& other);
+
+    //! Estimate number of distinct values
+    u64 estimate() const;
+
+    size_t get_size_in_bytes() const;
+};
+
+
+//                    //
+//  CardinalityIndex  //
+//                    //
+
+//! Maps keys (metric or tag=value hashes) to cardinality sketches
+class CardinalityIndex {
+    std::unordered_map<u64, HyperLogLog> table_;
+public:
+    void add(u64 key, u64 value);
+
+    size_t get_size_in_bytes() const;
+
+    //! Return sketch for the key (empty sketch if key is not found)
+    HyperLogLog extract(u64 key) const;
+};
+
+
 //               //
 // Inverted Index //
 //               //
@@ -456,6 +512,28 @@ public:
     TVal extract(u64 value) const;
 };
 
+/**
+ * Inverted index that stores postings as roaring bitmaps.
+ * Values are dense 32-bit ordinals, so set operations on
+ * the postings can use vectorized container algorithms.
+ */
+class BitmapInvertedIndex {
+    typedef Roaring TVal;
+    std::unordered_map<u64, TVal> table_;
+public:
+    void add(u64 key, u64 value);
+
+    size_t get_size_in_bytes() const;
+
+    TVal extract(u64 value) const;
+};
+
+//! Posting list representation used by the Index
+enum class IndexPostings {
+    COMPRESSED,  //< Delta-encoded lists of string pool offsets
+    ROARING,     //< Roaring bitmaps of series ordinals
+};
+
 //              //
 //  MetricName  //
 //              //
@@ -495,6 +573,36 @@ public:
 };
 
 
+//               //
+//  TagValueSet  //
+//               //
+
+/**
+ * @brief Allowed values of several tags
+ * Series name passes the check if every tag from the set is present
+ * and has one of the allowed values. Name is parsed only once so the
+ * check doesn't depend on the number of allowed values.
+ */
+class TagValueSet {
+    typedef std::unordered_map<StringTools::StringT, StringTools::SetT,
+                               decltype(&StringTools::hash),
+                               decltype(&StringTools::equal)> TableT;
+    std::deque<std::string> storage_;  //! Tag names and values (addresses are stable)
+    TableT                  tags_;     //! Tag name to allowed values mapping
+public:
+    TagValueSet();
+    TagValueSet(TagValueSet const&) = delete;
+    TagValueSet& operator = (TagValueSet const&) = delete;
+
+    //! Add tag and its allowed values
+    void add(std::string const& tag, std::vector<std::string> const& values);
+
+    bool empty() const;
+
+    bool check(const char* begin, const char* end) const;
+};
+
+
 //                             //
 //  IndexQueryResultsIterator  //
 //                             //
@@ -508,10 +616,16 @@ public:
  */
 class IndexQueryResultsIterator {
     CompressedPListConstIterator it_;
-    StringPool const* spool_;
+    InternedStringPool const* spool_;
+    RoaringSetBitForwardIterator bit_;
+    std::vector<StringT> const* names_;
 public:
-    IndexQueryResultsIterator(CompressedPListConstIterator postinglist, StringPool const* spool);
+    IndexQueryResultsIterator(CompressedPListConstIterator postinglist, InternedStringPool const* spool);
+
+    IndexQueryResultsIterator(CompressedPListConstIterator postinglist, RoaringSetBitForwardIterator bitmap,
+                              std::vector<StringT> const* names);
 
+    //! Return series name encoded using the dictionary of the string pool
     StringT operator * () const;
 
     IndexQueryResultsIterator& operator ++ ();
@@ -522,17 +636,104 @@ public:
 };
 
 
+//                  //
+//  TagValueFilter  //
+//                  //
+
+/** Tag value predicate. Matches tag values by prefix or by regular
+  * expression (whole value should match). All matching values share
+  * the literal prefix of the pattern so only the range of the sorted
+  * value dictionary that starts with this prefix needs to be checked.
+  */
+class TagValueFilter {
+public:
+    enum class Kind {
+        PREFIX,
+        REGEX,
+    };
+private:
+    Kind kind_;
+    std::string pattern_;
+    std::string prefix_;
+    std::shared_ptr<boost::regex> regex_;
+public:
+    /**
+     * @brief TagValueFilter c-tor
+     * @param kind is a filter type
+     * @param pattern is a prefix or a regular expression
+     * @throw boost::regex_error if regular expression is invalid
+     */
+    TagValueFilter(Kind kind, std::string const& pattern);
+
+    Kind get_kind() const;
+
+    std::string const& get_pattern() const;
+
+    //! Literal prefix of all matching values
+    std::string const& get_prefix() const;
+
+    //! Check tag value
+    bool match(StringT value) const;
+};
+
+
 //                     //
 //  IndexQueryResults  //
 //                     //
 
 class IndexQueryResults {
     CompressedPList postinglist_;
-    StringPool const* spool_;
+    InternedStringPool const* spool_;
+    Roaring bitmap_;
+    std::vector<StringT> const* names_;  //< Ordinal to encoded tuple mapping, not null if bitmap is used
+
+    //! Remove series that doesn't match the predicate (false positives)
+    template<class Pred>
+    IndexQueryResults filter_if(Pred const& pred) const {
+        // Names are stored in interned form and should be rebuilt before the check
+        std::string name;
+        auto match = [this, &pred, &name](StringT tuple) {
+            if (!spool_->decode(tuple, &name)) {
+                return false;
+            }
+            return pred(std::make_pair(name.data(), static_cast<u32>(name.size())));
+        };
+        bool rewrite = false;
+        // Check for falce positives
+        for (auto it = begin(); it != end(); ++it) {
+            if (!match(*it)) {
+                rewrite = true;
+                break;
+            }
+        }
+        if (!rewrite) {
+            return *this;
+        }
+        // This code only gets triggered when false positives are present
+        if (names_ != nullptr) {
+            Roaring newbitmap;
+            for (auto it = bitmap_.begin(); it != bitmap_.end(); ++it) {
+                if (match(names_->at(*it))) {
+                    newbitmap.add(*it);
+                }
+            }
+            return IndexQueryResults(std::move(newbitmap), names_, spool_);
+        }
+        CompressedPList newplist;
+        for (auto it = postinglist_.begin(); it != postinglist_.end(); ++it) {
+            auto id = *it;
+            if (match(spool_->tuple(id))) {
+                newplist.add(id);
+            }
+        }
+        return IndexQueryResults(std::move(newplist), spool_);
+    }
 public:
     IndexQueryResults();
 
-    IndexQueryResults(CompressedPList&& plist, StringPool const* spool);
+    IndexQueryResults(CompressedPList&& plist, InternedStringPool const* spool);
+
+    IndexQueryResults(Roaring&& bitmap, std::vector<StringT> const* names, InternedStringPool const* spool);
 
     IndexQueryResults(IndexQueryResults const& other);
 
@@ -542,74 +743,28 @@ public:
 
     template<class Checkable>
     IndexQueryResults filter(std::vector<Checkable> const& values) const {
-        bool rewrite = false;
-        // Check for falce positives
-        for (auto it = postinglist_.begin(); it != postinglist_.end(); ++it) {
-            auto id = *it;
-            auto str = spool_->str(id);
-            bool success = false;
+        return filter_if([&values](StringT str) {
             for (auto const& value: values) {
                 if (value.check(str.first, str.first + str.second)) {
-                    success = true;
-                    break;
-                }
-            }
-            if (!success) {
-                rewrite = true;
-                break;
-            }
-        }
-        if (rewrite) {
-            // This code only gets triggered when false positives are present
-            CompressedPList newplist;
-            for (auto it = postinglist_.begin(); it != postinglist_.end(); ++it) {
-                auto id = *it;
-                auto str = spool_->str(id);
-                for (auto const& value: values) {
-                    bool add = false;
-                    if (value.check(str.first, str.first + str.second)) {
-                        add = true;
-                        break;
-                    }
-                    if (add) {
-                        newplist.add(id);
-                    }
+                    return true;
                 }
             }
-            return IndexQueryResults(std::move(newplist), spool_);
-        }
-        return *this;
+            return false;
+        });
     }
 
     template<class Checkable>
     IndexQueryResults filter(Checkable const& value) const {
-        bool rewrite = false;
-        // Check for falce positives
-        for (auto it = postinglist_.begin(); it != postinglist_.end(); ++it) {
-            auto id = *it;
-            auto str = spool_->str(id);
-            if (!value.check(str.first, str.first + str.second)) {
-                rewrite = true;
-                break;
-            }
-        }
-        if (rewrite) {
-            // This code only gets triggered when false positives are present
-            CompressedPList newplist;
-            for (auto it = postinglist_.begin(); it != postinglist_.end(); ++it) {
-                auto id = *it;
-                auto str = spool_->str(id);
-                if (value.check(str.first, str.first + str.second)) {
-                    newplist.add(id);
-                }
-            }
-            return IndexQueryResults(std::move(newplist), spool_);
-        }
-        return *this;
+        return filter_if([&value](StringT str) {
+            return value.check(str.first, str.first + str.second);
+        });
     }
 
     IndexQueryResults unique() const;
 
+    //! Return union of all results (duplicates are removed)
+    static IndexQueryResults unite(std::vector<IndexQueryResults> const& parts);
+
     IndexQueryResults intersection(IndexQueryResults const& other) const;
 
     IndexQueryResults difference(IndexQueryResults const& other) const;
@@ -635,6 +790,9 @@ struct IndexBase {
     virtual std::vector<StringT> list_metric_names() const = 0;
     virtual std::vector<StringT> list_tags(StringT metric) const = 0;
     virtual std::vector<StringT> list_tag_values(StringT metric, StringT tag) const = 0;
+    virtual std::vector<StringT> match_tag_values(StringT metric, StringT tag, TagValueFilter const& filter) const = 0;
+    virtual HyperLogLog tagvalue_sketch(TagValuePair const& value) const = 0;
+    virtual HyperLogLog metric_sketch(MetricName const& value) const = 0;
 };
 
 
@@ -660,6 +818,12 @@ public:
 
     virtual IndexQueryResults query(const IndexBase&) const = 0;
 
+    /** Estimate number of series returned by the query without running it.
+      * Estimate is an upper bound up to the sketch error. Default
+      * implementation runs the query.
+      */
+    virtual u64 estimate(const IndexBase& index) const;
+
     const char* get_name() const {
         return name_;
     }
@@ -688,6 +852,8 @@ struct IncludeIfAllTagsMatch : IndexQueryNodeBase {
     }
 
     virtual IndexQueryResults query(IndexBase const&) const;
+
+    virtual u64 estimate(IndexBase const& index) const;
 };
 
 
@@ -699,10 +865,31 @@ struct IncludeMany2Many : IndexQueryNodeBase {
     constexpr static const char* node_name_ = "many2many";
     MetricName metric_;
     std::map<std::string, std::vector<std::string>> tags_;
+    std::map<std::string, TagValueFilter> filters_;  //< Tags matched by prefix or regex
 
     IncludeMany2Many(std::string mname, std::map<std::string, std::vector<std::string>> const& map);
 
+    /**
+     * @brief IncludeMany2Many c-tor
+     * @param mname is a metric name
+     * @param map contains list of possible values for some tags
+     * @param filters contains tags that should be matched by prefix or regex,
+     *        values of these tags are looked up in the index
+     */
+    IncludeMany2Many(std::string mname,
+                     std::map<std::string, std::vector<std::string>> const& map,
+                     std::map<std::string, TagValueFilter> const& filters);
+
     virtual IndexQueryResults query(IndexBase const& index) const;
+
+    virtual u64 estimate(IndexBase const& index) const;
+
+private:
+    /** Return tags and their values, filters are replaced with the list
+      * of matching values.
+      * @return false if some filter doesn't match any value
+      */
+    bool get_tags(IndexBase const& index, std::map<std::string, std::vector<std::string>>* tags) const;
 };
 
 //                   //
@@ -735,6 +922,8 @@ struct IncludeIfHasTag : IndexQueryNodeBase {
     }
 
     virtual IndexQueryResults query(IndexBase const&) const;
+
+    virtual u64 estimate(IndexBase const& index) const;
 };
 
 //               //
@@ -759,6 +948,8 @@ struct ExcludeTags : IndexQueryNodeBase {
     }
 
     virtual IndexQueryResults query(IndexBase const&) const;
+
+    virtual u64 estimate(IndexBase const& index) const;
 };
 
 
@@ -780,6 +971,8 @@ struct JoinByTags : IndexQueryNodeBase {
     }
 
     virtual IndexQueryResults query(IndexBase const&) const;
+
+    virtual u64 estimate(IndexBase const& index) const;
 };
 
 
@@ -787,19 +980,42 @@ struct JoinByTags : IndexQueryNodeBase {
 //  SeriesNameTopology  //
 //                      //
 
+/** Metric names, tags and tag values of all series.
+  * Metric names and tags of every metric are also stored in sorted
+  * sets so prefix lookups don't need to scan the hash tables.
+  */
 class SeriesNameTopology {
     typedef StringTools::L3TableT IndexT;
     IndexT index_;
+    StringTools::SortedSetT metrics_;  //< Sorted metric names
+    StringTools::L2TableT tags_;       //< Sorted tag names of every metric
 public:
     SeriesNameTopology();
 
-    void add_name(StringT name);
+    /** Add series name to the topology.
+      * @param tokens is a metric name followed by tag names and values (should outlive the topology)
+      */
+    void add_name(std::vector<StringT> const& tokens);
 
     std::vector<StringT> list_metric_names() const;
 
     std::vector<StringT> list_tags(StringT metric) const;
 
     std::vector<StringT> list_tag_values(StringT metric, StringT tag) const;
+
+    /** Return metric names (in sorted order) that start with the prefix.
+      * @param limit is a max number of results (0 - unlimited)
+      */
+    std::vector<StringT> suggest_metric_names(StringT prefix, size_t limit) const;
+
+    //! Return tags of the metric (in sorted order) that start with the prefix
+    std::vector<StringT> suggest_tags(StringT metric, StringT prefix, size_t limit) const;
+
+    //! Return tag values (in sorted order) that start with the prefix
+    std::vector<StringT> suggest_tag_values(StringT metric, StringT tag, StringT prefix, size_t limit) const;
+
+    //! Return tag values (in sorted order) that match the filter
+    std::vector<StringT> match_tag_values(StringT metric, StringT tag, TagValueFilter const& filter) const;
 };
 
 
@@ -808,18 +1024,31 @@ public:
 //         //
 
 class Index : public IndexBase {
-    StringPool pool_;
-    StringTools::TableT table_;
+    InternedStringPool pool_;
+    StringTools::TableT table_;  //< Encoded tuple to string pool address mapping
     //CMSketch metrics_names_;
     //CMSketch tagvalue_pairs_;
     InvertedIndex metrics_names_;
     InvertedIndex tagvalue_pairs_;
     SeriesNameTopology topology_;
+    const IndexPostings postings_;
+    // Used only if postings are stored as roaring bitmaps
+    std::vector<StringT> names_;  //< Ordinal to encoded tuple mapping
+    BitmapInvertedIndex metrics_bitmaps_;
+    BitmapInvertedIndex tagvalue_bitmaps_;
+    // Cardinality sketches
+    CardinalityIndex metrics_hll_;
+    CardinalityIndex tagvalue_hll_;
 public:
-    Index();
+    Index(IndexPostings postings = IndexPostings::COMPRESSED);
+
+    IndexPostings get_postings_type() const;
 
     SeriesNameTopology const& get_topology() const;
 
+    //! Get string pool that stores series names
+    InternedStringPool const& get_pool() const;
+
     size_t cardinality() const;
 
     size_t memory_use() const;
@@ -830,7 +1059,8 @@ public:
 
     /**
      * @brief Add new string to index
-     * @return status and resulting string (scope of the string is the same as the scope of the index)
+     * @return status and series name encoded using the string pool dictionary
+     *         (scope of the string is the same as the scope of the index)
      */
     std::tuple<aku_Status, StringT> append(const char* begin, const char* end);
 
@@ -843,6 +1073,12 @@ public:
     virtual std::vector<StringT> list_tags(StringT metric) const;
 
     virtual std::vector<StringT> list_tag_values(StringT metric, StringT tag) const;
+
+    virtual std::vector<StringT> match_tag_values(StringT metric, StringT tag, TagValueFilter const& filter) const;
+
+    virtual HyperLogLog tagvalue_sketch(TagValuePair const& value) const;
+
+    virtual HyperLogLog metric_sketch(MetricName const& value) const;
 };
 
 }  // namespace
@@ -0,0 +1,410 @@
+/**
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "persistentindex.h"
+#include "util.h"
+#include "log_iface.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <apr_file_io.h>
+#include <boost/filesystem.hpp>
+
+namespace Akumuli {
+
+static const char SEGMENT_MAGIC[8] = { 'A', 'K', 'U', 'S', 'I', 'D', 'X', '1' };
+static const char FOOTER_MAGIC[8]  = { 'A', 'K', 'U', 'S', 'I', 'D', 'X', 'E' };
+static const u32  SEGMENT_VERSION  = 1;
+static const char SEGMENT_EXT[]    = ".sidx";
+
+struct SegmentHeader {
+    char magic[8];
+    u32  version;
+    u32  reserved;
+    u64  size;        //< Number of series
+    u64  names_size;  //< Size of the names section (padded)
+    u64  max_id;      //< Max absolute value of the series id
+};
+
+struct SegmentFooter {
+    char magic[8];
+    u64  size;
+};
+
+//! Compare series names, shorter name goes first if one name is a prefix of another
+static bool less_name(StringT lhs, StringT rhs) {
+    int res = memcmp(lhs.first, rhs.first, std::min(lhs.second, rhs.second));
+    return res < 0 || (res == 0 && lhs.second < rhs.second);
+}
+
+static u64 abs_id(i64 id) {
+    return static_cast<u64>(id < 0 ? -id : id);
+}
+
+//                          //
+//    SeriesIndexSegment    //
+//                          //
+
+SeriesIndexSegment::SeriesIndexSegment()
+    : names_(nullptr)
+    , name_table_(nullptr)
+    , id_table_(nullptr)
+    , size_(0)
+    , max_id_(0)
+{
+}
+
+SeriesIndexSegment::~SeriesIndexSegment() {
+}
+
+std::tuple<aku_Status, std::unique_ptr<SeriesIndexSegment>> SeriesIndexSegment::open(std::string const& path) {
+    std::unique_ptr<SeriesIndexSegment> segment;
+    std::unique_ptr<MemoryMappedFile> mmap(new MemoryMappedFile(path.c_str(), false));
+    if (mmap->is_bad()) {
+        return std::make_tuple(AKU_EIO, std::move(segment));
+    }
+    const char* begin = static_cast<const char*>(mmap->get_pointer());
+    const size_t fsize = mmap->get_size();
+    if (fsize < sizeof(SegmentHeader) + sizeof(SegmentFooter)) {
+        Logger::msg(AKU_LOG_ERROR, "Series index segment " + path + " is truncated");
+        return std::make_tuple(AKU_EBAD_DATA, std::move(segment));
+    }
+    SegmentHeader const* header = reinterpret_cast<SegmentHeader const*>(begin);
+    SegmentFooter const* footer = reinterpret_cast<SegmentFooter const*>(begin + fsize - sizeof(SegmentFooter));
+    u64 expected_size = sizeof(SegmentHeader) + header->names_size
+                      + 2*header->size*sizeof(Entry) + sizeof(SegmentFooter);
+    if (memcmp(header->magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0
+        || header->version != SEGMENT_VERSION
+        || memcmp(footer->magic, FOOTER_MAGIC, sizeof(FOOTER_MAGIC)) != 0
+        || footer->size != header->size
+        || expected_size != fsize)
+    {
+        Logger::msg(AKU_LOG_ERROR, "Series index segment " + path + " is corrupted");
+        return std::make_tuple(AKU_EBAD_DATA, std::move(segment));
+    }
+    segment.reset(new SeriesIndexSegment());
+    segment->names_      = begin + sizeof(SegmentHeader);
+    segment->name_table_ = reinterpret_cast<Entry const*>(segment->names_ + header->names_size);
+    segment->id_table_   = segment->name_table_ + header->size;
+    segment->size_       = header->size;
+    segment->max_id_     = header->max_id;
+    segment->mmap_       = std::move(mmap);
+    return std::make_tuple(AKU_SUCCESS, std::move(segment));
+}
+
+aku_Status SeriesIndexSegment::write(std::string const& path, std::vector<SeriesT> series) {
+    std::sort(series.begin(), series.end(), [](SeriesT const& lhs, SeriesT const& rhs) {
+        return lhs.second < rhs.second;
+    });
+    SegmentHeader header = {};
+    memcpy(header.magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+    header.version = SEGMENT_VERSION;
+    header.size    = series.size();
+    // Names are stored in id order
+    std::vector<char> names;
+    std::vector<Entry> id_table;
+    id_table.reserve(series.size());
+    for (auto const& item: series) {
+        Entry entry = {};
+        entry.offset = names.size();
+        entry.length = static_cast<u32>(item.first.second);
+        entry.id     = item.second;
+        names.insert(names.end(), item.first.first, item.first.first + item.first.second);
+        id_table.push_back(entry);
+        header.max_id = std::max(header.max_id, abs_id(item.second));
+    }
+    names.resize((names.size() + 7) & ~7ul, '\0');
+    header.names_size = names.size();
+    auto to_str = [&names](Entry const& entry) {
+        return std::make_pair(static_cast<const char*>(names.data() + entry.offset), entry.length);
+    };
+    std::vector<Entry> name_table(id_table);
+    std::sort(name_table.begin(), name_table.end(), [&to_str](Entry const& lhs, Entry const& rhs) {
+        return less_name(to_str(lhs), to_str(rhs));
+    });
+    for (size_t i = 1; i < name_table.size(); i++) {
+        if (!less_name(to_str(name_table[i - 1]), to_str(name_table[i]))) {
+            Logger::msg(AKU_LOG_ERROR, "Duplicate series name in series index segment");
+            return AKU_EBAD_DATA;
+        }
+    }
+    SegmentFooter footer = {};
+    memcpy(footer.magic, FOOTER_MAGIC, sizeof(FOOTER_MAGIC));
+    footer.size = series.size();
+
+    // Write everything to the temporary file
+    std::string tmp_path = path + ".tmp";
+    apr_pool_t* pool = nullptr;
+    apr_status_t status = apr_pool_create(&pool, nullptr);
+    if (status != APR_SUCCESS) {
+        return AKU_ENO_MEM;
+    }
+    std::unique_ptr<apr_pool_t, decltype(&apr_pool_destroy)> pool_ptr(pool, &apr_pool_destroy);
+    apr_file_t* file = nullptr;
+    status = apr_file_open(&file, tmp_path.c_str(), APR_WRITE|APR_BINARY|APR_CREATE|APR_TRUNCATE,
+                           APR_OS_DEFAULT, pool);
+    if (status != APR_SUCCESS) {
+        Logger::msg(AKU_LOG_ERROR, "Can't create file " + tmp_path + ", error " + apr_error_message(status));
+        return AKU_EIO;
+    }
+    auto write_all = [file](const void* data, size_t size) {
+        size_t nwritten = 0;
+        return size == 0 ? APR_SUCCESS : apr_file_write_full(file, data, size, &nwritten);
+    };
+    status = write_all(&header, sizeof(header));
+    if (status == APR_SUCCESS) {
+        status = write_all(names.data(), names.size());
+    }
+    if (status == APR_SUCCESS) {
+        status = write_all(name_table.data(), name_table.size()*sizeof(Entry));
+    }
+    if (status == APR_SUCCESS) {
+        status = write_all(id_table.data(), id_table.size()*sizeof(Entry));
+    }
+    if (status == APR_SUCCESS) {
+        status = write_all(&footer, sizeof(footer));
+    }
+    if (status == APR_SUCCESS) {
+        status = apr_file_flush(file);
+    }
+    apr_status_t close_status = apr_file_close(file);
+    if (status == APR_SUCCESS) {
+        status = close_status;
+    }
+    if (status == APR_SUCCESS) {
+        status = apr_file_rename(tmp_path.c_str(), path.c_str(), pool);
+    }
+    if (status != APR_SUCCESS) {
+        Logger::msg(AKU_LOG_ERROR, "Can't write file " + path + ", error " + apr_error_message(status));
+        apr_file_remove(tmp_path.c_str(), pool);
+        return AKU_EIO;
+    }
+    return AKU_SUCCESS;
+}
+
+i64 SeriesIndexSegment::find(StringT name) const {
+    auto end = name_table_ + size_;
+    auto it = std::lower_bound(name_table_, end, name, [this](Entry const& entry, StringT value) {
+        return less_name(std::make_pair(names_ + entry.offset, entry.length), value);
+    });
+    if (it != end && it->length == name.second && memcmp(names_ + it->offset, name.first, name.second) == 0) {
+        return it->id;
+    }
+    return 0;
+}
+
+StringT SeriesIndexSegment::find(i64 id) const {
+    if (abs_id(id) > max_id_) {
+        return std::make_pair(nullptr, 0);
+    }
+    auto end = id_table_ + size_;
+    auto it = std::lower_bound(id_table_, end, id, [](Entry const& entry, i64 value) {
+        return entry.id < value;
+    });
+    if (it != end && it->id == id) {
+        return std::make_pair(names_ + it->offset, it->length);
+    }
+    return std::make_pair(nullptr, 0);
+}
+
+size_t SeriesIndexSegment::size() const {
+    return size_;
+}
+
+SeriesIndexSegment::SeriesT SeriesIndexSegment::at(size_t ix) const {
+    Entry const& entry = id_table_[ix];
+    return std::make_pair(std::make_pair(names_ + entry.offset, entry.length), entry.id);
+}
+
+u64 SeriesIndexSegment::max_id() const {
+    return max_id_;
+}
+
+
+//                             //
+//    PersistentSeriesIndex    //
+//                             //
+
+PersistentSeriesIndex::PersistentSeriesIndex(std::string path)
+    : path_(path)
+    , max_id_(0)
+{
+}
+
+std::string PersistentSeriesIndex::segment_path(u64 first, u64 last) const {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%020llu-%020llu", static_cast<unsigned long long>(first),
+                                                        static_cast<unsigned long long>(last));
+    boost::filesystem::path result(path_);
+    result /= std::string(buffer) + SEGMENT_EXT;
+    return result.string();
+}
+
+std::tuple<aku_Status, std::shared_ptr<PersistentSeriesIndex>> PersistentSeriesIndex::open(std::string const& path) {
+    namespace fs = boost::filesystem;
+    std::shared_ptr<PersistentSeriesIndex> result;
+    boost::system::error_code error;
+    if (!fs::exists(path, error)) {
+        if (!fs::create_directories(path, error)) {
+            Logger::msg(AKU_LOG_ERROR, "Can't create directory " + path + ", " + error.message());
+            return std::make_tuple(AKU_EIO, result);
+        }
+    } else if (!fs::is_directory(path, error)) {
+        Logger::msg(AKU_LOG_ERROR, path + " is not a directory");
+        return std::make_tuple(AKU_EBAD_ARG, result);
+    }
+    result.reset(new PersistentSeriesIndex(path));
+    std::vector<SegmentDesc> segments;
+    for (fs::directory_iterator it(path, error), end; !error && it != end; it.increment(error)) {
+        auto fname = it->path().filename().string();
+        if (fname.size() > 4 && fname.compare(fname.size() - 4, 4, ".tmp") == 0) {
+            // Incomplete segment
+            fs::remove(it->path(), error);
+            continue;
+        }
+        unsigned long long first, last;
+        char ext[16] = {};
+        if (sscanf(fname.c_str(), "%llu-%llu%15s", &first, &last, ext) != 3 || strcmp(ext, SEGMENT_EXT) != 0) {
+            continue;
+        }
+        SegmentDesc desc = { first, last, nullptr };
+        segments.push_back(desc);
+    }
+    if (error) {
+        Logger::msg(AKU_LOG_ERROR, "Can't read directory " + path + ", " + error.message());
+        return std::make_tuple(AKU_EIO, nullptr);
+    }
+    std::sort(segments.begin(), segments.end(), [](SegmentDesc const& lhs, SegmentDesc const& rhs) {
+        return lhs.first < rhs.first || (lhs.first == rhs.first && lhs.last > rhs.last);
+    });
+    for (auto& desc: segments) {
+        if (!result->segments_.empty()) {
+            auto const& prev = result->segments_.back();
+            if (desc.last <= prev.last) {
+                // Segment was merged but not deleted because of the crash
+                fs::remove(result->segment_path(desc.first, desc.last), error);
+                continue;
+            }
+            if (desc.first != prev.last + 1) {
+                Logger::msg(AKU_LOG_ERROR, "Series index segments are missing in " + path);
+                return std::make_tuple(AKU_EBAD_DATA, nullptr);
+            }
+        }
+        aku_Status status;
+        std::unique_ptr<SeriesIndexSegment> segment;
+        std::tie(status, segment) = SeriesIndexSegment::open(result->segment_path(desc.first, desc.last));
+        if (status != AKU_SUCCESS) {
+            return std::make_tuple(status, nullptr);
+        }
+        result->max_id_ = std::max(result->max_id_, segment->max_id());
+        desc.segment = std::move(segment);
+        result->segments_.push_back(desc);
+    }
+    return std::make_tuple(AKU_SUCCESS, result);
+}
+
+std::tuple<aku_Status, std::shared_ptr<PersistentSeriesIndex>> PersistentSeriesIndex::create(std::string const& path) {
+    boost::system::error_code error;
+    boost::filesystem::remove_all(path, error);
+    if (error) {
+        Logger::msg(AKU_LOG_ERROR, "Can't remove " + path + ", " + error.message());
+        return std::make_tuple(AKU_EIO, nullptr);
+    }
+    return open(path);
+}
+
+std::vector<std::shared_ptr<SeriesIndexSegment>> PersistentSeriesIndex::get_segments() const {
+    std::vector<std::shared_ptr<SeriesIndexSegment>> result;
+    for (auto const& desc: segments_) {
+        result.push_back(desc.segment);
+    }
+    return result;
+}
+
+size_t PersistentSeriesIndex::cardinality() const {
+    size_t result = 0;
+    for (auto const& desc: segments_) {
+        result += desc.segment->size();
+    }
+    return result;
+}
+
+u64 PersistentSeriesIndex::max_id() const {
+    return max_id_;
+}
+
+aku_Status PersistentSeriesIndex::append(std::vector<SeriesIndexSegment::SeriesT> const& series) {
+    if (series.empty()) {
+        return AKU_SUCCESS;
+    }
+    u64 batch = segments_.empty() ? 0 : segments_.back().last + 1;
+    auto path = segment_path(batch, batch);
+    auto status = SeriesIndexSegment::write(path, series);
+    if (status != AKU_SUCCESS) {
+        return status;
+    }
+    std::unique_ptr<SeriesIndexSegment> segment;
+    std::tie(status, segment) = SeriesIndexSegment::open(path);
+    if (status != AKU_SUCCESS) {
+        return status;
+    }
+    max_id_ = std::max(max_id_, segment->max_id());
+    SegmentDesc desc = { batch, batch, std::move(segment) };
+    segments_.push_back(desc);
+    return merge_tail();
+}
+
+aku_Status PersistentSeriesIndex::merge_tail() {
+    // Merge two last segments while the older one is less than twice as large
+    // as the newer one. Segment sizes form a geometric sequence as a result.
+    while (segments_.size() > 1) {
+        auto const& lhs = segments_.at(segments_.size() - 2);
+        auto const& rhs = segments_.back();
+        if (lhs.segment->size() > 2*rhs.segment->size()) {
+            break;
+        }
+        std::vector<SeriesIndexSegment::SeriesT> series;
+        series.reserve(lhs.segment->size() + rhs.segment->size());
+        for (size_t i = 0; i < lhs.segment->size(); i++) {
+            series.push_back(lhs.segment->at(i));
+        }
+        for (size_t i = 0; i < rhs.segment->size(); i++) {
+            series.push_back(rhs.segment->at(i));
+        }
+        auto path = segment_path(lhs.first, rhs.last);
+        auto status = SeriesIndexSegment::write(path, std::move(series));
+        if (status != AKU_SUCCESS) {
+            return status;
+        }
+        std::unique_ptr<SeriesIndexSegment> segment;
+        std::tie(status, segment) = SeriesIndexSegment::open(path);
+        if (status != AKU_SUCCESS) {
+            return status;
+        }
+        // Merged files can still be used by the readers, mapping stays valid after deletion
+        boost::system::error_code error;
+        boost::filesystem::remove(segment_path(lhs.first, lhs.last), error);
+        boost::filesystem::remove(segment_path(rhs.first, rhs.last), error);
+        SegmentDesc desc = { lhs.first, rhs.last, std::move(segment) };
+        segments_.pop_back();
+        segments_.back() = desc;
+    }
+    return AKU_SUCCESS;
+}
+
+}  // namespace
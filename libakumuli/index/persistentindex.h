@@ -0,0 +1,145 @@
+/**
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "akumuli_def.h"
+#include "index/stringpool.h"
+
+namespace Akumuli {
+
+class MemoryMappedFile;
+
+/** Immutable memory mapped file that contains series names and their ids.
+  * File layout:
+  * - header;
+  * - series names (canonical form, concatenated);
+  * - name table, entries sorted by series name;
+  * - id table, entries sorted by series id;
+  * - footer, it's written last and used to detect incomplete files.
+  * Lookups use binary search so the file can be used without loading
+  * it into memory.
+  */
+class SeriesIndexSegment {
+public:
+    struct Entry {
+        u64 offset;  //< Offset of the name inside the names section
+        u32 length;  //< Name length
+        u32 reserved;
+        i64 id;      //< Series id
+    };
+
+    //! Series name and id
+    typedef std::pair<StringT, i64> SeriesT;
+
+private:
+    std::unique_ptr<MemoryMappedFile> mmap_;
+    const char*  names_;
+    Entry const* name_table_;
+    Entry const* id_table_;
+    u64          size_;
+    u64          max_id_;
+
+    SeriesIndexSegment();
+public:
+    ~SeriesIndexSegment();
+
+    /** Open existing segment.
+      * @param path is a file name
+      * @return status and segment (or null on error)
+      */
+    static std::tuple<aku_Status, std::unique_ptr<SeriesIndexSegment>> open(std::string const& path);
+
+    /** Write new segment. Series names should be unique.
+      * @param path is a file name, file is written under temporary name and then renamed
+      * @param series is a list of series names and ids
+      */
+    static aku_Status write(std::string const& path, std::vector<SeriesT> series);
+
+    //! Return id of the series or 0 if series is not in the segment
+    i64 find(StringT name) const;
+
+    //! Return name of the series or empty string if series is not in the segment
+    StringT find(i64 id) const;
+
+    //! Number of series in the segment
+    size_t size() const;
+
+    //! Return series by index (series are ordered by id)
+    SeriesT at(size_t ix) const;
+
+    //! Max absolute value of the series id stored in the segment
+    u64 max_id() const;
+};
+
+
+/** Persistent series index.
+  * Directory with series index segments. New series names are written
+  * to the new segment, small segments are merged together so the number
+  * of segments is logarithmic in number of series. Segment file names
+  * contain the range of batch numbers stored in the segment, this range
+  * is used to recover after crash during merge.
+  */
+class PersistentSeriesIndex {
+    struct SegmentDesc {
+        u64 first;  //< First batch number
+        u64 last;   //< Last batch number
+        std::shared_ptr<SeriesIndexSegment> segment;
+    };
+    std::string              path_;
+    std::vector<SegmentDesc> segments_;
+    u64                      max_id_;
+
+    PersistentSeriesIndex(std::string path);
+
+    std::string segment_path(u64 first, u64 last) const;
+
+    //! Merge last segments if needed
+    aku_Status merge_tail();
+public:
+    /** Open persistent index, create empty index if directory doesn't exist.
+      * @param path is a directory name
+      * @return status and index, error status means that index is corrupted and
+      *         should be recreated
+      */
+    static std::tuple<aku_Status, std::shared_ptr<PersistentSeriesIndex>> open(std::string const& path);
+
+    /** Delete all index files and create empty index.
+      * @param path is a directory name
+      */
+    static std::tuple<aku_Status, std::shared_ptr<PersistentSeriesIndex>> create(std::string const& path);
+
+    //! Return all segments
+    std::vector<std::shared_ptr<SeriesIndexSegment>> get_segments() const;
+
+    //! Number of series in the index
+    size_t cardinality() const;
+
+    //! Max absolute value of the series id or 0 if index is empty
+    u64 max_id() const;
+
+    /** Write new series names to the index.
+      * Every new series should have larger absolute id value than the series
+      * that was added previously.
+      */
+    aku_Status append(std::vector<SeriesIndexSegment::SeriesT> const& series);
+};
+
+}  // namespace
@@ -19,6 +19,7 @@
 #include "util.h"
 #include "datetime.h"
 #include "status_util.h"
+#include "log_iface.h"
 
 #include <string>
 #include <map>
@@ -27,6 +28,7 @@
 
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
+#include <boost/exception/diagnostic_information.hpp>
 
 namespace Akumuli {
 
@@ -36,37 +38,112 @@ namespace Akumuli {
 
 static const StringT EMPTY = std::make_pair(nullptr, 0);
 
-SeriesMatcher::SeriesMatcher(i64 starting_id)
-    : table(StringTools::create_table(0x1000))
+SeriesMatcher::SeriesMatcher(i64 starting_id, IndexPostings postings)
+    : index(postings)
     , series_id(starting_id)
+    , cardinality_limit(0)
+    , id_range_size(0)
+    , id_ranges(StringTools::create_table(0x1000))
+    , loaded{true}
+    , stop_load(false)
 {
     if (starting_id == 0u) {
         AKU_PANIC("Bad series ID");
     }
 }
 
+SeriesMatcher::~SeriesMatcher() {
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        stop_load = true;
+    }
+    if (loader.joinable()) {
+        loader.join();
+    }
+}
+
+void SeriesMatcher::attach(std::vector<SegmentT> const& segs) {
+    if (segs.empty()) {
+        return;
+    }
+    segments = segs;
+    loaded.store(false);
+    loader = std::thread(&SeriesMatcher::load_segments, this);
+}
+
+void SeriesMatcher::load_segments() {
+    // Series are loaded in small batches to avoid blocking writers for too long
+    const size_t BATCH_SIZE = 0x1000;
+    for (auto const& segment: segments) {
+        for (size_t i = 0; i < segment->size(); i += BATCH_SIZE) {
+            std::lock_guard<std::mutex> guard(mutex);
+            if (stop_load) {
+                return;
+            }
+            size_t end = std::min(segment->size(), i + BATCH_SIZE);
+            for (size_t j = i; j < end; j++) {
+                auto series = segment->at(j);
+                try {
+                    _add_unlocked(series.first.first, series.first.first + series.first.second, series.second);
+                } catch (...) {
+                    Logger::msg(AKU_LOG_ERROR, "Can't load series " + std::to_string(series.second) + ": " +
+                                               boost::current_exception_diagnostic_information());
+                }
+            }
+        }
+    }
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        loaded.store(true);
+    }
+    load_cond.notify_all();
+}
+
+void SeriesMatcher::wait_for_segments(std::unique_lock<std::mutex>& lock) const {
+    load_cond.wait(lock, [this] { return loaded.load(); });
+}
+
 i64 SeriesMatcher::add(const char* begin, const char* end) {
     std::lock_guard<std::mutex> guard(mutex);
-    auto prev_id = series_id++;
-    auto id = prev_id;
-    if (*begin == '!') {
-        // Series name starts with ! which mean that we're dealing with event
-        id = -1*id;
-    }
     aku_Status status;
     StringT sname;
     std::tie(status, sname) = index.append(begin, end);
     if (status != AKU_SUCCESS) {
-        series_id = id;
         return 0;
     }
-    auto tup = std::make_tuple(std::get<0>(sname), std::get<1>(sname), id);
-    table[sname] = id;
-    inv_table[id] = sname;
-    names.push_back(tup);
+    auto id = next_id(index.get_pool().metric(sname));
+    if (*begin == '!') {
+        // Series name starts with ! which mean that we're dealing with event
+        id = -1*id;
+    }
+    lookup.insert(sname, id);
+    // Name is rebuilt because `sname` is stored in the interned form
+    names_storage.emplace_back();
+    std::string& name = names_storage.back();
+    index.get_pool().decode(sname, &name);
+    names.push_back(std::make_tuple(name.data(), static_cast<int>(name.size()), id));
     return id;
 }
 
+i64 SeriesMatcher::next_id(StringT metric) {
+    if (id_range_size == 0) {
+        return series_id++;
+    }
+    auto range = static_cast<i64>(id_range_size);
+    auto key = std::make_pair(metric.first, static_cast<int>(metric.second));
+    auto it = id_ranges.find(key);
+    if (it == id_ranges.end()) {
+        it = id_ranges.insert(std::make_pair(key, 0)).first;
+    }
+    if (it->second % range == 0) {
+        // Range is exhausted or metric is new, reserve next aligned range
+        i64 start = ((series_id + range - 1) / range) * range;
+        series_id = start + range;
+        it->second = start;
+    }
+    return it->second++;
+}
+
 void SeriesMatcher::_add(std::string series, i64 id) {
     if (series.empty()) {
         return;
@@ -76,110 +153,112 @@ void SeriesMatcher::_add(std::string series, i64 id) {
 
 void SeriesMatcher::_add(const char*  begin, const char* end, i64 id) {
     std::lock_guard<std::mutex> guard(mutex);
+    _add_unlocked(begin, end, id);
+}
+
+void SeriesMatcher::_add_unlocked(const char*  begin, const char* end, i64 id) {
     aku_Status status;
     StringT sname;
     std::tie(status, sname) = index.append(begin, end);
     StatusUtil::throw_on_error(status);
-    table[sname] = id;
-    inv_table[id] = sname;
+    lookup.insert(sname, id);
 }
 
 i64 SeriesMatcher::match(const char* begin, const char* end) const {
     int len = static_cast<int>(end - begin);
-    StringT str = std::make_pair(begin, len);
-
-    std::lock_guard<std::mutex> guard(mutex);
-    auto it = table.find(str);
-    if (it == table.end()) {
-        return 0ul;
+    char tuple[InternedStringPool::MAX_TUPLE_SIZE];
+    auto size = index.get_pool().encode(begin, end, tuple, sizeof(tuple));
+    // Name can't be in the index if some of its strings are not in the dictionary
+    i64 id = size == 0 ? 0 : lookup.find(std::make_pair(static_cast<const char*>(tuple), static_cast<int>(size)));
+    if (id == 0 && !loaded.load()) {
+        // Segments are immutable and can be used without locking
+        for (auto const& segment: segments) {
+            id = segment->find(std::make_pair(begin, static_cast<u32>(len)));
+            if (id != 0) {
+                break;
+            }
+        }
     }
-    return it->second;
+    return id;
 }
 
-StringT SeriesMatcher::id2str(i64 tokenid) const {
-    std::lock_guard<std::mutex> guard(mutex);
-    auto it = inv_table.find(tokenid);
-    if (it == inv_table.end()) {
-        return EMPTY;
+bool SeriesMatcher::id2str(i64 tokenid, std::string* name) const {
+    auto tuple = lookup.find(tokenid);
+    if (tuple.second != 0) {
+        return index.get_pool().decode(std::make_pair(tuple.first, static_cast<u32>(tuple.second)), name);
     }
-    return it->second;
+    if (!loaded.load()) {
+        for (auto const& segment: segments) {
+            auto res = segment->find(tokenid);
+            if (res.second != 0) {
+                name->assign(res.first, res.first + res.second);
+                return true;
+            }
+        }
+    }
+    name->clear();
+    return false;
 }
 
-void SeriesMatcher::pull_new_names(std::vector<PlainSeriesMatcher::SeriesNameT> *buffer) {
+void SeriesMatcher::pull_new_names(std::vector<PlainSeriesMatcher::SeriesNameT> *buffer,
+                                   std::deque<std::string>* storage)
+{
     std::lock_guard<std::mutex> guard(mutex);
     std::swap(names, *buffer);
+    std::swap(names_storage, *storage);
 }
 
 std::vector<i64> SeriesMatcher::get_all_ids() const {
     std::vector<i64> result;
     {
-        std::lock_guard<std::mutex> guard(mutex);
-        for (auto const &tup: inv_table) {
-            result.push_back(tup.first);
-        }
+        std::unique_lock<std::mutex> guard(mutex);
+        wait_for_segments(guard);
     }
+    result = lookup.get_ids();
     std::sort(result.begin(), result.end());
     return result;
 }
 
-std::vector<SeriesMatcher::SeriesNameT> SeriesMatcher::search(IndexQueryNodeBase const& query) const {
-    std::vector<SeriesMatcher::SeriesNameT> result;
-    std::lock_guard<std::mutex> guard(mutex);
+std::vector<i64> SeriesMatcher::search(IndexQueryNodeBase const& query) const {
+    std::vector<i64> result;
+    std::unique_lock<std::mutex> guard(mutex);
+    wait_for_segments(guard);
     auto resultset = query.query(index);
     for (auto it = resultset.begin(); it != resultset.end(); ++it) {
-        auto str = *it;
-        auto fit = table.find(str);
-        if (fit == table.end()) {
+        auto tuple = *it;
+        auto id = lookup.find(std::make_pair(tuple.first, static_cast<int>(tuple.second)));
+        if (id == 0) {
             AKU_PANIC("Invalid index state");
         }
-        result.push_back(std::make_tuple(str.first, str.second, fit->second));
+        result.push_back(id);
     }
     return result;
 }
 
-std::vector<StringT> SeriesMatcher::suggest_metric(std::string prefix) const {
-    std::vector<StringT> results;
-    std::lock_guard<std::mutex> guard(mutex);
-    results = index.get_topology().list_metric_names();
-    auto resit = std::remove_if(results.begin(), results.end(), [prefix](StringT val) {
-        if (val.second < prefix.size()) {
-            return true;
-        }
-        auto eq = std::equal(prefix.begin(), prefix.end(), val.first);
-        return !eq;
-    });
-    results.erase(resit, results.end());
-    return results;
+u64 SeriesMatcher::estimate(IndexQueryNodeBase const& query) const {
+    std::unique_lock<std::mutex> guard(mutex);
+    wait_for_segments(guard);
+    return query.estimate(index);
 }
 
-std::vector<StringT> SeriesMatcher::suggest_tags(std::string metric, std::string tag_prefix) const {
-    std::vector<StringT> results;
-    std::lock_guard<std::mutex> guard(mutex);
-    results = index.get_topology().list_tags(tostrt(metric));
-    auto resit = std::remove_if(results.begin(), results.end(), [tag_prefix](StringT val) {
-        if (val.second < tag_prefix.size()) {
-            return true;
-        }
-        auto eq = std::equal(tag_prefix.begin(), tag_prefix.end(), val.first);
-        return !eq;
-    });
-    results.erase(resit, results.end());
-    return results;
+std::vector<StringT> SeriesMatcher::suggest_metric(std::string prefix, size_t limit) const {
+    std::unique_lock<std::mutex> guard(mutex);
+    wait_for_segments(guard);
+    return index.get_topology().suggest_metric_names(tostrt(prefix), limit);
 }
 
-std::vector<StringT> SeriesMatcher::suggest_tag_values(std::string metric, std::string tag, std::string value_prefix) const {
-    std::vector<StringT> results;
-    std::lock_guard<std::mutex> guard(mutex);
-    results = index.get_topology().list_tag_values(tostrt(metric), tostrt(tag));
-    auto resit = std::remove_if(results.begin(), results.end(), [value_prefix](StringT val) {
-        if (val.second < value_prefix.size()) {
-            return true;
-        }
-        auto eq = std::equal(value_prefix.begin(), value_prefix.end(), val.first);
-        return !eq;
-    });
-    results.erase(resit, results.end());
-    return results;
+std::vector<StringT> SeriesMatcher::suggest_tags(std::string metric, std::string tag_prefix, size_t limit) const {
+    std::unique_lock<std::mutex> guard(mutex);
+    wait_for_segments(guard);
+    return index.get_topology().suggest_tags(tostrt(metric), tostrt(tag_prefix), limit);
+}
+
+std::vector<StringT> SeriesMatcher::suggest_tag_values(std::string metric, std::string tag, std::string value_prefix,
+                                                       size_t limit) const
+{
+    std::unique_lock<std::mutex> guard(mutex);
+    wait_for_segments(guard);
+    return index.get_topology().suggest_tag_values(tostrt(metric), tostrt(tag), tostrt(value_prefix), limit);
 }
 
 size_t SeriesMatcher::memory_use() const {
@@ -258,6 +337,12 @@ StringT PlainSeriesMatcher::id2str(i64 tokenid) const {
     return it->second;
 }
 
+bool PlainSeriesMatcher::id2str(i64 tokenid, std::string* name) const {
+    auto str = id2str(tokenid);
+    name->assign(str.first, str.first + str.second);
+    return str.second != 0;
+}
+
 void PlainSeriesMatcher::pull_new_names(std::vector<PlainSeriesMatcher::SeriesNameT> *buffer) {
     std::lock_guard<std::mutex> guard(mutex);
     std::swap(names, *buffer);
@@ -671,10 +756,14 @@ void GroupByTag::refresh_() {
             filter.insert(std::make_pair(tag.data(), tag.size()));
         }
         char buffer[AKU_LIMITS_MAX_SNAME];
-        for (auto item: results) {
+        std::string sname;
+        for (auto id: results) {
+            if (!matcher_.id2str(id, &sname)) {
+                continue;
+            }
             aku_Status status;
             SeriesParser::StringT result, stritem;
-            stritem = std::make_pair(std::get<0>(item), std::get<1>(item));
+            stritem = std::make_pair(sname.data(), static_cast<int>(sname.size()));
             std::tie(status, result) = SeriesParser::filter_tags(stritem, filter, buffer, type_ == GroupByOpType::GROUP);
             if (status == AKU_SUCCESS) {
                 if (funcs_.size() != 0) {
@@ -693,14 +782,14 @@ void GroupByTag::refresh_() {
                     auto localid = local_matcher_.add(result.first, result.first + result.second);
                     auto str = local_matcher_.id2str(localid);
                     snames_.insert(str);
-                    ids_[static_cast<aku_ParamId>(std::get<2>(item))] = static_cast<aku_ParamId>(localid);
+                    ids_[static_cast<aku_ParamId>(id)] = static_cast<aku_ParamId>(localid);
                 } else {
                     // local name already created
                     auto localid = local_matcher_.match(result.first, result.first + result.second);
                     if (localid == 0ul) {
                         AKU_PANIC("inconsistent matcher state");
                     }
-                    ids_[static_cast<aku_ParamId>(std::get<2>(item))] = static_cast<aku_ParamId>(localid);
+                    ids_[static_cast<aku_ParamId>(id)] = static_cast<aku_ParamId>(localid);
                 }
             }
         }
@@ -18,11 +18,16 @@
 #include "akumuli_def.h"
 #include "index/stringpool.h"
 #include "index/invertedindex.h"
+#include "index/persistentindex.h"
 
+#include <atomic>
+#include <condition_variable>
 #include <deque>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <string>
+#include <thread>
 #include <stdint.h>
 #include <tuple>
 #include <unordered_map>
@@ -33,6 +38,9 @@ namespace Akumuli {
 
 static const i64 AKU_STARTING_SERIES_ID = 1024;
 
+//! Max number of results returned by the suggest query by default
+static const size_t AKU_DEFAULT_SUGGEST_LIMIT = 1000;
+
 struct SeriesMatcherBase {
 
     virtual ~SeriesMatcherBase() = default;
@@ -61,15 +69,19 @@ struct SeriesMatcherBase {
     virtual i64 match(const char* begin, const char* end) const = 0;
 
     /**
-      * Convert id to string
+      * Convert id to string.
+      * @param name is an output parameter that receives the series name
+      * @return false if id is unknown
       */
-    virtual StringT id2str(i64 tokenid) const = 0;
+    virtual bool id2str(i64 tokenid, std::string* name) const = 0;
 };
 
 /** Series index. Can be used to retreive series names and ids by tags.
   * Implements inverted index with compression and other optimizations.
   * It's more efficient than PlainSeriesMatcher but it's costly to have
   * many instances in one application.
+  * Series names are stored in interned form (as tuples of dictionary ids)
+  * and rebuilt on demand by `id2str`.
   */
 struct SeriesMatcher : SeriesMatcherBase {
     //! Series name descriptor - pointer to string, length, series id.
@@ -79,19 +91,49 @@ struct SeriesMatcher : SeriesMatcherBase {
     typedef StringTools::InvT   InvT;
 
     Index                    index;      //! Series name index and storage
-    TableT                   table;      //! Series table (name to id mapping)
-    InvT                     inv_table;  //! Ids table (id to name mapping)
+    ConcurrentStringTable    lookup;     //! Encoded name to id and id to encoded name mapping with lock-free reads
     i64                      series_id;  //! Series ID counter, positive values
                                          //! are resurved for metrics, negative are for events
     std::vector<SeriesNameT> names;      //! List of recently added names
+    std::deque<std::string>  names_storage;  //! Storage for the recently added names
     mutable std::mutex       mutex;      //! Mutex for shared data
-
-    SeriesMatcher(i64 starting_id=AKU_STARTING_SERIES_ID);
+    u64                      cardinality_limit;  //! Max estimated number of series per query (0 - unlimited)
+    u64                      id_range_size;  //! Number of ids reserved for the metric at once (0 - sequential ids)
+    TableT                   id_ranges;  //! Metric name to next id in the metric's range mapping
+
+    // Persistent index support
+    typedef std::shared_ptr<SeriesIndexSegment> SegmentT;
+    std::vector<SegmentT>    segments;   //! Persistent index segments (not changed after `attach`)
+    std::atomic<bool>        loaded;     //! Content of the segments is loaded into memory
+    bool                     stop_load;  //! Interrupt loading
+    mutable std::condition_variable load_cond;
+    std::thread              loader;
+
+    SeriesMatcher(i64 starting_id=AKU_STARTING_SERIES_ID, IndexPostings postings=IndexPostings::COMPRESSED);
+
+    ~SeriesMatcher();
+
+    /** Attach segments of the persistent index. Series from the segments can be
+      * matched immediately. Search queries are blocked until the content of the
+      * segments is loaded into memory by the background thread.
+      * Should be called only once before matcher is used.
+      */
+    void attach(std::vector<SegmentT> const& segs);
 
     /** Add new string to matcher.
       */
     i64 add(const char* begin, const char* end);
 
+    /** Allocate id for the new series (should be called under the lock).
+      * If `id_range_size` is set every metric gets its own range of ids
+      * so series of the same metric have adjacent ids. When the range
+      * is exhausted the new range is reserved after all ids that was
+      * allocated so far. Ranges are aligned by the range size. Ranges are
+      * not restored after restart, every metric gets a new range instead.
+      * @param metric is a metric name (should be stored in the index)
+      */
+    i64 next_id(StringT metric);
+
     /** Add value to matcher. This function should be
       * used only to load data to matcher. Internal
       * `series_id` counter wouldn't be affected by this call, so
@@ -106,30 +148,51 @@ struct SeriesMatcher : SeriesMatcherBase {
       */
     void _add(const char* begin, const char* end, i64 id);
 
+    //! Same as `_add` but should be called under the lock
+    void _add_unlocked(const char* begin, const char* end, i64 id);
+
+    //! Load content of the attached segments into memory
+    void load_segments();
+
+    //! Wait until content of the attached segments is loaded (should be called under the lock)
+    void wait_for_segments(std::unique_lock<std::mutex>& lock) const;
+
     /**
       * Match string and return it's id. If string is new return 0.
+      * This method doesn't acquire the lock.
       */
     i64 match(const char* begin, const char* end) const;
 
     /**
-      * Convert id to string
+      * Convert id to string. Series name is rebuilt from the interned form.
+      * This method doesn't acquire the lock.
       */
-    StringT id2str(i64 tokenid) const;
+    bool id2str(i64 tokenid, std::string* name) const;
 
     /** Push all new elements to the buffer.
       * @param buffer is an output parameter that will receive new elements
+      * @param storage is an output parameter that will receive strings referenced by new elements
       */
-    void pull_new_names(std::vector<SeriesNameT>* buffer);
+    void pull_new_names(std::vector<SeriesNameT>* buffer, std::deque<std::string>* storage);
 
     std::vector<i64> get_all_ids() const;
 
-    std::vector<SeriesNameT> search(IndexQueryNodeBase const& query) const;
+    //! Return ids of the series that match the query (names can be retreived using `id2str`)
+    std::vector<i64> search(IndexQueryNodeBase const& query) const;
 
-    std::vector<StringT> suggest_metric(std::string prefix) const;
+    //! Estimate number of series returned by the query without running it
+    u64 estimate(IndexQueryNodeBase const& query) const;
 
-    std::vector<StringT> suggest_tags(std::string metric, std::string tag_prefix) const;
+    /** Return metric names that start with the prefix (in sorted order).
+      * @param limit is a max number of results (0 - unlimited)
+      */
+    std::vector<StringT> suggest_metric(std::string prefix, size_t limit = AKU_DEFAULT_SUGGEST_LIMIT) const;
+
+    std::vector<StringT> suggest_tags(std::string metric, std::string tag_prefix,
+                                      size_t limit = AKU_DEFAULT_SUGGEST_LIMIT) const;
 
-    std::vector<StringT> suggest_tag_values(std::string metric, std::string tag, std::string value_prefix) const;
+    std::vector<StringT> suggest_tag_values(std::string metric, std::string tag, std::string value_prefix,
+                                            size_t limit = AKU_DEFAULT_SUGGEST_LIMIT) const;
 
     size_t memory_use() const;
 
@@ -188,6 +251,8 @@ struct PlainSeriesMatcher : SeriesMatcherBase {
     //! Convert id to string
     StringT id2str(i64 tokenid) const;
 
+    bool id2str(i64 tokenid, std::string* name) const;
+
     /** Push all new elements to the buffer.
       * @param buffer is an output parameter that will receive new elements
       */
@@ -15,6 +15,8 @@
  */
 
 #include "stringpool.h"
+#include <algorithm>
+#include <cassert>
 #include <boost/regex.hpp>
 
 namespace Akumuli {
@@ -218,6 +220,11 @@ bool StringTools::equal(StringT lhs, StringT rhs) {
     return std::equal(lhs.first, lhs.first + lhs.second, rhs.first);
 }
 
+bool StringTools::less(StringT lhs, StringT rhs) {
+    return std::lexicographical_compare(lhs.first, lhs.first + lhs.second,
+                                        rhs.first, rhs.first + rhs.second);
+}
+
 StringTools::TableT StringTools::create_table(size_t size) {
     return TableT(size, &StringTools::hash, &StringTools::equal);
 }
@@ -226,6 +233,10 @@ StringTools::SetT StringTools::create_set(size_t size) {
     return SetT(size);
 }
 
+StringTools::SortedSetT StringTools::create_sorted_set() {
+    return SortedSetT(&StringTools::less);
+}
+
 StringTools::L2TableT StringTools::create_l2_table(size_t size_hint) {
     return L2TableT(size_hint, &StringTools::hash, &StringTools::equal);
 }
@@ -234,5 +245,359 @@ StringTools::L3TableT StringTools::create_l3_table(size_t size_hint) {
     return L3TableT(size_hint, &StringTools::hash, &StringTools::equal);
 }
 
+//                                   //
+//      Concurrent String Table      //
+//                                   //
+
+ConcurrentStringTable::SlotArray::SlotArray(size_t size)
+    : mask(size - 1)
+    , slots(new std::atomic<Entry const*>[size])
+{
+    assert((size & mask) == 0);
+    for (size_t i = 0; i < size; i++) {
+        slots[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+ConcurrentStringTable::ConcurrentStringTable(size_t size_hint)
+    : current_(nullptr)
+    , size_(0)
+    , id_current_(nullptr)
+    , id_size_(0)
+{
+    size_t size = 0x10;
+    while (size < size_hint*2) {
+        size *= 2;
+    }
+    arrays_.emplace_back(new SlotArray(size));
+    current_.store(arrays_.back().get(), std::memory_order_release);
+    id_arrays_.emplace_back(new SlotArray(size));
+    id_current_.store(id_arrays_.back().get(), std::memory_order_release);
+}
+
+size_t ConcurrentStringTable::slot_index(size_t hash, size_t mask) {
+    // djb2 hash has weak low bits, mix them before masking
+    hash ^= hash >> 17;
+    hash *= 0x9E3779B97F4A7C15ull;
+    hash ^= hash >> 29;
+    return hash & mask;
+}
+
+bool ConcurrentStringTable::put(SlotArray const* array, Entry const* entry) {
+    size_t ix = slot_index(entry->hash, array->mask);
+    while (true) {
+        Entry const* curr = array->slots[ix].load(std::memory_order_relaxed);
+        if (curr == nullptr) {
+            array->slots[ix].store(entry, std::memory_order_release);
+            return true;
+        }
+        if (curr->hash == entry->hash && StringTools::equal(curr->str, entry->str)) {
+            // Replace existing entry, readers will see either old or new one
+            array->slots[ix].store(entry, std::memory_order_release);
+            return false;
+        }
+        ix = (ix + 1) & array->mask;
+    }
+}
+
+bool ConcurrentStringTable::put_id(SlotArray const* array, Entry const* entry) {
+    size_t ix = slot_index(static_cast<size_t>(entry->id), array->mask);
+    while (true) {
+        Entry const* curr = array->slots[ix].load(std::memory_order_relaxed);
+        if (curr == nullptr) {
+            array->slots[ix].store(entry, std::memory_order_release);
+            return true;
+        }
+        if (curr->id == entry->id) {
+            array->slots[ix].store(entry, std::memory_order_release);
+            return false;
+        }
+        ix = (ix + 1) & array->mask;
+    }
+}
+
+i64 ConcurrentStringTable::find(StringT str) const {
+    SlotArray const* array = current_.load(std::memory_order_acquire);
+    size_t hash = StringTools::hash(str);
+    size_t ix = slot_index(hash, array->mask);
+    while (true) {
+        Entry const* curr = array->slots[ix].load(std::memory_order_acquire);
+        if (curr == nullptr) {
+            return 0;
+        }
+        if (curr->hash == hash && StringTools::equal(curr->str, str)) {
+            return curr->id;
+        }
+        ix = (ix + 1) & array->mask;
+    }
+}
+
+StringTools::StringT ConcurrentStringTable::find(i64 id) const {
+    SlotArray const* array = id_current_.load(std::memory_order_acquire);
+    size_t ix = slot_index(static_cast<size_t>(id), array->mask);
+    while (true) {
+        Entry const* curr = array->slots[ix].load(std::memory_order_acquire);
+        if (curr == nullptr) {
+            return std::make_pair(nullptr, 0);
+        }
+        if (curr->id == id) {
+            return curr->str;
+        }
+        ix = (ix + 1) & array->mask;
+    }
+}
+
+std::vector<i64> ConcurrentStringTable::get_ids() const {
+    std::vector<i64> result;
+    SlotArray const* array = id_current_.load(std::memory_order_acquire);
+    result.reserve(id_size_.load(std::memory_order_relaxed));
+    for (size_t i = 0; i <= array->mask; i++) {
+        Entry const* curr = array->slots[i].load(std::memory_order_acquire);
+        if (curr != nullptr) {
+            result.push_back(curr->id);
+        }
+    }
+    return result;
+}
+
+void ConcurrentStringTable::insert_entry(std::vector<std::unique_ptr<SlotArray>>* arrays,
+                                         std::atomic<SlotArray const*>* current,
+                                         std::atomic<size_t>* size,
+                                         Entry const* entry,
+                                         bool (*putfn)(SlotArray const*, Entry const*))
+{
+    SlotArray const* array = current->load(std::memory_order_relaxed);
+    size_t nelements = size->load(std::memory_order_relaxed);
+    if ((nelements + 1)*2 > array->mask + 1) {
+        // Load factor is too high, readers can use the old array
+        // while the new one is being populated.
+        std::unique_ptr<SlotArray> next(new SlotArray((array->mask + 1)*2));
+        for (size_t i = 0; i <= array->mask; i++) {
+            Entry const* curr = array->slots[i].load(std::memory_order_relaxed);
+            if (curr != nullptr) {
+                putfn(next.get(), curr);
+            }
+        }
+        array = next.get();
+        arrays->push_back(std::move(next));
+        current->store(array, std::memory_order_release);
+    }
+    if (putfn(array, entry)) {
+        size->store(nelements + 1, std::memory_order_relaxed);
+    }
+}
+
+void ConcurrentStringTable::insert(StringT str, i64 id) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    Entry entry = { StringTools::hash(str), str, id };
+    entries_.push_back(entry);
+    Entry const* pentry = &entries_.back();
+    insert_entry(&arrays_, &current_, &size_, pentry, &ConcurrentStringTable::put);
+    insert_entry(&id_arrays_, &id_current_, &id_size_, pentry, &ConcurrentStringTable::put_id);
+}
+
+size_t ConcurrentStringTable::size() const {
+    return size_.load(std::memory_order_relaxed);
+}
+
+//                          //
+//   Interned String Pool   //
+//                          //
+
+namespace {
+
+//! Empty strings are not stored in the string pool
+const char* EMPTY_TOKEN = "";
+
+//! Write base128 encoded value to the buffer, return false on overflow
+bool put_base128(u64 value, char** pout, char* end) {
+    char* p = *pout;
+    while (value >= 0x80) {
+        if (p == end) {
+            return false;
+        }
+        *p++ = static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    if (p == end) {
+        return false;
+    }
+    *p++ = static_cast<char>(value);
+    *pout = p;
+    return true;
 }
 
+//! Read base128 encoded value, return false on error
+bool get_base128(const char** pbegin, const char* end, u64* value) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(*pbegin);
+    const unsigned char* e = reinterpret_cast<const unsigned char*>(end);
+    u64 acc = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (p == e) {
+            return false;
+        }
+        acc |= static_cast<u64>(*p & 0x7F) << shift;
+        if ((*p++ & 0x80) == 0) {
+            *value = acc;
+            *pbegin = reinterpret_cast<const char*>(p);
+            return true;
+        }
+    }
+    return false;
+}
+
+/** Split series name in canonical form into tokens (metric name followed
+  * by tag names and values) and pass every token to `fn`.
+  * @return false if name is malformed or `fn` returned false
+  */
+template<class Fn>
+bool visit_tokens(const char* begin, const char* end, Fn const& fn) {
+    const char* p = begin;
+    // Metric name can contain escaped spaces
+    while (p < end && (*p != ' ' || (p != begin && p[-1] == '\\'))) {
+        p++;
+    }
+    if (p == begin || !fn(begin, p)) {
+        return false;
+    }
+    while (p < end) {
+        const char* tag = ++p;
+        while (p < end && *p != '=' && *p != ' ') {
+            p++;
+        }
+        if (p == end || *p != '=' || !fn(tag, p)) {
+            return false;
+        }
+        const char* value = ++p;
+        while (p < end && *p != ' ') {
+            p++;
+        }
+        if (!fn(value, p)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+InternedStringPool::InternedStringPool()
+    : dict_(0x1000)
+{
+}
+
+i64 InternedStringPool::intern(const char* begin, const char* end) {
+    StringTools::StringT str = std::make_pair(begin, static_cast<int>(end - begin));
+    auto id = dict_.find(str);
+    if (id != 0) {
+        return id;
+    }
+    if (begin == end) {
+        str.first = EMPTY_TOKEN;
+    } else {
+        auto addr = dict_pool_.add(begin, end);
+        if (addr == 0) {
+            return 0;
+        }
+        str.first = dict_pool_.str(addr).first;  // str has the same lifetime as the pool
+    }
+    id = static_cast<i64>(dict_.size()) + 1;
+    dict_.insert(str, id);
+    return id;
+}
+
+u64 InternedStringPool::add(const char* begin, const char* end) {
+    // Check the name first so the dictionary is not modified if the name is malformed
+    auto valid = visit_tokens(begin, end, [](const char*, const char*) {
+        return true;
+    });
+    if (!valid) {
+        return 0;
+    }
+    char buffer[MAX_TUPLE_SIZE];
+    char* it = buffer;
+    bool success = visit_tokens(begin, end, [&](const char* tbegin, const char* tend) {
+        auto id = intern(tbegin, tend);
+        return id != 0 && put_base128(static_cast<u64>(id), &it, buffer + MAX_TUPLE_SIZE);
+    });
+    if (!success) {
+        return 0;
+    }
+    return pool_.add(buffer, it);
+}
+
+size_t InternedStringPool::encode(const char* begin, const char* end, char* out, size_t size) const {
+    char* it = out;
+    bool success = visit_tokens(begin, end, [&](const char* tbegin, const char* tend) {
+        auto id = dict_.find(std::make_pair(tbegin, static_cast<int>(tend - tbegin)));
+        return id != 0 && put_base128(static_cast<u64>(id), &it, out + size);
+    });
+    return success ? static_cast<size_t>(it - out) : 0;
+}
+
+StringT InternedStringPool::tuple(u64 bits) const {
+    return pool_.str(bits);
+}
+
+bool InternedStringPool::decode(StringT tuple, std::string* out) const {
+    out->clear();
+    const char* p = tuple.first;
+    const char* end = p + tuple.second;
+    for (size_t ix = 0; p < end; ix++) {
+        u64 id;
+        if (!get_base128(&p, end, &id)) {
+            return false;
+        }
+        auto str = dict_.find(static_cast<i64>(id));
+        if (str.first == nullptr) {
+            return false;
+        }
+        if (ix != 0) {
+            out->push_back(ix % 2 == 1 ? ' ' : '=');
+        }
+        out->append(str.first, str.first + str.second);
+    }
+    return !out->empty();
+}
+
+bool InternedStringPool::tokens(StringT tuple, std::vector<StringT>* out) const {
+    out->clear();
+    const char* p = tuple.first;
+    const char* end = p + tuple.second;
+    while (p < end) {
+        u64 id;
+        if (!get_base128(&p, end, &id)) {
+            return false;
+        }
+        auto str = dict_.find(static_cast<i64>(id));
+        if (str.first == nullptr) {
+            return false;
+        }
+        out->push_back(std::make_pair(str.first, static_cast<u32>(str.second)));
+    }
+    return !out->empty();
+}
+
+StringT InternedStringPool::metric(StringT tuple) const {
+    const char* p = tuple.first;
+    u64 id;
+    if (!get_base128(&p, tuple.first + tuple.second, &id)) {
+        return std::make_pair(nullptr, 0);
+    }
+    auto str = dict_.find(static_cast<i64>(id));
+    return std::make_pair(str.first, static_cast<u32>(str.second));
+}
+
+size_t InternedStringPool::size() const {
+    return pool_.size();
+}
+
+size_t InternedStringPool::dictionary_size() const {
+    return dict_.size();
+}
+
+size_t InternedStringPool::mem_used() const {
+    return dict_pool_.mem_used() + pool_.mem_used();
+}
+
+}
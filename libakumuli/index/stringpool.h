@@ -18,7 +18,10 @@
 
 #include <atomic>
 #include <deque>
+#include <memory>
 #include <mutex>
+#include <set>
+#include <string>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -114,6 +117,9 @@ struct StringTools {
     static size_t hash(StringT str);
     static bool equal(StringT lhs, StringT rhs);
 
+    //! Lexicographical comparison, shorter string goes first if one string is a prefix of another
+    static bool less(StringT lhs, StringT rhs);
+
     typedef std::unordered_map<StringT, i64, decltype(&StringTools::hash),
                                decltype(&StringTools::equal)>
         TableT;
@@ -127,7 +133,10 @@ struct StringTools {
     };
 
 
-    typedef std::unordered_map<StringT, SetT, decltype(&StringTools::hash), decltype(&StringTools::equal)> L2TableT;
+    //! Ordered set of strings, supports range lookups
+    typedef std::set<StringT, decltype(&StringTools::less)> SortedSetT;
+
+    typedef std::unordered_map<StringT, SortedSetT, decltype(&StringTools::hash), decltype(&StringTools::equal)> L2TableT;
 
     typedef std::unordered_map<StringT, L2TableT, decltype(&StringTools::hash), decltype(&StringTools::equal)> L3TableT;
 
@@ -138,8 +147,167 @@ struct StringTools {
 
     static SetT create_set(size_t size);
 
+    static SortedSetT create_sorted_set();
+
     static L2TableT create_l2_table(size_t size_hint);
 
     static L3TableT create_l3_table(size_t size_hint);
 };
+
+
+/** Hash table that maps pooled strings to ids and ids to strings.
+  * Lookups are lock-free and can run concurrently with insertions.
+  * Insertions are serialized by the internal mutex (single writer).
+  * Table uses open addressing with linear probing, entries are immutable
+  * and published by the atomic store so readers see either complete
+  * entry or nothing. Strings are not copied so they should outlive the
+  * table (e.g. be stored in the string pool). Old slot arrays are
+  * retained after resize until the table is destroyed because concurrent
+  * readers can still use them.
+  */
+class ConcurrentStringTable {
+    typedef StringTools::StringT StringT;
+
+    struct Entry {
+        size_t  hash;
+        StringT str;
+        i64     id;
+    };
+
+    struct SlotArray {
+        size_t mask;
+        std::unique_ptr<std::atomic<Entry const*>[]> slots;
+
+        SlotArray(size_t size);
+    };
+
+    //! Entries storage (addresses are stable)
+    std::deque<Entry> entries_;
+    //! All allocated slot arrays, last one is current
+    std::vector<std::unique_ptr<SlotArray>> arrays_;
+    //! Current slot array
+    std::atomic<SlotArray const*> current_;
+    //! Number of elements in the table
+    std::atomic<size_t> size_;
+    //! Slot arrays of the id to string mapping, last one is current
+    std::vector<std::unique_ptr<SlotArray>> id_arrays_;
+    //! Current slot array of the id to string mapping
+    std::atomic<SlotArray const*> id_current_;
+    //! Number of ids in the table
+    std::atomic<size_t> id_size_;
+    mutable std::mutex mutex_;
+
+    static size_t slot_index(size_t hash, size_t mask);
+
+    //! Put entry to the array (should be called under lock)
+    static bool put(SlotArray const* array, Entry const* entry);
+
+    //! Put entry to the id array (should be called under lock)
+    static bool put_id(SlotArray const* array, Entry const* entry);
+
+    //! Add entry to the array, grow the array if needed (should be called under lock)
+    static void insert_entry(std::vector<std::unique_ptr<SlotArray>>* arrays,
+                             std::atomic<SlotArray const*>* current,
+                             std::atomic<size_t>* size,
+                             Entry const* entry,
+                             bool (*putfn)(SlotArray const*, Entry const*));
+public:
+    ConcurrentStringTable(size_t size_hint = 0x1000);
+    ConcurrentStringTable(ConcurrentStringTable const&) = delete;
+    ConcurrentStringTable& operator=(ConcurrentStringTable const&) = delete;
+
+    /** Find string in the table (lock-free).
+      * @return id of the string or 0 if string is not in the table
+      */
+    i64 find(StringT str) const;
+
+    /** Find string by id (lock-free).
+      * @return string or empty string if id is not in the table
+      */
+    StringT find(i64 id) const;
+
+    //! Return all ids stored in the table (lock-free, unordered)
+    std::vector<i64> get_ids() const;
+
+    /** Add string to the table or replace its id if string is already there.
+      * @param str is a pooled string
+      * @param id is a string id
+      */
+    void insert(StringT str, i64 id);
+
+    size_t size() const;
+};
+
+
+//                          //
+//   Interned String Pool   //
+//                          //
+
+/** String pool that stores series names in interned form.
+  * Metric names, tag names and tag values are stored in the dictionary
+  * only once. Series name is stored as a tuple of dictionary ids (metric
+  * id followed by tag and value ids of every tag) encoded using base128.
+  * Ids are never zero so encoded tuples don't contain 0 characters and
+  * can be stored in the string pool. Full names are rebuilt on demand.
+  * Names should be in canonical form. Lookups are lock-free, `add` should
+  * be serialized by the caller (single writer).
+  */
+class InternedStringPool {
+    StringPool            dict_pool_;  //! Dictionary strings
+    ConcurrentStringTable dict_;       //! Dictionary (string to id and id to string mapping)
+    StringPool            pool_;       //! Encoded tuples
+
+    //! Add string to the dictionary, return its id (0 on error)
+    i64 intern(const char* begin, const char* end);
+public:
+    //! Max size of the encoded tuple
+    static const size_t MAX_TUPLE_SIZE = AKU_LIMITS_MAX_SNAME*3;
+
+    InternedStringPool();
+    InternedStringPool(InternedStringPool const&) = delete;
+    InternedStringPool& operator=(InternedStringPool const&) = delete;
+
+    /**
+     * @brief add series name to the pool
+     * @param begin is a pointer to the begining of the name (in canonical form)
+     * @param end is a pointer to the next character after the end of the name
+     * @return address of the encoded tuple (0 in case of error)
+     */
+    u64 add(const char* begin, const char* end);
+
+    /**
+     * @brief encode series name using the dictionary (lock-free)
+     * @param out is an output buffer
+     * @param size is a size of the output buffer
+     * @return size of the encoded tuple or 0 if name is malformed or
+     *         contains strings that are not in the dictionary
+     */
+    size_t encode(const char* begin, const char* end, char* out, size_t size) const;
+
+    /**
+     * @brief tuple returns encoded tuple
+     * @param bits is an address returned by `add`
+     * @return 0-copy tuple representation (or empty string)
+     */
+    StringT tuple(u64 bits) const;
+
+    //! Rebuild series name from the encoded tuple (lock-free), return false on error
+    bool decode(StringT tuple, std::string* out) const;
+
+    /** Get strings of the encoded tuple (lock-free): metric name followed
+      * by tag names and values. Strings have the same lifetime as the pool.
+      */
+    bool tokens(StringT tuple, std::vector<StringT>* out) const;
+
+    //! Get metric name of the encoded tuple (lock-free)
+    StringT metric(StringT tuple) const;
+
+    //! Get number of stored names
+    size_t size() const;
+
+    //! Get number of strings in the dictionary
+    size_t dictionary_size() const;
+
+    size_t mem_used() const;
+};
 }
@@ -18,13 +18,14 @@
 #include "metadatastorage.h"
 #include "util.h"
 #include "log_iface.h"
+#include "storage_engine/compression.h"
 
 #include <sstream>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/exception/diagnostic_information.hpp>
 
-#include <sqlite3.h>  // to set trace callback
+#include <sqlite3.h>  // to set trace callback and use prepared statements
 
 namespace Akumuli {
 
@@ -45,6 +46,82 @@ void AprHandleDeleter::operator()(apr_dbd_t* handle) {
     }
 }
 
+void StatementDeleter::operator()(sqlite3_stmt* stmt) {
+    sqlite3_finalize(stmt);
+}
+
+//-------------------------------RescuePointsBuffer-------------------------------------
+
+RescuePointsBuffer::RescuePointsBuffer()
+    : ndirty_(0)
+{
+}
+
+bool RescuePointsBuffer::add(aku_ParamId id, std::vector<u64> const& addrlist) {
+    bool isnew = !dirty_.contains(id);
+    if (isnew) {
+        dirty_.add(id);
+        ndirty_++;
+    }
+    Entry entry = { id, static_cast<u32>(data_.size()), 0 };
+    encode(addrlist, &data_);
+    entry.size = static_cast<u32>(data_.size() - entry.offset);
+    entries_.push_back(entry);
+    // Series that are updated often shouldn't increase memory usage
+    if (entries_.size() > 2*ndirty_ + 0x400) {
+        coalesce();
+    }
+    return isnew;
+}
+
+void RescuePointsBuffer::coalesce() {
+    Roaring64Map       seen;
+    std::vector<u8>    data;
+    std::vector<Entry> entries;
+    entries.reserve(ndirty_);
+    // Last update is the most recent one
+    for (auto it = entries_.rbegin(); it != entries_.rend(); it++) {
+        if (seen.contains(it->id)) {
+            continue;
+        }
+        seen.add(it->id);
+        Entry entry = { it->id, static_cast<u32>(data.size()), it->size };
+        data.insert(data.end(), data_.begin() + it->offset, data_.begin() + it->offset + it->size);
+        entries.push_back(entry);
+    }
+    std::swap(data, data_);
+    std::swap(entries, entries_);
+}
+
+u64 RescuePointsBuffer::size() const {
+    return ndirty_;
+}
+
+bool RescuePointsBuffer::empty() const {
+    return ndirty_ == 0;
+}
+
+void RescuePointsBuffer::encode(std::vector<u64> const& addrlist, std::vector<u8>* out) {
+    const size_t max_size = addrlist.size()*10;  // max size of the base128 encoded u64
+    auto pos = out->size();
+    out->resize(pos + max_size);
+    Base128StreamWriter writer(out->data() + pos, out->data() + pos + max_size);
+    for (auto addr: addrlist) {
+        // EMPTY_ADDR (~0) is encoded as 0
+        writer.put(addr + 1);
+    }
+    out->resize(pos + writer.size());
+}
+
+std::vector<u64> RescuePointsBuffer::decode(const u8* data, size_t size) {
+    std::vector<u64> result;
+    Base128StreamReader reader(data, data + size);
+    while (reader.space_left() != 0) {
+        result.push_back(reader.next<u64>() - 1);
+    }
+    return result;
+}
+
 
 //-------------------------------MetadataStorage----------------------------------------
 
@@ -63,6 +140,8 @@ MetadataStorage::MetadataStorage(const char* db)
     : pool_(nullptr, &delete_apr_pool)
     , driver_(nullptr)
     , handle_(nullptr, AprHandleDeleter(nullptr))
+    , sqlite_(nullptr)
+    , backlog_{0}
 {
     apr_pool_t *pool = nullptr;
     auto status = apr_pool_create(&pool, NULL);
@@ -86,24 +165,33 @@ MetadataStorage::MetadataStorage(const char* db)
     }
     handle_ = HandleT(handle, AprHandleDeleter(driver_));
 
-    auto sqlite_handle = apr_dbd_native_handle(driver_, handle);
-    sqlite3_trace(static_cast<sqlite3*>(sqlite_handle), callback_adapter, nullptr);
+    sqlite_ = static_cast<sqlite3*>(apr_dbd_native_handle(driver_, handle));
+    sqlite3_trace(sqlite_, callback_adapter, nullptr);
+
+    // WAL mode allows readers to proceed during the sync and doesn't require
+    // fsync on every commit with synchronous=NORMAL. Database can't be corrupted
+    // but the last transactions can be lost on power failure, the data will be
+    // restored from the input log in this case. In-memory database ignores this.
+    const char* pragmas[] = {
+        "PRAGMA journal_mode=WAL;",
+        "PRAGMA synchronous=NORMAL;",
+    };
+    for (auto pragma: pragmas) {
+        char* errmsg = nullptr;
+        if (sqlite3_exec(sqlite_, pragma, nullptr, nullptr, &errmsg) != SQLITE_OK) {
+            Logger::msg(AKU_LOG_ERROR, std::string("Can't execute ") + pragma + " " + (errmsg ? errmsg : ""));
+        }
+        sqlite3_free(errmsg);
+    }
 
     create_tables();
-
-    // Create prepared statement
-    const char* query = "INSERT INTO akumuli_series (series_id, keyslist, storage_id) VALUES (%s, %s, %d)";
-    status = apr_dbd_prepare(driver_, pool_.get(), handle_.get(), query, "INSERT_SERIES_NAME", &insert_);
-    if (status != 0) {
-        Logger::msg(AKU_LOG_ERROR, "Error creating prepared statement");
-        AKU_PANIC(apr_dbd_error(driver_, handle_.get(), status));
-    }
+    migrate_rescue_points();
 }
 
 void MetadataStorage::sync_with_metadata_storage(std::function<void(std::vector<SeriesT>*)> pull_new_names) {
     // Make temporary copies under the lock
     std::vector<PlainSeriesMatcher::SeriesNameT>           newnames;
-    std::unordered_map<aku_ParamId, std::vector<u64>> rescue_points;
+    RescuePointsBuffer                                rescue_points;
     std::unordered_map<u32, VolumeDesc>               volume_records;
     {
         std::lock_guard<std::mutex> guard(sync_lock_);
@@ -127,10 +215,22 @@ void MetadataStorage::sync_with_metadata_storage(std::function<void(std::vector<
     }
     //:TODO
 
-    // Save new names
+    // Save new names, large bursts are split into several transactions so
+    // the transaction size and the amount of memory used by sqlite are bounded
+    auto chunk_begin = newnames.begin();
+    while (newnames.end() - chunk_begin > NAMES_PER_TRANSACTION) {
+        std::vector<SeriesT> chunk(chunk_begin, chunk_begin + NAMES_PER_TRANSACTION);
+        chunk_begin += NAMES_PER_TRANSACTION;
+        begin_transaction();
+        insert_new_names(std::move(chunk));
+        end_transaction();
+    }
+    newnames.erase(newnames.begin(), chunk_begin);
     begin_transaction();
     insert_new_names(std::move(newnames));
 
+    u64 nupdates = rescue_points.size() + volume_records.size();
+
     // Save rescue points
     upsert_rescue_points(std::move(rescue_points));
 
@@ -138,6 +238,8 @@ void MetadataStorage::sync_with_metadata_storage(std::function<void(std::vector<
     upsert_volume_records(std::move(volume_records));
 
     end_transaction();
+
+    backlog_ -= nupdates;
 }
 
 void MetadataStorage::force_sync() {
@@ -189,21 +291,57 @@ void MetadataStorage::create_tables() {
             ");";
     execute_query(query);
 
+    // Address list is encoded by the RescuePointsBuffer::encode
     query =
             "CREATE TABLE IF NOT EXISTS akumuli_rescue_points("
             "storage_id INTEGER PRIMARY KEY UNIQUE,"
-            "addr0 INTEGER,"
-            "addr1 INTEGER,"
-            "addr2 INTEGER,"
-            "addr3 INTEGER,"
-            "addr4 INTEGER,"
-            "addr5 INTEGER,"
-            "addr6 INTEGER,"
-            "addr7 INTEGER"
+            "addrlist BLOB"
             ");";
     execute_query(query);
 }
 
+void MetadataStorage::migrate_rescue_points() {
+    auto columns = select_query("PRAGMA table_info(akumuli_rescue_points);");
+    bool legacy = false;
+    for (auto const& col: columns) {
+        // Column name is a second field
+        if (col.size() > 1 && col.at(1) == "addr0") {
+            legacy = true;
+        }
+    }
+    if (!legacy) {
+        return;
+    }
+    Logger::msg(AKU_LOG_INFO, "Convert rescue points to the binary format");
+    auto rows = select_query(
+        "SELECT storage_id, addr0, addr1, addr2, addr3,"
+                          " addr4, addr5, addr6, addr7 "
+        "FROM akumuli_rescue_points;");
+    RescuePointsBuffer buffer;
+    for (auto const& row: rows) {
+        if (row.size() != 9) {
+            continue;
+        }
+        auto series_id = boost::lexical_cast<i64>(row.at(0));
+        std::vector<u64> addrlist;
+        for (size_t i = 0; i < 8; i++) {
+            auto addr = row.at(1 + i);
+            if (addr.empty()) {
+                break;
+            }
+            // Negative value is an EMPTY_ADDR
+            i64 iaddr = boost::lexical_cast<i64>(addr);
+            addrlist.push_back(iaddr < 0 ? ~0ull : static_cast<u64>(iaddr));
+        }
+        buffer.add(static_cast<aku_ParamId>(series_id), addrlist);
+    }
+    begin_transaction();
+    execute_query("DROP TABLE akumuli_rescue_points;");
+    create_tables();
+    upsert_rescue_points(std::move(buffer));
+    end_transaction();
+}
+
 void MetadataStorage::init_config(const char* db_name,
                                   const char* creation_datetime,
                                   const char* bstore_type)
@@ -387,16 +525,25 @@ aku_Status MetadataStorage::wait_for_sync_request(int timeout_us) {
 
 void MetadataStorage::add_rescue_point(aku_ParamId id, std::vector<u64>&& val) {
     std::lock_guard<std::mutex> guard(sync_lock_);
-    pending_rescue_points_[id] = val;
+    if (pending_rescue_points_.add(id, val)) {
+        backlog_++;
+    }
     sync_cvar_.notify_one();
 }
 
 void MetadataStorage::update_volume(const VolumeDesc& vol) {
     std::lock_guard<std::mutex> guard(sync_lock_);
+    if (pending_volumes_.count(vol.id) == 0) {
+        backlog_++;
+    }
     pending_volumes_[vol.id] = vol;
     sync_cvar_.notify_one();
 }
 
+u64 MetadataStorage::get_backlog() const {
+    return backlog_.load(std::memory_order_relaxed);
+}
+
 std::string MetadataStorage::get_dbname() {
     std::string dbname;
     bool success = get_config_param("db_name", &dbname);
@@ -447,83 +594,99 @@ void MetadataStorage::upsert_volume_records(std::unordered_map<u32, VolumeDesc>&
     execute_query(query.str());
 }
 
-void MetadataStorage::upsert_rescue_points(std::unordered_map<aku_ParamId, std::vector<u64>>&& input) {
+sqlite3_stmt* MetadataStorage::get_statement(PreparedT* cache, int nrows, const char* prefix, int ncolumns) {
+    PreparedT& stmt = cache[nrows == 1 ? 0 : 1];
+    if (stmt) {
+        return stmt.get();
+    }
+    std::stringstream query;
+    query << prefix << " VALUES ";
+    for (int row = 0; row < nrows; row++) {
+        query << (row == 0 ? "(" : ", (");
+        for (int col = 0; col < ncolumns; col++) {
+            query << (col == 0 ? "?" : ", ?");
+        }
+        query << ")";
+    }
+    query << ";";
+    std::string text = query.str();
+    sqlite3_stmt* result = nullptr;
+    if (sqlite3_prepare_v2(sqlite_, text.c_str(), static_cast<int>(text.size()), &result, nullptr) != SQLITE_OK) {
+        Logger::msg(AKU_LOG_ERROR, "Error creating prepared statement");
+        AKU_PANIC(sqlite3_errmsg(sqlite_));
+    }
+    stmt.reset(result);
+    return result;
+}
+
+void MetadataStorage::execute_statement(sqlite3_stmt* stmt) {
+    int status = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    if (status != SQLITE_DONE) {
+        Logger::msg(AKU_LOG_ERROR, "Error executing prepared statement");
+        AKU_PANIC(sqlite3_errmsg(sqlite_));
+    }
+}
+
+void MetadataStorage::upsert_rescue_points(RescuePointsBuffer&& input) {
     if (input.empty()) {
         return;
     }
-    std::stringstream query;
-    typedef std::pair<aku_ParamId, std::vector<u64>> ValueT;
-    std::vector<ValueT> items(input.begin(), input.end());
-    while(!items.empty()) {
-        const size_t batchsize = 500;  // This limit is defined by SQLITE_MAX_COMPOUND_SELECT
-        const size_t newsize = items.size() > batchsize ? items.size() - batchsize : 0;
-        std::vector<ValueT> batch(items.begin() + static_cast<ssize_t>(newsize), items.end());
-        items.resize(newsize);
-        query <<
-            "INSERT OR REPLACE INTO akumuli_rescue_points (storage_id, addr0, addr1, addr2, addr3, addr4, addr5, addr6, addr7) VALUES ";
-        size_t ix = 0;
-        for (auto const& kv: batch) {
-            query << "( " << static_cast<i64>(kv.first);
-            for (auto id: kv.second) {
-                if (id == ~0ull) {
-                    // Values that big can't be represented in SQLite, -1 value should be interpreted as EMPTY_ADDR,
-                    query << ", -1";
-                } else {
-                    query << ", " << id;
-                }
-            }
-            for(auto i = kv.second.size(); i < 8; i++) {
-                query << ", null";
-            }
-            query << ")";
-            ix++;
-            if (ix == batch.size()) {
-                query << ";\n";
+    input.coalesce();
+    const char* prefix = "INSERT OR REPLACE INTO akumuli_rescue_points (storage_id, addrlist)";
+    const int ncolumns = 2;
+    auto const& entries = input.entries_;
+    size_t ix = 0;
+    while (ix < entries.size()) {
+        int nrows = entries.size() - ix >= static_cast<size_t>(ROWS_PER_STATEMENT) ? ROWS_PER_STATEMENT : 1;
+        auto stmt = get_statement(upsert_rescue_points_, nrows, prefix, ncolumns);
+        for (int row = 0; row < nrows; row++, ix++) {
+            int param = row*ncolumns + 1;
+            auto const& entry = entries[ix];
+            sqlite3_bind_int64(stmt, param, static_cast<i64>(entry.id));
+            if (entry.size == 0) {
+                // Empty address list is stored as an empty blob, not null
+                sqlite3_bind_zeroblob(stmt, param + 1, 0);
             } else {
-                query << ",";
+                sqlite3_bind_blob(stmt, param + 1, input.data_.data() + entry.offset,
+                                  static_cast<int>(entry.size), SQLITE_STATIC);
             }
         }
+        execute_statement(stmt);
     }
-    execute_query(query.str());
-
 }
 
 void MetadataStorage::insert_new_names(std::vector<SeriesT> &&items) {
     if (items.size() == 0) {
         return;
     }
-    // Write all data
-    std::stringstream query;
-    while(!items.empty()) {
-        const size_t batchsize = 500; // This limit is defined by SQLITE_MAX_COMPOUND_SELECT
-        const size_t newsize = items.size() > batchsize ? items.size() - batchsize : 0;
-        std::vector<MetadataStorage::SeriesT> batch(items.begin() + static_cast<ssize_t>(newsize), items.end());
-        items.resize(newsize);
-        query << "INSERT INTO akumuli_series (series_id, keyslist, storage_id)" << std::endl;
-        bool first = true;
-        for (auto item: batch) {
-            LightweightString name, keys;
-            auto stid = std::get<2>(item);
-            if (split_series(std::get<0>(item), std::get<1>(item), &name, &keys)) {
-                if (first) {
-                    query << "\tSELECT '" << name << "' as series_id, '"
-                                          << keys << "' as keyslist, "
-                                          << stid << "  as storage_id"
-                                          << std::endl;
-                    first = false;
-                } else {
-                    query << "\tUNION "
-                          <<   "SELECT '" << name << "', '"
-                                          << keys << "', "
-                                          << stid
-                                          << std::endl;
-                }
-            }
+    const char* prefix = "INSERT INTO akumuli_series (series_id, keyslist, storage_id)";
+    const int ncolumns = 3;
+    // Split series names first, invalid names are skipped
+    std::vector<std::tuple<LightweightString, LightweightString, i64>> rows;
+    rows.reserve(items.size());
+    for (auto const& item: items) {
+        LightweightString name, keys;
+        if (split_series(std::get<0>(item), std::get<1>(item), &name, &keys)) {
+            rows.push_back(std::make_tuple(name, keys, std::get<2>(item)));
         }
-        query << ";\n";
     }
-    std::string full_query = query.str();
-    execute_query(full_query);
+    size_t ix = 0;
+    while (ix < rows.size()) {
+        int nrows = rows.size() - ix >= ROWS_PER_STATEMENT ? ROWS_PER_STATEMENT : 1;
+        auto stmt = get_statement(insert_names_, nrows, prefix, ncolumns);
+        for (int row = 0; row < nrows; row++, ix++) {
+            int param = row*ncolumns + 1;
+            auto const& name = std::get<0>(rows[ix]);
+            auto const& keys = std::get<1>(rows[ix]);
+            // Strings are owned by the series matcher and outlive the statement execution
+            sqlite3_bind_text(stmt, param, name.str, name.len, SQLITE_STATIC);
+            sqlite3_bind_text(stmt, param + 1, keys.str, keys.len, SQLITE_STATIC);
+            sqlite3_bind_int64(stmt, param + 2, std::get<2>(rows[ix]));
+        }
+        execute_statement(stmt);
+    }
 }
 
 boost::optional<i64> MetadataStorage::get_prev_largest_id() {
@@ -548,10 +711,14 @@ boost::optional<i64> MetadataStorage::get_prev_largest_id() {
     return max_id;
 }
 
-aku_Status MetadataStorage::load_matcher_data(SeriesMatcherBase& matcher) {
-    auto query = "SELECT series_id || ' ' || keyslist, storage_id FROM akumuli_series;";
+aku_Status MetadataStorage::load_matcher_data(SeriesMatcherBase& matcher, u64 min_id) {
+    std::string query = "SELECT series_id || ' ' || keyslist, storage_id FROM akumuli_series";
+    if (min_id != 0) {
+        query += " WHERE abs(storage_id) > " + std::to_string(min_id);
+    }
+    query += ";";
     try {
-        auto results = select_query(query);
+        auto results = select_query(query.c_str());
         for(auto row: results) {
             if (row.size() != 2) {
                 continue;
@@ -568,44 +735,33 @@ aku_Status MetadataStorage::load_matcher_data(SeriesMatcherBase& matcher) {
 }
 
 aku_Status MetadataStorage::load_rescue_points(std::unordered_map<u64, std::vector<u64>>& mapping) {
-    auto query =
-        "SELECT storage_id, addr0, addr1, addr2, addr3,"
-                          " addr4, addr5, addr6, addr7 "
-        "FROM akumuli_rescue_points;";
+    // Blobs can't be read using apr_dbd_get_entry
+    const char* query = "SELECT storage_id, addrlist FROM akumuli_rescue_points;";
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(sqlite_, query, -1, &stmt, nullptr) != SQLITE_OK) {
+        Logger::msg(AKU_LOG_ERROR, std::string("Can't read rescue points: ") + sqlite3_errmsg(sqlite_));
+        return AKU_EGENERAL;
+    }
+    PreparedT guard(stmt);
+    aku_Status status = AKU_SUCCESS;
     try {
-        auto results = select_query(query);
-        for(auto row: results) {
-            if (row.size() != 9) {
-                continue;
-            }
-            auto series_id = boost::lexical_cast<u64>(row.at(0));
-            if (errno == ERANGE) {
-                Logger::msg(AKU_LOG_ERROR, "Can't parse series id, database corrupted");
-                return AKU_EBAD_DATA;
-            }
-            std::vector<u64> addrlist;
-            for (size_t i = 0; i < 8; i++) {
-                auto addr = row.at(1 + i);
-                if (addr.empty()) {
-                    break;
-                } else {
-                    u64 uaddr;
-                    i64 iaddr = boost::lexical_cast<i64>(addr);
-                    if (iaddr < 0) {
-                        uaddr = ~0ull;
-                    } else {
-                        uaddr = static_cast<u64>(iaddr);
-                    }
-                    addrlist.push_back(uaddr);
-                }
-            }
-            mapping[series_id] = std::move(addrlist);
+        int res;
+        while ((res = sqlite3_step(stmt)) == SQLITE_ROW) {
+            auto series_id = static_cast<u64>(sqlite3_column_int64(stmt, 0));
+            auto data = static_cast<const u8*>(sqlite3_column_blob(stmt, 1));
+            auto size = static_cast<size_t>(sqlite3_column_bytes(stmt, 1));
+            mapping[series_id] = RescuePointsBuffer::decode(data, size);
+        }
+        if (res != SQLITE_DONE) {
+            Logger::msg(AKU_LOG_ERROR, std::string("Can't read rescue points: ") + sqlite3_errmsg(sqlite_));
+            status = AKU_EGENERAL;
         }
     } catch(...) {
+        Logger::msg(AKU_LOG_ERROR, "Can't decode rescue points, database corrupted");
         Logger::msg(AKU_LOG_ERROR, boost::current_exception_diagnostic_information().c_str());
-        return AKU_EGENERAL;
+        status = AKU_EBAD_DATA;
     }
-    return AKU_SUCCESS;
+    return status;
 }
 
 }
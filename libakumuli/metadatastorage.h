@@ -18,6 +18,7 @@
 #include <cstddef>
 #include <memory>
 #include <vector>
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
 #include <boost/optional.hpp>
@@ -27,8 +28,12 @@
 
 #include "akumuli_def.h"
 #include "index/seriesparser.h"
+#include "roaring/roaring.hh"
 #include "volumeregistry.h"
 
+struct sqlite3;
+struct sqlite3_stmt;
+
 namespace Akumuli {
 
 //! Delete apr pool
@@ -41,33 +46,93 @@ struct AprHandleDeleter {
     void operator()(apr_dbd_t* handle);
 };
 
+//! Sqlite3 prepared statement deleter
+struct StatementDeleter {
+    void operator()(sqlite3_stmt* stmt);
+};
+
+/** Rescue points updates accumulated between metadata syncs.
+  * Address lists are appended to the single buffer in compact binary form (the
+  * same form is stored in the database). Ids with pending updates are tracked
+  * using the bitmap. Multiple updates of the same id are coalesced, only the
+  * last one is written.
+  */
+struct RescuePointsBuffer {
+    //! Update record: series id, offset and size of the encoded address list
+    struct Entry {
+        aku_ParamId id;
+        u32         offset;
+        u32         size;
+    };
+
+    Roaring64Map       dirty_;
+    u64                ndirty_;
+    std::vector<u8>    data_;
+    std::vector<Entry> entries_;
+
+    RescuePointsBuffer();
+
+    /** Add update.
+      * @return true if series didn't have pending updates
+      */
+    bool add(aku_ParamId id, std::vector<u64> const& addrlist);
+
+    //! Remove all updates except the last one for every id
+    void coalesce();
+
+    //! Number of ids with pending updates
+    u64 size() const;
+
+    bool empty() const;
+
+    //! Encode address list (base128 encoded address + 1, so EMPTY_ADDR takes one byte)
+    static void encode(std::vector<u64> const& addrlist, std::vector<u8>* out);
+
+    //! Decode address list
+    static std::vector<u64> decode(const u8* data, size_t size);
+};
+
 
 /** Sqlite3 backed storage for metadata.
   * Metadata includes:
   * - Volumes list
   * - Conviguration data
   * - Key to id mapping
+  * Database is opened in WAL mode. Series names and rescue points are written
+  * using cached multi-row prepared statements.
   */
 struct MetadataStorage : VolumeRegistry {
+    enum {
+        //! Number of rows inserted by one multi-row statement (limited by SQLITE_MAX_VARIABLE_NUMBER)
+        ROWS_PER_STATEMENT = 100,
+        //! Max number of series names written in one transaction
+        NAMES_PER_TRANSACTION = 20000,
+    };
+
     // Typedefs
     typedef std::unique_ptr<apr_pool_t, decltype(&delete_apr_pool)> PoolT;
     typedef const apr_dbd_driver_t* DriverT;
     typedef std::unique_ptr<apr_dbd_t, AprHandleDeleter> HandleT;
-    typedef apr_dbd_prepared_t* PreparedT;
+    typedef std::unique_ptr<sqlite3_stmt, StatementDeleter> PreparedT;
     typedef PlainSeriesMatcher::SeriesNameT SeriesT;
 
     // Members
     PoolT           pool_;
     DriverT         driver_;
     HandleT         handle_;
-    PreparedT       insert_;
+    sqlite3*        sqlite_;
+    //! Cached statements, first inserts one row, second inserts `ROWS_PER_STATEMENT` rows
+    PreparedT       insert_names_[2];
+    PreparedT       upsert_rescue_points_[2];
 
     // Synchronization
     mutable std::mutex                                sync_lock_;
     mutable std::mutex                                tran_lock_;
     std::condition_variable                           sync_cvar_;
-    std::unordered_map<aku_ParamId, std::vector<u64>> pending_rescue_points_;
+    RescuePointsBuffer                                pending_rescue_points_;
     std::unordered_map<u32, VolumeDesc>               pending_volumes_;
+    //! Number of updates that wasn't written to sqlite yet (pending + in progress)
+    std::atomic<u64>                                  backlog_;
 
     /** Create new or open existing db.
       * @throw std::runtime_error in a case of error
@@ -115,7 +180,11 @@ struct MetadataStorage : VolumeRegistry {
     /** Read larges series id */
     boost::optional<i64> get_prev_largest_id();
 
-    aku_Status load_matcher_data(SeriesMatcherBase &matcher);
+    /** Load series names into matcher.
+      * @param matcher is a series matcher that should receive names
+      * @param min_id only series with absolute id value larger than `min_id` will be loaded
+      */
+    aku_Status load_matcher_data(SeriesMatcherBase &matcher, u64 min_id = 0);
 
     aku_Status load_rescue_points(std::unordered_map<u64, std::vector<u64>>& mapping);
 
@@ -132,24 +201,36 @@ struct MetadataStorage : VolumeRegistry {
 
     aku_Status wait_for_sync_request(int timeout_us);
 
+    /** Write pending metadata updates and new series names.
+      * New names are written in chunks of `NAMES_PER_TRANSACTION` names, every chunk
+      * in its own transaction. Pending rescue points and volume records are written
+      * together with the last chunk.
+      * @param pull_new_names is a function that receives new series names
+      */
     void sync_with_metadata_storage(std::function<void(std::vector<SeriesT>*)> pull_new_names);
 
     //! Forces `wait_for_sync_request` to return immediately
     void force_sync();
 
+    /** Return number of metadata updates (rescue points, volume records) that
+      * wasn't written to sqlite yet. Grows if the sync worker can't keep up.
+      */
+    u64 get_backlog() const;
+
     // should be private:
 
     void begin_transaction();
 
     void end_transaction();
 
-    /** Add new series to the metadata storage (generate sql query and execute it).
+    /** Add new series to the metadata storage (bind and execute prepared statements).
       */
     void insert_new_names(std::vector<SeriesT>&& items);
 
-    /** Insert or update rescue provided points (generate sql query and execute it).
+    /** Insert or update provided rescue points (bind and execute prepared statements).
+      * Only the last update of every series is written.
       */
-    void upsert_rescue_points(std::unordered_map<aku_ParamId, std::vector<u64> > &&input);
+    void upsert_rescue_points(RescuePointsBuffer&& input);
 
     /**
      * @brief Update volume descriptors
@@ -161,6 +242,24 @@ struct MetadataStorage : VolumeRegistry {
 
 private:
 
+    /** Compile statement or return cached one.
+      * @param cache is a pair of cached statements (single row and multi-row)
+      * @param nrows is a number of rows (1 or `ROWS_PER_STATEMENT`)
+      * @param prefix is a query text without VALUES clause
+      * @param ncolumns is a number of values in a row
+      * @throw std::runtime_error in a case of error
+      */
+    sqlite3_stmt* get_statement(PreparedT* cache, int nrows, const char* prefix, int ncolumns);
+
+    //! Execute prepared statement and reset it
+    void execute_statement(sqlite3_stmt* stmt);
+
+    /** Convert rescue points table from the old format (one column per address)
+      * to the binary format if needed.
+      * @throw std::runtime_error in a case of error
+      */
+    void migrate_rescue_points();
+
     /** Execute query that doesn't return anything.
       * @throw std::runtime_error in a case of error
       * @return number of rows changed
@@ -21,9 +21,9 @@ static std::unordered_map<std::string, int> buildNameToIndexMapping(const QP::Re
             continue;
         }
         auto idcol = req.select.columns[ix].ids.front();
-        auto rawstr = matcher->id2str(idcol);
         // copy metric name from the begining until the ' ' or ':'
-        std::string sname(rawstr.first, rawstr.first + rawstr.second);
+        std::string sname;
+        matcher->id2str(idcol, &sname);
         auto it = std::find_if(sname.begin(), sname.end(), [](char c) {
             return std::isspace(c) || c == ':';
         });
@@ -57,9 +57,9 @@ struct MuparserEvalImpl : Node {
                 continue;
             }
             auto id = col.ids.front();
-            auto st = req.select.global_matcher->id2str(id);
             // extract series name
-            std::string metric(st.first, st.first + st.second);
+            std::string metric;
+            req.select.global_matcher->id2str(id, &metric);
             auto pos = metric.find(' ');
             if (pos != std::string::npos) {
                 metric.resize(pos);
@@ -36,7 +36,7 @@ aku_Status SeriesRetreiver::add_tag(std::string name, std::string value) {
         Logger::msg(AKU_LOG_ERROR, "Series already set");
         return AKU_EBAD_ARG;
     }
-    if (tags_.count(name)) {
+    if (tags_.count(name) || filters_.count(name)) {
         // Duplicates not allowed
         Logger::msg(AKU_LOG_ERROR, "Duplicate tag '" + name + "' found");
         return AKU_EBAD_ARG;
@@ -55,7 +55,7 @@ aku_Status SeriesRetreiver::add_tags(std::string name, std::vector<std::string>
         Logger::msg(AKU_LOG_ERROR, "Series already set");
         return AKU_EBAD_ARG;
     }
-    if (tags_.count(name)) {
+    if (tags_.count(name) || filters_.count(name)) {
         // Duplicates not allowed
         Logger::msg(AKU_LOG_ERROR, "Duplicate tag '" + name + "' found");
         return AKU_EBAD_ARG;
@@ -64,8 +64,27 @@ aku_Status SeriesRetreiver::add_tags(std::string name, std::vector<std::string>
     return AKU_SUCCESS;
 }
 
+//! Add tag name and prefix or regex that should match tag value
+aku_Status SeriesRetreiver::add_tag_filter(std::string name, TagValueFilter const& filter) {
+    if (metric_.empty()) {
+        Logger::msg(AKU_LOG_ERROR, "Metric not set");
+        return AKU_EBAD_ARG;
+    }
+    if (!series_.empty()) {
+        Logger::msg(AKU_LOG_ERROR, "Series already set");
+        return AKU_EBAD_ARG;
+    }
+    if (tags_.count(name) || filters_.count(name)) {
+        // Duplicates not allowed
+        Logger::msg(AKU_LOG_ERROR, "Duplicate tag '" + name + "' found");
+        return AKU_EBAD_ARG;
+    }
+    filters_.insert(std::make_pair(name, filter));
+    return AKU_SUCCESS;
+}
+
 aku_Status SeriesRetreiver::add_series_name(std::string name) {
-    if (!tags_.empty()) {
+    if (!tags_.empty() || !filters_.empty()) {
         Logger::msg(AKU_LOG_ERROR, "Tags already set");
         return AKU_EBAD_ARG;
     }
@@ -101,30 +120,44 @@ std::tuple<aku_Status, std::vector<aku_ParamId>> SeriesRetreiver::extract_ids(Se
         // Case 2, metric not set.
         // get all ids
         auto sids = matcher.get_all_ids();
+        if (matcher.cardinality_limit && sids.size() > matcher.cardinality_limit) {
+            Logger::msg(AKU_LOG_ERROR, "Query matches " + std::to_string(sids.size()) + " series, limit is " +
+                                       std::to_string(matcher.cardinality_limit));
+            return std::make_tuple(AKU_EHIGH_CARDINALITY, ids);
+        }
         for (i64 id: sids) {
             ids.push_back(static_cast<aku_ParamId>(id));
         }
     } else {
         // Case 3, metric is set
         auto first_metric = metric_.front();
-        IncludeMany2Many query(first_metric, tags_);
+        IncludeMany2Many query(first_metric, tags_, filters_);
+        if (matcher.cardinality_limit) {
+            // Reject the query before the list of ids is materialized
+            u64 estimate = matcher.estimate(query)*metric_.size();
+            if (estimate > matcher.cardinality_limit) {
+                Logger::msg(AKU_LOG_ERROR, "Query matches about " + std::to_string(estimate) +
+                                           " series, limit is " + std::to_string(matcher.cardinality_limit));
+                return std::make_tuple(AKU_EHIGH_CARDINALITY, ids);
+            }
+        }
         auto search_results = matcher.search(query);
-        for (auto tup: search_results) {
-            ids.push_back(static_cast<aku_ParamId>(std::get<2>(tup)));
+        for (auto id: search_results) {
+            ids.push_back(static_cast<aku_ParamId>(id));
         }
         if (metric_.size() > 1) {
             std::vector<std::string> tail(metric_.begin() + 1, metric_.end());
             std::vector<aku_ParamId> full(ids);
+            std::string name;
             for (auto metric: tail) {
                 for (auto id: ids) {
-                    StringT name = matcher.id2str(static_cast<i64>(id));
-                    if (name.second == 0) {
+                    if (!matcher.id2str(static_cast<i64>(id), &name)) {
                         // This shouldn't happen but it can happen after memory corruption or data-race.
                         // Clearly indicates an error.
                         Logger::msg(AKU_LOG_ERROR, "Matcher data is broken, can read series name for " + std::to_string(id));
                         AKU_PANIC("Matcher data is broken");
                     }
-                    std::string series_tags(name.first + first_metric.size(), name.first + name.second);
+                    std::string series_tags(name.begin() + first_metric.size(), name.end());
                     std::string alt_name = metric + series_tags;
                     auto sid = matcher.match(alt_name.data(), alt_name.data() + alt_name.size());
                     full.push_back(static_cast<aku_ParamId>(sid));
@@ -141,6 +174,11 @@ std::tuple<aku_Status, std::vector<aku_ParamId>> SeriesRetreiver::extract_ids(Se
 
 std::tuple<aku_Status, std::vector<aku_ParamId>> SeriesRetreiver::extract_ids(PlainSeriesMatcher const& matcher) const {
     std::vector<aku_ParamId> ids;
+    if (!filters_.empty()) {
+        // Plain matcher doesn't have tag value dictionary
+        Logger::msg(AKU_LOG_ERROR, "Tag value filters are not supported");
+        return std::make_tuple(AKU_ENOT_IMPLEMENTED, ids);
+    }
     // Three cases, no metric (get all ids), only metric is set and both metric and tags are set.
     if (metric_.empty()) {
         // Case 1, metric not set.
@@ -694,6 +732,8 @@ static std::tuple<aku_Status, aku_Timestamp, aku_Timestamp, ErrorMsg> parse_rang
   * or
   * "where": [ { "tag1": "value1", "tag2": "value2" },
   *            { "tag1": "value3", "tag2": "value4" } ]
+  * Tag values can be matched by prefix or regular expression:
+  * "where": { "tag1": { "prefix": "web-" }, "tag2": { "regex": "eu-(west|east)" } }
   */
 static std::tuple<aku_Status, std::vector<aku_ParamId>, ErrorMsg> parse_where_clause(boost::property_tree::ptree const& ptree,
                                                                                      std::vector<std::string> metrics,
@@ -723,8 +763,34 @@ static std::tuple<aku_Status, std::vector<aku_ParamId>, ErrorMsg> parse_where_cl
                 }
             } else {
                 auto idslist = item.second;
-                // Read idlist
-                if (!idslist.empty()) {
+                if (!idslist.empty() && !idslist.begin()->first.empty()) {
+                    // Read prefix or regex
+                    if (idslist.size() != 1) {
+                        return std::make_tuple(AKU_EQUERY_PARSING_ERROR, output,
+                                               "Invalid where clause, single filter expected for tag " + tag);
+                    }
+                    auto kind = idslist.begin()->first;
+                    auto pattern = idslist.begin()->second.get_value<std::string>();
+                    std::unique_ptr<TagValueFilter> filter;
+                    try {
+                        if (kind == "prefix") {
+                            filter.reset(new TagValueFilter(TagValueFilter::Kind::PREFIX, pattern));
+                        } else if (kind == "regex") {
+                            filter.reset(new TagValueFilter(TagValueFilter::Kind::REGEX, pattern));
+                        } else {
+                            return std::make_tuple(AKU_EQUERY_PARSING_ERROR, output,
+                                                   "Invalid where clause, unknown filter `" + kind + "`");
+                        }
+                    } catch (boost::regex_error const& err) {
+                        return std::make_tuple(AKU_EQUERY_PARSING_ERROR, output,
+                                               "Invalid where clause, bad regex `" + pattern + "`: " + err.what());
+                    }
+                    status = retreiver.add_tag_filter(tag, *filter);
+                    if (status != AKU_SUCCESS) {
+                        return std::make_tuple(status, output, "Invalid where clause, duplicate tag " + tag);
+                    }
+                } else if (!idslist.empty()) {
+                    // Read idlist
                     std::vector<std::string> tag_values;
                     for (auto idnode: idslist) {
                         tag_values.push_back(idnode.second.get_value<std::string>());
@@ -746,6 +812,11 @@ static std::tuple<aku_Status, std::vector<aku_ParamId>, ErrorMsg> parse_where_cl
         SeriesRetreiver retreiver;
         std::tie(status, output) = retreiver.extract_ids(matcher);
     }
+    if (status == AKU_EHIGH_CARDINALITY) {
+        return std::make_tuple(status, output, "Query matches too many series (limit is " +
+                                               std::to_string(matcher.cardinality_limit) +
+                                               "), narrow down the where clause");
+    }
     return std::make_tuple(status, output, ErrorMsg());
 }
 
@@ -1149,6 +1220,7 @@ static std::tuple<aku_Status, ErrorMsg> validate_suggest_query(boost::property_t
         "metric",
         "tag",
         "starts-with",
+        "limit",
         "output"
     };
     for (const auto& item: ptree) {
@@ -1203,6 +1275,22 @@ static std::string get_starts_with(boost::property_tree::ptree const& ptree) {
     return strval;
 }
 
+/** Parse `limit` statement of the suggest query, format:
+  * { "limit": 100, ... }
+  * Value 0 means unlimited.
+  */
+static std::tuple<aku_Status, size_t> get_suggest_limit(boost::property_tree::ptree const& ptree) {
+    auto child = ptree.get_child_optional("limit");
+    if (!child) {
+        return std::make_tuple(AKU_SUCCESS, AKU_DEFAULT_SUGGEST_LIMIT);
+    }
+    auto value = child->get_value_optional<u64>();
+    if (!value) {
+        return std::make_tuple(AKU_EQUERY_PARSING_ERROR, size_t());
+    }
+    return std::make_tuple(AKU_SUCCESS, static_cast<size_t>(value.get()));
+}
+
 static std::tuple<aku_Status, std::string> get_property(std::string name, boost::property_tree::ptree const& ptree) {
     auto child = ptree.get_child_optional(name);
     if (!child) {
@@ -1230,13 +1318,19 @@ std::tuple<aku_Status, std::shared_ptr<PlainSeriesMatcher>, std::vector<aku_Para
     SuggestQueryKind kind;
     std::tie(kind, status, error) = get_suggest_query_type(ptree);
     std::string starts_with = get_starts_with(ptree);
+    size_t limit;
+    std::tie(status, limit) = get_suggest_limit(ptree);
+    if (status != AKU_SUCCESS) {
+        Logger::msg(AKU_LOG_ERROR, "Query object has invalid `limit` field, integer expected");
+        return std::make_tuple(status, substitute, ids, "Query object has invalid `limit` field, integer expected");
+    }
     std::vector<StringT> results;
     std::string metric_name;
     std::string tag_name;
     switch (kind) {
     case SuggestQueryKind::SUGGEST_METRIC_NAMES:
         // This should work for empty 'starts_with' values. Method should return all metric names.
-        results = matcher.suggest_metric(starts_with);
+        results = matcher.suggest_metric(starts_with, limit);
     break;
     case SuggestQueryKind::SUGGEST_TAG_NAMES:
         std::tie(status, metric_name) = get_property("metric", ptree);
@@ -1244,7 +1338,7 @@ std::tuple<aku_Status, std::shared_ptr<PlainSeriesMatcher>, std::vector<aku_Para
             Logger::msg(AKU_LOG_ERROR, "Metric name expected");
             return std::make_tuple(AKU_EQUERY_PARSING_ERROR, substitute, ids, "Metric name expected");
         }
-        results = matcher.suggest_tags(metric_name, starts_with);
+        results = matcher.suggest_tags(metric_name, starts_with, limit);
     break;
     case SuggestQueryKind::SUGGEST_TAG_VALUES:
         std::tie(status, metric_name) = get_property("metric", ptree);
@@ -1257,7 +1351,7 @@ std::tuple<aku_Status, std::shared_ptr<PlainSeriesMatcher>, std::vector<aku_Para
             Logger::msg(AKU_LOG_ERROR, "Tag name expected");
             return std::make_tuple(AKU_EQUERY_PARSING_ERROR, substitute, ids, "Tag name expected");
         }
-        results = matcher.suggest_tag_values(metric_name, tag_name, starts_with);
+        results = matcher.suggest_tag_values(metric_name, tag_name, starts_with, limit);
     break;
     case SuggestQueryKind::SUGGEST_ERROR:
         return std::make_tuple(AKU_EQUERY_PARSING_ERROR, substitute, ids, error);
@@ -1457,8 +1551,8 @@ static std::tuple<aku_Status, ErrorMsg>
     for (u32 ix = 0; ix < ids.size(); ix++) {
         auto id = ids.at(ix);
         auto fn = req->agg.func.at(ix);
-        auto sname = global_matcher.id2str(id);
-        std::string name(sname.first, sname.first + sname.second);
+        std::string name;
+        global_matcher.id2str(id, &name);
         auto mpos = name.find_first_of(" ");
         if (mpos == std::string::npos) {
             Logger::msg(AKU_LOG_ERROR, "Matcher initialization failed. Invalid series name.");
@@ -1594,8 +1688,8 @@ static std::tuple<aku_Status, ErrorMsg>
     std::vector<aku_ParamId> ids = req->select.columns.at(0).ids;
     auto matcher = std::make_shared<PlainSeriesMatcher>();
     for (auto id: ids) {
-        auto sname = global_matcher.id2str(id);
-        std::string name(sname.first, sname.first + sname.second);
+        std::string name;
+        global_matcher.id2str(id, &name);
         auto npos = name.find_first_of(' ');
         if (npos == std::string::npos) {
             Logger::msg(AKU_LOG_ERROR, "Matcher initialization failed. Invalid series name.");
@@ -1792,8 +1886,8 @@ static std::tuple<aku_Status, ErrorMsg> init_matcher_in_join_query(
     std::vector<aku_ParamId> ids = req->select.columns.at(0).ids;
     auto matcher = std::make_shared<PlainSeriesMatcher>();
     for (auto id: ids) {
-        auto sname = global_matcher.id2str(id);
-        std::string name(sname.first, sname.first + sname.second);
+        std::string name;
+        global_matcher.id2str(id, &name);
         if (!boost::algorithm::starts_with(name, metric_names.front())) {
             Logger::msg(AKU_LOG_ERROR, "Matcher initialization failed. Invalid metric names.");
             return std::make_tuple(AKU_EBAD_DATA, "Matcher initialization failed. Invalid metric names.");
@@ -23,6 +23,7 @@ enum class QueryKind {
 class SeriesRetreiver {
     std::vector<std::string> metric_;
     std::map<std::string, std::vector<std::string>> tags_;
+    std::map<std::string, TagValueFilter> filters_;
     std::vector<std::string> series_;
 public:
     //! Matches all series names
@@ -37,6 +38,9 @@ public:
     //! Add tag name and set of possible values
     aku_Status add_tags(std::string name, std::vector<std::string> values);
 
+    //! Add tag name and prefix or regex that should match tag value
+    aku_Status add_tag_filter(std::string name, TagValueFilter const& filter);
+
     //! Add full series name
     aku_Status add_series_name(std::string name);
 
@@ -31,6 +31,7 @@
 #include <sstream>
 #include <cassert>
 #include <functional>
+#include <numeric>
 
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
@@ -203,6 +204,126 @@ aku_Status StorageSession::write(aku_Sample const& sample) {
     return AKU_SUCCESS;
 }
 
+aku_Status StorageSession::write_batch(const aku_ParamId*   ids,
+                                       const aku_Timestamp* tss,
+                                       const double*        xss,
+                                       u32                  size,
+                                       aku_Status*          out_status_or_null)
+{
+    using namespace StorageEngine;
+    // Group samples by series, stable sort preserves the order of samples
+    // of the same series.
+    std::vector<u32> order(size);
+    std::iota(order.begin(), order.end(), 0u);
+    std::stable_sort(order.begin(), order.end(), [ids](u32 lhs, u32 rhs) {
+        return ids[lhs] < ids[rhs];
+    });
+    std::vector<aku_ParamId>   bids(size);
+    std::vector<aku_Timestamp> btss(size);
+    std::vector<double>        bxss(size);
+    for (u32 ix = 0; ix < size; ix++) {
+        bids[ix] = ids[order[ix]];
+        btss[ix] = tss[order[ix]];
+        bxss[ix] = xss[order[ix]];
+    }
+    aku_Status result = AKU_SUCCESS;
+    auto set_error = [&](u32 begin, u32 end, aku_Status status) {
+        if (result == AKU_SUCCESS && out_status_or_null != nullptr) {
+            std::fill(out_status_or_null, out_status_or_null + size, AKU_SUCCESS);
+        }
+        if (result == AKU_SUCCESS) {
+            result = status;
+        }
+        if (out_status_or_null != nullptr) {
+            for (u32 ix = begin; ix < end; ix++) {
+                out_status_or_null[order[ix]] = status;
+            }
+        }
+    };
+    // Successfully written samples are compacted at the beginning of the
+    // arrays to be added to the input log.
+    u32 nlogged = 0;
+    std::vector<std::pair<aku_ParamId, std::vector<u64>>> rescue_points;
+    u32 begin = 0;
+    while (begin < size) {
+        aku_ParamId id = bids[begin];
+        u32 end = begin + 1;
+        while (end < size && bids[end] == id) {
+            end++;
+        }
+        std::vector<u64> rpoints;
+        u32 pos = begin;
+        while (pos < end) {
+            std::vector<u64> tmp;
+            NBTreeAppendResult res;
+            u32 nwritten;
+            std::tie(res, nwritten) = session_->write(id, btss.data() + pos, bxss.data() + pos, end - pos, &tmp);
+            if (!tmp.empty()) {
+                rpoints.swap(tmp);
+            }
+            if (nlogged != pos) {
+                std::copy(bids.begin() + pos, bids.begin() + pos + nwritten, bids.begin() + nlogged);
+                std::copy(btss.begin() + pos, btss.begin() + pos + nwritten, btss.begin() + nlogged);
+                std::copy(bxss.begin() + pos, bxss.begin() + pos + nwritten, bxss.begin() + nlogged);
+            }
+            nlogged += nwritten;
+            pos     += nwritten;
+            switch (res) {
+            case NBTreeAppendResult::OK:
+            case NBTreeAppendResult::OK_FLUSH_NEEDED:
+                break;
+            case NBTreeAppendResult::FAIL_BAD_ID:
+                Logger::msg(AKU_LOG_ERROR, "Invalid session cache, id = " + std::to_string(id));
+                set_error(pos, end, AKU_ENOT_FOUND);
+                pos = end;
+                break;
+            case NBTreeAppendResult::FAIL_LATE_WRITE:
+                set_error(pos, pos + 1, AKU_ELATE_WRITE);
+                pos++;
+                break;
+            case NBTreeAppendResult::FAIL_BAD_VALUE:
+                set_error(pos, pos + 1, AKU_EBAD_ARG);
+                pos++;
+                break;
+            };
+        }
+        if (!rpoints.empty()) {
+            auto rpoints_copy = rpoints;
+            storage_->_update_rescue_points(id, std::move(rpoints_copy));
+            rescue_points.push_back(std::make_pair(id, std::move(rpoints)));
+        }
+        begin = end;
+    }
+    if (slog_ != nullptr && nlogged != 0) {
+        if (ilog_ == nullptr) {
+            ilog_ = get_input_log(slog_);
+        }
+        auto handle_overflow = [this](std::vector<u64>* staleids) {
+            if (!staleids->empty()) {
+                std::promise<void> barrier;
+                std::future<void> future = barrier.get_future();
+                storage_->add_metadata_sync_barrier(std::move(barrier));
+                storage_->close_specific_columns(*staleids);
+                staleids->clear();
+                future.wait();
+            }
+            ilog_->rotate();
+        };
+        std::vector<u64> staleids;
+        auto res = ilog_->append(bids.data(), btss.data(), bxss.data(), nlogged, &staleids);
+        if (res == AKU_EOVERFLOW) {
+            handle_overflow(&staleids);
+        }
+        for (const auto& kv: rescue_points) {
+            res = ilog_->append(kv.first, kv.second.data(), static_cast<u32>(kv.second.size()), &staleids);
+            if (res == AKU_EOVERFLOW) {
+                handle_overflow(&staleids);
+            }
+        }
+    }
+    return result;
+}
+
 aku_Status StorageSession::init_series_id(const char* begin, const char* end, aku_Sample *sample) {
     // Series name normalization procedure. Most likeley a bottleneck but
     // can be easily parallelized.
@@ -407,6 +528,10 @@ int StorageSession::get_series_name(aku_ParamId id, char* buffer, size_t buffer_
     return static_cast<int>(name.second);
 }
 
+u64 StorageSession::get_write_backlog() const {
+    return storage_->get_write_backlog();
+}
+
 void StorageSession::query(InternalCursor* cur, const char* query) const {
     storage_->query(this, cur, query);
 }
@@ -445,6 +570,8 @@ Storage::Storage()
 Storage::Storage(const char* path, const aku_FineTuneParams &params)
     : done_{0}
     , close_barrier_(2)
+    , global_matcher_(AKU_STARTING_SERIES_ID, params.roaring_index ? IndexPostings::ROARING
+                                                                   : IndexPostings::COMPRESSED)
 {
     metadata_.reset(new MetadataStorage(path));
 
@@ -470,12 +597,37 @@ Storage::Storage(const char* path, const aku_FineTuneParams &params)
         AKU_PANIC("Unknown blockstore type (" + bstore_type + ")");
     }
     cstore_ = std::make_shared<StorageEngine::ColumnStore>(bstore_);
+    if (params.reorder_window) {
+        Logger::msg(AKU_LOG_INFO, "Out-of-order writes enabled, window: " +
+                                  std::to_string(params.reorder_window) + ", buffer size: " +
+                                  std::to_string(params.reorder_buffer_size));
+        cstore_->set_reorder_window(params.reorder_window, params.reorder_buffer_size);
+    }
+    if (params.roaring_index) {
+        Logger::msg(AKU_LOG_INFO, "Series index uses roaring bitmaps");
+    }
+    global_matcher_.cardinality_limit = params.max_query_cardinality;
+    if (params.series_id_range) {
+        if (params.persistent_index) {
+            // Persistent index finds new series by comparing their ids with the largest indexed id
+            Logger::msg(AKU_LOG_ERROR, "Series id ranges can't be used with the persistent index, "
+                                       "series ids will be allocated sequentially");
+        } else {
+            Logger::msg(AKU_LOG_INFO, "Series id range size: " + std::to_string(params.series_id_range));
+            global_matcher_.id_range_size = params.series_id_range;
+        }
+    }
     // Update series matcher
     boost::optional<i64> baseline = metadata_->get_prev_largest_id();
     if (baseline) {
         global_matcher_.series_id = baseline.get() + 1;
     }
-    auto status = metadata_->load_matcher_data(global_matcher_);
+    aku_Status status;
+    if (params.persistent_index) {
+        status = open_series_index(std::string(path) + ".index");
+    } else {
+        status = metadata_->load_matcher_data(global_matcher_);
+    }
     if (status != AKU_SUCCESS) {
         Logger::msg(AKU_LOG_ERROR, "Can't read series names");
         AKU_PANIC("Can't read series names");
@@ -503,6 +655,42 @@ Storage::Storage(const char* path, const aku_FineTuneParams &params)
     start_sync_worker();
 }
 
+aku_Status Storage::open_series_index(std::string const& path) {
+    aku_Status status;
+    std::tie(status, series_index_) = PersistentSeriesIndex::open(path);
+    if (status != AKU_SUCCESS) {
+        Logger::msg(AKU_LOG_ERROR, "Series index " + path + " can't be opened, rebuilding");
+        std::tie(status, series_index_) = PersistentSeriesIndex::create(path);
+        if (status != AKU_SUCCESS) {
+            return status;
+        }
+    }
+    auto segments = series_index_->get_segments();
+    // Series that was added after the last index update (or all series if
+    // the index was just created)
+    status = metadata_->load_matcher_data(global_matcher_, series_index_->max_id());
+    if (status != AKU_SUCCESS) {
+        return status;
+    }
+    std::deque<std::string> names;  // Matcher stores names in interned form
+    std::vector<SeriesIndexSegment::SeriesT> tail;
+    for (auto id: global_matcher_.get_all_ids()) {
+        names.emplace_back();
+        global_matcher_.id2str(id, &names.back());
+        tail.push_back(std::make_pair(std::make_pair(names.back().data(), static_cast<u32>(names.back().size())), id));
+    }
+    global_matcher_.attach(segments);
+    Logger::msg(AKU_LOG_INFO, "Series index opened, " + std::to_string(series_index_->cardinality()) +
+                              " series in the index, " + std::to_string(tail.size()) + " series added");
+    status = series_index_->append(tail);
+    if (status != AKU_SUCCESS) {
+        // Missing series will be loaded from the metadata storage on next start
+        Logger::msg(AKU_LOG_ERROR, "Can't update series index, " + StatusUtil::str(status));
+        series_index_.reset();
+    }
+    return AKU_SUCCESS;
+}
+
 void Storage::run_recovery(const aku_FineTuneParams &params,
         std::unordered_map<aku_ParamId, std::vector<StorageEngine::LogicAddr>>* mapping)
 {
@@ -560,6 +748,7 @@ void Storage::run_inputlog_metadata_recovery(
         std::unordered_map<aku_ParamId, std::vector<StorageEngine::LogicAddr>>* mapping;
         StorageEngine::LogicAddr top_addr;
         std::vector<aku_ParamId>* restored_ids;
+        std::string name;  //! Buffer for the series names
 
         /** Should be called for each input-log record
           * before using as a visitor
@@ -574,8 +763,7 @@ void Storage::run_inputlog_metadata_recovery(
         }
 
         bool operator () (const InputLogSeriesName& sname) {
-            auto strref = storage->global_matcher_.id2str(curr_id);
-            if (strref.second) {
+            if (storage->global_matcher_.id2str(curr_id, &name)) {
                 // Fast path, name already added
                 return true;
             }
@@ -586,12 +774,10 @@ void Storage::run_inputlog_metadata_recovery(
             if (id == 0) {
                 // create new series
                 id = curr_id;
-                StringT prev = storage->global_matcher_.id2str(id);
-                if (prev.second != 0) {
+                if (storage->global_matcher_.id2str(id, &name)) {
                     // sample.paramid maps to some other series
                     Logger::msg(AKU_LOG_ERROR, "Series id conflict. Id " + std::to_string(id) + " is already taken by "
-                                             + std::string(prev.first, prev.first + prev.second) + ". Series name "
-                                             + sname.value + " is skipped.");
+                                             + name + ". Series name " + sname.value + " is skipped.");
                     return true;
                 }
                 storage->global_matcher_._add(sname.value, id);
@@ -609,8 +795,7 @@ void Storage::run_inputlog_metadata_recovery(
 
         bool operator () (const InputLogRecoveryInfo& rinfo) {
             // Check that series exists
-            auto strref = storage->global_matcher_.id2str(curr_id);
-            if (!strref.second) {
+            if (!storage->global_matcher_.id2str(curr_id, &name)) {
                 // Id is not taken
                 Logger::msg(AKU_LOG_ERROR, "Series id is not taken. Id " + std::to_string(curr_id) + ", recovery record will be skipped.");
                 return true;
@@ -790,7 +975,7 @@ void Storage::run_inputlog_recovery(ShardedInputLog* ilog, std::vector<aku_Param
         }
         if (done_.load() == 1) {
             // Save finall mapping (should contain all affected columns)
-            metadata_->sync_with_metadata_storage(boost::bind(&SeriesMatcher::pull_new_names, &global_matcher_, _1));
+            sync_metadata();
         }
     }
     bstore_->flush();
@@ -1185,16 +1370,11 @@ void Storage::start_sync_worker() {
         SYNC_REQUEST_TIMEOUT = 10000,
     };
     auto sync_worker = [this]() {
-        auto get_names = [this](std::vector<PlainSeriesMatcher::SeriesNameT>* names) {
-            std::lock_guard<std::mutex> guard(lock_);
-            global_matcher_.pull_new_names(names);
-        };
-
         while(done_.load() == 0) {
             auto status = metadata_->wait_for_sync_request(SYNC_REQUEST_TIMEOUT);
             if (status == AKU_SUCCESS) {
                 bstore_->flush();
-                metadata_->sync_with_metadata_storage(get_names);
+                sync_metadata();
                 std::lock_guard<std::mutex> lock(session_lock_);
                 for (auto& it: sessions_await_list_) {
                     it.set_value();
@@ -1209,6 +1389,32 @@ void Storage::start_sync_worker() {
     sync_worker_thread.detach();
 }
 
+void Storage::sync_metadata() {
+    std::vector<SeriesIndexSegment::SeriesT> newnames;
+    std::deque<std::string> storage;  // Names are referenced until the end of the sync
+    auto get_names = [this, &newnames, &storage](std::vector<PlainSeriesMatcher::SeriesNameT>* names) {
+        std::lock_guard<std::mutex> guard(lock_);
+        global_matcher_.pull_new_names(names, &storage);
+        if (series_index_) {
+            for (auto const& name: *names) {
+                newnames.push_back(std::make_pair(std::make_pair(std::get<0>(name), static_cast<u32>(std::get<1>(name))),
+                                                  std::get<2>(name)));
+            }
+        }
+    };
+    metadata_->sync_with_metadata_storage(get_names);
+    // Series index is updated after the metadata storage so it never contains
+    // series that are not in the metadata storage
+    if (series_index_ && !newnames.empty()) {
+        auto status = series_index_->append(newnames);
+        if (status != AKU_SUCCESS) {
+            // Missing series will be loaded from the metadata storage on next start
+            Logger::msg(AKU_LOG_ERROR, "Can't update series index, " + StatusUtil::str(status));
+            series_index_.reset();
+        }
+    }
+}
+
 void Storage::add_metadata_sync_barrier(std::promise<void>&& barrier) {
     std::lock_guard<std::mutex> lock(session_lock_);
     if (done_.load() != 0) {
@@ -1243,7 +1449,7 @@ void Storage::close() {
             metadata_->add_rescue_point(id, std::move(vals));
         }
         // Save finall mapping (should contain all affected columns)
-        metadata_->sync_with_metadata_storage(boost::bind(&SeriesMatcher::pull_new_names, &global_matcher_, _1));
+        sync_metadata();
     }
     bstore_->flush();
 
@@ -1279,6 +1485,10 @@ void Storage::_update_rescue_points(aku_ParamId id, std::vector<StorageEngine::L
     metadata_->add_rescue_point(id, std::move(rpoints));
 }
 
+u64 Storage::get_write_backlog() const {
+    return metadata_->get_backlog();
+}
+
 std::shared_ptr<StorageSession> Storage::create_write_session() {
     std::shared_ptr<StorageEngine::CStoreSession> session =
             std::make_shared<StorageEngine::CStoreSession>(cstore_);
@@ -1288,9 +1498,10 @@ std::shared_ptr<StorageSession> Storage::create_write_session() {
 }
 
 std::tuple<aku_Status, bool> Storage::init_series_id(const char* begin, const char* end, aku_Sample *sample, PlainSeriesMatcher *local_matcher) {
-    u64 id = 0;
     bool create_new = false;
-    {
+    // Fast path, series name lookup doesn't require the lock
+    u64 id = static_cast<u64>(global_matcher_.match(begin, end));
+    if (id == 0) {
         std::lock_guard<std::mutex> guard(lock_);
         id = static_cast<u64>(global_matcher_.match(begin, end));
         if (id == 0) {
@@ -1313,18 +1524,18 @@ std::tuple<aku_Status, bool> Storage::init_series_id(const char* begin, const ch
 }
 
 int Storage::get_series_name(aku_ParamId id, char* buffer, size_t buffer_size, PlainSeriesMatcher *local_matcher) {
-    auto str = global_matcher_.id2str(static_cast<i64>(id));
-    if (str.first == nullptr) {
+    std::string str;
+    if (!global_matcher_.id2str(static_cast<i64>(id), &str)) {
         return 0;
     }
     // copy value to local matcher
-    local_matcher->_add(str.first, str.first + str.second, static_cast<i64>(id));
+    local_matcher->_add(str.data(), str.data() + str.size(), static_cast<i64>(id));
     // copy the string to out buffer
-    if (str.second > buffer_size) {
-        return -1*static_cast<int>(str.second);
+    if (str.size() > buffer_size) {
+        return -1*static_cast<int>(str.size());
     }
-    memcpy(buffer, str.first, static_cast<size_t>(str.second));
-    return static_cast<int>(str.second);
+    memcpy(buffer, str.data(), str.size());
+    return static_cast<int>(str.size());
 }
 
 std::tuple<aku_Status, std::string>
@@ -1690,6 +1901,10 @@ aku_Status Storage::remove_storage(const char* file_name, const char* wal_path,
 
     std::for_each(volume_names.begin(), volume_names.end(), delete_file);
 
+    // Series index can be missing
+    boost::system::error_code ec;
+    boost::filesystem::remove_all(std::string(file_name) + ".index", ec);
+
     int card;
     std::tie(status, card) = ShardedInputLog::find_logs(wal_path);
     if (status == AKU_SUCCESS && card > 0) {
@@ -1714,6 +1929,7 @@ boost::property_tree::ptree Storage::get_stats() {
         result.put(path + ".free_space", free_vol);
         result.put(path + ".file_name", name);
     }
+    result.put("write_backlog", get_write_backlog());
     return result;
 }
 
@@ -61,6 +61,24 @@ public:
 
     aku_Status write(aku_Sample const& sample);
 
+    /** Write samples in bulk.
+      * Samples are grouped by series id (order of samples of the same series is
+      * preserved). Every run of samples is written using one tree lookup and
+      * the input log is updated using whole frames.
+      * @param ids is an array of series ids
+      * @param tss is an array of timestamps
+      * @param xss is an array of values
+      * @param size is a size of every array
+      * @param out_status_or_null is an array of `size` elements that receives the
+      *        status of every sample, it's filled only if error is returned
+      * @return AKU_SUCCESS if all samples were written, status of the first failure otherwise
+      */
+    aku_Status write_batch(const aku_ParamId*   ids,
+                           const aku_Timestamp* tss,
+                           const double*        xss,
+                           u32                  size,
+                           aku_Status*          out_status_or_null);
+
     /** Match series name. If series with such name doesn't exists - create it.
       * This method should be called for each sample to init its `paramid` field.
       */
@@ -74,6 +92,9 @@ public:
 
     int get_series_name(aku_ParamId id, char* buffer, size_t buffer_size);
 
+    //! Return number of storage updates that wasn't synced yet (see Storage::get_write_backlog)
+    u64 get_write_backlog() const;
+
     void query(InternalCursor* cur, const char* query) const;
 
     /**
@@ -105,6 +126,8 @@ class Storage : public std::enable_shared_from_this<Storage> {
     std::shared_ptr<MetadataStorage> metadata_;
     std::shared_ptr<ShardedInputLog> inputlog_;
     std::string input_log_path_;
+    //! Persistent series index (null if disabled)
+    std::shared_ptr<PersistentSeriesIndex> series_index_;
 
     // Await support
     std::vector<std::promise<void>> sessions_await_list_;
@@ -112,6 +135,14 @@ class Storage : public std::enable_shared_from_this<Storage> {
 
     void start_sync_worker();
 
+    //! Write new series names and other metadata to disk
+    void sync_metadata();
+
+    /** Open persistent series index and attach it to the series matcher,
+      * series that are not in the index are loaded from the metadata storage.
+      */
+    aku_Status open_series_index(std::string const& path);
+
     std::tuple<aku_Status, std::string> parse_query(const boost::property_tree::ptree &ptree,
                                                     QP::ReshapeRequest* req) const;
 
@@ -173,6 +204,13 @@ public:
 
     void _update_rescue_points(aku_ParamId id, std::vector<StorageEngine::LogicAddr>&& rpoints);
 
+    /** Return number of metadata updates waiting for the sync worker.
+      * Every tree flush produces an update, write sessions block on it
+      * when the input log is rotated, so the value can be used by the
+      * ingestion front-end to slow down the clients.
+      */
+    u64 get_write_backlog() const;
+
     /** This method should be called before object destructor.
       * All ingestion sessions should be stopped first.
       */
@@ -21,9 +21,17 @@ using namespace QP;
 
 ColumnStore::ColumnStore(std::shared_ptr<BlockStore> bstore)
     : blockstore_(bstore)
+    , reorder_window_(0)
+    , reorder_capacity_(0)
 {
 }
 
+void ColumnStore::set_reorder_window(aku_Timestamp window, u32 capacity) {
+    std::lock_guard<std::mutex> tl(table_lock_);
+    reorder_window_   = window;
+    reorder_capacity_ = capacity;
+}
+
 std::tuple<aku_Status, std::vector<aku_ParamId>> ColumnStore::open_or_restore(
         std::unordered_map<aku_ParamId,
         std::vector<StorageEngine::LogicAddr>> const& mapping,
@@ -43,6 +51,9 @@ std::tuple<aku_Status, std::vector<aku_ParamId>> ColumnStore::open_or_restore(
         auto tree = std::make_shared<NBTreeExtentsList>(id, rescue_points, blockstore_);
 
         std::lock_guard<std::mutex> tl(table_lock_);
+        if (reorder_window_) {
+            tree->set_reorder_window(reorder_window_, reorder_capacity_);
+        }
         if (columns_.count(id)) {
             Logger::msg(AKU_LOG_ERROR, "Can't open/repair " + std::to_string(id) + " (already exists)");
             return std::make_tuple(AKU_EBAD_ARG, std::vector<aku_ParamId>());
@@ -120,6 +131,9 @@ aku_Status ColumnStore::create_new_column(aku_ParamId id) {
         if (columns_.count(id)) {
             return AKU_EBAD_ARG;
         } else {
+            if (reorder_window_) {
+                tree->set_reorder_window(reorder_window_, reorder_capacity_);
+            }
             columns_[id] = std::move(tree);
             columns_[id]->force_init();
             return AKU_SUCCESS;
@@ -224,6 +238,53 @@ NBTreeAppendResult CStoreSession::write(aku_Sample const& sample, std::vector<Lo
     return NBTreeAppendResult::FAIL_BAD_VALUE;
 }
 
+std::tuple<NBTreeAppendResult, u32> CStoreSession::write(aku_ParamId id,
+                                                         const aku_Timestamp* tss,
+                                                         const double* xss,
+                                                         u32 size,
+                                                         std::vector<LogicAddr>* rescue_points)
+{
+    if (size == 0) {
+        return std::make_tuple(NBTreeAppendResult::OK, 0u);
+    }
+    bool flushed = false;
+    u32 pos = 0;
+    auto it = cache_.find(id);
+    if (it == cache_.end()) {
+        // Cache miss - access global registry, tree will be added to the cache
+        aku_Sample sample = {};
+        sample.paramid = id;
+        sample.timestamp = tss[0];
+        sample.payload.type = AKU_PAYLOAD_FLOAT;
+        sample.payload.size = sizeof(aku_Sample);
+        sample.payload.float64 = xss[0];
+        auto res = cstore_->write(sample, rescue_points, &cache_);
+        if (res != NBTreeAppendResult::OK && res != NBTreeAppendResult::OK_FLUSH_NEEDED) {
+            return std::make_tuple(res, 0u);
+        }
+        flushed = res == NBTreeAppendResult::OK_FLUSH_NEEDED;
+        it = cache_.find(id);
+        pos = 1;
+    }
+    if (pos < size) {
+        NBTreeAppendResult res;
+        u32 count;
+        std::tie(res, count) = it->second->append(tss + pos, xss + pos, size - pos);
+        if (res == NBTreeAppendResult::OK_FLUSH_NEEDED) {
+            auto tmp = it->second->get_roots();
+            rescue_points->swap(tmp);
+            flushed = true;
+        } else if (res != NBTreeAppendResult::OK) {
+            return std::make_tuple(res, pos);
+        }
+        pos += count;
+        if (pos != size) {
+            return std::make_tuple(NBTreeAppendResult::FAIL_LATE_WRITE, pos);
+        }
+    }
+    return std::make_tuple(flushed ? NBTreeAppendResult::OK_FLUSH_NEEDED : NBTreeAppendResult::OK, size);
+}
+
 void CStoreSession::close() {
     // This method can't be implemented yet, because it will waste space.
     // Leaf node recovery should be implemented first.
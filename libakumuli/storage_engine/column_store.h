@@ -65,6 +65,10 @@ class ColumnStore : public std::enable_shared_from_this<ColumnStore> {
     mutable std::mutex table_lock_;
     //! Syncronization for watcher thread
     std::condition_variable cvar_;
+    //! Out-of-order write window (0 - disabled)
+    aku_Timestamp reorder_window_;
+    //! Max number of data-points in reorder buffer
+    u32 reorder_capacity_;
 
 public:
     ColumnStore(std::shared_ptr<StorageEngine::BlockStore> bstore);
@@ -74,6 +78,12 @@ public:
     ColumnStore(ColumnStore &&) = delete;
     ColumnStore& operator = (ColumnStore const&) = delete;
 
+    /** Enable out-of-order writes for all columns opened or created after the call.
+      * @param window is a window size in timestamp units (0 disables reordering)
+      * @param capacity is a max number of data-points buffered per column
+      */
+    void set_reorder_window(aku_Timestamp window, u32 capacity);
+
     //! Open storage or restore if needed
     std::tuple<aku_Status, std::vector<aku_ParamId>> open_or_restore(
             const std::unordered_map<aku_ParamId, std::vector<LogicAddr>> &mapping,
@@ -260,6 +270,21 @@ public:
     //! Write sample
     NBTreeAppendResult write(const aku_Sample &sample, std::vector<LogicAddr>* rescue_points);
 
+    /** Write run of values that belong to the same series.
+      * Values are written in order until the first failure.
+      * @param id is a series id
+      * @param tss is an array of timestamps
+      * @param xss is an array of values
+      * @param size is a size of both arrays
+      * @param rescue_points will receive new rescue points if any leaf node was flushed
+      * @return status of the failed append (or OK/OK_FLUSH_NEEDED) and number of values written
+      */
+    std::tuple<NBTreeAppendResult, u32> write(aku_ParamId id,
+                                              const aku_Timestamp* tss,
+                                              const double* xss,
+                                              u32 size,
+                                              std::vector<LogicAddr>* rescue_points);
+
     /**
      * Closes the session. This method should unload all cached trees
      */
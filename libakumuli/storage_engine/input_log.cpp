@@ -8,6 +8,8 @@
 #include <boost/lexical_cast.hpp>
 #include <chrono>
 
+#include <sys/mman.h>
+
 namespace Akumuli {
 
 const static u16 V1_MAGIC = 0x1;
@@ -65,6 +67,33 @@ static AprFilePtr _open_file_ro(const char* file_name, apr_pool_t* pool) {
     return file;
 }
 
+static void _delete_apr_mmap(apr_mmap_t* mmap) {
+    apr_mmap_delete(mmap);
+}
+
+/** Map the whole file in read-only mode. Returns null pointer if
+  * the file can't be mapped, in this case the caller should fallback
+  * to regular reads.
+  */
+static AprMmapPtr _mmap_file_ro(apr_file_t* file, size_t size, apr_pool_t* pool) {
+    apr_mmap_t* pmmap = nullptr;
+    AprMmapPtr result(nullptr, &_delete_apr_mmap);
+    if (size == 0) {
+        return result;
+    }
+    apr_status_t status = apr_mmap_create(&pmmap, file, 0, size, APR_MMAP_READ, pool);
+    if (status != APR_SUCCESS) {
+        log_apr_error(status, "Can't mmap file");
+        return result;
+    }
+    // Frames are read strictly in order during recovery
+    if (madvise(pmmap->mm, size, MADV_SEQUENTIAL) != 0) {
+        Logger::msg(AKU_LOG_INFO, "madvise(MADV_SEQUENTIAL) failed");
+    }
+    result.reset(pmmap);
+    return result;
+}
+
 static size_t _get_file_size(apr_file_t* file) {
     apr_finfo_t info;
     auto status = apr_file_info_get(&info, APR_FINFO_SIZE, file);
@@ -149,18 +178,36 @@ aku_Status LZ4Volume::write(int i) {
 
 std::tuple<aku_Status, size_t> LZ4Volume::read(int i) {
     assert(is_read_only_);
-    Frame& frame = frames_[i];
-    // Read frame
+    return decompress(&frames_[i]);
+}
+
+std::tuple<aku_Status, size_t> LZ4Volume::decompress(Frame* dest) {
+    assert(is_read_only_);
+    const char* source = buffer_;
     u32 frame_size;
-    aku_Status status;
-    std::tie(status, frame_size) = _read_frame(file_, sizeof(buffer_), buffer_);
-    if (status != AKU_SUCCESS) {
-        return std::make_tuple(status, 0);
+    if (mmap_) {
+        // Zero-copy path, decompress straight from the mapped file
+        if (read_offset_ + sizeof(u32) > file_size_) {
+            return std::make_tuple(AKU_EBAD_DATA, 0);
+        }
+        const char* begin = static_cast<const char*>(mmap_->mm) + read_offset_;
+        memcpy(&frame_size, begin, sizeof(u32));
+        if (frame_size > sizeof(buffer_) || read_offset_ + sizeof(u32) + frame_size > file_size_) {
+            return std::make_tuple(AKU_EBAD_DATA, 0);
+        }
+        source = begin + sizeof(u32);
+        read_offset_ += sizeof(u32) + frame_size;
+    } else {
+        aku_Status status;
+        std::tie(status, frame_size) = _read_frame(file_, sizeof(buffer_), buffer_);
+        if (status != AKU_SUCCESS) {
+            return std::make_tuple(status, 0);
+        }
+        assert(frame_size <= sizeof(buffer_));
     }
-    assert(frame_size <= sizeof(buffer_));
     int out_bytes = LZ4_decompress_safe_continue(&decode_stream_,
-                                                 buffer_,
-                                                 frame.block,
+                                                 source,
+                                                 dest->block,
                                                  frame_size,
                                                  BLOCK_SIZE);
     if(out_bytes <= 0) {
@@ -174,6 +221,8 @@ LZ4Volume::LZ4Volume(LogSequencer* sequencer, const char* file_name, size_t volu
     , pos_(0)
     , pool_(_make_apr_pool())
     , file_(_open_file(file_name, pool_.get()))
+    , mmap_(nullptr, &_delete_apr_mmap)
+    , read_offset_(0)
     , file_size_(0)
     , max_file_size_(volume_size)
     , bitmap_(std::make_shared<Roaring64Map>())
@@ -197,6 +246,8 @@ LZ4Volume::LZ4Volume(const char* file_name)
     , pos_(1)
     , pool_(_make_apr_pool())
     , file_(nullptr, &null_deleter)
+    , mmap_(nullptr, &_delete_apr_mmap)
+    , read_offset_(0)
     , file_size_(0)
     , max_file_size_(0)
     , bitmap_(std::make_shared<Roaring64Map>())
@@ -222,6 +273,8 @@ void LZ4Volume::open_ro() {
     file_ = _open_file_ro(path_.c_str(), pool_.get());
     file_size_ = _get_file_size(file_.get());
     bytes_to_read_ = static_cast<i64>(file_size_);
+    mmap_ = _mmap_file_ro(file_.get(), file_size_, pool_.get());
+    read_offset_ = 0;
 }
 
 bool LZ4Volume::is_opened() const {
@@ -239,6 +292,7 @@ void LZ4Volume::close() {
             write(pos_);
         }
     }
+    mmap_.reset();
     file_.reset();
 }
 
@@ -291,6 +345,36 @@ aku_Status LZ4Volume::append(u64 id, u64 timestamp, double value) {
     return AKU_SUCCESS;
 }
 
+aku_Status LZ4Volume::append(const u64* ids, const u64* tss, const double* xss, u32 size) {
+    bitmap_->addMany(size, ids);
+    u32 pos = 0;
+    while (pos < size) {
+        auto status = require_frame_type(FrameType::DATA_ENTRY);
+        if (status != AKU_SUCCESS) {
+            return status;
+        }
+        Frame& frame = frames_[pos_];
+        u32 nelem = std::min(static_cast<u32>(NUM_TUPLES) - frame.data_points.size, size - pos);
+        std::copy(ids + pos, ids + pos + nelem, frame.data_points.ids + frame.data_points.size);
+        std::copy(tss + pos, tss + pos + nelem, frame.data_points.tss + frame.data_points.size);
+        std::copy(xss + pos, xss + pos + nelem, frame.data_points.xss + frame.data_points.size);
+        frame.data_points.size += nelem;
+        pos += nelem;
+        if (frame.data_points.size == NUM_TUPLES) {
+            status = write(pos_);
+            if (status != AKU_SUCCESS) {
+                return status;
+            }
+            pos_ = (pos_ + 1) % 2;
+            clear(pos_);
+        }
+    }
+    if(file_size_ >= max_file_size_) {
+        return AKU_EOVERFLOW;
+    }
+    return AKU_SUCCESS;
+}
+
 struct MutableEntry : LZ4Volume::Frame::FlexibleEntry {
     union Bits {
         u64 value;
@@ -520,11 +604,32 @@ std::tuple<aku_Status, const LZ4Volume::Frame*> LZ4Volume::read_next_frame() {
     return std::make_tuple(AKU_SUCCESS, frame);
 }
 
+std::tuple<aku_Status, u32> LZ4Volume::read_frames(Frame* dest, u32 nframes) {
+    if (nframes < 2) {
+        // Previous frame is used as a dictionary and shouldn't be overwritten
+        return std::make_tuple(AKU_EBAD_ARG, 0);
+    }
+    u32 nread = 0;
+    while (nread < nframes && bytes_to_read_ > 0) {
+        size_t bytes_read;
+        aku_Status status;
+        std::tie(status, bytes_read) = decompress(dest + nread);
+        if (status != AKU_SUCCESS) {
+            return std::make_tuple(status, nread);
+        }
+        bytes_to_read_ -= bytes_read;
+        nread++;
+    }
+    elements_to_read_ = 0;
+    return std::make_tuple(AKU_SUCCESS, nread);
+}
+
 const std::string LZ4Volume::get_path() const {
     return path_;
 }
 
 void LZ4Volume::delete_file() {
+    mmap_.reset();
     file_.reset();
     remove(path_.c_str());
 }
@@ -640,6 +745,8 @@ InputLog::InputLog(LogSequencer* sequencer, const char* rootdir, size_t nvol, si
     , volume_size_(svol)
     , stream_id_(stream_id)
     , sequencer_(sequencer)
+    , read_pos_(0)
+    , read_size_(0)
 {
     std::string path = get_volume_name();
     Logger::msg(AKU_LOG_INFO, std::string("Open input log ") + std::to_string(stream_id) + " for logging.");
@@ -653,6 +760,8 @@ InputLog::InputLog(const char* rootdir, u32 stream_id)
     , volume_size_(0)
     , stream_id_(stream_id)
     , sequencer_(nullptr)
+    , read_pos_(0)
+    , read_size_(0)
 {
     Logger::msg(AKU_LOG_INFO, std::string("Open input log ") + std::to_string(stream_id) + " for recovery.");
     find_volumes();
@@ -662,6 +771,8 @@ InputLog::InputLog(const char* rootdir, u32 stream_id)
 void InputLog::reopen() {
     assert(volume_size_ == 0 &&  max_volumes_ == 0);  // read mode
     volumes_.clear();
+    read_pos_ = 0;
+    read_size_ = 0;
     open_volumes();
 }
 
@@ -712,6 +823,14 @@ aku_Status InputLog::append(u64 id, const u64 *rescue_points, u32 len, std::vect
     return result;
 }
 
+aku_Status InputLog::append(const u64* ids, const u64* tss, const double* xss, u32 size, std::vector<u64>* stale_ids) {
+    aku_Status result = volumes_.front()->append(ids, tss, xss, size);
+    if (result == AKU_EOVERFLOW && volumes_.size() == max_volumes_) {
+        detect_stale_ids(stale_ids);
+    }
+    return result;
+}
+
 std::tuple<aku_Status, u32> InputLog::read_next(size_t buffer_size, u64* id, u64* ts, double* xs) {
     while(true) {
         if (volumes_.empty()) {
@@ -749,6 +868,13 @@ std::tuple<aku_Status, u32> InputLog::read_next(size_t buffer_size, InputLogRow*
 }
 
 std::tuple<aku_Status, const LZ4Volume::Frame*> InputLog::read_next_frame() {
+    if (read_pos_ < read_size_) {
+        const LZ4Volume::Frame* result = &read_buffer_.at(read_pos_++);
+        return std::make_tuple(AKU_SUCCESS, result);
+    }
+    if (read_buffer_.empty()) {
+        read_buffer_.resize(READ_BATCH);
+    }
     while(true) {
         if (volumes_.empty()) {
             return std::make_tuple(AKU_ENO_DATA, nullptr);
@@ -757,16 +883,22 @@ std::tuple<aku_Status, const LZ4Volume::Frame*> InputLog::read_next_frame() {
             volumes_.front()->open_ro();
         }
         aku_Status status;
-        const LZ4Volume::Frame* result;
-        std::tie(status, result) = volumes_.front()->read_next_frame();
-        if (result == nullptr && status == AKU_SUCCESS) {
-            volumes_.pop_front();
-            continue;
-        }
+        u32 nframes;
+        std::tie(status, nframes) = volumes_.front()->read_frames(read_buffer_.data(), READ_BATCH);
         if (status != AKU_SUCCESS) {
+            read_size_ = 0;
             return std::make_tuple(status, nullptr);
         }
-        return std::make_pair(AKU_SUCCESS, result);
+        if (nframes == 0) {
+            volumes_.pop_front();
+            continue;
+        }
+        // Frames are decoded straight into the batch, the last one is used
+        // by LZ4 as a dictionary for the next batch
+        read_size_ = nframes;
+        read_pos_  = 1;
+        const LZ4Volume::Frame* result = &read_buffer_.at(0);
+        return std::make_tuple(AKU_SUCCESS, result);
     }
 }
 
@@ -9,6 +9,7 @@
 #include <apr.h>
 #include <apr_file_io.h>
 #include <apr_general.h>
+#include <apr_mmap.h>
 
 #include <boost/filesystem.hpp>
 #include <boost/variant.hpp>
@@ -24,6 +25,7 @@ namespace Akumuli {
 
 typedef std::unique_ptr<apr_pool_t, void (*)(apr_pool_t*)> AprPoolPtr;
 typedef std::unique_ptr<apr_file_t, void (*)(apr_file_t*)> AprFilePtr;
+typedef std::unique_ptr<apr_mmap_t, void (*)(apr_mmap_t*)> AprMmapPtr;
 
 
 struct InputLogDataPoint {
@@ -135,6 +137,8 @@ struct LZ4Volume {
     LZ4_streamDecode_t decode_stream_;
     AprPoolPtr pool_;
     AprFilePtr file_;
+    AprMmapPtr mmap_;       //! Read-only mapping of the volume (read mode only, can be null)
+    size_t read_offset_;    //! Offset of the next frame inside the mapping
     size_t file_size_;
     const size_t max_file_size_;
     std::shared_ptr<Roaring64Map> bitmap_;
@@ -149,6 +153,12 @@ struct LZ4Volume {
 
     std::tuple<aku_Status, size_t> read(int i);
 
+    /** Read next frame from the file and decompress it into `dest`.
+      * If the volume is mapped into memory the frame is decompressed
+      * directly from the mapping, otherwise it's read into `buffer_` first.
+      */
+    std::tuple<aku_Status, size_t> decompress(Frame* dest);
+
     /** Check if the current frame is of required type.
       * If this is the case the method will do nothing
       * and return AKU_SUCCESS. If the current frame has
@@ -195,6 +205,16 @@ public:
     aku_Status append(u64 id, const char* sname, u32 len);
     aku_Status append(u64 id, const u64* recovery_array, u32 len);
 
+    /**
+     * @brief Append data points in bulk (whole frames are filled at once)
+     * @param ids is an array of series ids
+     * @param tss is an array of timestamps
+     * @param xss is an array of values
+     * @param size is a size of every array
+     * @return AKU_EOVERFLOW if volume size limit is reached (all values are written anyway)
+     */
+    aku_Status append(const u64* ids, const u64* tss, const double* xss, u32 size);
+
     /**
      * @brief Read values in bulk (volume should be opened in read mode)
      * @param buffer_size is a size of any input buffer (all should be of the same size)
@@ -212,6 +232,17 @@ public:
      */
     std::tuple<aku_Status, const Frame*> read_next_frame();
 
+    /**
+     * @brief Decompress up to `nframes` frames into the caller-provided array
+     * @param dest is a pointer to array of frames
+     * @param nframes is a size of the array (should be at least 2)
+     * @return status and number of frames being read (0 if EOF reached)
+     * @note LZ4 stream uses previously decoded frame as a dictionary. The last
+     *       frame returned by the previous call should be left intact until the
+     *       next call returns. Don't mix this method with other read methods.
+     */
+    std::tuple<aku_Status, u32> read_frames(Frame* dest, u32 nframes);
+
     const std::string get_path() const;
 
     void delete_file();
@@ -235,6 +266,13 @@ class InputLog {
     const u32 stream_id_;
     LogSequencer* sequencer_;
 
+    enum {
+        READ_BATCH = 16,  //< Number of frames decoded by `read_next_frame` at once
+    };
+    std::vector<LZ4Volume::Frame> read_buffer_;  //< Frames decoded during recovery
+    u32 read_pos_;
+    u32 read_size_;
+
     void find_volumes();
 
     void open_volumes();
@@ -277,6 +315,11 @@ public:
     aku_Status append(u64 id, const char* sname, u32 len, std::vector<u64> *stale_ids);
     aku_Status append(u64 id, const u64* rescue_points, u32 len, std::vector<u64> *stale_ids);
 
+    /** Append data points in bulk.
+      * Return AKU_EOVERFLOW on overflow, the same way as single point version does.
+      */
+    aku_Status append(const u64* ids, const u64* tss, const double* xss, u32 size, std::vector<u64>* stale_ids);
+
     /**
      * @brief Read values in bulk (volume should be opened in read mode)
      * @param buffer_size is a size of any input buffer (all should be of the same size)
@@ -291,6 +334,7 @@ public:
     /**
      * @brief Read next frame from the volume
      * @return status and pointer to frame
+     * @note Frames are decoded in batches, pointer stays valid until the next call
      */
     std::tuple<aku_Status, const LZ4Volume::Frame*> read_next_frame();
 
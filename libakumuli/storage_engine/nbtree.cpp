@@ -1973,6 +1973,42 @@ aku_Status IOVecLeaf::append(aku_Timestamp ts, double value) {
     return status;
 }
 
+std::tuple<aku_Status, u32> IOVecLeaf::append(const aku_Timestamp* tss, const double* xss, u32 size) {
+    aku_Status status = AKU_SUCCESS;
+    u32 count = 0;
+    for (; count < size; count++) {
+        status = writer_.put(tss[count], xss[count]);
+        if (status != AKU_SUCCESS) {
+            break;
+        }
+    }
+    if (count == 0) {
+        return std::make_tuple(status, count);
+    }
+    // Update node metadata once for the whole run
+    SubtreeRef* subtree = block_->get_header<SubtreeRef>();
+    if (subtree->count == 0) {
+        subtree->begin = tss[0];
+        subtree->first = xss[0];
+    }
+    subtree->end = tss[count - 1];
+    subtree->last = xss[count - 1];
+    subtree->count += count;
+    for (u32 ix = 0; ix < count; ix++) {
+        double value = xss[ix];
+        subtree->sum += value;
+        if (subtree->max < value) {
+            subtree->max = value;
+            subtree->max_time = tss[ix];
+        }
+        if (subtree->min > value) {
+            subtree->min = value;
+            subtree->min_time = tss[ix];
+        }
+    }
+    return std::make_tuple(status, count);
+}
+
 std::tuple<aku_Status, LogicAddr> IOVecLeaf::commit(std::shared_ptr<BlockStore> bstore) {
     assert(nelements() != 0);
     u16 size = static_cast<u16>(writer_.commit()) - sizeof(SubtreeRef);
@@ -2644,6 +2680,7 @@ struct NBTreeLeafExtent : NBTreeExtent {
     }
 
     virtual std::tuple<bool, LogicAddr> append(aku_Timestamp ts, double value) override;
+    virtual std::tuple<bool, LogicAddr> append(const aku_Timestamp* tss, const double* xss, u32 size) override;
     virtual std::tuple<bool, LogicAddr> append(const SubtreeRef &pl) override;
     virtual std::tuple<bool, LogicAddr> commit(bool final) override;
     virtual std::unique_ptr<RealValuedOperator> search(aku_Timestamp begin, aku_Timestamp end) const override;
@@ -2779,6 +2816,29 @@ std::tuple<bool, LogicAddr> NBTreeLeafExtent::append(aku_Timestamp ts, double va
     return std::make_tuple(false, EMPTY_ADDR);
 }
 
+std::tuple<bool, LogicAddr> NBTreeLeafExtent::append(const aku_Timestamp* tss, const double* xss, u32 size) {
+    bool parent_saved = false;
+    LogicAddr addr = EMPTY_ADDR;
+    u32 pos = 0;
+    while (pos < size) {
+        aku_Status status;
+        u32 count;
+        std::tie(status, count) = leaf_->append(tss + pos, xss + pos, size - pos);
+        pos += count;
+        if (status == AKU_EOVERFLOW) {
+            // Split only at the leaf boundary
+            bool saved;
+            std::tie(saved, addr) = commit(false);
+            parent_saved |= saved;
+        } else if (status != AKU_SUCCESS) {
+            Logger::msg(AKU_LOG_ERROR, "Can't append data to leaf-node, " + StatusUtil::str(status)
+                        + ", id=" + std::to_string(id_));
+            AKU_PANIC("Can't append data to leaf-node, " + StatusUtil::str(status));
+        }
+    }
+    return std::make_tuple(parent_saved, addr);
+}
+
 //! Forcibly commit changes, even if current page is not full
 std::tuple<bool, LogicAddr> NBTreeLeafExtent::commit(bool final) {
     // Invariant: after call to this method data from `leaf_` should
@@ -3016,6 +3076,7 @@ struct NBTreeSBlockExtent : NBTreeExtent {
     }
 
     virtual std::tuple<bool, LogicAddr> append(aku_Timestamp ts, double value) override;
+    virtual std::tuple<bool, LogicAddr> append(const aku_Timestamp* tss, const double* xss, u32 size) override;
     virtual std::tuple<bool, LogicAddr> append(const SubtreeRef &pl) override;
     virtual std::tuple<bool, LogicAddr> commit(bool final) override;
     virtual std::unique_ptr<RealValuedOperator> search(aku_Timestamp begin, aku_Timestamp end) const override;
@@ -3138,6 +3199,10 @@ std::tuple<bool, LogicAddr> NBTreeSBlockExtent::append(aku_Timestamp, double) {
     AKU_PANIC("Data should be added to the root 0");
 }
 
+std::tuple<bool, LogicAddr> NBTreeSBlockExtent::append(const aku_Timestamp*, const double*, u32) {
+    AKU_PANIC("Data should be added to the root 0");
+}
+
 std::tuple<bool, LogicAddr> NBTreeSBlockExtent::append(SubtreeRef const& pl) {
     auto status = curr_->append(pl);
     if (status == AKU_EOVERFLOW) {
@@ -3377,6 +3442,208 @@ void NBTreeExtent::check_extent(NBTreeExtent const* extent, std::shared_ptr<Bloc
     }
 }
 
+// /////////////////////// //
+//   NBTreeReorderBuffer   //
+// /////////////////////// //
+
+//! Min size of the reorder buffer storage
+static const size_t REORDER_BUFFER_MIN_SIZE = 16;
+
+NBTreeReorderBuffer::NBTreeReorderBuffer(aku_ParamId id, aku_Timestamp window, u32 capacity)
+    : window_(window)
+    , capacity_(capacity)
+    , batch_(std::max(1u, capacity / 8))
+    , head_(0)
+    , size_(0)
+    , meta_(INIT_SUBTREE_REF)
+{
+    meta_.id = id;
+}
+
+size_t NBTreeReorderBuffer::pos(size_t ix) const {
+    return (head_ + ix) & (tss_.size() - 1);
+}
+
+void NBTreeReorderBuffer::update_meta() {
+    aku_ParamId id = meta_.id;
+    meta_ = INIT_SUBTREE_REF;
+    meta_.id = id;
+    if (size_ == 0) {
+        return;
+    }
+    meta_.count = size_;
+    meta_.begin = tss_[pos(0)];
+    meta_.end   = tss_[pos(size_ - 1)];
+    meta_.first = xss_[pos(0)];
+    meta_.last  = xss_[pos(size_ - 1)];
+    for (size_t ix = 0; ix < size_; ix++) {
+        double value = xss_[pos(ix)];
+        meta_.sum += value;
+        if (meta_.max < value) {
+            meta_.max = value;
+            meta_.max_time = tss_[pos(ix)];
+        }
+        if (meta_.min > value) {
+            meta_.min = value;
+            meta_.min_time = tss_[pos(ix)];
+        }
+    }
+}
+
+void NBTreeReorderBuffer::reallocate(size_t new_size) {
+    assert(new_size >= size_);
+    std::vector<aku_Timestamp> tss(new_size);
+    std::vector<double> xss(new_size);
+    for (size_t ix = 0; ix < size_; ix++) {
+        tss[ix] = tss_[pos(ix)];
+        xss[ix] = xss_[pos(ix)];
+    }
+    tss_.swap(tss);
+    xss_.swap(xss);
+    head_ = 0;
+}
+
+size_t NBTreeReorderBuffer::upper_bound(aku_Timestamp ts) const {
+    size_t lo = 0, hi = size_;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tss_[pos(mid)] <= ts) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+size_t NBTreeReorderBuffer::lower_bound(aku_Timestamp ts) const {
+    size_t lo = 0, hi = size_;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tss_[pos(mid)] < ts) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+bool NBTreeReorderBuffer::insert(aku_Timestamp ts, double value, bool allow_duplicate_timestamps) {
+    // Common case - data-point is not late
+    size_t ix = size_;
+    if (size_ != 0 && ts < tss_[pos(size_ - 1)]) {
+        ix = upper_bound(ts);
+    }
+    if (!allow_duplicate_timestamps && ix != 0 && tss_[pos(ix - 1)] == ts) {
+        return false;
+    }
+    if (size_ == tss_.size()) {
+        reallocate(std::max(REORDER_BUFFER_MIN_SIZE, tss_.size() * 2));
+    }
+    // Shift newer data-points
+    for (size_t i = size_; i > ix; i--) {
+        tss_[pos(i)] = tss_[pos(i - 1)];
+        xss_[pos(i)] = xss_[pos(i - 1)];
+    }
+    tss_[pos(ix)] = ts;
+    xss_[pos(ix)] = value;
+    size_++;
+    // Update summary incrementally, full recalculation is needed only on eviction
+    meta_.count = size_;
+    meta_.sum  += value;
+    meta_.begin = tss_[pos(0)];
+    meta_.end   = tss_[pos(size_ - 1)];
+    meta_.first = xss_[pos(0)];
+    meta_.last  = xss_[pos(size_ - 1)];
+    if (meta_.max < value) {
+        meta_.max = value;
+        meta_.max_time = ts;
+    }
+    if (meta_.min > value) {
+        meta_.min = value;
+        meta_.min_time = ts;
+    }
+    return true;
+}
+
+u32 NBTreeReorderBuffer::evictable() const {
+    if (size_ == 0) {
+        return 0;
+    }
+    size_t expired = 0;
+    aku_Timestamp newest = tss_[pos(size_ - 1)];
+    if (newest > window_) {
+        expired = lower_bound(newest - window_);
+    }
+    // Data-points that fell out of the window are kept until the batch is accumulated,
+    // they're not written to the tree yet so late writes that hit them are still accepted.
+    size_t count = expired >= batch_ ? expired : 0;
+    if (size_ > capacity_) {
+        count = std::max(count, std::min(size_, size_ - capacity_ + batch_));
+    }
+    return static_cast<u32>(count);
+}
+
+u32 NBTreeReorderBuffer::front(u32 n, const aku_Timestamp** tss, const double** xss) const {
+    size_t count = std::min(static_cast<size_t>(n), size_);
+    if (count == 0) {
+        return 0;
+    }
+    count = std::min(count, tss_.size() - head_);
+    *tss = tss_.data() + head_;
+    *xss = xss_.data() + head_;
+    return static_cast<u32>(count);
+}
+
+void NBTreeReorderBuffer::pop(u32 n) {
+    assert(n <= size_);
+    if (n == 0) {
+        return;
+    }
+    head_ = pos(n);
+    size_ -= n;
+    // Release memory if the buffer is mostly empty
+    size_t new_size = tss_.size();
+    while (new_size > REORDER_BUFFER_MIN_SIZE && size_ < new_size / 4) {
+        new_size /= 2;
+    }
+    if (size_ == 0) {
+        new_size = 0;
+    }
+    if (new_size != tss_.size()) {
+        reallocate(new_size);
+    }
+    update_meta();
+}
+
+size_t NBTreeReorderBuffer::size() const {
+    return size_;
+}
+
+std::tuple<aku_Timestamp, aku_Timestamp> NBTreeReorderBuffer::get_timestamps() const {
+    if (size_ == 0) {
+        return std::make_tuple(aku_Timestamp(0), aku_Timestamp(0));
+    }
+    return std::make_tuple(tss_[pos(0)], tss_[pos(size_ - 1)]);
+}
+
+aku_Status NBTreeReorderBuffer::read_all(std::vector<aku_Timestamp>* timestamps, std::vector<double>* values) const {
+    if (size_ == 0) {
+        return AKU_SUCCESS;
+    }
+    size_t first = std::min(size_, tss_.size() - head_);
+    timestamps->insert(timestamps->end(), tss_.begin() + head_, tss_.begin() + head_ + first);
+    values->insert(values->end(), xss_.begin() + head_, xss_.begin() + head_ + first);
+    timestamps->insert(timestamps->end(), tss_.begin(), tss_.begin() + (size_ - first));
+    values->insert(values->end(), xss_.begin(), xss_.begin() + (size_ - first));
+    return AKU_SUCCESS;
+}
+
+SubtreeRef const* NBTreeReorderBuffer::get_leafmeta() const {
+    return &meta_;
+}
+
 // ///////////////////// //
 //   NBTreeExtentsList   //
 // ///////////////////// //
@@ -3434,6 +3701,15 @@ size_t NBTreeExtentsList::_get_uncommitted_size() const {
     return 0;
 }
 
+void NBTreeExtentsList::set_reorder_window(aku_Timestamp window, u32 capacity) {
+    UniqueLock lock(lock_);
+    if (window == 0 || capacity == 0) {
+        reorder_.reset();
+    } else {
+        reorder_.reset(new NBTreeReorderBuffer(id_, window, capacity));
+    }
+}
+
 bool NBTreeExtentsList::is_initialized() const {
     SharedLock lock(lock_);
     return initialized_;
@@ -3624,6 +3900,13 @@ NBTreeAppendResult NBTreeExtentsList::append(aku_Timestamp ts, double value, boo
     if (allow_duplicate_timestamps ? ts < last_ : ts <= last_) {
         return NBTreeAppendResult::FAIL_LATE_WRITE;
     }
+    if (reorder_) {
+        if (!reorder_->insert(ts, value, allow_duplicate_timestamps)) {
+            return NBTreeAppendResult::FAIL_LATE_WRITE;
+        }
+        write_count_++;
+        return flush_reorder_buffer(false);
+    }
     last_ = ts;
     write_count_++;
     if (extents_.size() == 0) {
@@ -3651,6 +3934,88 @@ NBTreeAppendResult NBTreeExtentsList::append(aku_Timestamp ts, double value, boo
     return result;
 }
 
+std::tuple<NBTreeAppendResult, u32> NBTreeExtentsList::append(const aku_Timestamp* tss, const double* xss, u32 size) {
+    UniqueLock lock(lock_);  // NOTE: NBTreeExtentsList::append(subtree) can be called from here
+                             //       recursively (maybe even many times).
+    if (!initialized_) {
+        init();
+    }
+    u32 count = 0;
+    NBTreeAppendResult result = NBTreeAppendResult::OK;
+    if (reorder_) {
+        // Data-points are merged through the reorder buffer
+        for (; count < size; count++) {
+            if (tss[count] < last_ || !reorder_->insert(tss[count], xss[count], true)) {
+                break;
+            }
+        }
+        write_count_ += count;
+        result = flush_reorder_buffer(false);
+    } else {
+        // Find the longest ordered prefix
+        aku_Timestamp last = last_;
+        for (; count < size; count++) {
+            if (tss[count] < last) {
+                break;
+            }
+            last = tss[count];
+        }
+        if (count != 0) {
+            last_ = last;
+            write_count_ += count;
+            result = append_run(tss, xss, count);
+        }
+    }
+    if (count == 0 && size != 0) {
+        return std::make_tuple(NBTreeAppendResult::FAIL_LATE_WRITE, 0u);
+    }
+    // NOTE: if `count` is less than `size` the element at `count` is a late write,
+    //       the result is not an error because the prefix was written and rescue points
+    //       could be updated.
+    return std::make_tuple(result, count);
+}
+
+NBTreeAppendResult NBTreeExtentsList::append_run(const aku_Timestamp* tss, const double* xss, u32 size) {
+    if (extents_.size() == 0) {
+        // create first leaf node
+        std::unique_ptr<NBTreeExtent> leaf;
+        leaf.reset(new NBTreeLeafExtent(bstore_, shared_from_this(), id_, EMPTY_ADDR));
+        extents_.push_back(std::move(leaf));
+        rescue_points_.push_back(EMPTY_ADDR);
+    }
+    auto result = NBTreeAppendResult::OK;
+    bool parent_saved = false;
+    LogicAddr addr = EMPTY_ADDR;
+    std::tie(parent_saved, addr) = extents_.front()->append(tss, xss, size);
+    if (addr != EMPTY_ADDR) {
+        if (rescue_points_.size() > 0) {
+            rescue_points_.at(0) = addr;
+        } else {
+            rescue_points_.push_back(addr);
+        }
+        result = NBTreeAppendResult::OK_FLUSH_NEEDED;
+    }
+    return result;
+}
+
+NBTreeAppendResult NBTreeExtentsList::flush_reorder_buffer(bool all) {
+    u32 count = all ? static_cast<u32>(reorder_->size()) : reorder_->evictable();
+    auto result = NBTreeAppendResult::OK;
+    while (count != 0) {
+        // Data-points are written directly from the ring buffer (one or two runs)
+        const aku_Timestamp* tss = nullptr;
+        const double* xss = nullptr;
+        u32 run = reorder_->front(count, &tss, &xss);
+        last_ = tss[run - 1];
+        if (append_run(tss, xss, run) == NBTreeAppendResult::OK_FLUSH_NEEDED) {
+            result = NBTreeAppendResult::OK_FLUSH_NEEDED;
+        }
+        reorder_->pop(run);
+        count -= run;
+    }
+    return result;
+}
+
 NBTreeAppendResult NBTreeExtentsList::append(aku_Timestamp ts, const u8* blob, u32 size) {
     // Correct event serialization sequence:
     // TS       - 0         1           2           3
@@ -3968,6 +4333,16 @@ std::unique_ptr<RealValuedOperator> NBTreeExtentsList::search(aku_Timestamp begi
             }
         }
     }
+    if (reorder_ && reorder_->size() != 0) {
+        // Buffered data-points are newer than anything stored in the tree
+        std::unique_ptr<RealValuedOperator> it;
+        it.reset(new NBTreeLeafIterator(begin, end, *reorder_));
+        if (begin < end) {
+            iterators.push_back(std::move(it));
+        } else {
+            iterators.insert(iterators.begin(), std::move(it));
+        }
+    }
     if (iterators.size() == 1) {
         return std::move(iterators.front());
     }
@@ -3996,6 +4371,16 @@ std::unique_ptr<BinaryDataOperator> NBTreeExtentsList::search_binary(aku_Timesta
             }
         }
     }
+    if (reorder_ && reorder_->size() != 0) {
+        // Buffered data-points are newer than anything stored in the tree
+        std::unique_ptr<RealValuedOperator> it;
+        it.reset(new NBTreeLeafIterator(begin, end, *reorder_));
+        if (begin < end) {
+            iterators.push_back(std::move(it));
+        } else {
+            iterators.insert(iterators.begin(), std::move(it));
+        }
+    }
     if (iterators.size() == 1) {
         std::unique_ptr<BinaryDataOperator> res(new BinaryDataIterator(std::move(iterators.front())));
         return res;
@@ -4036,6 +4421,16 @@ std::unique_ptr<RealValuedOperator> NBTreeExtentsList::filter(aku_Timestamp begi
             }
         }
     }
+    if (reorder_ && reorder_->size() != 0) {
+        // Buffered data-points are newer than anything stored in the tree
+        std::unique_ptr<RealValuedOperator> it;
+        it.reset(new NBTreeLeafFilter(begin, end, filter, *reorder_));
+        if (begin < end) {
+            iterators.push_back(std::move(it));
+        } else {
+            iterators.insert(iterators.begin(), std::move(it));
+        }
+    }
     if (iterators.size() == 1) {
         return std::move(iterators.front());
     }
@@ -4064,6 +4459,16 @@ std::unique_ptr<AggregateOperator> NBTreeExtentsList::aggregate(aku_Timestamp be
             }
         }
     }
+    if (reorder_ && reorder_->size() != 0) {
+        // Buffered data-points are newer than anything stored in the tree
+        std::unique_ptr<AggregateOperator> it;
+        it.reset(new NBTreeLeafAggregator(begin, end, *reorder_));
+        if (begin < end) {
+            iterators.push_back(std::move(it));
+        } else {
+            iterators.insert(iterators.begin(), std::move(it));
+        }
+    }
     if (iterators.size() == 1) {
         return std::move(iterators.front());
     }
@@ -4093,6 +4498,16 @@ std::unique_ptr<AggregateOperator> NBTreeExtentsList::group_aggregate(aku_Timest
             }
         }
     }
+    if (reorder_ && reorder_->size() != 0) {
+        // Buffered data-points are newer than anything stored in the tree
+        std::unique_ptr<AggregateOperator> it;
+        it.reset(new NBTreeLeafGroupAggregator(begin, end, step, *reorder_));
+        if (begin < end) {
+            iterators.push_back(std::move(it));
+        } else {
+            iterators.insert(iterators.begin(), std::move(it));
+        }
+    }
     std::unique_ptr<AggregateOperator> concat;
     concat.reset(new CombineGroupAggregateOperator(begin, end, step, std::move(iterators)));
     return concat;
@@ -4129,6 +4544,16 @@ std::unique_ptr<AggregateOperator> NBTreeExtentsList::candlesticks(aku_Timestamp
             }
         }
     }
+    if (reorder_ && reorder_->size() != 0) {
+        // Buffered data-points are newer than anything stored in the tree
+        std::unique_ptr<AggregateOperator> it;
+        it.reset(new NBTreeLeafAggregator(begin, end, *reorder_));
+        if (begin < end) {
+            iterators.push_back(std::move(it));
+        } else {
+            iterators.insert(iterators.begin(), std::move(it));
+        }
+    }
     if (iterators.size() == 1) {
         return std::move(iterators.front());
     }
@@ -4142,6 +4567,9 @@ std::unique_ptr<AggregateOperator> NBTreeExtentsList::candlesticks(aku_Timestamp
 std::vector<LogicAddr> NBTreeExtentsList::close() {
     UniqueLock lock(lock_);
     if (initialized_) {
+        if (reorder_) {
+            flush_reorder_buffer(true);
+        }
         if (write_count_) {
             Logger::msg(AKU_LOG_TRACE, std::to_string(id_) + " Going to close the tree.");
             LogicAddr addr = EMPTY_ADDR;
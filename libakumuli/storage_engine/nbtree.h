@@ -188,6 +188,15 @@ public:
     //! Append values to NBTree
     aku_Status append(aku_Timestamp ts, double value);
 
+    /** Append sorted run of values to the leaf node.
+      * Values are encoded until the node is full. Node metadata is updated once per call.
+      * @param tss Timestamps (should be ordered).
+      * @param xss Values.
+      * @param size Number of elements in `tss` and `xss`.
+      * @return status (AKU_EOVERFLOW if node is full) and number of appended elements.
+      */
+    std::tuple<aku_Status, u32> append(const aku_Timestamp* tss, const double* xss, u32 size);
+
     /** Flush all pending changes to block store and close.
       * Calling this function too often can result in unoptimal space usage.
       */
@@ -388,6 +397,12 @@ struct NBTreeExtent {
       */
     virtual std::tuple<bool, LogicAddr> append(aku_Timestamp ts, double value) = 0;
 
+    /** Append sorted run of values to the root (doesn't work with superblocks).
+      * Node is committed only when it becomes full, address of the last committed
+      * node is returned (or EMPTY if nothing was committed).
+      */
+    virtual std::tuple<bool, LogicAddr> append(const aku_Timestamp* tss, const double* xss, u32 size) = 0;
+
     /** Append subtree metadata to the root (doesn't work with leaf nodes)
       * If new root created - return address of the previous root, otherwise return EMPTY
       */
@@ -466,6 +481,81 @@ enum class NBTreeAppendResult {
 };
 
 
+/** Bounded reorder window for out-of-order writes.
+  * Holds the most recent data-points of the series sorted by timestamp.
+  * Data-points are evicted (in order and in batches) when they fall out
+  * of the window or when the buffer is full. Storage is a ring buffer
+  * that grows on demand and shrinks when data-points are evicted.
+  * Provides the same read interface as the leaf node, so leaf-level
+  * query operators can be used to read it.
+  */
+class NBTreeReorderBuffer {
+    //! Window size (in timestamp units)
+    aku_Timestamp window_;
+    //! Max number of elements
+    u32 capacity_;
+    //! Min number of data-points to evict at once
+    u32 batch_;
+    //! Ring buffer storage (size is zero or power of two)
+    std::vector<aku_Timestamp> tss_;
+    std::vector<double> xss_;
+    //! Index of the oldest data-point in the ring buffer
+    size_t head_;
+    //! Number of buffered data-points
+    size_t size_;
+    //! Summary of the buffered data-points
+    SubtreeRef meta_;
+
+    //! Convert logical index to ring buffer index
+    size_t pos(size_t ix) const;
+
+    //! Recalculate summary (after eviction)
+    void update_meta();
+
+    //! Change ring buffer size
+    void reallocate(size_t new_size);
+
+    //! Return logical index of the first data-point with timestamp greater than `ts`
+    size_t upper_bound(aku_Timestamp ts) const;
+
+    //! Return logical index of the first data-point with timestamp not less than `ts`
+    size_t lower_bound(aku_Timestamp ts) const;
+public:
+    NBTreeReorderBuffer(aku_ParamId id, aku_Timestamp window, u32 capacity);
+
+    /** Add data-point to the buffer.
+      * Data-point is placed after all buffered data-points with the same timestamp.
+      * @return false if duplicates are not allowed and timestamp is already buffered.
+      */
+    bool insert(aku_Timestamp ts, double value, bool allow_duplicate_timestamps);
+
+    //! Return number of data-points that should be evicted from the buffer
+    u32 evictable() const;
+
+    /** Get oldest data-points.
+      * @param n is a max number of data-points to return
+      * @param tss is a pointer to timestamps
+      * @param xss is a pointer to values
+      * @return number of data-points stored contiguously (can be less than `n`,
+      *         pointers are valid until next modification)
+      */
+    u32 front(u32 n, const aku_Timestamp** tss, const double** xss) const;
+
+    //! Remove `n` oldest data-points from the buffer
+    void pop(u32 n);
+
+    size_t size() const;
+
+    // Leaf node compatible interface
+
+    std::tuple<aku_Timestamp, aku_Timestamp> get_timestamps() const;
+
+    aku_Status read_all(std::vector<aku_Timestamp>* timestamps, std::vector<double>* values) const;
+
+    SubtreeRef const* get_leafmeta() const;
+};
+
+
 /** @brief This class represents set of roots of the NBTree.
   * It serves two purposes:
   * @li store all roots of the NBTree
@@ -481,6 +571,8 @@ class NBTreeExtentsList : public std::enable_shared_from_this<NBTreeExtentsList>
     bool initialized_;
     //! Number of write operations performed on object
     u64 write_count_;
+    //! Out-of-order write buffer (null if disabled)
+    std::unique_ptr<NBTreeReorderBuffer> reorder_;
 
     void open();
 
@@ -488,6 +580,12 @@ class NBTreeExtentsList : public std::enable_shared_from_this<NBTreeExtentsList>
 
     void init();
 
+    //! Append ordered run of data-points to the leaf extent (lock should be held)
+    NBTreeAppendResult append_run(const aku_Timestamp* tss, const double* xss, u32 size);
+
+    //! Move data-points out of the reorder buffer (all of them if `all` is set)
+    NBTreeAppendResult flush_reorder_buffer(bool all);
+
     mutable RWLock lock_;
 
     // Testing
@@ -518,6 +616,16 @@ public:
 
     aku_ParamId get_id() const { return id_; }
 
+    /** Enable out-of-order writes.
+      * Data-points that are older than the last one are accepted if they
+      * are not older than the last data-point written to the tree. Up to
+      * `capacity` data-points within `window` are buffered in memory and
+      * merged in timestamp order. Should be called before first write.
+      * @param window is a window size in timestamp units (0 disables buffering)
+      * @param capacity is a max number of buffered data-points
+      */
+    void set_reorder_window(aku_Timestamp window, u32 capacity);
+
     /** Append new subtree reference to extents list.
       * This operation can't fail and should be used only by NB-tree itself (from node-commit functions).
       * This property is not enforced by the typesystem.
@@ -533,6 +641,18 @@ public:
 
     NBTreeAppendResult append(aku_Timestamp ts, const u8 *blob, u32 size);
 
+    /** Append sorted run of values to extents list.
+      * Lock is acquired once for the whole run. Write stops at the first out of
+      * order element.
+      * @param tss Timestamps.
+      * @param xss Values.
+      * @param size Number of elements in `tss` and `xss`.
+      * @return OK or OK_FLUSH_NEEDED (if rescue points list was changed) and number of
+      *         written elements, it's less than `size` if element at this index is out
+      *         of order. FAIL_LATE_WRITE is returned if the first element is out of order.
+      */
+    std::tuple<NBTreeAppendResult, u32> append(const aku_Timestamp* tss, const double* xss, u32 size);
+
     /**
      * @brief search function
      * @param begin is a start of the search interval
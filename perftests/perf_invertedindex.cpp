@@ -1,24 +1,69 @@
 #include "invertedindex.h"
+#include "perftest_tools.h"
 #include <iostream>
 #include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
 
 using namespace Akumuli;
 
-int main() {
+const int N_QUERIES = 10;
 
-    InvertedIndex index(128);
-
-    for (int i = 0; i < 1000; i++) {
-        char buffer[128];
-        int n = snprintf(buffer, 128, "%d", i);
-        index.append(i, buffer, buffer + n);
+/** Populate the index and run query with three tag filters.
+  * @return min query time
+  */
+static double run_test(IndexPostings postings, int nseries, size_t* cardinality) {
+    Index index(postings);
+    PerfTimer tm;
+    for (int i = 0; i < nseries; i++) {
+        std::string name = "cpu.user host=host_" + std::to_string(i)
+                         + " region=region_" + std::to_string(i % 10)
+                         + " rack=rack_" + std::to_string(i % 100)
+                         + " os=os_" + std::to_string(i % 7);
+        aku_Status status;
+        StringT res;
+        std::tie(status, res) = index.append(name.data(), name.data() + name.size());
+        if (status != AKU_SUCCESS) {
+            std::cerr << "Can't add series " << name << std::endl;
+            std::exit(-1);
+        }
     }
-
-    const char* query = "981";
-    auto results = index.get_count(query, query + strlen(query));
-    for (auto kv: results) {
-        std::cout << "kv: " << kv.first << ", " << kv.second << std::endl;
+    std::cout << "Index populated in " << tm.elapsed() << " sec, index memory use: "
+              << index.index_memory_use() << " bytes" << std::endl;
+    std::vector<TagValuePair> tags = {
+        TagValuePair("region=region_3"),
+        TagValuePair("rack=rack_13"),
+        TagValuePair("os=os_1"),
+    };
+    IncludeIfAllTagsMatch query(MetricName("cpu.user"), tags.begin(), tags.end());
+    double min = std::numeric_limits<double>::max();
+    for (int i = 0; i < N_QUERIES; i++) {
+        tm.restart();
+        auto results = query.query(index);
+        size_t card = 0;
+        for (auto it = results.begin(); it != results.end(); ++it) {
+            card++;
+        }
+        min = std::min(min, tm.elapsed());
+        *cardinality = card;
     }
+    return min;
+}
 
+int main(int argc, char *argv[]) {
+    int nseries = 1000000;
+    if (argc == 2) {
+        nseries = std::atoi(argv[1]);
+    }
+    size_t ncompressed = 0, nroaring = 0;
+    double compressed = run_test(IndexPostings::COMPRESSED, nseries, &ncompressed);
+    std::cout << "Query (compressed lists): " << ncompressed << " series in " << compressed << " sec." << std::endl;
+    double roaring = run_test(IndexPostings::ROARING, nseries, &nroaring);
+    std::cout << "Query (roaring bitmaps): " << nroaring << " series in " << roaring << " sec." << std::endl;
+    if (ncompressed != nroaring) {
+        std::cerr << "Results doesn't match" << std::endl;
+        return -1;
+    }
     return 0;
 }
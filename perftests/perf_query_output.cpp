@@ -0,0 +1,193 @@
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/lexical_cast.hpp>
+
+#include "query_results_pooler.h"
+#include "perftest_tools.h"
+
+using namespace Akumuli;
+
+enum {
+    NSERIES  = 1000,
+    BUF_SIZE = 0x10000,
+};
+
+/** Cursor that returns `nsamples` float samples ordered by time,
+  * consecutive samples belong to different series.
+  */
+struct CursorMock : DbCursor {
+    u64 nsamples_;
+    u64 pos_;
+
+    CursorMock(u64 nsamples)
+        : nsamples_(nsamples)
+        , pos_(0)
+    {
+    }
+
+    virtual size_t read(void* dest, size_t dest_size) override {
+        aku_Sample* out = reinterpret_cast<aku_Sample*>(dest);
+        size_t n = 0;
+        while (pos_ < nsamples_ && (n + 1)*sizeof(aku_Sample) <= dest_size) {
+            out[n] = {};
+            out[n].paramid = 1 + pos_ % NSERIES;
+            out[n].timestamp = 1418197363000000000ull + pos_*1000000ull;
+            out[n].payload.type = AKU_PAYLOAD_FLOAT;
+            out[n].payload.size = sizeof(aku_Sample);
+            out[n].payload.float64 = 0.1*pos_;
+            pos_++;
+            n++;
+        }
+        return n*sizeof(aku_Sample);
+    }
+
+    virtual int is_done() override {
+        return pos_ == nsamples_;
+    }
+
+    virtual bool is_error(aku_Status* out_error_code_or_null) override {
+        if (out_error_code_or_null) {
+            *out_error_code_or_null = AKU_SUCCESS;
+        }
+        return false;
+    }
+
+    virtual bool is_error(const char** error_message, aku_Status* out_error_code_or_null) override {
+        *error_message = "";
+        return is_error(out_error_code_or_null);
+    }
+
+    virtual void close() override {}
+};
+
+/** Session with series name lookup similar to the real one (lock + hash table).
+  */
+struct SessionMock : DbSession {
+    u64                                          nsamples_;
+    std::mutex                                   mutex_;
+    std::unordered_map<aku_ParamId, std::string> names_;
+    u64                                          nlookups_;
+
+    SessionMock(u64 nsamples)
+        : nsamples_(nsamples)
+        , nlookups_(0)
+    {
+        for (aku_ParamId id = 1; id <= NSERIES; id++) {
+            names_[id] = "cpu.user host=host_" + std::to_string(id) + " region=eu-west-1";
+        }
+    }
+
+    virtual aku_Status write(aku_Sample const&) override {
+        return AKU_ENOT_IMPLEMENTED;
+    }
+
+    virtual std::shared_ptr<DbCursor> query(std::string) override {
+        return std::make_shared<CursorMock>(nsamples_);
+    }
+
+    virtual std::shared_ptr<DbCursor> suggest(std::string) override {
+        throw "not implemented";
+    }
+
+    virtual std::shared_ptr<DbCursor> search(std::string) override {
+        throw "not implemented";
+    }
+
+    virtual int param_id_to_series(aku_ParamId id, char* buffer, size_t buffer_size) override {
+        std::lock_guard<std::mutex> guard(mutex_);
+        nlookups_++;
+        auto it = names_.find(id);
+        if (it == names_.end()) {
+            return 0;
+        }
+        if (it->second.size() > buffer_size) {
+            return -1*static_cast<int>(it->second.size());
+        }
+        memcpy(buffer, it->second.data(), it->second.size());
+        return static_cast<int>(it->second.size());
+    }
+
+    virtual aku_Status series_to_param_id(const char*, size_t, aku_Sample*) override {
+        return AKU_ENOT_IMPLEMENTED;
+    }
+
+    virtual int name_to_param_id_list(const char*, const char*, aku_ParamId*, u32) override {
+        return -1;
+    }
+};
+
+/** Read all query results using the output format.
+  * @return number of bytes produced
+  */
+static u64 run_query(u64 nsamples, std::string const& query, double* elapsed, u64* nlookups) {
+    auto session = std::make_shared<SessionMock>(nsamples);
+    std::vector<char> buffer(BUF_SIZE);
+    QueryResultsPooler cursor(session, 1024, ApiEndpoint::QUERY);
+    cursor.append(query.data(), query.size());
+    cursor.start();
+    u64 total = 0;
+    PerfTimer tm;
+    while (true) {
+        size_t len;
+        bool done;
+        std::tie(len, done) = cursor.read_some(buffer.data(), buffer.size());
+        total += len;
+        if (done) {
+            break;
+        }
+    }
+    *elapsed = tm.elapsed();
+    *nlookups = session->nlookups_;
+    cursor.close();
+    return total;
+}
+
+//! Compare IsoTimestampFormatter with aku_timestamp_to_string
+static void run_timestamp_test(u64 nsamples) {
+    char buffer[0x100];
+    aku_Timestamp base = 1418197363000000000ull;
+    PerfTimer tm;
+    for (u64 i = 0; i < nsamples; i++) {
+        aku_timestamp_to_string(base + i*1000000ull, buffer, sizeof(buffer));
+    }
+    double slow = tm.elapsed();
+    IsoTimestampFormatter formatter;
+    tm.restart();
+    for (u64 i = 0; i < nsamples; i++) {
+        formatter.format(base + i*1000000ull, buffer, sizeof(buffer));
+    }
+    double fast = tm.elapsed();
+    std::cout << "aku_timestamp_to_string: " << static_cast<u64>(nsamples/slow) << " timestamps/sec" << std::endl;
+    std::cout << "IsoTimestampFormatter:   " << static_cast<u64>(nsamples/fast) << " timestamps/sec" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    std::cout << "Query output formatting performance test" << std::endl;
+    std::cout << "Usage: perf_query_output [number of samples]" << std::endl;
+    u64 nsamples = 10000000;
+    if (argc > 1) {
+        nsamples = boost::lexical_cast<u64>(argv[1]);
+    }
+
+    run_timestamp_test(nsamples);
+
+    std::vector<std::pair<std::string, std::string>> formats = {
+        std::make_pair("CSV (iso)",  R"({"output": {"format": "csv"}})"),
+        std::make_pair("CSV (raw)",  R"({"output": {"format": "csv", "timestamp": "raw"}})"),
+        std::make_pair("RESP (iso)", R"({"output": {"format": "resp"}})"),
+        std::make_pair("RESP (raw)", R"({"output": {"format": "resp", "timestamp": "raw"}})"),
+        std::make_pair("Arrow",      R"({"output": {"format": "arrow"}})"),
+    };
+    for (auto const& fmt: formats) {
+        double elapsed;
+        u64 nlookups;
+        u64 nbytes = run_query(nsamples, fmt.second, &elapsed, &nlookups);
+        std::cout << fmt.first << ": " << static_cast<u64>(nsamples/elapsed) << " samples/sec, "
+                  << static_cast<u64>(nbytes/elapsed/1024/1024) << " MB/sec, "
+                  << nlookups << " name lookups" << std::endl;
+    }
+    return 0;
+}
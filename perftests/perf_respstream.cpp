@@ -2,6 +2,10 @@
 #include "perftest_tools.h"
 #include <iostream>
 #include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <limits>
 
 const int TEST_ITERATIONS = 100000;
 const int N_TESTS = 1000;
@@ -10,17 +14,27 @@ using namespace Akumuli;
 
 bool push_to_graphite = false;
 
-int main(int argc, char *argv[]) {
-    if (argc == 2) {
-        push_to_graphite = std::string(argv[1]) == "graphite";
-    }
-    const char* pattern = ":1234567\r\n+3.14159\r\n";
-    std::string input;
-    for (int i = 0; i < TEST_ITERATIONS/2; i++) {
-        input += pattern;
-    }
+typedef std::function<double(const Byte*, int)> FloatParserT;
+
+static double parse_strtod(const Byte* buffer, int len) {
+    Byte tmp[RESPStream::STRING_LENGTH_MAX + 1];
+    std::copy(buffer, buffer + len, tmp);
+    tmp[len] = '\0';
+    char *p = nullptr;
+    return strtod(tmp, &p);
+}
+
+static double parse_fast(const Byte* buffer, int len) {
+    double res = 0;
+    parse_double(buffer, buffer + len, &res);
+    return res;
+}
+
+/** Run the benchmark using provided float parser.
+  * @return min time or negative value on error
+  */
+static double run_test(std::string const& input, FloatParserT const& parse_float) {
     std::vector<double> timedeltas;
-    u64 intvalue;
     Byte buffer[RESPStream::STRING_LENGTH_MAX];
     for (int i = N_TESTS; i --> 0;) {
         PerfTimer tm;
@@ -29,22 +43,26 @@ int main(int argc, char *argv[]) {
         for (int j = TEST_ITERATIONS; j --> 0;) {
             auto type = protocol.next_type();
             switch(type) {
-            case RESPStream::INTEGER:
-                intvalue = protocol.read_int();
-                if (intvalue != 1234567) {
-                    std::cerr << "Bad int value at " << j << std::endl;
-                    return -1;
+            case RESPStream::INTEGER: {
+                    bool success;
+                    u64 intvalue;
+                    std::tie(success, intvalue) = protocol.read_int();
+                    if (!success || intvalue != 1234567) {
+                        std::cerr << "Bad int value at " << j << std::endl;
+                        return -1;
+                    }
                 }
                 break;
             case RESPStream::STRING: {
-                    int len = protocol.read_string(buffer, sizeof(buffer));
-                    if (len != 7) {
+                    bool success;
+                    int len;
+                    std::tie(success, len) = protocol.read_string(buffer, sizeof(buffer));
+                    if (!success || len != 7) {
                         std::cerr << "Bad string value at " << j << std::endl;
                         return -1;
                     }
-                    char *p = buffer;
-                    double res = strtod(buffer, &p);
-                    if (abs(res - 3.14159) > 0.0001) {
+                    double res = parse_float(buffer, len);
+                    if (std::abs(res - 3.14159) > 0.0001) {
                         std::cerr << "Can't parse float at " << j << std::endl;
                         return -1;
                     }
@@ -65,9 +83,30 @@ int main(int argc, char *argv[]) {
     for (auto t: timedeltas) {
         min = std::min(min, t);
     }
-    std::cout << "Parsing " << TEST_ITERATIONS << " messages in " << min << " sec." << std::endl;
+    return min;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 2) {
+        push_to_graphite = std::string(argv[1]) == "graphite";
+    }
+    const char* pattern = ":1234567\r\n+3.14159\r\n";
+    std::string input;
+    for (int i = 0; i < TEST_ITERATIONS/2; i++) {
+        input += pattern;
+    }
+    double slow = run_test(input, &parse_strtod);
+    if (slow < 0) {
+        return -1;
+    }
+    std::cout << "Parsing " << TEST_ITERATIONS << " messages (strtod) in " << slow << " sec." << std::endl;
+    double fast = run_test(input, &parse_fast);
+    if (fast < 0) {
+        return -1;
+    }
+    std::cout << "Parsing " << TEST_ITERATIONS << " messages (parse_double) in " << fast << " sec." << std::endl;
     if (push_to_graphite) {
-        push_metric_to_graphite("respstream", 1000.0*min);
+        push_metric_to_graphite("respstream", 1000.0*fast);
     }
     return 0;
 }
@@ -0,0 +1,93 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/lexical_cast.hpp>
+
+#include "akumuli.h"
+#include "perftest_tools.h"
+
+using namespace Akumuli;
+
+static const char* DB_META_FILE = "/tmp/perf_series_creation.akumuli";
+//! Input log is not used
+static const char* DB_WAL_PATH = "";
+
+static void logger_(aku_LogLevel level, const char * msg) {
+    if (level == AKU_LOG_ERROR) {
+        aku_console_logger(level, msg);
+    }
+}
+
+/** Create `nseries` new series, write one sample to each and close the database.
+  * Measures series creation throughput end to end, including metadata sync
+  * (series names and rescue points written to sqlite).
+  * Usage: perf_series_creation [nseries] [nthreads]
+  */
+int main(int argc, const char** argv) {
+    int nseries = 500000;
+    int nthreads = 4;
+    if (argc > 1) {
+        nseries = boost::lexical_cast<int>(argv[1]);
+    }
+    if (argc > 2) {
+        nthreads = boost::lexical_cast<int>(argv[2]);
+    }
+
+    aku_initialize(nullptr, logger_);
+    aku_remove_database(DB_META_FILE, DB_WAL_PATH, true);
+    aku_Status status = aku_create_database("perf_series_creation", "/tmp", "/tmp", 2, false);
+    if (status != AKU_SUCCESS) {
+        std::cerr << "Can't create database: " << aku_error_message(status) << std::endl;
+        return -1;
+    }
+    aku_FineTuneParams params = {};
+    auto db = aku_open_database(DB_META_FILE, params);
+
+    PerfTimer tm;
+    auto worker = [db, nseries, nthreads](int thread_ix) {
+        auto session = aku_create_session(db);
+        for (int i = thread_ix; i < nseries; i += nthreads) {
+            std::string name = "cpu.user host=host_" + std::to_string(i)
+                             + " region=region_" + std::to_string(i % 10);
+            aku_Sample sample;
+            auto status = aku_series_to_param_id(session, name.data(), name.data() + name.size(), &sample);
+            if (status != AKU_SUCCESS) {
+                std::cerr << "Can't create series " << name << ": " << aku_error_message(status) << std::endl;
+                std::terminate();
+            }
+            sample.timestamp = 1000000ul + static_cast<u64>(i);
+            sample.payload.type = AKU_PAYLOAD_FLOAT;
+            sample.payload.float64 = i;
+            status = aku_write(session, &sample);
+            if (status != AKU_SUCCESS) {
+                std::cerr << "Write error: " << aku_error_message(status) << std::endl;
+                std::terminate();
+            }
+        }
+        aku_destroy_session(session);
+    };
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nthreads; i++) {
+        threads.emplace_back(worker, i);
+    }
+    for (auto& th: threads) {
+        th.join();
+    }
+    double created = tm.elapsed();
+    std::cout << nseries << " series created in " << created << " sec." << std::endl;
+
+    // Close waits until all series names are written to the metadata storage
+    aku_close_database(db);
+    double total = tm.elapsed();
+    std::cout << "Metadata synced in " << (total - created) << " sec." << std::endl;
+    std::cout << "Series creation throughput: " << (nseries / total) << " series/sec." << std::endl;
+
+    tm.restart();
+    db = aku_open_database(DB_META_FILE, params);
+    std::cout << "Database reopened in " << tm.elapsed() << " sec." << std::endl;
+    aku_close_database(db);
+    aku_remove_database(DB_META_FILE, DB_WAL_PATH, true);
+    return 0;
+}
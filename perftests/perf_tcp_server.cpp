@@ -1,48 +1,169 @@
 #include <iostream>
 #include <thread>
+#include <atomic>
+#include <sstream>
+
+#include <boost/lexical_cast.hpp>
 
 #include "tcp_server.h"
+#include "signal_handler.h"
+#include "storage_api.h"
 #include "perftest_tools.h"
-#include <sys/time.h>
 
 using namespace Akumuli;
 
-struct DbMock : DbConnection {
-    typedef std::tuple<aku_ParamId, aku_Timestamp, double> ValueT;
-    size_t nrec = 0u;
-    PerfTimer tm;
-    Logger logger_ = Logger("dbmock", 100);
-
-    aku_Status write(aku_Sample const&) {
-        static const int N = 1000000;
-        if (nrec++ % N == 0) {
-            double elapsed = tm.elapsed();
-            auto throughput = static_cast<int>(N*(1.0/elapsed));
-            logger_.info() << "Server throughput " << throughput << " msg/sec";
-            tm.restart();
-        }
+/** Session that counts written samples without storing them.
+  */
+struct SessionMock : DbSession {
+    std::atomic<u64>& nrec;
+
+    SessionMock(std::atomic<u64>& nrec)
+        : nrec(nrec)
+    {
+    }
+
+    virtual aku_Status write(aku_Sample const&) override {
+        nrec++;
         return AKU_SUCCESS;
     }
 
-    virtual std::shared_ptr<DbCursor> search(std::string query) {
+    virtual aku_Status write_batch(const aku_ParamId*, const aku_Timestamp*, const double*, u32 size) override {
+        nrec += size;
+        return AKU_SUCCESS;
+    }
+
+    virtual std::shared_ptr<DbCursor> query(std::string) override {
+        throw "not implemented";
+    }
+
+    virtual std::shared_ptr<DbCursor> suggest(std::string) override {
         throw "not implemented";
     }
 
-    int param_id_to_series(aku_ParamId id, char *buffer, size_t buffer_size) {
+    virtual std::shared_ptr<DbCursor> search(std::string) override {
         throw "not implemented";
     }
 
-    aku_Status series_to_param_id(const char *name, size_t size, aku_Sample *sample) {
+    virtual int param_id_to_series(aku_ParamId, char*, size_t) override {
+        throw "not implemented";
+    }
+
+    virtual aku_Status series_to_param_id(const char* begin, size_t sz, aku_Sample* sample) override {
+        sample->paramid = boost::lexical_cast<u64>(std::string(begin, begin + sz));
+        return AKU_SUCCESS;
+    }
+
+    virtual int name_to_param_id_list(const char* begin, const char* end, aku_ParamId* ids, u32 cap) override {
+        if (cap == 0) {
+            return -1;
+        }
+        ids[0] = boost::lexical_cast<u64>(std::string(begin, end));
+        return 1;
+    }
+};
+
+struct ConnectionMock : DbConnection {
+    std::atomic<u64> nrec = {0};
+
+    virtual std::string get_all_stats() override {
         throw "not implemented";
     }
+
+    virtual std::shared_ptr<DbSession> create_session() override {
+        return std::make_shared<SessionMock>(nrec);
+    }
+};
+
+enum {
+    RESP_PORT   = 4111,
+    BINARY_PORT = 4112,
+    NSERIES     = 1000,
+    BATCH_SIZE  = 1000,
 };
 
+//! Generate `n` RESP messages (the payload is reused by the client)
+static std::string make_resp_payload(u32 n, aku_Timestamp ts) {
+    std::stringstream str;
+    for (u32 i = 0; i < n; i++) {
+        str << "+" << (1 + i % NSERIES) << "\r\n:" << (ts + i) << "\r\n+" << (0.1*i) << "\r\n";
+    }
+    return str.str();
+}
+
+//! Generate ID_BATCH frame with `n` samples
+static std::string make_binary_payload(u32 n, aku_Timestamp ts) {
+    std::string payload;
+    auto put = [&payload](const void* p, size_t sz) {
+        payload.append(reinterpret_cast<const char*>(p), sz);
+    };
+    u32 size = static_cast<u32>(sizeof(u32) + n*(sizeof(aku_ParamId) + sizeof(aku_Timestamp) + sizeof(double)));
+    char type = BinaryProtocolParser::ID_BATCH;
+    put(&size, sizeof(size));
+    put(&type, 1);
+    put(&n, sizeof(n));
+    for (u32 i = 0; i < n; i++) {
+        aku_ParamId id = 1 + i % NSERIES;
+        put(&id, sizeof(id));
+    }
+    for (u32 i = 0; i < n; i++) {
+        aku_Timestamp t = ts + i;
+        put(&t, sizeof(t));
+    }
+    for (u32 i = 0; i < n; i++) {
+        double x = 0.1*i;
+        put(&x, sizeof(x));
+    }
+    return payload;
+}
+
+/** Send `nbatches` copies of the payload to the server and wait until
+  * all samples are processed.
+  * @return throughput in samples per second
+  */
+static double run_client(ConnectionMock& con, unsigned short port, std::string const& payload, u64 nbatches) {
+    IOServiceT io;
+    SocketT socket(io);
+    EndpointT peer(boost::asio::ip::address_v4::loopback(), port);
+    socket.connect(peer);
+    u64 start = con.nrec.load();
+    u64 expected = start + nbatches*BATCH_SIZE;
+    PerfTimer tm;
+    for (u64 i = 0; i < nbatches; i++) {
+        boost::asio::write(socket, boost::asio::buffer(payload));
+    }
+    while (con.nrec.load() < expected) {
+        std::this_thread::yield();
+    }
+    double elapsed = tm.elapsed();
+    socket.close();
+    return static_cast<double>(expected - start)/elapsed;
+}
+
 int main(int argc, char *argv[]) {
     std::cout << "Tcp server performance test" << std::endl;
-    auto con = std::make_shared<DbMock>();
-    auto ppl = std::make_shared<IngestionPipeline>(con, AKU_LINEAR_BACKOFF);
-    auto server = std::make_shared<TcpServer>(ppl, 4, 4111);
-    server->start();
-    server->wait_for_signal();
+    std::cout << "Usage: perf_tcp_server [number of samples]" << std::endl;
+    u64 nsamples = 10000000;
+    if (argc > 1) {
+        nsamples = boost::lexical_cast<u64>(argv[1]);
+    }
+    u64 nbatches = nsamples / BATCH_SIZE;
+
+    auto con = std::make_shared<ConnectionMock>();
+    std::map<EndpointT, std::unique_ptr<ProtocolSessionBuilder>> protocols;
+    protocols[EndpointT(boost::asio::ip::tcp::v4(), RESP_PORT)]   = ProtocolSessionBuilder::create_resp_builder(false);
+    protocols[EndpointT(boost::asio::ip::tcp::v4(), BINARY_PORT)] = ProtocolSessionBuilder::create_binary_builder(false);
+
+    // Single event loop, throughput is measured per core
+    auto server = std::make_shared<TcpServer>(con, 1, std::move(protocols));
+    SignalHandler sig;
+    server->start(&sig, 0);
+
+    auto resp = run_client(*con, RESP_PORT, make_resp_payload(BATCH_SIZE, 1000), nbatches);
+    std::cout << "RESP throughput:   " << static_cast<u64>(resp) << " samples/sec" << std::endl;
+
+    auto binary = run_client(*con, BINARY_PORT, make_binary_payload(BATCH_SIZE, 1000), nbatches);
+    std::cout << "Binary throughput: " << static_cast<u64>(binary) << " samples/sec" << std::endl;
+
     server->stop();
+    return 0;
 }
@@ -4,5 +4,6 @@ brew install log4cxx
 brew install jemalloc
 brew install sqlite
 brew install libmicrohttpd
+brew install zstd
 brew install apr
 brew install apr-util
@@ -25,6 +25,7 @@ if [ "x$pkgman" = "xyum" -o "x$pkgman" = "xdnf" ]; then
                           sqlite sqlite-devel \
                           apr-devel apr-util-devel apr-util-sqlite \
                           libmicrohttpd-devel \
+                          zlib-devel libzstd-devel \
                           jemalloc-devel
 else
         if [ "x$pkgman" = "xapt" ]; then
@@ -41,6 +42,7 @@ else
         sudo apt-get install -y libjemalloc-dev
         sudo apt-get install -y libsqlite3-dev
         sudo apt-get install -y libmicrohttpd-dev
+        sudo apt-get install -y zlib1g-dev libzstd-dev
 
                 echo 'Trying to install cmake'
                 sudo apt-get install -y cmake
@@ -0,0 +1,122 @@
+// tests for akumulid/arrow_output.cpp
+
+#include <iostream>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+#include <boost/test/unit_test.hpp>
+#include <cstring>
+#include <vector>
+
+#include "arrow_output.h"
+
+using namespace Akumuli;
+
+static std::vector<char> read_all(ArrowStreamWriter& writer) {
+    std::vector<char> out;
+    char buf[100];
+    while (size_t n = writer.read(buf, sizeof(buf))) {
+        out.insert(out.end(), buf, buf + n);
+    }
+    return out;
+}
+
+//! Read little-endian u32 from the stream
+static u32 read_u32(std::vector<char> const& data, size_t pos) {
+    u32 res;
+    BOOST_REQUIRE(pos + 4 <= data.size());
+    memcpy(&res, data.data() + pos, 4);
+    return res;
+}
+
+BOOST_AUTO_TEST_CASE(Test_arrow_schema_is_written_first) {
+    ArrowStreamWriter writer(false);
+    auto data = read_all(writer);
+    BOOST_REQUIRE(data.size() > 8);
+    BOOST_REQUIRE_EQUAL(read_u32(data, 0), 0xFFFFFFFF);
+    u32 len = read_u32(data, 4);
+    BOOST_REQUIRE_EQUAL(len % 8, 0);
+    BOOST_REQUIRE_EQUAL(data.size(), 8 + len);
+    BOOST_REQUIRE_EQUAL(writer.available(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(Test_arrow_empty_batch) {
+    ArrowStreamWriter writer(false);
+    read_all(writer);
+    writer.flush_batch();
+    BOOST_REQUIRE_EQUAL(writer.available(), 0);
+    writer.finish();
+    auto data = read_all(writer);
+    // Only end-of-stream marker
+    BOOST_REQUIRE_EQUAL(data.size(), 8);
+    BOOST_REQUIRE_EQUAL(read_u32(data, 0), 0xFFFFFFFF);
+    BOOST_REQUIRE_EQUAL(read_u32(data, 4), 0);
+}
+
+BOOST_AUTO_TEST_CASE(Test_arrow_dictionary) {
+    ArrowStreamWriter writer(true);
+    read_all(writer);
+    BOOST_REQUIRE_EQUAL(writer.find_series(42), -1);
+    BOOST_REQUIRE_EQUAL(writer.add_series(42, "cpu host=A"), 0);
+    BOOST_REQUIRE_EQUAL(writer.add_series(11, "cpu host=B"), 1);
+    BOOST_REQUIRE_EQUAL(writer.find_series(42), 0);
+    BOOST_REQUIRE_EQUAL(writer.find_series(11), 1);
+
+    aku_Timestamp ts = 100;
+    double value = 1.0;
+    writer.append(0, &ts, &value);
+    writer.append(1, &ts, nullptr);
+    writer.append(-1, nullptr, &value);
+    BOOST_REQUIRE_EQUAL(writer.batch_size(), 3);
+    writer.flush_batch();
+    BOOST_REQUIRE_EQUAL(writer.batch_size(), 0);
+    auto first = read_all(writer);
+
+    // Dictionary batch followed by record batch, names are sent once
+    std::string str(first.begin(), first.end());
+    BOOST_REQUIRE(str.find("cpu host=A") != std::string::npos);
+    BOOST_REQUIRE(str.find("cpu host=B") != std::string::npos);
+    BOOST_REQUIRE_EQUAL(first.size() % 8, 0);
+    BOOST_REQUIRE_EQUAL(read_u32(first, 0), 0xFFFFFFFF);
+
+    writer.append(0, &ts, &value);
+    writer.flush_batch();
+    auto second = read_all(writer);
+    str.assign(second.begin(), second.end());
+    BOOST_REQUIRE(str.find("cpu host=A") == std::string::npos);
+    BOOST_REQUIRE_EQUAL(second.size() % 8, 0);
+    // Record batch only, smaller than dictionary + record batch
+    BOOST_REQUIRE(second.size() < first.size());
+
+    // New series is sent using delta dictionary batch
+    BOOST_REQUIRE_EQUAL(writer.add_series(7, "mem host=C"), 2);
+    writer.append(2, &ts, &value);
+    writer.finish();
+    auto third = read_all(writer);
+    str.assign(third.begin(), third.end());
+    BOOST_REQUIRE(str.find("mem host=C") != std::string::npos);
+    BOOST_REQUIRE(str.find("cpu host=B") == std::string::npos);
+    BOOST_REQUIRE_EQUAL(read_u32(third, third.size() - 8), 0xFFFFFFFF);
+    BOOST_REQUIRE_EQUAL(read_u32(third, third.size() - 4), 0);
+}
+
+BOOST_AUTO_TEST_CASE(Test_arrow_finish_with_error) {
+    ArrowStreamWriter writer(false);
+    read_all(writer);
+    aku_Timestamp ts = 100;
+    double value = 1.0;
+    writer.append(writer.add_series(42, "cpu host=A"), &ts, &value);
+    writer.finish("query failed");
+    auto data = read_all(writer);
+    std::string str(data.begin(), data.end());
+    // Pending rows go first, error is sent in the custom metadata of the last batch
+    auto name_pos = str.find("cpu host=A");
+    auto error_pos = str.find("query failed");
+    BOOST_REQUIRE(name_pos != std::string::npos);
+    BOOST_REQUIRE(error_pos != std::string::npos);
+    BOOST_REQUIRE(name_pos < error_pos);
+    BOOST_REQUIRE(str.find("error") != std::string::npos);
+    BOOST_REQUIRE_EQUAL(data.size() % 8, 0);
+    BOOST_REQUIRE_EQUAL(read_u32(data, data.size() - 8), 0xFFFFFFFF);
+    BOOST_REQUIRE_EQUAL(read_u32(data, data.size() - 4), 0);
+}
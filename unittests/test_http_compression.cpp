@@ -0,0 +1,130 @@
+// tests for akumulid/http_compression.cpp
+
+#include <iostream>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+#include <boost/test/unit_test.hpp>
+#include <cstring>
+#include <string>
+#include <zlib.h>
+
+#include "http_compression.h"
+
+using namespace Akumuli;
+using namespace Akumuli::Http;
+
+//! Read operation that returns the text in small pieces with pauses
+struct ReadOperationMock : ReadOperation {
+    std::string text_;
+    size_t pos_ = 0;
+    int ncalls_ = 0;
+    bool closed_ = false;
+
+    ReadOperationMock(std::string text)
+        : text_(text)
+    {
+    }
+
+    virtual void start() {}
+    virtual void append(const char*, size_t) {}
+    virtual aku_Status get_error() { return AKU_SUCCESS; }
+    virtual const char* get_error_message() { return ""; }
+
+    virtual std::tuple<size_t, bool> read_some(char* buf, size_t buf_size) {
+        if (pos_ == text_.size()) {
+            return std::make_tuple(0u, true);
+        }
+        if (ncalls_++ % 3 == 2) {
+            // data is not ready yet
+            return std::make_tuple(0u, false);
+        }
+        size_t len = std::min(buf_size, std::min(text_.size() - pos_, (size_t)1000));
+        memcpy(buf, text_.data() + pos_, len);
+        pos_ += len;
+        return std::make_tuple(len, false);
+    }
+
+    virtual void close() {
+        closed_ = true;
+    }
+};
+
+static std::string gunzip(std::string const& input) {
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    BOOST_REQUIRE(inflateInit2(&strm, 15 + 16) == Z_OK);
+    strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+    strm.avail_in = static_cast<uInt>(input.size());
+    std::string result;
+    char buf[0x1000];
+    int ret = Z_OK;
+    while (ret == Z_OK) {
+        strm.next_out = reinterpret_cast<Bytef*>(buf);
+        strm.avail_out = sizeof(buf);
+        ret = inflate(&strm, Z_NO_FLUSH);
+        result.append(buf, sizeof(buf) - strm.avail_out);
+    }
+    inflateEnd(&strm);
+    BOOST_REQUIRE_EQUAL(ret, Z_STREAM_END);
+    return result;
+}
+
+BOOST_AUTO_TEST_CASE(Test_negotiate_encoding) {
+    CompressionSettings all = { 6, 3 };
+    CompressionSettings gzip_only = { 6, 0 };
+    CompressionSettings none = { 0, 0 };
+    BOOST_REQUIRE(negotiate_encoding(nullptr, all) == ContentEncoding::IDENTITY);
+    BOOST_REQUIRE(negotiate_encoding("", all) == ContentEncoding::IDENTITY);
+    BOOST_REQUIRE(negotiate_encoding("identity", all) == ContentEncoding::IDENTITY);
+    BOOST_REQUIRE(negotiate_encoding("gzip, deflate", all) == ContentEncoding::GZIP);
+    BOOST_REQUIRE(negotiate_encoding("GZIP", all) == ContentEncoding::GZIP);
+    BOOST_REQUIRE(negotiate_encoding("gzip;q=0", all) == ContentEncoding::IDENTITY);
+    BOOST_REQUIRE(negotiate_encoding("gzip", none) == ContentEncoding::IDENTITY);
+    BOOST_REQUIRE(negotiate_encoding("*;q=0.5, zstd;q=0", gzip_only) == ContentEncoding::GZIP);
+#ifdef AKU_WITH_ZSTD
+    BOOST_REQUIRE(negotiate_encoding("gzip, zstd", all) == ContentEncoding::ZSTD);
+    BOOST_REQUIRE(negotiate_encoding("gzip;q=1.0, zstd;q=0.5", all) == ContentEncoding::GZIP);
+    BOOST_REQUIRE(negotiate_encoding("*", all) == ContentEncoding::ZSTD);
+#endif
+    BOOST_REQUIRE(negotiate_encoding("gzip, zstd", gzip_only) == ContentEncoding::GZIP);
+    BOOST_REQUIRE_EQUAL(encoding_name(ContentEncoding::GZIP), "gzip");
+    BOOST_REQUIRE(encoding_name(ContentEncoding::IDENTITY) == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(Test_compressed_read_operation) {
+    std::string expected;
+    for (int i = 0; i < 100000; i++) {
+        expected += "cpu.user host=host_" + std::to_string(i % 100) + ",20141210T074243.111999000," + std::to_string(i) + "\n";
+    }
+    auto mock = new ReadOperationMock(expected);
+    CompressionSettings settings = { 6, 3 };
+    CompressedReadOperation cursor(std::unique_ptr<ReadOperation>(mock),
+                                   StreamCompressor::create(ContentEncoding::GZIP, settings));
+    std::string compressed;
+    char buf[0x1000];
+    while (true) {
+        size_t len;
+        bool done;
+        std::tie(len, done) = cursor.read_some(buf, sizeof(buf));
+        compressed.append(buf, len);
+        if (done) {
+            break;
+        }
+    }
+    cursor.close();
+    BOOST_REQUIRE(mock->closed_);
+    BOOST_REQUIRE(compressed.size() < expected.size() / 4);
+    BOOST_REQUIRE(gunzip(compressed) == expected);
+}
+
+BOOST_AUTO_TEST_CASE(Test_compressed_read_operation_close_early) {
+    auto mock = new ReadOperationMock(std::string(1000000, 'x'));
+    CompressionSettings settings = { 1, 1 };
+    CompressedReadOperation cursor(std::unique_ptr<ReadOperation>(mock),
+                                   StreamCompressor::create(ContentEncoding::GZIP, settings));
+    char buf[10];
+    cursor.read_some(buf, sizeof(buf));
+    cursor.close();
+    BOOST_REQUIRE(mock->closed_);
+}
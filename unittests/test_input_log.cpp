@@ -164,6 +164,52 @@ BOOST_AUTO_TEST_CASE(Test_input_volume_read_next_frame) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(Test_input_volume_read_frames) {
+    std::vector<std::tuple<u64, u64, double>> exp, act;
+    const char* filename = "./tmp_test_vol.ilog";
+    {
+        LZ4Volume volume(&sequencer, filename, 0x10000);
+        for (int i = 0; i < 10000; i++) {
+            double val = static_cast<double>(rand()) / RAND_MAX;
+            aku_Status status = volume.append(42, i, val);
+            exp.push_back(std::make_tuple(42, i, val));
+            if (status == AKU_EOVERFLOW) {
+                break;
+            }
+        }
+    }
+    {
+        LZ4Volume volume(filename);
+        volume.open_ro();
+        std::vector<LZ4Volume::Frame> frames(3);
+        while(true) {
+            aku_Status status;
+            u32 nframes;
+            std::tie(status, nframes) = volume.read_frames(frames.data(), static_cast<u32>(frames.size()));
+            BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+            if (nframes == 0) {
+                // Done iterating
+                break;
+            }
+            for (u32 ix = 0; ix < nframes; ix++) {
+                const LZ4Volume::Frame& frame = frames.at(ix);
+                for(u32 i = 0; i < frame.data_points.size; i++) {
+                    act.push_back(std::make_tuple(frame.data_points.ids[i],
+                                                  frame.data_points.tss[i],
+                                                  frame.data_points.xss[i]));
+                }
+            }
+        }
+        volume.delete_file();
+    }
+    BOOST_REQUIRE_EQUAL(exp.size(), act.size());
+    for (u32 i = 0; i < exp.size(); i++) {
+        BOOST_REQUIRE_EQUAL(std::get<0>(exp.at(i)), std::get<0>(act.at(i)));
+        BOOST_REQUIRE_EQUAL(std::get<1>(exp.at(i)), std::get<1>(act.at(i)));
+        BOOST_REQUIRE_EQUAL(std::get<2>(exp.at(i)), std::get<2>(act.at(i)));
+    }
+}
+
 BOOST_AUTO_TEST_CASE(Test_input_roundtrip_with_frames) {
     std::vector<std::tuple<u64, u64, double>> exp, act;
     std::vector<u64> stale_ids;
@@ -207,6 +253,50 @@ BOOST_AUTO_TEST_CASE(Test_input_roundtrip_with_frames) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(Test_input_roundtrip_with_frames_large_volumes) {
+    // Every volume contains more frames than a single batch decoded by `read_next_frame`
+    std::vector<std::tuple<u64, u64, double>> exp, act;
+    std::vector<u64> stale_ids;
+    {
+        InputLog ilog(&sequencer, "./", 100, 0x40000, 0);
+        for (int i = 0; i < 100000; i++) {
+            double val = static_cast<double>(rand()) / RAND_MAX;
+            aku_Status status = ilog.append(42 + i % 10, i, val, &stale_ids);
+            exp.push_back(std::make_tuple(42 + i % 10, i, val));
+            if (status == AKU_EOVERFLOW) {
+                ilog.rotate();
+            }
+        }
+    }
+    BOOST_REQUIRE(stale_ids.empty());
+    {
+        InputLog ilog("./", 0);
+        while(true) {
+            aku_Status status;
+            const LZ4Volume::Frame* frame;
+            std::tie(status, frame) = ilog.read_next_frame();
+            if (frame == nullptr) {
+                BOOST_REQUIRE_EQUAL(status, AKU_ENO_DATA);
+                break;
+            }
+            BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+            for(u32 i = 0; i < frame->data_points.size; i++) {
+                act.push_back(std::make_tuple(frame->data_points.ids[i],
+                                              frame->data_points.tss[i],
+                                              frame->data_points.xss[i]));
+            }
+        }
+        ilog.reopen();
+        ilog.delete_files();
+    }
+    BOOST_REQUIRE_EQUAL(exp.size(), act.size());
+    for (u32 i = 0; i < exp.size(); i++) {
+        BOOST_REQUIRE_EQUAL(std::get<0>(exp.at(i)), std::get<0>(act.at(i)));
+        BOOST_REQUIRE_EQUAL(std::get<1>(exp.at(i)), std::get<1>(act.at(i)));
+        BOOST_REQUIRE_EQUAL(std::get<2>(exp.at(i)), std::get<2>(act.at(i)));
+    }
+}
+
 void test_input_roundtrip_no_conflicts(int ccr) {
     std::map<u64, std::vector<std::tuple<u64, double>>> exp, act;
     std::vector<u64> stale_ids;
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 
 #define BOOST_TEST_DYN_LINK
@@ -6,7 +7,9 @@
 #include <boost/test/unit_test.hpp>
 
 #include <apr.h>
+#include <numeric>
 #include <queue>
+#include <thread>
 #include <fstream>
 #include <stdlib.h>
 
@@ -1132,6 +1135,248 @@ BOOST_AUTO_TEST_CASE(Test_reopen_late_write) {
     BOOST_REQUIRE(status == NBTreeAppendResult::FAIL_LATE_WRITE);
 }
 
+BOOST_AUTO_TEST_CASE(Test_nbtree_bulk_append) {
+    std::vector<LogicAddr> addrlist;
+    std::shared_ptr<BlockStore> bstore =
+        BlockStoreBuilder::create_memstore();
+
+    auto collection = std::make_shared<NBTreeExtentsList>(42, addrlist, bstore);
+    collection->force_init();
+
+    // Large enough to span many leaf nodes
+    const u32 N = 100000;
+    std::vector<aku_Timestamp> tss;
+    std::vector<double> xss;
+    for (u32 i = 0; i < N; i++) {
+        tss.push_back(1000 + i);
+        xss.push_back(i);
+    }
+    // Out of order element in the middle
+    tss[N/2] = 1;
+
+    NBTreeAppendResult res;
+    u32 count;
+    std::tie(res, count) = collection->append(tss.data(), xss.data(), N);
+    BOOST_REQUIRE(res == NBTreeAppendResult::OK_FLUSH_NEEDED);
+    BOOST_REQUIRE_EQUAL(count, N/2);
+
+    std::tie(res, count) = collection->append(tss.data() + N/2, xss.data() + N/2, N/2);
+    BOOST_REQUIRE(res == NBTreeAppendResult::FAIL_LATE_WRITE);
+    BOOST_REQUIRE_EQUAL(count, 0);
+
+    std::tie(res, count) = collection->append(tss.data() + N/2 + 1, xss.data() + N/2 + 1, N/2 - 1);
+    BOOST_REQUIRE(res == NBTreeAppendResult::OK_FLUSH_NEEDED);
+    BOOST_REQUIRE_EQUAL(count, N/2 - 1);
+
+    // Read data back
+    std::unique_ptr<RealValuedOperator> it = collection->search(0, 1000 + N);
+    std::vector<aku_Timestamp> outts(N, 0);
+    std::vector<double> outxs(N, 0);
+    aku_Status status;
+    size_t sz;
+    std::tie(status, sz) = it->read(outts.data(), outxs.data(), N - 1);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(sz, N - 1);
+    size_t ix = 0;
+    for (u32 i = 0; i < N; i++) {
+        if (i == N/2) {
+            continue;
+        }
+        BOOST_REQUIRE_EQUAL(outts[ix], tss[i]);
+        BOOST_REQUIRE_EQUAL(outxs[ix], xss[i]);
+        ix++;
+    }
+
+    // Check aggregates
+    auto agg = collection->aggregate(0, 1000 + N);
+    AggregationResult aggres;
+    std::tie(status, sz) = agg->read(&outts[0], &aggres, 1);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(sz, 1);
+    BOOST_REQUIRE_EQUAL(aggres.cnt, N - 1);
+    BOOST_REQUIRE_EQUAL(aggres.min, 0);
+    BOOST_REQUIRE_EQUAL(aggres.max, N - 1);
+    BOOST_REQUIRE_EQUAL(aggres.first, 0);
+    BOOST_REQUIRE_EQUAL(aggres.last, N - 1);
+}
+
+BOOST_AUTO_TEST_CASE(Test_nbtree_reorder_window) {
+    std::vector<LogicAddr> addrlist;
+    std::shared_ptr<BlockStore> bstore =
+        BlockStoreBuilder::create_memstore();
+
+    auto collection = std::make_shared<NBTreeExtentsList>(42, addrlist, bstore);
+    collection->set_reorder_window(100, 1000);
+    collection->force_init();
+
+    // Swap neighbouring pairs of data-points
+    const u32 N = 10000;
+    for (u32 i = 0; i < N; i += 2) {
+        auto res = collection->append(1000 + i + 1, i + 1);
+        BOOST_REQUIRE(res != NBTreeAppendResult::FAIL_LATE_WRITE);
+        res = collection->append(1000 + i, i);
+        BOOST_REQUIRE(res != NBTreeAppendResult::FAIL_LATE_WRITE);
+    }
+    // Data-point outside of the window
+    BOOST_REQUIRE(collection->append(1000, 0) == NBTreeAppendResult::FAIL_LATE_WRITE);
+
+    auto check_fwd = [&]() {
+        std::unique_ptr<RealValuedOperator> it = collection->search(0, 1000 + N);
+        std::vector<aku_Timestamp> outts(N, 0);
+        std::vector<double> outxs(N, 0);
+        aku_Status status;
+        size_t sz;
+        std::tie(status, sz) = it->read(outts.data(), outxs.data(), N);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(sz, N);
+        for (u32 i = 0; i < N; i++) {
+            BOOST_REQUIRE_EQUAL(outts[i], 1000 + i);
+            BOOST_REQUIRE_EQUAL(outxs[i], i);
+        }
+    };
+
+    auto check_bwd = [&]() {
+        std::unique_ptr<RealValuedOperator> it = collection->search(1000 + N, 0);
+        std::vector<aku_Timestamp> outts(N, 0);
+        std::vector<double> outxs(N, 0);
+        aku_Status status;
+        size_t sz;
+        std::tie(status, sz) = it->read(outts.data(), outxs.data(), N);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(sz, N);
+        for (u32 i = 0; i < N; i++) {
+            BOOST_REQUIRE_EQUAL(outts[i], 1000 + N - i - 1);
+            BOOST_REQUIRE_EQUAL(outxs[i], N - i - 1);
+        }
+    };
+
+    auto check_agg = [&]() {
+        auto agg = collection->aggregate(0, 1000 + N);
+        aku_Timestamp ts;
+        AggregationResult aggres;
+        aku_Status status;
+        size_t sz;
+        std::tie(status, sz) = agg->read(&ts, &aggres, 1);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(sz, 1);
+        BOOST_REQUIRE_EQUAL(aggres.cnt, N);
+        BOOST_REQUIRE_EQUAL(aggres.first, 0);
+        BOOST_REQUIRE_EQUAL(aggres.last, N - 1);
+        BOOST_REQUIRE_EQUAL(aggres.max, N - 1);
+    };
+
+    // Last data-points are still buffered
+    check_fwd();
+    check_bwd();
+    check_agg();
+
+    // Reorder buffer should be flushed on close
+    addrlist = collection->close();
+    collection = std::make_shared<NBTreeExtentsList>(42, addrlist, bstore);
+    collection->force_init();
+
+    check_fwd();
+    check_bwd();
+    check_agg();
+}
+
+BOOST_AUTO_TEST_CASE(Test_nbtree_reorder_buffer_eviction) {
+    const u32 capacity = 64;
+    NBTreeReorderBuffer buffer(42, 1000000, capacity);
+
+    // Reversed input, buffer is limited by capacity (window is large)
+    const u32 N = 1000;
+    u32 nevicted = 0;
+    aku_Timestamp last = 0;
+    for (u32 i = 0; i < N; i++) {
+        aku_Timestamp ts = 1000 + (i ^ 1);
+        BOOST_REQUIRE(buffer.insert(ts, static_cast<double>(ts), false));
+        BOOST_REQUIRE(buffer.size() <= capacity + 1);
+        u32 count = buffer.evictable();
+        if (count != 0) {
+            // Data-points are evicted in batches
+            BOOST_REQUIRE(count > 1);
+            while (count != 0) {
+                const aku_Timestamp* tss;
+                const double* xss;
+                u32 run = buffer.front(count, &tss, &xss);
+                BOOST_REQUIRE(run != 0);
+                for (u32 j = 0; j < run; j++) {
+                    BOOST_REQUIRE(tss[j] > last);
+                    BOOST_REQUIRE_EQUAL(xss[j], static_cast<double>(tss[j]));
+                    last = tss[j];
+                }
+                buffer.pop(run);
+                count -= run;
+                nevicted += run;
+            }
+        }
+    }
+    BOOST_REQUIRE_EQUAL(nevicted + buffer.size(), N);
+
+    std::vector<aku_Timestamp> tss;
+    std::vector<double> xss;
+    BOOST_REQUIRE_EQUAL(buffer.read_all(&tss, &xss), AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(tss.size(), buffer.size());
+    BOOST_REQUIRE(std::is_sorted(tss.begin(), tss.end()));
+    BOOST_REQUIRE(tss.front() > last);
+
+    // Summary is recalculated after eviction
+    auto meta = buffer.get_leafmeta();
+    BOOST_REQUIRE_EQUAL(meta->count, tss.size());
+    BOOST_REQUIRE_EQUAL(meta->begin, tss.front());
+    BOOST_REQUIRE_EQUAL(meta->end, tss.back());
+    BOOST_REQUIRE_EQUAL(meta->min, xss.front());
+    BOOST_REQUIRE_EQUAL(meta->max, xss.back());
+    BOOST_REQUIRE_EQUAL(meta->sum, std::accumulate(xss.begin(), xss.end(), 0.0));
+}
+
+BOOST_AUTO_TEST_CASE(Test_nbtree_reorder_window_concurrent_aggregate) {
+    std::vector<LogicAddr> addrlist;
+    std::shared_ptr<BlockStore> bstore =
+        BlockStoreBuilder::create_memstore();
+
+    auto collection = std::make_shared<NBTreeExtentsList>(42, addrlist, bstore);
+    collection->set_reorder_window(100, 1000);
+    collection->force_init();
+
+    // Swap neighbouring pairs of data-points, some of them are evicted from the buffer
+    const u32 N = 10000;
+    for (u32 i = 0; i < N; i += 2) {
+        BOOST_REQUIRE(collection->append(1000 + i + 1, i + 1) != NBTreeAppendResult::FAIL_LATE_WRITE);
+        BOOST_REQUIRE(collection->append(1000 + i, i) != NBTreeAppendResult::FAIL_LATE_WRITE);
+    }
+
+    // Leaf metadata of the reorder buffer is used by all aggregate queries
+    const int NTHREADS = 4;
+    const int NITER = 200;
+    std::vector<int> nerrors(NTHREADS, 0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < NTHREADS; t++) {
+        threads.emplace_back([&, t]() {
+            for (int i = 0; i < NITER; i++) {
+                auto agg = collection->aggregate(0, 1000 + N);
+                aku_Timestamp ts;
+                AggregationResult aggres;
+                aku_Status status;
+                size_t sz;
+                std::tie(status, sz) = agg->read(&ts, &aggres, 1);
+                if (status != AKU_SUCCESS || sz != 1 || aggres.cnt != N || aggres.min != 0 ||
+                    aggres.max != N - 1 || aggres.sum != static_cast<double>(N)*(N - 1)/2)
+                {
+                    nerrors[static_cast<size_t>(t)]++;
+                }
+            }
+        });
+    }
+    for (auto& th: threads) {
+        th.join();
+    }
+    for (auto n: nerrors) {
+        BOOST_REQUIRE_EQUAL(n, 0);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(Test_reopen_write_reopen) {
     std::vector<LogicAddr> addrlist;
     std::shared_ptr<BlockStore> bstore =
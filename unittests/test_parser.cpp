@@ -8,6 +8,7 @@
 #include "queryprocessor_framework.h"
 #include "datetime.h"
 #include <tuple>
+#include <thread>
 
 using namespace Akumuli;
 using namespace Akumuli::QP;
@@ -61,6 +62,78 @@ BOOST_AUTO_TEST_CASE(Test_stringpool_0) {
     BOOST_REQUIRE_EQUAL(std::string(result_bar.first, result_bar.first + result_bar.second), bar);
 }
 
+BOOST_AUTO_TEST_CASE(Test_interned_stringpool_0) {
+
+    InternedStringPool pool;
+    std::vector<std::string> names;
+    std::vector<u64> ids;
+    size_t total_size = 0;
+    for (int i = 0; i < 1000; i++) {
+        names.push_back("cpu.user host=host_" + std::to_string(i % 100) + " rack=" + std::to_string(i) + " region=eu-" + std::to_string(i % 3));
+        ids.push_back(pool.add(names.back().data(), names.back().data() + names.back().size()));
+        BOOST_REQUIRE(ids.back() != 0);
+        total_size += names.back().size();
+    }
+    BOOST_REQUIRE_EQUAL(pool.size(), 1000u);
+    // metric + 3 tags + 100 hosts + 1000 racks + 3 regions
+    BOOST_REQUIRE_EQUAL(pool.dictionary_size(), 1107u);
+    BOOST_REQUIRE_LT(pool.mem_used(), total_size / 2);
+    std::string out;
+    std::vector<StringT> tokens;
+    for (size_t i = 0; i < names.size(); i++) {
+        auto tuple = pool.tuple(ids[i]);
+        BOOST_REQUIRE(pool.decode(tuple, &out));
+        BOOST_REQUIRE_EQUAL(out, names[i]);
+        BOOST_REQUIRE(pool.tokens(tuple, &tokens));
+        BOOST_REQUIRE_EQUAL(tokens.size(), 7u);
+        auto metric = pool.metric(tuple);
+        BOOST_REQUIRE_EQUAL(std::string(metric.first, metric.first + metric.second), "cpu.user");
+        // Encoded name is the same as the stored one
+        char buffer[InternedStringPool::MAX_TUPLE_SIZE];
+        auto size = pool.encode(names[i].data(), names[i].data() + names[i].size(), buffer, sizeof(buffer));
+        BOOST_REQUIRE_EQUAL(std::string(buffer, buffer + size), std::string(tuple.first, tuple.first + tuple.second));
+    }
+    // Series that share tag values share dictionary ids
+    pool.tokens(pool.tuple(ids[0]), &tokens);
+    std::vector<StringT> other;
+    pool.tokens(pool.tuple(ids[100]), &other);
+    BOOST_REQUIRE(tokens.at(2).first == other.at(2).first);
+    BOOST_REQUIRE(tokens.at(4).first != other.at(4).first);
+    // Names with unknown strings can't be encoded
+    std::string unknown = "cpu.user host=host_100 rack=1 region=eu-1";
+    char buffer[InternedStringPool::MAX_TUPLE_SIZE];
+    BOOST_REQUIRE_EQUAL(pool.encode(unknown.data(), unknown.data() + unknown.size(), buffer, sizeof(buffer)), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(Test_interned_stringpool_1) {
+
+    InternedStringPool pool;
+    const char* metric = "cpu";
+    const char* empty = "cpu host= =foo";
+    const char* escaped = "cpu\\ user host=1";
+    const char* bad1 = "cpu host";
+    const char* bad2 = "cpu  host=1";
+    const char* bad3 = " cpu host=1";
+    auto id = pool.add(metric, metric + strlen(metric));
+    BOOST_REQUIRE(id != 0);
+    BOOST_REQUIRE_EQUAL(pool.add(bad1, bad1 + strlen(bad1)), 0u);
+    BOOST_REQUIRE_EQUAL(pool.add(bad2, bad2 + strlen(bad2)), 0u);
+    BOOST_REQUIRE_EQUAL(pool.add(bad3, bad3 + strlen(bad3)), 0u);
+    // Malformed names doesn't change the dictionary
+    BOOST_REQUIRE_EQUAL(pool.size(), 1u);
+    BOOST_REQUIRE_EQUAL(pool.dictionary_size(), 1u);
+    std::string out;
+    BOOST_REQUIRE(pool.decode(pool.tuple(id), &out));
+    BOOST_REQUIRE_EQUAL(out, metric);
+    for (auto name: { empty, escaped }) {
+        id = pool.add(name, name + strlen(name));
+        BOOST_REQUIRE(id != 0);
+        BOOST_REQUIRE(pool.decode(pool.tuple(id), &out));
+        BOOST_REQUIRE_EQUAL(out, name);
+    }
+    BOOST_REQUIRE(!pool.decode(std::make_pair("\x7F", 1u), &out));
+}
+
 BOOST_AUTO_TEST_CASE(Test_seriesmatcher_0) {
 
     SeriesMatcher matcher(1ul);
@@ -113,6 +186,124 @@ BOOST_AUTO_TEST_CASE(Test_seriesmatcher_1) {
     BOOST_REQUIRE_EQUAL(res.size(), 0u);
 }
 
+BOOST_AUTO_TEST_CASE(Test_concurrent_string_table_0) {
+
+    ConcurrentStringTable table(4);
+    std::vector<std::string> names;
+    for (int i = 0; i < 10000; i++) {
+        names.push_back("cpu host=" + std::to_string(i));
+    }
+    // Reader runs concurrently with insertions and resizes
+    std::atomic<int> done = {0};
+    std::atomic<int> errors = {0};
+    std::thread reader([&]() {
+        while (done.load() == 0) {
+            for (int i = 0; i < 10000; i += 100) {
+                auto id = table.find(std::make_pair(names[i].data(), static_cast<int>(names[i].size())));
+                if (id != 0 && id != i + 1) {
+                    errors++;
+                }
+            }
+        }
+    });
+    for (int i = 0; i < 10000; i++) {
+        table.insert(std::make_pair(names[i].data(), static_cast<int>(names[i].size())), i + 1);
+    }
+    done.store(1);
+    reader.join();
+
+    BOOST_REQUIRE_EQUAL(errors.load(), 0);
+    BOOST_REQUIRE_EQUAL(table.size(), 10000u);
+    for (int i = 0; i < 10000; i++) {
+        auto id = table.find(std::make_pair(names[i].data(), static_cast<int>(names[i].size())));
+        BOOST_REQUIRE_EQUAL(id, i + 1);
+    }
+    std::string missing = "cpu host=10000";
+    BOOST_REQUIRE_EQUAL(table.find(std::make_pair(missing.data(), static_cast<int>(missing.size()))), 0);
+
+    // Replace existing value
+    table.insert(std::make_pair(names[0].data(), static_cast<int>(names[0].size())), 42);
+    BOOST_REQUIRE_EQUAL(table.size(), 10000u);
+    BOOST_REQUIRE_EQUAL(table.find(std::make_pair(names[0].data(), static_cast<int>(names[0].size()))), 42);
+}
+
+BOOST_AUTO_TEST_CASE(Test_concurrent_string_table_1) {
+
+    ConcurrentStringTable table(4);
+    std::vector<std::string> names;
+    for (int i = 0; i < 10000; i++) {
+        names.push_back("cpu host=" + std::to_string(i));
+    }
+    // Id lookups run concurrently with insertions and resizes
+    std::atomic<int> done = {0};
+    std::atomic<int> errors = {0};
+    std::thread reader([&]() {
+        while (done.load() == 0) {
+            for (int i = 0; i < 10000; i += 100) {
+                auto str = table.find(static_cast<i64>(-i - 1));
+                if (str.second != 0 && std::string(str.first, str.first + str.second) != names[i]) {
+                    errors++;
+                }
+            }
+        }
+    });
+    for (int i = 0; i < 10000; i++) {
+        table.insert(std::make_pair(names[i].data(), static_cast<int>(names[i].size())), -i - 1);
+    }
+    done.store(1);
+    reader.join();
+
+    BOOST_REQUIRE_EQUAL(errors.load(), 0);
+    for (int i = 0; i < 10000; i++) {
+        auto str = table.find(static_cast<i64>(-i - 1));
+        BOOST_REQUIRE_EQUAL(std::string(str.first, str.first + str.second), names[i]);
+    }
+    BOOST_REQUIRE_EQUAL(table.find(static_cast<i64>(1)).second, 0);
+    auto ids = table.get_ids();
+    std::sort(ids.begin(), ids.end());
+    BOOST_REQUIRE_EQUAL(ids.size(), 10000u);
+    BOOST_REQUIRE_EQUAL(ids.front(), -10000);
+    BOOST_REQUIRE_EQUAL(ids.back(), -1);
+}
+
+BOOST_AUTO_TEST_CASE(Test_seriesmatcher_concurrent_reads) {
+
+    SeriesMatcher matcher(1ul);
+    std::vector<std::string> names;
+    for (int i = 0; i < 10000; i++) {
+        names.push_back("cpu host=" + std::to_string(i));
+    }
+    // Readers don't acquire the matcher lock while writer adds new names
+    std::atomic<int> done = {0};
+    std::atomic<int> errors = {0};
+    std::thread reader([&]() {
+        while (done.load() == 0) {
+            for (int i = 0; i < 10000; i += 10) {
+                auto const& name = names[i];
+                auto id = matcher.match(name.data(), name.data() + name.size());
+                if (id == 0) {
+                    continue;
+                }
+                std::string str;
+                if (!matcher.id2str(id, &str) || str != name) {
+                    errors++;
+                }
+            }
+        }
+    });
+    for (auto const& name: names) {
+        matcher.add(name.data(), name.data() + name.size());
+    }
+    done.store(1);
+    reader.join();
+    BOOST_REQUIRE_EQUAL(errors.load(), 0);
+    auto ids = matcher.get_all_ids();
+    BOOST_REQUIRE_EQUAL(ids.size(), names.size());
+    for (size_t i = 0; i < ids.size(); i++) {
+        BOOST_REQUIRE_EQUAL(ids[i], static_cast<i64>(i + 1));
+    }
+}
+
 BOOST_AUTO_TEST_CASE(Test_seriesparser_0) {
 
     const char* series1 = " cpu  region=europe   host=127.0.0.1 ";
@@ -288,12 +479,10 @@ BOOST_AUTO_TEST_CASE(Test_index_0) {
     BOOST_REQUIRE_EQUAL(res.size(), 4);
     int i = 0;
     u64 exp_id = 10ul;
-    for (auto tup: res) {
-        const char* name;
-        int size;
-        u64 id;
-        std::tie(name, size, id) = tup;
-        BOOST_REQUIRE_EQUAL(std::string(name, name + size), names[i]);
+    for (auto id: res) {
+        std::string name;
+        BOOST_REQUIRE(matcher.id2str(id, &name));
+        BOOST_REQUIRE_EQUAL(name, names[i]);
         BOOST_REQUIRE_EQUAL(id, exp_id);
         i++;
         exp_id++;
@@ -334,13 +523,11 @@ BOOST_AUTO_TEST_CASE(Test_index_1) {
     std::vector<u64> offsets = {
         6,
     };
-    for (auto tup: res) {
-        const char* name;
-        int size;
-        u64 id;
-        std::tie(name, size, id) = tup;
+    for (auto id: res) {
+        std::string name;
+        BOOST_REQUIRE(matcher.id2str(id, &name));
         std::string exp_name = names[offsets[i]];
-        BOOST_REQUIRE_EQUAL(std::string(name, name + size), exp_name);
+        BOOST_REQUIRE_EQUAL(name, exp_name);
         BOOST_REQUIRE_EQUAL(id, base_id + offsets[i]);
         i++;
     }
@@ -410,13 +597,11 @@ BOOST_AUTO_TEST_CASE(Test_index_3) {
         1,
         5,
     };
-    for (auto tup: res) {
-        const char* name;
-        int size;
-        u64 id;
-        std::tie(name, size, id) = tup;
+    for (auto id: res) {
+        std::string name;
+        BOOST_REQUIRE(matcher.id2str(id, &name));
         std::string exp_name = names[offsets[i]];
-        BOOST_REQUIRE_EQUAL(std::string(name, name + size), exp_name);
+        BOOST_REQUIRE_EQUAL(name, exp_name);
         BOOST_REQUIRE_EQUAL(id, base_id + offsets[i]);
         i++;
     }
@@ -457,14 +642,322 @@ BOOST_AUTO_TEST_CASE(Test_index_4) {
         5,
         6,
     };
-    for (auto tup: res) {
-        const char* name;
-        int size;
-        u64 id;
-        std::tie(name, size, id) = tup;
+    for (auto id: res) {
+        std::string name;
+        BOOST_REQUIRE(matcher.id2str(id, &name));
         std::string exp_name = names[offsets[i]];
-        BOOST_REQUIRE_EQUAL(std::string(name, name + size), exp_name);
+        BOOST_REQUIRE_EQUAL(name, exp_name);
         BOOST_REQUIRE_EQUAL(id, base_id + offsets[i]);
         i++;
     }
 }
+
+//! Run the query using both posting list representations and compare results
+static void test_roaring_index(std::vector<std::string> const& names, IndexQueryNodeBase const& query, std::vector<u64> offsets) {
+    u64 base_id = 10ul;
+    SeriesMatcher compressed(base_id);
+    SeriesMatcher roaring(base_id, IndexPostings::ROARING);
+    BOOST_REQUIRE(roaring.index.get_postings_type() == IndexPostings::ROARING);
+    for (auto name: names) {
+        auto id = compressed.add(name.data(), name.data() + name.size());
+        if (id == 0 || roaring.add(name.data(), name.data() + name.size()) != id) {
+            BOOST_FAIL("Bad id");
+        }
+    }
+    auto expected = compressed.search(query);
+    auto res = roaring.search(query);
+    BOOST_REQUIRE_EQUAL(res.size(), offsets.size());
+    BOOST_REQUIRE_EQUAL(expected.size(), offsets.size());
+    for (size_t i = 0; i < res.size(); i++) {
+        auto id = res.at(i);
+        std::string name;
+        BOOST_REQUIRE(roaring.id2str(id, &name));
+        BOOST_REQUIRE_EQUAL(name, names[offsets[i]]);
+        BOOST_REQUIRE_EQUAL(id, base_id + offsets[i]);
+        BOOST_REQUIRE_EQUAL(expected.at(i), id);
+    }
+}
+
+static const std::vector<std::string> ROARING_TEST_NAMES = {
+    "foo tagA=1 tagB=1 tagC=2",
+    "foo tagA=1 tagB=2 tagD=1",
+    "foo tagA=1 tagB=3 tagC=8",
+    "foo tagA=1 tagB=4 tagC=2",
+    "foo tagA=2 tagB=1 tagC=3",
+    "foo tagA=2 tagB=2 tagD=0",
+    "foo tagA=2 tagB=3 tagC=9",
+    "foo tagA=2 tagB=4 tagC=4",
+    "bar tagA=2 tagB=3 tagC=9",
+};
+
+BOOST_AUTO_TEST_CASE(Test_index_roaring_0) {
+    MetricName mname("foo");
+    std::vector<TagValuePair> tags = {
+        TagValuePair("tagA=2"),
+        TagValuePair("tagB=3")
+    };
+    IncludeIfAllTagsMatch query(mname, tags.begin(), tags.end());
+    test_roaring_index(ROARING_TEST_NAMES, query, { 6 });
+}
+
+BOOST_AUTO_TEST_CASE(Test_index_roaring_1) {
+    std::map<std::string, std::vector<std::string>> tags = {
+        {"tagA", {"2"}},
+        {"tagB", {"2", "3"}},
+    };
+    IncludeMany2Many query("foo", tags);
+    test_roaring_index(ROARING_TEST_NAMES, query, { 5, 6 });
+}
+
+BOOST_AUTO_TEST_CASE(Test_index_roaring_2) {
+    std::vector<std::string> qtags = {"tagD"};
+    IncludeIfHasTag query("foo", qtags);
+    test_roaring_index(ROARING_TEST_NAMES, query, { 1, 5 });
+}
+
+BOOST_AUTO_TEST_CASE(Test_index_roaring_3) {
+    MetricName mname("foo");
+    std::vector<TagValuePair> tags = {
+        TagValuePair("tagA=1"),
+        TagValuePair("tagC=9")
+    };
+    ExcludeTags query(mname, tags.begin(), tags.end());
+    test_roaring_index(ROARING_TEST_NAMES, query, { 4, 5, 7 });
+}
+
+BOOST_AUTO_TEST_CASE(Test_index_roaring_4) {
+    std::map<std::string, std::vector<std::string>> tags = {
+        {"tagA", {"3"}},
+    };
+    IncludeMany2Many query("foo", tags);
+    test_roaring_index(ROARING_TEST_NAMES, query, {});
+}
+
+static const std::vector<std::string> FILTER_TEST_NAMES = {
+    "cpu host=web-01 region=eu-west",
+    "cpu host=web-02 region=eu-east",
+    "cpu host=db-01 region=eu-west",
+    "cpu host=web-10 region=us-east",
+    "cpu host=webserver region=us-west",
+    "mem host=web-01 region=eu-west",
+};
+
+BOOST_AUTO_TEST_CASE(Test_tag_value_filter_0) {
+    TagValueFilter prefix(TagValueFilter::Kind::PREFIX, "web-");
+    BOOST_REQUIRE_EQUAL(prefix.get_prefix(), "web-");
+    BOOST_REQUIRE(prefix.match(tostrt("web-01")));
+    BOOST_REQUIRE(!prefix.match(tostrt("web")));
+    BOOST_REQUIRE(!prefix.match(tostrt("db-01")));
+
+    TagValueFilter rexp(TagValueFilter::Kind::REGEX, "web-0[0-9]");
+    BOOST_REQUIRE_EQUAL(rexp.get_prefix(), "web-0");
+    BOOST_REQUIRE(rexp.match(tostrt("web-01")));
+    BOOST_REQUIRE(!rexp.match(tostrt("web-10")));
+    // Whole value should match
+    BOOST_REQUIRE(!rexp.match(tostrt("web-011")));
+
+    BOOST_REQUIRE_EQUAL(TagValueFilter(TagValueFilter::Kind::REGEX, "^abc*").get_prefix(), "ab");
+    BOOST_REQUIRE_EQUAL(TagValueFilter(TagValueFilter::Kind::REGEX, "abc|abd").get_prefix(), "");
+    BOOST_REQUIRE_EQUAL(TagValueFilter(TagValueFilter::Kind::REGEX, ".*-01").get_prefix(), "");
+    BOOST_CHECK_THROW(TagValueFilter(TagValueFilter::Kind::REGEX, "web-(0"), boost::regex_error);
+}
+
+BOOST_AUTO_TEST_CASE(Test_tag_value_filter_1) {
+    SeriesMatcher matcher(10ul);
+    for (auto name: FILTER_TEST_NAMES) {
+        matcher.add(name.data(), name.data() + name.size());
+    }
+    TagValueFilter filter(TagValueFilter::Kind::REGEX, "web-[0-9]+");
+    auto values = matcher.index.match_tag_values(tostrt("cpu"), tostrt("host"), filter);
+    BOOST_REQUIRE_EQUAL(values.size(), 3);
+    // Values are sorted
+    BOOST_REQUIRE_EQUAL(fromstrt(values.at(0)), "web-01");
+    BOOST_REQUIRE_EQUAL(fromstrt(values.at(1)), "web-02");
+    BOOST_REQUIRE_EQUAL(fromstrt(values.at(2)), "web-10");
+    values = matcher.index.match_tag_values(tostrt("mem"), tostrt("host"), filter);
+    BOOST_REQUIRE_EQUAL(values.size(), 1);
+    values = matcher.index.match_tag_values(tostrt("cpu"), tostrt("rack"), filter);
+    BOOST_REQUIRE(values.empty());
+}
+
+BOOST_AUTO_TEST_CASE(Test_tag_value_filter_2) {
+    std::map<std::string, std::vector<std::string>> tags;
+    std::map<std::string, TagValueFilter> filters = {
+        {"host", TagValueFilter(TagValueFilter::Kind::PREFIX, "web-")},
+    };
+    IncludeMany2Many query("cpu", tags, filters);
+    test_roaring_index(FILTER_TEST_NAMES, query, { 0, 1, 3 });
+}
+
+BOOST_AUTO_TEST_CASE(Test_tag_value_filter_3) {
+    std::map<std::string, std::vector<std::string>> tags = {
+        {"host", {"web-01", "db-01", "webserver"}},
+    };
+    std::map<std::string, TagValueFilter> filters = {
+        {"region", TagValueFilter(TagValueFilter::Kind::REGEX, "(eu|us)-west")},
+    };
+    IncludeMany2Many query("cpu", tags, filters);
+    test_roaring_index(FILTER_TEST_NAMES, query, { 0, 2, 4 });
+}
+
+BOOST_AUTO_TEST_CASE(Test_tag_value_filter_4) {
+    std::map<std::string, std::vector<std::string>> tags;
+    std::map<std::string, TagValueFilter> filters = {
+        {"host", TagValueFilter(TagValueFilter::Kind::PREFIX, "web-")},
+        {"region", TagValueFilter(TagValueFilter::Kind::REGEX, "ap-.*")},
+    };
+    IncludeMany2Many query("cpu", tags, filters);
+    test_roaring_index(FILTER_TEST_NAMES, query, {});
+}
+
+BOOST_AUTO_TEST_CASE(Test_tag_value_filter_5) {
+    // Filters that match thousands of values
+    std::vector<std::string> names;
+    std::vector<u64> expected;
+    for (int i = 0; i < 5000; i++) {
+        std::string ix = std::to_string(i);
+        if (i % 2 == 0) {
+            expected.push_back(names.size());
+        }
+        names.push_back("cpu host=web-" + ix + " region=" + (i % 2 == 0 ? "eu-west" : "us-east"));
+        names.push_back("cpu host=db-" + ix + " region=eu-west");
+        names.push_back("mem host=web-" + ix + " region=eu-west");
+    }
+    std::map<std::string, std::vector<std::string>> tags = {
+        {"region", {"eu-west", "ap-south"}},
+    };
+    std::map<std::string, TagValueFilter> filters = {
+        {"host", TagValueFilter(TagValueFilter::Kind::REGEX, "web-[0-9]+")},
+    };
+    IncludeMany2Many query("cpu", tags, filters);
+    test_roaring_index(names, query, expected);
+}
+
+static std::vector<std::string> to_strings(std::vector<StringT> const& values) {
+    std::vector<std::string> res;
+    for (auto val: values) {
+        res.push_back(fromstrt(val));
+    }
+    return res;
+}
+
+BOOST_AUTO_TEST_CASE(Test_seriesmatcher_suggest_0) {
+    SeriesMatcher matcher;
+    std::vector<std::string> names = {
+        "net.tcp.out host=web-02 region=us-west",
+        "cpu.user host=web-01 region=eu-west",
+        "cpu.user host=db-01 rack=r1",
+        "cpu.system host=web-01 region=eu-west",
+        "net.tcp.in host=web-03",
+        "cpu.user host=web-02 region=eu-east",
+        "cpu host=webserver",
+    };
+    for (auto const& name: names) {
+        matcher.add(name.data(), name.data() + name.size());
+    }
+    typedef std::vector<std::string> Vec;
+    BOOST_REQUIRE(to_strings(matcher.suggest_metric("cpu")) == Vec({"cpu", "cpu.system", "cpu.user"}));
+    BOOST_REQUIRE(to_strings(matcher.suggest_metric("net.tcp.")) == Vec({"net.tcp.in", "net.tcp.out"}));
+    BOOST_REQUIRE(to_strings(matcher.suggest_metric("")).size() == 5);
+    BOOST_REQUIRE(to_strings(matcher.suggest_metric("cpu", 2)) == Vec({"cpu", "cpu.system"}));
+    BOOST_REQUIRE(matcher.suggest_metric("mem").empty());
+
+    BOOST_REQUIRE(to_strings(matcher.suggest_tags("cpu.user", "r")) == Vec({"rack", "region"}));
+    BOOST_REQUIRE(to_strings(matcher.suggest_tags("cpu.user", "")) == Vec({"host", "rack", "region"}));
+    BOOST_REQUIRE(to_strings(matcher.suggest_tags("cpu.user", "", 1)) == Vec({"host"}));
+    BOOST_REQUIRE(matcher.suggest_tags("mem", "").empty());
+
+    BOOST_REQUIRE(to_strings(matcher.suggest_tag_values("cpu.user", "host", "web")) == Vec({"web-01", "web-02"}));
+    BOOST_REQUIRE(to_strings(matcher.suggest_tag_values("cpu.user", "region", "eu-", 1)) == Vec({"eu-east"}));
+    BOOST_REQUIRE(to_strings(matcher.suggest_tag_values("cpu", "host", "web")) == Vec({"webserver"}));
+    BOOST_REQUIRE(matcher.suggest_tag_values("cpu.user", "os", "").empty());
+}
+
+BOOST_AUTO_TEST_CASE(Test_seriesmatcher_id_ranges_0) {
+    SeriesMatcher matcher(1024);
+    matcher.id_range_size = 4;
+    std::vector<i64> cpu, mem, events;
+    for (int i = 0; i < 6; i++) {
+        auto cname = "cpu host=" + std::to_string(i);
+        auto mname = "mem host=" + std::to_string(i);
+        auto ename = "!evt host=" + std::to_string(i);
+        cpu.push_back(matcher.add(cname.data(), cname.data() + cname.size()));
+        mem.push_back(matcher.add(mname.data(), mname.data() + mname.size()));
+        events.push_back(matcher.add(ename.data(), ename.data() + ename.size()));
+        BOOST_REQUIRE_EQUAL(matcher.match(cname.data(), cname.data() + cname.size()), cpu.back());
+        std::string name;
+        BOOST_REQUIRE(matcher.id2str(mem.back(), &name));
+        BOOST_REQUIRE_EQUAL(name, mname);
+    }
+    // Every metric gets aligned ranges of adjacent ids
+    BOOST_REQUIRE(cpu == std::vector<i64>({1024, 1025, 1026, 1027, 1036, 1037}));
+    BOOST_REQUIRE(mem == std::vector<i64>({1028, 1029, 1030, 1031, 1040, 1041}));
+    BOOST_REQUIRE(events == std::vector<i64>({-1032, -1033, -1034, -1035, -1044, -1045}));
+    BOOST_REQUIRE_EQUAL(matcher.series_id, 1048);
+
+    // Sequential allocation
+    SeriesMatcher seq(1000);
+    const char* names[] = { "cpu host=0", "mem host=0", "cpu host=1" };
+    for (int i = 0; i < 3; i++) {
+        BOOST_REQUIRE_EQUAL(seq.add(names[i], names[i] + strlen(names[i])), 1000 + i);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_hyperloglog_0) {
+    for (u64 n: { 10ul, 100ul, 1000ul, 10000ul, 100000ul }) {
+        HyperLogLog sketch;
+        for (u64 i = 0; i < n; i++) {
+            sketch.add(i);
+            // Duplicates shouldn't affect the estimate
+            sketch.add(i);
+        }
+        double error = std::abs(static_cast<double>(sketch.estimate()) - n)/n;
+        BOOST_REQUIRE_LT(error, 0.1);
+    }
+    HyperLogLog empty;
+    BOOST_REQUIRE_EQUAL(empty.estimate(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(Test_hyperloglog_1) {
+    // Merge sparse and dense sketches
+    HyperLogLog small, large, copy;
+    for (u64 i = 0; i < 50; i++) {
+        small.add(i);
+    }
+    for (u64 i = 25; i < 10025; i++) {
+        large.add(i);
+    }
+    copy = small;
+    small.merge(large);
+    large.merge(copy);
+    BOOST_REQUIRE_EQUAL(small.estimate(), large.estimate());
+    double error = std::abs(static_cast<double>(small.estimate()) - 10025)/10025;
+    BOOST_REQUIRE_LT(error, 0.1);
+}
+
+BOOST_AUTO_TEST_CASE(Test_query_estimate_0) {
+    SeriesMatcher matcher(10ul);
+    for (int i = 0; i < 10000; i++) {
+        std::string name = "cpu host=host_" + std::to_string(i) + " region=region_" + std::to_string(i % 10);
+        matcher.add(name.data(), name.data() + name.size());
+    }
+    auto check = [&](IndexQueryNodeBase const& query, double expected) {
+        double estimate = static_cast<double>(matcher.estimate(query));
+        BOOST_REQUIRE_LT(std::abs(estimate - expected)/expected, 0.1);
+        // Estimate is an upper bound of the result size
+        BOOST_REQUIRE_GE(estimate*1.1, static_cast<double>(matcher.search(query).size()));
+    };
+    std::map<std::string, std::vector<std::string>> tags;
+    check(IncludeMany2Many("cpu", tags), 10000);
+    tags["region"] = { "region_1", "region_2" };
+    check(IncludeMany2Many("cpu", tags), 2000);
+    std::map<std::string, std::vector<std::string>> notags;
+    std::map<std::string, TagValueFilter> filters = {
+        {"region", TagValueFilter(TagValueFilter::Kind::REGEX, "region_[0-4]")},
+    };
+    check(IncludeMany2Many("cpu", notags, filters), 5000);
+    std::vector<TagValuePair> pairs = { TagValuePair("region=region_3") };
+    check(IncludeIfAllTagsMatch(MetricName("cpu"), pairs.begin(), pairs.end()), 1000);
+    // Unknown metric
+    BOOST_REQUIRE_EQUAL(matcher.estimate(IncludeMany2Many("mem", notags)), 0);
+}
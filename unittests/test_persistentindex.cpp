@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+#include <apr.h>
+
+#include "akumuli_def.h"
+#include "log_iface.h"
+#include "index/persistentindex.h"
+#include "index/seriesparser.h"
+
+using namespace Akumuli;
+
+void test_logger(aku_LogLevel tag, const char* msg) {
+    BOOST_TEST_MESSAGE(msg);
+}
+
+struct AkumuliInitializer {
+    AkumuliInitializer() {
+        apr_initialize();
+        Akumuli::Logger::set_logger(&test_logger);
+    }
+};
+
+AkumuliInitializer initializer;
+
+static const char* INDEX_PATH = "./test_persistentindex.index";
+
+static std::vector<std::string> make_names(int begin, int end) {
+    std::vector<std::string> names;
+    for (int i = begin; i < end; i++) {
+        names.push_back("cpu.user host=host_" + std::to_string(i) + " region=region_" + std::to_string(i % 4));
+    }
+    return names;
+}
+
+static std::vector<SeriesIndexSegment::SeriesT> make_series(std::vector<std::string> const& names, i64 first_id) {
+    std::vector<SeriesIndexSegment::SeriesT> series;
+    for (size_t i = 0; i < names.size(); i++) {
+        StringT str = std::make_pair(names[i].data(), static_cast<int>(names[i].size()));
+        series.push_back(std::make_pair(str, first_id + static_cast<i64>(i)));
+    }
+    return series;
+}
+
+static std::string to_string(StringT str) {
+    return std::string(str.first, str.first + str.second);
+}
+
+static std::vector<std::string> list_segments() {
+    std::vector<std::string> result;
+    for (boost::filesystem::directory_iterator it(INDEX_PATH), end; it != end; ++it) {
+        result.push_back(it->path().filename().string());
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+BOOST_AUTO_TEST_CASE(Test_index_segment_1) {
+    boost::filesystem::remove_all(INDEX_PATH);
+    boost::filesystem::create_directories(INDEX_PATH);
+    std::string path = std::string(INDEX_PATH) + "/segment.sidx";
+    auto names = make_names(0, 1000);
+    // Shuffled order and negative ids (events) should be supported
+    auto series = make_series(names, 1024);
+    std::reverse(series.begin(), series.end());
+    series.at(10).second = -5000;
+    auto status = SeriesIndexSegment::write(path, series);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+
+    std::unique_ptr<SeriesIndexSegment> segment;
+    std::tie(status, segment) = SeriesIndexSegment::open(path);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(segment->size(), names.size());
+    BOOST_REQUIRE_EQUAL(segment->max_id(), 5000u);
+    for (auto const& item: series) {
+        BOOST_REQUIRE_EQUAL(segment->find(item.first), item.second);
+        BOOST_REQUIRE_EQUAL(to_string(segment->find(item.second)), to_string(item.first));
+    }
+    // Series are ordered by id
+    for (size_t i = 1; i < segment->size(); i++) {
+        BOOST_REQUIRE(segment->at(i - 1).second < segment->at(i).second);
+    }
+    std::string missing = "cpu.user host=host_1 region=region_2";
+    StringT missing_str = std::make_pair(missing.data(), static_cast<int>(missing.size()));
+    BOOST_REQUIRE_EQUAL(segment->find(missing_str), 0);
+    // Prefix of the existing name
+    StringT prefix_str = std::make_pair(names.front().data(), 10);
+    BOOST_REQUIRE_EQUAL(segment->find(prefix_str), 0);
+    BOOST_REQUIRE(segment->find(static_cast<i64>(1)).second == 0);
+    BOOST_REQUIRE(segment->find(static_cast<i64>(100000)).second == 0);
+}
+
+BOOST_AUTO_TEST_CASE(Test_index_segment_2) {
+    boost::filesystem::remove_all(INDEX_PATH);
+    boost::filesystem::create_directories(INDEX_PATH);
+    std::string path = std::string(INDEX_PATH) + "/segment.sidx";
+    auto names = make_names(0, 10);
+    names.push_back(names.front());
+    auto status = SeriesIndexSegment::write(path, make_series(names, 1024));
+    BOOST_REQUIRE_EQUAL(status, AKU_EBAD_DATA);
+
+    // Truncated file shouldn't be opened
+    names.pop_back();
+    status = SeriesIndexSegment::write(path, make_series(names, 1024));
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    auto fsize = boost::filesystem::file_size(path);
+    boost::filesystem::resize_file(path, fsize - 8);
+    std::unique_ptr<SeriesIndexSegment> segment;
+    std::tie(status, segment) = SeriesIndexSegment::open(path);
+    BOOST_REQUIRE_EQUAL(status, AKU_EBAD_DATA);
+    BOOST_REQUIRE(!segment);
+}
+
+BOOST_AUTO_TEST_CASE(Test_persistent_index_merge) {
+    aku_Status status;
+    std::shared_ptr<PersistentSeriesIndex> index;
+    std::tie(status, index) = PersistentSeriesIndex::create(INDEX_PATH);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(index->cardinality(), 0u);
+    BOOST_REQUIRE_EQUAL(index->max_id(), 0u);
+
+    const int NBATCHES = 100;
+    const int BATCH_SIZE = 10;
+    auto names = make_names(0, NBATCHES*BATCH_SIZE);
+    for (int i = 0; i < NBATCHES; i++) {
+        std::vector<std::string> batch(names.begin() + i*BATCH_SIZE, names.begin() + (i + 1)*BATCH_SIZE);
+        status = index->append(make_series(batch, 1024 + i*BATCH_SIZE));
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    }
+    BOOST_REQUIRE_EQUAL(index->cardinality(), names.size());
+    BOOST_REQUIRE_EQUAL(index->max_id(), static_cast<u64>(1024 + names.size() - 1));
+    // Number of segments should be logarithmic
+    auto segments = index->get_segments();
+    BOOST_REQUIRE(segments.size() <= 8);
+    BOOST_REQUIRE_EQUAL(list_segments().size(), segments.size());
+
+    // Reopen
+    index.reset();
+    segments.clear();
+    std::tie(status, index) = PersistentSeriesIndex::open(INDEX_PATH);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(index->cardinality(), names.size());
+    segments = index->get_segments();
+    for (size_t i = 0; i < names.size(); i++) {
+        StringT str = std::make_pair(names[i].data(), static_cast<int>(names[i].size()));
+        i64 id = 0;
+        for (auto const& seg: segments) {
+            id = seg->find(str);
+            if (id) {
+                break;
+            }
+        }
+        BOOST_REQUIRE_EQUAL(id, static_cast<i64>(1024 + i));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_persistent_index_recovery) {
+    aku_Status status;
+    std::shared_ptr<PersistentSeriesIndex> index;
+    std::tie(status, index) = PersistentSeriesIndex::create(INDEX_PATH);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    auto names = make_names(0, 30);
+    status = index->append(make_series(std::vector<std::string>(names.begin(), names.begin() + 20), 1024));
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    index.reset();
+
+    // Simulate crash during merge: merged segment exists together with the
+    // source segments, and incomplete temporary file is present.
+    std::string dir(INDEX_PATH);
+    auto first = dir + "/" + list_segments().front();
+    status = SeriesIndexSegment::write(dir + "/00000000000000000001-00000000000000000001.sidx",
+                                       make_series(std::vector<std::string>(names.begin() + 20, names.end()), 2000));
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    auto merged = make_series(names, 1024);
+    for (size_t i = 20; i < merged.size(); i++) {
+        merged[i].second = 2000 + static_cast<i64>(i) - 20;
+    }
+    status = SeriesIndexSegment::write(dir + "/00000000000000000000-00000000000000000001.sidx", merged);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    boost::filesystem::copy_file(first, dir + "/00000000000000000000-00000000000000000002.sidx.tmp");
+
+    std::tie(status, index) = PersistentSeriesIndex::open(INDEX_PATH);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(index->get_segments().size(), 1u);
+    BOOST_REQUIRE_EQUAL(index->cardinality(), names.size());
+    BOOST_REQUIRE_EQUAL(index->max_id(), 2009u);
+    auto files = list_segments();
+    BOOST_REQUIRE_EQUAL(files.size(), 1u);
+    BOOST_REQUIRE_EQUAL(files.front(), "00000000000000000000-00000000000000000001.sidx");
+    index.reset();
+
+    // Missing segment
+    SeriesIndexSegment::write(dir + "/00000000000000000005-00000000000000000005.sidx",
+                              make_series(make_names(100, 110), 3000));
+    std::tie(status, index) = PersistentSeriesIndex::open(INDEX_PATH);
+    BOOST_REQUIRE_EQUAL(status, AKU_EBAD_DATA);
+}
+
+BOOST_AUTO_TEST_CASE(Test_series_matcher_attach) {
+    aku_Status status;
+    std::shared_ptr<PersistentSeriesIndex> index;
+    std::tie(status, index) = PersistentSeriesIndex::create(INDEX_PATH);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    const int N = 10000;
+    auto names = make_names(0, N);
+    status = index->append(make_series(names, 1024));
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+
+    SeriesMatcher matcher(1024 + N);
+    matcher.attach(index->get_segments());
+    // Lookups work without loading
+    std::string str;
+    for (int i = 0; i < N; i += 97) {
+        auto const& name = names.at(i);
+        BOOST_REQUIRE_EQUAL(matcher.match(name.data(), name.data() + name.size()), 1024 + i);
+        BOOST_REQUIRE(matcher.id2str(1024 + i, &str));
+        BOOST_REQUIRE_EQUAL(str, name);
+    }
+    // New series
+    std::string newname = "cpu.user host=new_host region=region_0";
+    BOOST_REQUIRE_EQUAL(matcher.match(newname.data(), newname.data() + newname.size()), 0);
+    auto newid = matcher.add(newname.data(), newname.data() + newname.size());
+    BOOST_REQUIRE_EQUAL(newid, 1024 + N);
+
+    // Search waits for the background thread
+    auto ids = matcher.get_all_ids();
+    BOOST_REQUIRE_EQUAL(ids.size(), static_cast<size_t>(N + 1));
+    std::vector<TagValuePair> tags = {
+        TagValuePair("region=region_1"),
+    };
+    IncludeIfAllTagsMatch query(MetricName("cpu.user"), tags.begin(), tags.end());
+    auto results = matcher.search(query);
+    BOOST_REQUIRE_EQUAL(results.size(), static_cast<size_t>(N/4));
+    for (auto id: results) {
+        BOOST_REQUIRE(matcher.id2str(id, &str));
+        BOOST_REQUIRE_EQUAL(str, names.at(static_cast<size_t>(id - 1024)));
+    }
+    // Only new names should be pulled
+    std::vector<SeriesMatcher::SeriesNameT> newnames;
+    std::deque<std::string> storage;
+    matcher.pull_new_names(&newnames, &storage);
+    BOOST_REQUIRE_EQUAL(newnames.size(), 1u);
+    BOOST_REQUIRE_EQUAL(std::get<2>(newnames.front()), newid);
+    BOOST_REQUIRE_EQUAL(std::string(std::get<0>(newnames.front()), std::get<0>(newnames.front()) + std::get<1>(newnames.front())),
+                        newname);
+}
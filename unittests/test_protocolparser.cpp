@@ -5,6 +5,8 @@
 #include <boost/test/unit_test.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string/trim.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
 
 #include "storage_api.h"
 #include "protocolparser.h"
@@ -17,6 +19,7 @@ struct ConsumerMock : DbSession {
     std::vector<aku_Timestamp>   ts_;
     std::vector<double>          data_;
     std::vector<std::string>     event_;
+    int                          nresolved_ = 0;
 
     virtual ~ConsumerMock() {}
 
@@ -71,6 +74,7 @@ struct ConsumerMock : DbSession {
     }
 
     virtual int name_to_param_id_list(const char* begin, const char* end, aku_ParamId* ids, u32 cap) override {
+        nresolved_++;
         u32 nelem = std::count(begin, end, '|') + 1;
         if (nelem > cap) {
             return -1*static_cast<int>(nelem);
@@ -149,6 +153,29 @@ BOOST_AUTO_TEST_CASE(Test_protocol_parser_bulk_1) {
     BOOST_REQUIRE_EQUAL(cons->data_[4], 1.6);
 }
 
+BOOST_AUTO_TEST_CASE(Test_protocol_parser_resume) {
+    // Message is delivered byte by byte, series name should be resolved only once
+    const char *message = "+1|2\r\n:3\r\n*2\r\n+45.6\r\n+7.89\r\n";
+    std::shared_ptr<ConsumerMock> cons(new ConsumerMock());
+    RESPProtocolParser parser(cons);
+    parser.start();
+    for (size_t i = 0; i < strlen(message); i++) {
+        auto buf = parser.get_next_buffer();
+        buf[0] = message[i];
+        parser.parse_next(buf, 1);
+    }
+    parser.close();
+
+    BOOST_REQUIRE_EQUAL(cons->nresolved_, 1);
+    BOOST_REQUIRE_EQUAL(cons->param_.size(), 2);
+    BOOST_REQUIRE_EQUAL(cons->param_[0], 1);
+    BOOST_REQUIRE_EQUAL(cons->param_[1], 2);
+    BOOST_REQUIRE_EQUAL(cons->ts_[0], 3);
+    BOOST_REQUIRE_EQUAL(cons->ts_[1], 3);
+    BOOST_REQUIRE_EQUAL(cons->data_[0], 45.6);
+    BOOST_REQUIRE_EQUAL(cons->data_[1], 7.89);
+}
+
 BOOST_AUTO_TEST_CASE(Test_protocol_parse_2) {
 
     const char *message1 = "+1\r\n:2\r\n+34.5\r\n+6\r\n:7\r\n+8.9";
@@ -717,3 +744,267 @@ BOOST_AUTO_TEST_CASE(Test_open_tsdb_protocol_parser_framing) {
         find_framing_issues<OpenTSDBProtocolParser>(message, msglen, pivot1, pivot2, pred, cons);
     }
 }
+
+template<class T>
+static void binary_put(std::string* out, T value) {
+    out->append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+static void binary_frame(std::string* out, char type, std::string const& payload) {
+    binary_put<u32>(out, static_cast<u32>(payload.size()));
+    out->push_back(type);
+    out->append(payload);
+}
+
+static std::string binary_dict(std::vector<std::string> const& names) {
+    std::string payload;
+    binary_put<u32>(&payload, static_cast<u32>(names.size()));
+    for (auto const& name: names) {
+        binary_put<u16>(&payload, static_cast<u16>(name.size()));
+        payload.append(name);
+    }
+    return payload;
+}
+
+template<class IdT>
+static std::string binary_batch(std::vector<IdT> const& ids, std::vector<aku_Timestamp> const& tss, std::vector<double> const& xss) {
+    std::string payload;
+    binary_put<u32>(&payload, static_cast<u32>(ids.size()));
+    for (auto id: ids) {
+        binary_put<IdT>(&payload, id);
+    }
+    for (auto ts: tss) {
+        binary_put<aku_Timestamp>(&payload, ts);
+    }
+    for (auto x: xss) {
+        binary_put<double>(&payload, x);
+    }
+    return payload;
+}
+
+BOOST_AUTO_TEST_CASE(Test_binary_protocol_parser_framing) {
+
+    std::string message;
+    binary_frame(&message, BinaryProtocolParser::DICT, binary_dict({ "11", "22" }));
+    binary_frame(&message, BinaryProtocolParser::REF_BATCH,
+                 binary_batch<u32>({ 0, 1, 0 }, { 100, 101, 102 }, { 1.5, 2.5, 3.5 }));
+    binary_frame(&message, BinaryProtocolParser::ID_BATCH,
+                 binary_batch<aku_ParamId>({ 33, 44 }, { 103, 104 }, { 4.5, 5.5 }));
+
+    std::vector<aku_ParamId>   expected_ids = { 11, 22, 11, 33, 44 };
+    std::vector<aku_Timestamp> expected_ts  = { 100, 101, 102, 103, 104 };
+    std::vector<double>        expected_xs  = { 1.5, 2.5, 3.5, 4.5, 5.5 };
+
+    auto pred = [&](std::shared_ptr<ConsumerMock> cons) {
+        BOOST_REQUIRE_EQUAL(cons->param_.size(), expected_ids.size());
+        for (size_t i = 0; i < expected_ids.size(); i++) {
+            BOOST_REQUIRE_EQUAL(cons->param_.at(i), expected_ids.at(i));
+            BOOST_REQUIRE_EQUAL(cons->ts_.at(i), expected_ts.at(i));
+            BOOST_REQUIRE_EQUAL(cons->data_.at(i), expected_xs.at(i));
+        }
+    };
+
+    size_t msglen = message.size();
+    for (size_t pivot1 = 1; pivot1 < msglen - 1; pivot1++) {
+        size_t pivot2 = pivot1 + 1 + static_cast<size_t>(rand()) % (msglen - pivot1 - 1);
+        std::shared_ptr<ConsumerMock> cons(new ConsumerMock);
+        find_framing_issues<BinaryProtocolParser>(message.data(), msglen, pivot1, pivot2, pred, cons);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_binary_protocol_parser_unknown_ref) {
+
+    std::string message;
+    binary_frame(&message, BinaryProtocolParser::DICT, binary_dict({ "11" }));
+    binary_frame(&message, BinaryProtocolParser::REF_BATCH,
+                 binary_batch<u32>({ 0, 1 }, { 100, 101 }, { 1.5, 2.5 }));
+
+    std::shared_ptr<ConsumerMock> cons(new ConsumerMock);
+    BinaryProtocolParser parser(cons);
+    parser.start();
+    auto buf = parser.get_next_buffer();
+    memcpy(buf, message.data(), message.size());
+    BOOST_REQUIRE_THROW(parser.parse_next(buf, static_cast<u32>(message.size())), ProtocolParserError);
+    BOOST_REQUIRE_EQUAL(cons->param_.size(), 0);
+}
+
+/** Splits compound series names and assigns ids to individual series.
+  */
+struct CompoundNameConsumer : DbSession {
+    std::map<std::string, aku_ParamId> index;
+    std::vector<std::string>   names;
+    std::vector<aku_Timestamp> ts;
+    std::vector<double>        xs;
+    int                        nbatches = 0;
+
+    virtual aku_Status write(const aku_Sample&) override {
+        BOOST_FAIL("Batch write expected");
+        return AKU_SUCCESS;
+    }
+
+    virtual aku_Status write_batch(const aku_ParamId* ids, const aku_Timestamp* tss, const double* xss, u32 size) override {
+        nbatches++;
+        for (u32 i = 0; i < size; i++) {
+            for (auto const& kv: index) {
+                if (kv.second == ids[i]) {
+                    names.push_back(kv.first);
+                }
+            }
+            ts.push_back(tss[i]);
+            xs.push_back(xss[i]);
+        }
+        return AKU_SUCCESS;
+    }
+
+    virtual std::shared_ptr<DbCursor> query(std::string) override {
+        throw "Not implemented";
+    }
+
+    virtual std::shared_ptr<DbCursor> suggest(std::string) override {
+        throw "Not implemented";
+    }
+
+    virtual std::shared_ptr<DbCursor> search(std::string) override {
+        throw "Not implemented";
+    }
+
+    virtual int param_id_to_series(aku_ParamId, char*, size_t) override {
+        throw "Not implemented";
+    }
+
+    virtual aku_Status series_to_param_id(const char*, size_t, aku_Sample*) override {
+        throw "Not implemented";
+    }
+
+    virtual int name_to_param_id_list(const char* begin, const char* end, aku_ParamId* ids, u32 cap) override {
+        std::string name(begin, end);
+        auto space = name.find(' ');
+        std::string metrics = name.substr(0, space);
+        std::string tags = space == std::string::npos ? std::string() : name.substr(space);
+        std::vector<std::string> parts;
+        boost::algorithm::split(parts, metrics, boost::is_any_of("|"));
+        if (parts.size() > cap) {
+            return -1*static_cast<int>(parts.size());
+        }
+        for (size_t i = 0; i < parts.size(); i++) {
+            auto sname = parts[i] + tags;
+            if (index.count(sname) == 0) {
+                auto id = static_cast<aku_ParamId>(index.size() + 1);
+                index[sname] = id;
+            }
+            ids[i] = index[sname];
+        }
+        return static_cast<int>(parts.size());
+    }
+};
+
+BOOST_AUTO_TEST_CASE(Test_influx_protocol_parser_1) {
+
+    const char *messages = "cpu,host=machine1,region=NW user=3.12,sys=12i 1418197423000000000\n"
+                           "# comment\n"
+                           "mem,host=machine1 free=100u,msg=\"out of, memory\",ok=true 1418197424000000000\r\n"
+                           "disk\\,io,host=machine\\,1 read=1.5e3 1418197425000000000\n";
+
+    std::shared_ptr<CompoundNameConsumer> cons(new CompoundNameConsumer);
+    InfluxProtocolParser parser(cons);
+    parser.start();
+    auto buf = parser.get_next_buffer();
+    size_t buflen = strlen(messages);
+    memcpy(buf, messages, buflen);
+    parser.parse_next(buf, static_cast<u32>(buflen));
+    parser.close();
+
+    std::vector<std::string> expected_names = {
+        "cpu.user host=machine1 region=NW",
+        "cpu.sys host=machine1 region=NW",
+        "mem.free host=machine1",
+        "mem.ok host=machine1",
+        "disk,io.read host=machine,1",
+    };
+    std::vector<aku_Timestamp> expected_ts = {
+        1418197423000000000ull,
+        1418197423000000000ull,
+        1418197424000000000ull,
+        1418197424000000000ull,
+        1418197425000000000ull,
+    };
+    std::vector<double> expected_xs = { 3.12, 12.0, 100.0, 1.0, 1500.0 };
+
+    BOOST_REQUIRE_EQUAL(cons->nbatches, 1);
+    BOOST_REQUIRE_EQUAL(cons->names.size(), expected_names.size());
+    for (size_t i = 0; i < expected_names.size(); i++) {
+        BOOST_REQUIRE_EQUAL(cons->names.at(i), expected_names.at(i));
+        BOOST_REQUIRE_EQUAL(cons->ts.at(i), expected_ts.at(i));
+        BOOST_REQUIRE_EQUAL(cons->xs.at(i), expected_xs.at(i));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_influx_protocol_parser_framing) {
+
+    const char *message = "cpu,host=machine1 user=3.12,sys=12.6 1418197423000000000\n"
+                          "cpu,host=machine2 user=1.5 1418197424000000000\n"
+                          "cpu,host=machine1 sys=2i 1418197425000000000\n";
+
+    auto pred = [&](std::shared_ptr<CompoundNameConsumer> cons) {
+        std::vector<std::string> expected_names = {
+            "cpu.user host=machine1",
+            "cpu.sys host=machine1",
+            "cpu.user host=machine2",
+            "cpu.sys host=machine1",
+        };
+        std::vector<double> expected_xs = { 3.12, 12.6, 1.5, 2.0 };
+        BOOST_REQUIRE_EQUAL(cons->names.size(), expected_names.size());
+        for (size_t i = 0; i < expected_names.size(); i++) {
+            BOOST_REQUIRE_EQUAL(cons->names.at(i), expected_names.at(i));
+            BOOST_REQUIRE_EQUAL(cons->xs.at(i), expected_xs.at(i));
+        }
+    };
+
+    size_t msglen = strlen(message);
+    for (int i = 0; i < 100; i++) {
+        size_t pivot1 = 1 + static_cast<size_t>(rand()) % (msglen / 2);
+        size_t pivot2 = 1 + static_cast<size_t>(rand()) % (msglen - pivot1 - 2) + pivot1;
+        std::shared_ptr<CompoundNameConsumer> cons(new CompoundNameConsumer);
+        find_framing_issues<InfluxProtocolParser>(message, msglen, pivot1, pivot2, pred, cons);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_influx_protocol_parser_error) {
+    const char *messages = "cpu,host=machine1 user=bad 1418197423000000000\n";
+    std::shared_ptr<CompoundNameConsumer> cons(new CompoundNameConsumer);
+    InfluxProtocolParser parser(cons);
+    parser.start();
+    auto buf = parser.get_next_buffer();
+    size_t buflen = strlen(messages);
+    memcpy(buf, messages, buflen);
+    BOOST_REQUIRE_THROW(parser.parse_next(buf, static_cast<u32>(buflen)), ProtocolParserError);
+}
+
+BOOST_AUTO_TEST_CASE(Test_influx_protocol_parser_error_partial_batch) {
+    const char *messages = "cpu,host=machine1 user=3.12 1418197423000000000 \t\n"
+                           "cpu,host=machine2 user=1.5 1418197424000000000\n"
+                           "cpu,host=machine1 user=bad 1418197425000000000\n"
+                           "cpu,host=machine2 user=2.5 1418197426000000000\n";
+    std::shared_ptr<CompoundNameConsumer> cons(new CompoundNameConsumer);
+    InfluxProtocolParser parser(cons);
+    parser.start();
+    auto buf = parser.get_next_buffer();
+    size_t buflen = strlen(messages);
+    memcpy(buf, messages, buflen);
+    BOOST_REQUIRE_THROW(parser.parse_next(buf, static_cast<u32>(buflen)), ProtocolParserError);
+
+    // Lines before the bad one should be written
+    std::vector<std::string> expected_names = {
+        "cpu.user host=machine1",
+        "cpu.user host=machine2",
+    };
+    std::vector<double> expected_xs = { 3.12, 1.5 };
+    BOOST_REQUIRE_EQUAL(cons->nbatches, 1);
+    BOOST_REQUIRE_EQUAL(cons->names.size(), expected_names.size());
+    BOOST_REQUIRE_EQUAL(cons->ts.size(), expected_names.size());
+    for (size_t i = 0; i < expected_names.size(); i++) {
+        BOOST_REQUIRE_EQUAL(cons->names.at(i), expected_names.at(i));
+        BOOST_REQUIRE_EQUAL(cons->xs.at(i), expected_xs.at(i));
+    }
+    BOOST_REQUIRE_EQUAL(cons->ts.at(0), 1418197423000000000ull);
+}
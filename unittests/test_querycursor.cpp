@@ -135,3 +135,191 @@ BOOST_AUTO_TEST_CASE(Test_query_cursor) {
     auto actual = std::string(buffer, buffer + len);
     BOOST_REQUIRE_EQUAL(expected, actual);
 }
+
+//! Session that counts series name lookups
+struct CountingSessionMock : SessionMock {
+    int nlookups = 0;
+
+    int param_id_to_series(aku_ParamId id, char *buffer, size_t buffer_size) override {
+        nlookups++;
+        if (id == 0) {
+            return 0;  // no such id
+        }
+        return SessionMock::param_id_to_series(id, buffer, buffer_size);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(Test_series_name_cache) {
+    auto session = std::make_shared<CountingSessionMock>();
+    SeriesNameCache cache(session, 2);
+    char buffer[0x100];
+
+    BOOST_REQUIRE_EQUAL(cache.get(11, buffer, sizeof(buffer)), 2);
+    BOOST_REQUIRE_EQUAL(std::string(buffer, buffer + 2), "11");
+    BOOST_REQUIRE_EQUAL(cache.get(11, buffer, sizeof(buffer)), 2);
+    BOOST_REQUIRE_EQUAL(session->nlookups, 1);
+
+    // 11 becomes least recently used and gets evicted
+    cache.get(22, buffer, sizeof(buffer));
+    cache.get(22, buffer, sizeof(buffer));
+    cache.get(333, buffer, sizeof(buffer));
+    BOOST_REQUIRE_EQUAL(cache.size(), 2);
+    BOOST_REQUIRE_EQUAL(session->nlookups, 3);
+    BOOST_REQUIRE_EQUAL(cache.get(22, buffer, sizeof(buffer)), 2);
+    BOOST_REQUIRE_EQUAL(session->nlookups, 3);
+    BOOST_REQUIRE_EQUAL(cache.get(11, buffer, sizeof(buffer)), 2);
+    BOOST_REQUIRE_EQUAL(session->nlookups, 4);
+
+    // Errors are not cached
+    BOOST_REQUIRE_EQUAL(cache.get(0, buffer, sizeof(buffer)), 0);
+    BOOST_REQUIRE_EQUAL(cache.get(4444, buffer, 2), -4);
+    BOOST_REQUIRE_EQUAL(cache.get(11, buffer, 1), -2);
+    BOOST_REQUIRE_EQUAL(cache.size(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(Test_iso_timestamp_formatter) {
+    IsoTimestampFormatter formatter;
+    char expected[0x100];
+    char actual[0x100];
+    std::vector<aku_Timestamp> timestamps = {
+        0ull,
+        1ull,
+        999999999ull,
+        1000000000ull,
+        86399999999999ull,
+        86400000000000ull,
+        951782399999999999ull,  // 2000-02-28
+        951868800000000000ull,  // 2000-03-01
+        1418197363111999000ull,
+        1418197363111999001ull,
+        1418197364000000000ull,
+        1418256000000000000ull,
+        0ull,
+        ~0ull,
+    };
+    aku_Timestamp ts = 1418197363111999000ull;
+    for (int i = 0; i < 10000; i++) {
+        ts += 1000000ull * (i % 7) + 86400000000000ull * (i % 1000 == 0);
+        timestamps.push_back(ts);
+    }
+    for (auto ts: timestamps) {
+        int explen = aku_timestamp_to_string(ts, expected, sizeof(expected));
+        int actlen = formatter.format(ts, actual, sizeof(actual));
+        BOOST_REQUIRE_EQUAL(explen, actlen);
+        BOOST_REQUIRE_EQUAL(std::string(expected), std::string(actual));
+    }
+    // Buffer is too small
+    BOOST_REQUIRE(formatter.format(ts, actual, 10) < 0);
+}
+
+//! Cursor that fails on the second read
+struct FailingCursorMock : CursorMock {
+    bool failed_ = false;
+
+    size_t read(void *dest, size_t dest_size) {
+        if (isdone_) {
+            failed_ = true;
+            return 0;
+        }
+        return CursorMock::read(dest, dest_size);
+    }
+
+    int is_done() {
+        return failed_;
+    }
+
+    bool is_error(aku_Status *out_error_code_or_null) {
+        if (out_error_code_or_null) {
+            *out_error_code_or_null = failed_ ? AKU_EQUERY_PARSING_ERROR : AKU_SUCCESS;
+        }
+        return failed_;
+    }
+
+    bool is_error(const char** error_message, aku_Status *out_error_code) {
+        *out_error_code = failed_ ? AKU_EQUERY_PARSING_ERROR : AKU_SUCCESS;
+        *error_message  = failed_ ? "query failed" : "";
+        return failed_;
+    }
+};
+
+//! Session with long series names
+struct ArrowSessionMock : SessionMock {
+    bool fail_;
+
+    ArrowSessionMock(bool fail)
+        : fail_(fail)
+    {
+    }
+
+    std::shared_ptr<DbCursor> query(std::string) override {
+        if (fail_) {
+            return std::make_shared<FailingCursorMock>();
+        }
+        return std::make_shared<CursorMock>();
+    }
+
+    static std::string name(aku_ParamId id) {
+        std::string name = "cpu host=" + std::to_string(id) + " tag=";
+        name.resize(5000, 'x');
+        return name;
+    }
+
+    int param_id_to_series(aku_ParamId id, char *buffer, size_t buffer_size) override {
+        auto str = name(id);
+        if (str.size() <= buffer_size) {
+            memcpy(buffer, str.data(), str.size());
+            return static_cast<int>(str.size());
+        }
+        return -1*static_cast<int>(str.size());
+    }
+};
+
+static std::string read_arrow_stream(bool fail) {
+    std::shared_ptr<DbSession> session = std::make_shared<ArrowSessionMock>(fail);
+    QueryResultsPooler cursor(session, 1000, ApiEndpoint::QUERY);
+    std::string query = "{\"output\": { \"format\": \"arrow\" }}";
+    cursor.append(query.data(), query.size());
+    cursor.start();
+    std::string output;
+    char buffer[0x100];
+    for (int i = 0; i < 10000; i++) {
+        size_t len;
+        bool done;
+        std::tie(len, done) = cursor.read_some(buffer, sizeof(buffer));
+        output.append(buffer, buffer + len);
+        if (done) {
+            return output;
+        }
+    }
+    BOOST_FAIL("query results pooler doesn't stop");
+    return output;
+}
+
+//! Check that stream starts with the schema message and ends with end-of-stream marker
+static void check_arrow_framing(std::string const& output) {
+    const std::string marker("\xFF\xFF\xFF\xFF", 4);
+    const std::string eos = marker + std::string(4, '\0');
+    BOOST_REQUIRE(output.size() > 16);
+    BOOST_REQUIRE_EQUAL(output.substr(0, 4), marker);
+    BOOST_REQUIRE_EQUAL(output.substr(output.size() - 8), eos);
+    BOOST_REQUIRE_EQUAL(output.size() % 8, 0);
+}
+
+BOOST_AUTO_TEST_CASE(Test_query_cursor_arrow) {
+    auto output = read_arrow_stream(false);
+    check_arrow_framing(output);
+    // Names longer than the formatter's name buffer are sent in full
+    BOOST_REQUIRE(output.find(ArrowSessionMock::name(33)) != std::string::npos);
+    BOOST_REQUIRE(output.find(ArrowSessionMock::name(44)) != std::string::npos);
+    BOOST_REQUIRE(output.find("error") == std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(Test_query_cursor_arrow_error) {
+    auto output = read_arrow_stream(true);
+    // Error is reported inside of the valid stream, rows read before the error are kept
+    check_arrow_framing(output);
+    BOOST_REQUIRE(output.find(ArrowSessionMock::name(33)) != std::string::npos);
+    BOOST_REQUIRE(output.find("error") != std::string::npos);
+    BOOST_REQUIRE(output.find("query failed") != std::string::npos);
+    BOOST_REQUIRE(output.find("-query failed\r\n") == std::string::npos);
+}
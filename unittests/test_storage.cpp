@@ -1,3 +1,4 @@
+#include <cstdio>
 #include <iostream>
 
 #define BOOST_TEST_DYN_LINK
@@ -108,6 +109,131 @@ BOOST_AUTO_TEST_CASE(Test_metadata_storage_numeric_config) {
     BOOST_REQUIRE_EQUAL(db_name, actual_db_name);
 }
 
+BOOST_AUTO_TEST_CASE(Test_metadata_storage_series_names) {
+
+    MetadataStorage db(":memory:");
+    SeriesMatcher matcher(1ul);
+    // Several transactions, multi-row and single-row statements
+    const int N = MetadataStorage::NAMES_PER_TRANSACTION*2 + 57;
+    for (int i = 0; i < N; i++) {
+        std::string name = "cpu.user host=host_" + std::to_string(i) + " rack='rack_" + std::to_string(i % 10) + "'";
+        matcher.add(name.data(), name.data() + name.size());
+    }
+    std::deque<std::string> storage;
+    auto pull = [&](std::vector<MetadataStorage::SeriesT>* names) {
+        matcher.pull_new_names(names, &storage);
+    };
+    db.sync_with_metadata_storage(pull);
+
+    auto prev = db.get_prev_largest_id();
+    BOOST_REQUIRE(prev);
+    BOOST_REQUIRE_EQUAL(prev.get(), N);
+    SeriesMatcher loaded(1ul);
+    auto status = db.load_matcher_data(loaded);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    auto ids = loaded.get_all_ids();
+    BOOST_REQUIRE_EQUAL(ids.size(), static_cast<size_t>(N));
+    std::string expected, actual;
+    for (i64 id = 1; id <= N; id++) {
+        BOOST_REQUIRE(matcher.id2str(id, &expected));
+        BOOST_REQUIRE(loaded.id2str(id, &actual));
+        BOOST_REQUIRE_EQUAL(actual, expected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_metadata_storage_rescue_points) {
+
+    MetadataStorage db(":memory:");
+    std::unordered_map<u64, std::vector<u64>> expected;
+    for (u64 id = 1; id <= 250; id++) {
+        std::vector<u64> addrlist;
+        for (u64 i = 0; i < id % 9; i++) {
+            addrlist.push_back(i == 3 ? ~0ull : id*10 + i);
+        }
+        expected[id] = addrlist;
+        db.add_rescue_point(id, std::move(addrlist));
+    }
+    BOOST_REQUIRE_EQUAL(db.get_backlog(), 250u);
+    db.sync_with_metadata_storage([](std::vector<MetadataStorage::SeriesT>*) {});
+    BOOST_REQUIRE_EQUAL(db.get_backlog(), 0u);
+
+    // Update existing rescue points
+    expected[42] = { 1, 2, 3 };
+    db.add_rescue_point(42, std::vector<u64>(expected[42]));
+    db.sync_with_metadata_storage([](std::vector<MetadataStorage::SeriesT>*) {});
+
+    std::unordered_map<u64, std::vector<u64>> actual;
+    auto status = db.load_rescue_points(actual);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(actual.size(), expected.size());
+    for (auto const& kv: expected) {
+        auto const& addrlist = actual[kv.first];
+        BOOST_REQUIRE_EQUAL_COLLECTIONS(addrlist.begin(), addrlist.end(), kv.second.begin(), kv.second.end());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_rescue_points_buffer) {
+
+    RescuePointsBuffer buffer;
+    BOOST_REQUIRE(buffer.empty());
+    std::vector<u64> addrlist = { 0, 1, 0x100000002ull, ~0ull };
+    std::vector<u8> encoded;
+    RescuePointsBuffer::encode(addrlist, &encoded);
+    BOOST_REQUIRE(encoded.size() < addrlist.size()*sizeof(u64));
+    auto decoded = RescuePointsBuffer::decode(encoded.data(), encoded.size());
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(decoded.begin(), decoded.end(), addrlist.begin(), addrlist.end());
+
+    // Updates of the same series are coalesced
+    for (u64 i = 0; i < 10000; i++) {
+        bool isnew = buffer.add(i % 10, { i, ~0ull });
+        BOOST_REQUIRE_EQUAL(isnew, i < 10);
+    }
+    BOOST_REQUIRE_EQUAL(buffer.size(), 10u);
+    BOOST_REQUIRE(buffer.entries_.size() < 10000u);
+    buffer.coalesce();
+    BOOST_REQUIRE_EQUAL(buffer.entries_.size(), 10u);
+    for (auto const& entry: buffer.entries_) {
+        auto actual = RescuePointsBuffer::decode(buffer.data_.data() + entry.offset, entry.size);
+        std::vector<u64> expected = { 9990 + entry.id, ~0ull };
+        BOOST_REQUIRE_EQUAL_COLLECTIONS(actual.begin(), actual.end(), expected.begin(), expected.end());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_metadata_storage_rescue_points_migration) {
+
+    const char* path = "./test_metadata_migration.db";
+    std::remove(path);
+    // Create database with the old rescue points table format
+    sqlite3* db = nullptr;
+    BOOST_REQUIRE_EQUAL(sqlite3_open(path, &db), SQLITE_OK);
+    const char* query =
+            "CREATE TABLE akumuli_rescue_points("
+            "storage_id INTEGER PRIMARY KEY UNIQUE,"
+            "addr0 INTEGER, addr1 INTEGER, addr2 INTEGER, addr3 INTEGER,"
+            "addr4 INTEGER, addr5 INTEGER, addr6 INTEGER, addr7 INTEGER);"
+            "INSERT INTO akumuli_rescue_points (storage_id, addr0, addr1, addr2, addr3, addr4, addr5, addr6, addr7) "
+            "VALUES (1, 10, 20, -1, null, null, null, null, null),"
+            "       (2, null, null, null, null, null, null, null, null),"
+            "       (-3, 30, null, null, null, null, null, null, null);";
+    BOOST_REQUIRE_EQUAL(sqlite3_exec(db, query, nullptr, nullptr, nullptr), SQLITE_OK);
+    sqlite3_close(db);
+
+    std::unordered_map<u64, std::vector<u64>> actual;
+    {
+        MetadataStorage meta(path);
+        auto status = meta.load_rescue_points(actual);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    }
+    std::remove(path);
+    BOOST_REQUIRE_EQUAL(actual.size(), 3u);
+    std::vector<u64> expected = { 10, 20, ~0ull };
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(actual[1].begin(), actual[1].end(), expected.begin(), expected.end());
+    BOOST_REQUIRE(actual[2].empty());
+    expected = { 30 };
+    auto const& events = actual[static_cast<u64>(-3)];
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(events.begin(), events.end(), expected.begin(), expected.end());
+}
+
 BOOST_AUTO_TEST_CASE(Test_storage_add_series_1) {
     aku_Status status;
     const char* sname = "hello world=1";
@@ -409,6 +535,62 @@ static void check_paramids(StorageSession& session,
     }
 }
 
+BOOST_AUTO_TEST_CASE(Test_storage_write_batch) {
+    std::vector<std::string> names = {
+        "test key=0",
+        "test key=1",
+    };
+    auto store = create_storage();
+    auto session = store->create_write_session();
+    std::vector<aku_ParamId> series;
+    for (auto const& name: names) {
+        aku_Sample sample;
+        auto status = session->init_series_id(name.data(), name.data() + name.size(), &sample);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        series.push_back(sample.paramid);
+    }
+    // Interleaved samples with one late write
+    std::vector<aku_ParamId> ids;
+    std::vector<aku_Timestamp> tss;
+    std::vector<double> xss;
+    for (aku_Timestamp ts = 100; ts < 200; ts++) {
+        for (auto id: series) {
+            ids.push_back(id);
+            tss.push_back(ts);
+            xss.push_back(static_cast<double>(ts));
+        }
+    }
+    ids.push_back(series.front());
+    tss.push_back(10);
+    xss.push_back(10.0);
+    std::vector<aku_Status> statuses(ids.size(), AKU_EGENERAL);
+    auto status = session->write_batch(ids.data(), tss.data(), xss.data(), static_cast<u32>(ids.size()), statuses.data());
+    BOOST_REQUIRE_EQUAL(status, AKU_ELATE_WRITE);
+    for (size_t ix = 0; ix < statuses.size() - 1; ix++) {
+        BOOST_REQUIRE_EQUAL(statuses.at(ix), AKU_SUCCESS);
+    }
+    BOOST_REQUIRE_EQUAL(statuses.back(), AKU_ELATE_WRITE);
+
+    // Successfull batch shouldn't touch the status array
+    ids.pop_back();
+    tss.pop_back();
+    xss.pop_back();
+    for (auto& ts: tss) {
+        ts += 100;
+    }
+    std::fill(statuses.begin(), statuses.end(), AKU_EGENERAL);
+    status = session->write_batch(ids.data(), tss.data(), xss.data(), static_cast<u32>(ids.size()), statuses.data());
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(statuses.front(), AKU_EGENERAL);
+
+    CursorMock cursor;
+    auto query = make_scan_query(100, 300, OrderBy::TIME);
+    session->query(&cursor, query.c_str());
+    BOOST_REQUIRE(cursor.done);
+    BOOST_REQUIRE_EQUAL(cursor.error, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(cursor.samples.size(), 400);
+}
+
 void test_storage_read_query(aku_Timestamp begin, aku_Timestamp end, OrderBy order) {
     std::vector<std::string> series_names = {
         "test key=0",
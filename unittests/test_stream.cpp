@@ -2,6 +2,9 @@
 #define BOOST_TEST_MODULE Main
 #include <boost/test/unit_test.hpp>
 #include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include "stream.h"
 
 using namespace Akumuli;
@@ -39,3 +42,66 @@ BOOST_AUTO_TEST_CASE(Test_stream_3) {
     BOOST_REQUIRE_EQUAL(stream_reader.pick(), 'd');
     BOOST_REQUIRE_EQUAL(stream_reader.get(),  'd');
 }
+
+BOOST_AUTO_TEST_CASE(Test_stream_read_line) {
+
+    std::string input = "first line\r\nsecond";
+    MemStreamReader stream_reader(input.data(), input.size());
+    Byte buffer[1024] = {};
+    auto bytes_read = stream_reader.read_line(buffer, 1024);
+    BOOST_REQUIRE_EQUAL(bytes_read, 12);
+    BOOST_REQUIRE_EQUAL(std::string(buffer, buffer + bytes_read), "first line\r\n");
+    bytes_read = stream_reader.read_line(buffer, 1024);
+    BOOST_REQUIRE_EQUAL(bytes_read, -6);
+}
+
+BOOST_AUTO_TEST_CASE(Test_find_first_of) {
+
+    // Long enough to exercise vectorized and scalar paths
+    std::string input;
+    for (int i = 0; i < 100; i++) {
+        input += std::string(static_cast<size_t>(i), 'x') + " ";
+    }
+    input += "\n";
+    const Byte* begin = input.data();
+    const Byte* end = input.data() + input.size();
+    for (size_t i = 0; i < input.size(); i++) {
+        auto expected = begin + input.find_first_of(" \n", i);
+        BOOST_REQUIRE(find_first_of(begin + i, end, ' ', '\n') == expected);
+    }
+    BOOST_REQUIRE(find_first_of(begin, begin + 5, '!', '?') == begin + 5);
+    BOOST_REQUIRE(find_newline(begin, end) == end - 1);
+}
+
+BOOST_AUTO_TEST_CASE(Test_parse_double) {
+
+    std::vector<std::string> inputs = {
+        "3.14", "-0.001", "+7", "1e10", "1.5e-3", "007.50", ".5", "1.",
+        "0.000000000000000000000001", "12345678901234567890", "1e300", "4.9e-324",
+        "nan", "inf", "-inf", "1e", "1e+", "0x10", "-0X1p3", "00x10",
+    };
+    for (int i = 0; i < 100000; i++) {
+        char buf[64];
+        snprintf(buf, 64, "%.*f", i % 10, static_cast<double>(rand()) / (1 + rand() % 1000));
+        inputs.push_back(buf);
+        snprintf(buf, 64, "%.17g", static_cast<double>(rand()) / (1 + rand()));
+        inputs.push_back(buf);
+    }
+    for (auto const& str: inputs) {
+        double expected, actual;
+        char* endptr = nullptr;
+        expected = strtod(str.c_str(), &endptr);
+        auto res = parse_double(str.data(), str.data() + str.size(), &actual);
+        BOOST_REQUIRE_EQUAL(res - str.data(), endptr - str.c_str());
+        if (expected == expected) {
+            BOOST_REQUIRE_EQUAL(actual, expected);
+        } else {
+            BOOST_REQUIRE(actual != actual);
+        }
+    }
+
+    // Invalid input
+    const char* bad = "abc";
+    double value;
+    BOOST_REQUIRE(parse_double(bad, bad + 3, &value) == bad);
+}
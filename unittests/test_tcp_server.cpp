@@ -361,3 +361,223 @@ BOOST_AUTO_TEST_CASE(Test_tcp_server_backend_error_handling) {
     });
 }
 
+
+BOOST_AUTO_TEST_CASE(Test_tcp_server_reuse_port) {
+
+    auto dbcon = std::make_shared<ConnectionMock>();
+    IOServiceT io1, io2;
+    EndpointT ep(boost::asio::ip::tcp::v4(), PORT);
+
+    // Two acceptors listen on the same port, each one uses its own event loop
+    auto serv1 = std::make_shared<TcpAcceptor>(std::vector<IOServiceT*>{ &io1 }, ep,
+                                               ProtocolSessionBuilder::create_resp_builder(false),
+                                               dbcon, false, true);
+    auto serv2 = std::make_shared<TcpAcceptor>(std::vector<IOServiceT*>{ &io2 }, ep,
+                                               ProtocolSessionBuilder::create_resp_builder(false),
+                                               dbcon, false, true);
+    serv1->_start();
+    serv2->_start();
+
+    IOServiceT client_io;
+    const int NCONN = 4;
+    for (int i = 0; i < NCONN; i++) {
+        SocketT socket(client_io);
+        auto loopback = boost::asio::ip::address_v4::loopback();
+        boost::asio::ip::tcp::endpoint peer(loopback, PORT);
+        socket.connect(peer);
+
+        boost::asio::streambuf stream;
+        std::ostream os(&stream);
+        os << "+1\r\n" << ":" << (i + 1) << "\r\n" << "+3.14\r\n";
+        boost::asio::write(socket, stream);
+
+        // Connection can be accepted by any of the acceptors
+        for (int j = 0; j < 1000 && dbcon->results.size() != static_cast<size_t>(i + 1); j++) {
+            io1.poll();
+            io2.poll();
+        }
+        BOOST_REQUIRE_EQUAL(dbcon->results.size(), i + 1);
+        BOOST_REQUIRE_EQUAL(std::get<1>(dbcon->results.at(static_cast<size_t>(i))), i + 1);
+    }
+
+    serv1->_stop();
+    serv2->_stop();
+    io1.poll();
+    io2.poll();
+}
+
+
+BOOST_AUTO_TEST_CASE(Test_tcp_server_per_thread_builders) {
+
+    // Acceptor per thread mode clones the builder for every event loop, sessions
+    // created by the clone shouldn't use the strand
+    std::vector<std::unique_ptr<ProtocolSessionBuilder>> builders;
+    builders.push_back(ProtocolSessionBuilder::create_resp_builder(true));
+    builders.push_back(ProtocolSessionBuilder::create_opentsdb_builder(true));
+    builders.push_back(ProtocolSessionBuilder::create_binary_builder(true));
+    builders.push_back(ProtocolSessionBuilder::create_influx_builder(true));
+    for (auto const& builder: builders) {
+        BOOST_REQUIRE(builder->is_parallel());
+        auto single = builder->clone(false);
+        BOOST_REQUIRE(!single->is_parallel());
+        BOOST_REQUIRE_EQUAL(single->name(), builder->name());
+        BOOST_REQUIRE(single->clone(true)->is_parallel());
+    }
+}
+
+
+BOOST_AUTO_TEST_CASE(Test_flow_control_credits) {
+
+    FlowControl flow(100, 10);
+
+    // Single request is granted even if it's larger than the capacity
+    BOOST_REQUIRE(flow.acquire(150));
+    BOOST_REQUIRE(!flow.acquire(1));
+    flow.release(150);
+
+    BOOST_REQUIRE(flow.acquire(60));
+    BOOST_REQUIRE(flow.acquire(40));
+    BOOST_REQUIRE(!flow.acquire(1));
+    flow.release(40);
+    BOOST_REQUIRE(flow.acquire(1));
+    flow.release(1);
+    flow.release(60);
+
+    // Storage backlog above the limit blocks everything
+    flow.update_backlog(11);
+    BOOST_REQUIRE(!flow.acquire(1));
+    flow.update_backlog(10);
+    BOOST_REQUIRE(flow.acquire(1));
+    flow.release(1);
+
+    boost::property_tree::ptree stats;
+    flow.get_stats(stats);
+    BOOST_REQUIRE_EQUAL(stats.get<u64>("inflight_bytes"), 0);
+    BOOST_REQUIRE_EQUAL(stats.get<u64>("write_backlog"), 10);
+}
+
+
+struct BacklogSessionMock : SessionMock {
+    std::atomic<u64>& backlog;
+
+    BacklogSessionMock(std::vector<ValueT>& results, std::atomic<u64>& backlog)
+        : SessionMock(results)
+        , backlog(backlog)
+    {
+    }
+
+    virtual u64 get_write_backlog() override {
+        return backlog.load();
+    }
+};
+
+struct BacklogConnectionMock : ConnectionMock {
+    std::atomic<u64> backlog = {0};
+
+    virtual std::shared_ptr<DbSession> create_session() override {
+        return std::make_shared<BacklogSessionMock>(results, backlog);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(Test_tcp_server_flow_control_pause) {
+
+    auto dbcon = std::make_shared<BacklogConnectionMock>();
+    auto flow = std::make_shared<FlowControl>(0, 10);
+    IOServiceT io;
+    EndpointT ep(boost::asio::ip::tcp::v4(), PORT);
+    auto serv = std::make_shared<TcpAcceptor>(std::vector<IOServiceT*>{ &io }, ep,
+                                              ProtocolSessionBuilder::create_resp_builder(false),
+                                              dbcon, false, true);
+    serv->set_flow_control(flow);
+    serv->_start();
+
+    // Storage is behind, the session shouldn't read anything
+    dbcon->backlog = 100;
+    flow->update_backlog(100);
+
+    IOServiceT client_io;
+    SocketT socket(client_io);
+    auto loopback = boost::asio::ip::address_v4::loopback();
+    boost::asio::ip::tcp::endpoint peer(loopback, PORT);
+    socket.connect(peer);
+
+    boost::asio::streambuf stream;
+    std::ostream os(&stream);
+    os << "+1\r\n" << ":2\r\n" << "+3.14\r\n";
+    boost::asio::write(socket, stream);
+
+    for (int i = 0; i < 10; i++) {
+        io.poll();
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    BOOST_REQUIRE(dbcon->results.empty());
+    boost::property_tree::ptree stats;
+    flow->get_stats(stats);
+    BOOST_REQUIRE_EQUAL(stats.get<u64>("paused_sessions"), 1);
+
+    // Storage caught up, reading resumes
+    dbcon->backlog = 0;
+    for (int i = 0; i < 1000 && dbcon->results.empty(); i++) {
+        io.poll();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    BOOST_REQUIRE_EQUAL(dbcon->results.size(), 1);
+    BOOST_REQUIRE_EQUAL(std::get<1>(dbcon->results.at(0)), 2);
+
+    socket.close();
+    serv->_stop();
+    io.poll();
+}
+
+BOOST_AUTO_TEST_CASE(Test_tcp_server_flow_control_idle_session) {
+
+    auto dbcon = std::make_shared<BacklogConnectionMock>();
+    // Capacity is less than the size of the read buffer
+    auto flow = std::make_shared<FlowControl>(16, 10);
+    IOServiceT io;
+    EndpointT ep(boost::asio::ip::tcp::v4(), PORT);
+    auto serv = std::make_shared<TcpAcceptor>(std::vector<IOServiceT*>{ &io }, ep,
+                                              ProtocolSessionBuilder::create_resp_builder(false),
+                                              dbcon, false, true);
+    serv->set_flow_control(flow);
+    serv->_start();
+
+    IOServiceT client_io;
+    auto loopback = boost::asio::ip::address_v4::loopback();
+    boost::asio::ip::tcp::endpoint peer(loopback, PORT);
+
+    // Idle session waits for the data without holding any credits
+    SocketT idle(client_io);
+    idle.connect(peer);
+    for (int i = 0; i < 10; i++) {
+        io.poll();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    boost::property_tree::ptree stats;
+    flow->get_stats(stats);
+    BOOST_REQUIRE_EQUAL(stats.get<u64>("inflight_bytes"), 0);
+
+    SocketT active(client_io);
+    active.connect(peer);
+
+    boost::asio::streambuf stream;
+    std::ostream os(&stream);
+    os << "+1\r\n" << ":2\r\n" << "+3.14\r\n";
+    boost::asio::write(active, stream);
+
+    for (int i = 0; i < 1000 && dbcon->results.empty(); i++) {
+        io.poll();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    BOOST_REQUIRE_EQUAL(dbcon->results.size(), 1);
+    BOOST_REQUIRE_EQUAL(std::get<1>(dbcon->results.at(0)), 2);
+
+    stats.clear();
+    flow->get_stats(stats);
+    BOOST_REQUIRE_EQUAL(stats.get<u64>("inflight_bytes"), 0);
+
+    idle.close();
+    active.close();
+    serv->_stop();
+    io.poll();
+}